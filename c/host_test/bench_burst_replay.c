@@ -0,0 +1,85 @@
+// Burst replay through the whole report path on the simulated link: the key
+// ring, the report builder, hogp_tx and the NimBLE stand-in with its
+// connection events. Bursts of distinct key presses and releases (what a
+// macro or a fast typist produces) are posted at once, and the reports/s the
+// host receives is measured on the simulated clock. Every key change has to
+// arrive as its own report.
+//
+// Usage: bench_burst_replay [bursts] [burst keys] [conn itvl, 1.25 ms units]
+#include "fake_central.h"
+#include "fake_nimble.h"
+#include "fake_power_mgr.h"
+#include "gap.h"
+#include "hogp_gatt_svr.h"
+#include "report_builder.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void on_sync(void) { adv_init(); }
+
+int main(int argc, char **argv) {
+  int bursts = argc > 1 ? atoi(argv[1]) : 200;
+  int keys = argc > 2 ? atoi(argv[2]) : 16;
+  fake_peer_cfg_t cfg = FAKE_PEER_CFG_DEFAULT;
+  cfg.conn_itvl = argc > 3 ? atoi(argv[3]) : 6;
+  cfg.min_itvl = cfg.conn_itvl;
+
+  if (keys < 1 || keys > 32) {
+    fprintf(stderr, "burst keys must be 1 to 32\n");
+    return 2;
+  }
+
+  ble_hs_cfg.sync_cb = on_sync;
+  ble_hs_cfg.gatts_register_cb = hogp_gatt_svr_register_cb;
+  power_mgr_init();
+  gap_init();
+  hogp_gatt_svr_init();
+  fake_nimble_start();
+
+  uint16_t conn = fake_central_connect_cfg(1, &cfg);
+  uint16_t nkro = fake_central_find_report(conn, KBD_NKRO_REPORT_ID, 1);
+  fake_central_subscribe(conn, nkro, true);
+  fake_nimble_advance(500000);
+  fake_central_clear(conn);
+
+  uint32_t expected = 0;
+  uint32_t received = 0;
+  uint64_t first_us = 0;
+  uint64_t last_us = 0;
+  uint64_t start = fake_nimble_now_us();
+  for (int b = 0; b < bursts; b++) {
+    for (int k = 0; k < keys; k++) {
+      hogp_gatt_svr_post_key(0x04 + k, true);
+    }
+    for (int k = 0; k < keys; k++) {
+      hogp_gatt_svr_post_key(0x04 + k, false);
+    }
+    expected += 2 * keys;
+    // Until everything went out, one connection event at a time
+    while (fake_central_count(conn) < 2u * keys &&
+           fake_nimble_now_us() - start < 600000000ull) {
+      fake_nimble_advance(cfg.conn_itvl * 1250);
+    }
+    uint32_t n = fake_central_count(conn);
+    if (n > 0) {
+      first_us = received == 0 ? fake_central_get(conn, 0)->at_us : first_us;
+      last_us = fake_central_get(conn, n - 1)->at_us;
+    }
+    received += n;
+    fake_central_clear(conn);
+  }
+
+  double span_s = last_us > first_us ? (last_us - first_us) / 1e6 : 0;
+  struct hogp_tx_stats stats;
+  hogp_gatt_svr_get_tx_stats(&stats);
+
+  printf("{\"bench\": \"burst_replay\", \"bursts\": %d, \"burst_keys\": %d, "
+         "\"conn_itvl_us\": %u, \"reports\": %u, \"expected\": %u, "
+         "\"reports_per_s\": %.1f, \"max_reports_per_flush\": %u, "
+         "\"max_queue_depth\": %u, \"dropped\": %u, \"busy\": %u}\n",
+         bursts, keys, cfg.conn_itvl * 1250, received, expected,
+         span_s > 0 ? (received - 1) / span_s : 0.0,
+         stats.max_reports_per_flush, stats.max_queue_depth, stats.dropped,
+         stats.busy);
+  return received == expected ? 0 : 1;
+}
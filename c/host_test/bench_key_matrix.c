@@ -0,0 +1,87 @@
+// ns per key_matrix_sample() and key_matrix_scan() on a full 8 x 16 matrix
+// playing bounce traces (bounce_trace.h), every key typing at once. The
+// scan figure includes building the sample from 8 read_row() calls, which on
+// the device are GPIO reads instead.
+//
+// Usage: bench_key_matrix [scans]
+#include "bounce_trace.h"
+#include "key_matrix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_SCANS 1000000
+#define TRACE_SAMPLES 20000
+#define ROWS KEY_MATRIX_MAX_ROWS
+#define COLS KEY_MATRIX_MAX_COLS
+
+static uint8_t raw[KEY_MATRIX_MAX_KEYS][TRACE_SAMPLES];
+static bounce_edge_t edges[TRACE_SAMPLES / BOUNCE_TRACE_STABLE_MIN];
+// The traces packed as key_matrix_sample() and read_row() take them
+static uint32_t words[TRACE_SAMPLES][KEY_MATRIX_WORDS];
+static uint16_t row_bits[TRACE_SAMPLES][ROWS];
+static uint32_t sample;
+static uint32_t emitted;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t read_row(uint8_t row, void *arg) {
+  return row_bits[sample][row];
+}
+
+static void emit(uint16_t key, bool pressed, uint32_t timestamp_us,
+                 void *arg) {
+  emitted++;
+}
+
+static const key_matrix_ops_t ops = {.read_row = read_row, .emit = emit};
+
+static void make_traces(void) {
+  uint32_t seed = 1;
+  for (int key = 0; key < KEY_MATRIX_MAX_KEYS; key++) {
+    bounce_trace_key(raw[key], TRACE_SAMPLES, edges, &seed);
+  }
+  for (int i = 0; i < TRACE_SAMPLES; i++) {
+    for (int key = 0; key < KEY_MATRIX_MAX_KEYS; key++) {
+      words[i][key / 32] |= (uint32_t)raw[key][i] << (key % 32);
+      row_bits[i][key / COLS] |= raw[key][i] << (key % COLS);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t scans = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_SCANS;
+  key_matrix_t km;
+  uint32_t busy = 0;
+
+  make_traces();
+
+  key_matrix_init(&km, ROWS, COLS, &ops);
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < scans; i++) {
+    busy += key_matrix_sample(&km, words[i % TRACE_SAMPLES], i);
+  }
+  uint64_t sample_ns = now_ns() - start;
+  uint32_t sample_events = emitted;
+
+  emitted = 0;
+  key_matrix_init(&km, ROWS, COLS, &ops);
+  start = now_ns();
+  for (size_t i = 0; i < scans; i++) {
+    sample = i % TRACE_SAMPLES;
+    busy += key_matrix_scan(&km, i);
+  }
+  uint64_t scan_ns = now_ns() - start;
+
+  printf("{\"bench\": \"key_matrix\", \"keys\": %d, \"scans\": %zu, "
+         "\"events\": %u, \"busy\": %u, \"ns_per_sample\": %.2f, "
+         "\"ns_per_scan\": %.2f}\n",
+         ROWS * COLS, scans, sample_events, busy, (double)sample_ns / scans,
+         (double)scan_ns / scans);
+  // Both paths debounce the same traces
+  return emitted != sample_events;
+}
@@ -0,0 +1,131 @@
+// Caller cost of a KLOG_I() against an ESP_LOGI() of the same line, the
+// price of logging on the report path. Every call is timed on its own and
+// the median and p99 printed, less the cost of reading the clock:
+//
+//  - klog: bursts of half the ring, the klog task draining between them.
+//    On a single CPU host the task can run inside a call it was woken by,
+//    which shows in the p99 and not the median
+//  - klog_dropped: the ring full, every call dropped
+//  - esp_logi: formatting the line with the output thrown away. On target
+//    it also waits for the UART once its FIFO is full, which this leaves out
+//
+// The unit is the host's TSC cycles where there is one, ns otherwise. Either
+// only compares the two calls on this machine, the ESP32-S3 numbers come
+// from the trace service's Costs characteristic.
+//
+// Usage: bench_klog [calls]
+#include "esp_log.h"
+#include "fake_esp.h"
+#include "klog.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STAMP_UNIT "tsc_cycles"
+#else
+#define STAMP_UNIT "ns"
+#endif
+
+#define DEFAULT_CALLS 1000000
+#define BURST (KLOG_RING_SIZE / 2)
+
+static inline uint64_t stamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Sorts samples, returns the pct percentile
+static uint32_t percentile(uint32_t *samples, size_t count, int pct) {
+  qsort(samples, count, sizeof(samples[0]), cmp_u32);
+  return samples[(count - 1) * pct / 100];
+}
+
+static void print_cost(const char *name, uint32_t *samples, size_t count,
+                       uint32_t overhead) {
+  uint32_t p50 = percentile(samples, count, 50);
+  uint32_t p99 = percentile(samples, count, 99);
+  printf("\"%s\": {\"p50\": %u, \"p99\": %u}, ", name,
+         p50 > overhead ? p50 - overhead : 0,
+         p99 > overhead ? p99 - overhead : 0);
+}
+
+// Waits for the klog task to print everything written so far
+static void klog_drain(uint32_t lines_before) {
+  struct klog_stats stats;
+  klog_get_stats(&stats);
+  while (fake_log_lines() - lines_before < stats.written) {
+    sched_yield();
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t calls = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_CALLS;
+  uint32_t *samples;
+  struct klog_stats stats;
+  uint64_t start;
+
+  calls = (calls + BURST - 1) / BURST * BURST;
+  samples = malloc(calls * sizeof(samples[0]));
+  if (samples == NULL) {
+    return 1;
+  }
+  fake_log_level_set(ESP_LOG_NONE);
+  uint32_t lines_before = fake_log_lines();
+
+  for (size_t i = 0; i < calls; i++) {
+    start = stamp();
+    samples[i] = stamp() - start;
+  }
+  uint32_t overhead = percentile(samples, calls, 50);
+  printf("{\"bench\": \"klog\", \"calls\": %zu, \"unit\": \"%s\", ", calls,
+         STAMP_UNIT);
+
+  // The task is not running yet, so the ring fills and stays full
+  for (size_t i = 0; i < KLOG_RING_SIZE; i++) {
+    KLOG_I(GAP, "conn=%d itvl=%d", (int)i, 6);
+  }
+  for (size_t i = 0; i < calls; i++) {
+    start = stamp();
+    KLOG_I(GAP, "conn=%d itvl=%d", (int)i, 6);
+    samples[i] = stamp() - start;
+  }
+  print_cost("klog_dropped", samples, calls, overhead);
+
+  if (klog_init() != 0) {
+    return 1;
+  }
+  klog_drain(lines_before);
+  for (size_t i = 0; i < calls; i++) {
+    start = stamp();
+    KLOG_I(GAP, "conn=%d itvl=%d", (int)i, 6);
+    samples[i] = stamp() - start;
+    if (i % BURST == BURST - 1) {
+      klog_drain(lines_before);
+    }
+  }
+  print_cost("klog", samples, calls, overhead);
+
+  for (size_t i = 0; i < calls; i++) {
+    start = stamp();
+    ESP_LOGI(TAG, "conn=%d itvl=%d", (int)i, 6);
+    samples[i] = stamp() - start;
+  }
+  print_cost("esp_logi", samples, calls, overhead);
+
+  klog_get_stats(&stats);
+  printf("\"written\": %u, \"dropped\": %u}\n", stats.written, stats.dropped);
+  free(samples);
+  return stats.written != calls + KLOG_RING_SIZE || stats.dropped != calls;
+}
@@ -0,0 +1,67 @@
+// ns per report_builder_apply() over random chords: 2 to 5 keys, sometimes
+// with a modifier, pressed one after the other and released in random order.
+//
+// Usage: bench_report_builder [events]
+#include "report_builder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_EVENTS 10000000
+
+typedef struct {
+  uint8_t usage;
+  uint8_t pressed;
+} event_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static size_t make_chords(event_t *events, size_t count) {
+  size_t n = 0;
+  srand(1);
+
+  while (n + 10 <= count) {
+    uint8_t keys[5];
+    int size = 2 + rand() % 4;
+    for (int i = 0; i < size; i++) {
+      keys[i] = i == 0 && rand() % 3 == 0 ? HID_KEY_LEFT_CTRL + rand() % 8
+                                          : 0x04 + rand() % 0x60;
+      events[n++] = (event_t){keys[i], 1};
+    }
+    for (int i = size; i > 0; i--) {
+      int j = rand() % i;
+      events[n++] = (event_t){keys[j], 0};
+      keys[j] = keys[i - 1];
+    }
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_EVENTS;
+  event_t *events = malloc(count * sizeof(*events));
+  report_builder_t rb;
+  uint32_t changed = 0;
+
+  if (events == NULL) {
+    return 1;
+  }
+  count = make_chords(events, count);
+  report_builder_init(&rb);
+
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < count; i++) {
+    changed += report_builder_apply(&rb, events[i].usage, events[i].pressed);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  printf("{\"bench\": \"report_builder\", \"events\": %zu, \"changed\": %u, "
+         "\"ns_per_event\": %.2f}\n",
+         count, changed, (double)elapsed / count);
+  free(events);
+  return 0;
+}
@@ -0,0 +1,32 @@
+// Host run of the report path bench (main/bench.h), the same code and JSON
+// as the on-target run. The counter is CLOCK_MONOTONIC in ns, reported as a
+// 1000 MHz clock, so cycles_per_event and ns_per_event agree. It times this
+// PC, the ESP32-S3 figures come from BENCH_REPORT_PATH (config.h).
+//
+// Usage: bench_report_path [events]
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_EVENTS 1000000
+
+static uint32_t now_ns(void *arg) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static void print_line(const char *line, void *arg) { puts(line); }
+
+static const bench_ops_t ops = {
+    .cycles = now_ns,
+    .print = print_line,
+    .cpu_mhz = 1000,
+};
+
+int main(int argc, char **argv) {
+  uint32_t events = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_EVENTS;
+
+  return bench_run(&ops, events) != 0;
+}
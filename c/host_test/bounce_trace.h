@@ -0,0 +1,93 @@
+#ifndef BOUNCE_TRACE_H
+#define BOUNCE_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic switch traces for the key_matrix test and benchmark, one sample
+// per scan. A key is pressed and released at random, and contacts bounce
+// for up to BOUNCE_TRACE_MAX samples at every change: runs of 1 to 3
+// samples alternating between the new and the old state. While a key is
+// stable it also picks up single glitches of 1 to 3 samples, never in the
+// first 4 samples after a change. No run of a wrong reading is 4 samples
+// long, so with KEY_MATRIX_DEBOUNCE_SAMPLES == 4 every real change must
+// come out exactly once, 4 to BOUNCE_TRACE_MAX + 4 samples after it began.
+
+#define BOUNCE_TRACE_MAX 10
+#define BOUNCE_TRACE_STABLE_MIN 8
+#define BOUNCE_TRACE_STABLE_MAX 207
+
+typedef struct {
+  uint32_t at;    // First sample of the change
+  uint8_t bounce; // Samples it bounced for
+  bool pressed;
+} bounce_edge_t;
+
+static inline uint32_t bounce_trace_rand(uint32_t *seed) {
+  // xorshift32, seed must not be 0
+  uint32_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *seed = x;
+}
+
+// Fills raw[start, end) with state, with glitches after the first 4 samples
+static inline void bounce_trace_stable(uint8_t *raw, uint32_t start,
+                                       uint32_t end, bool state,
+                                       uint32_t *seed) {
+  for (uint32_t i = start; i < end; i++) {
+    raw[i] = state;
+  }
+  for (uint32_t i = start + 4; i + 1 < end; i++) {
+    if (bounce_trace_rand(seed) % 64 != 0) {
+      continue;
+    }
+    uint32_t run = 1 + bounce_trace_rand(seed) % 3;
+    for (; run > 0 && i + 1 < end; run--) {
+      raw[i++] = !state;
+    }
+  }
+}
+
+// Writes one key's trace of samples to raw and its real changes to edges,
+// which needs room for samples / BOUNCE_TRACE_STABLE_MIN. The key starts
+// and ends released. Returns the number of edges
+static inline size_t bounce_trace_key(uint8_t *raw, uint32_t samples,
+                                      bounce_edge_t *edges, uint32_t *seed) {
+  const uint32_t pair_max =
+      2 * (BOUNCE_TRACE_STABLE_MAX + BOUNCE_TRACE_MAX) + BOUNCE_TRACE_STABLE_MIN;
+  uint32_t pos = 0;
+  bool state = false;
+  size_t n = 0;
+
+  for (;;) {
+    uint32_t end = pos + BOUNCE_TRACE_STABLE_MIN +
+                   bounce_trace_rand(seed) % (BOUNCE_TRACE_STABLE_MAX -
+                                              BOUNCE_TRACE_STABLE_MIN + 1);
+    // A press always gets room for its release
+    if (!state && end + pair_max > samples) {
+      break;
+    }
+    bounce_trace_stable(raw, pos, end, state, seed);
+
+    uint8_t bounce = bounce_trace_rand(seed) % (BOUNCE_TRACE_MAX + 1);
+    bool reading = !state;
+    for (uint32_t i = end; i < end + bounce;) {
+      uint32_t run = 1 + bounce_trace_rand(seed) % 3;
+      for (; run > 0 && i < end + bounce; run--) {
+        raw[i++] = reading;
+      }
+      reading = !reading;
+    }
+    state = !state;
+    edges[n++] = (bounce_edge_t){.at = end, .bounce = bounce,
+                                 .pressed = state};
+    pos = end + bounce;
+  }
+  bounce_trace_stable(raw, pos, samples, false, seed);
+  return n;
+}
+
+#endif
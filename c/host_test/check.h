@@ -0,0 +1,37 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+// Minimal assertions for the host tests. A failed check is printed and
+// counted, the test keeps going and main() returns check_failures
+static int check_failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      check_failures++;                                                        \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    long long check_a_ = (long long)(a);                                       \
+    long long check_b_ = (long long)(b);                                       \
+    if (check_a_ != check_b_) {                                                \
+      fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n",        \
+              __FILE__, __LINE__, #a, #b, check_a_, check_b_);                 \
+      check_failures++;                                                        \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_DONE()                                                           \
+  do {                                                                         \
+    if (check_failures != 0) {                                                 \
+      fprintf(stderr, "%d check(s) failed\n", check_failures);                 \
+    }                                                                          \
+    return check_failures != 0;                                                \
+  } while (0)
+
+#endif
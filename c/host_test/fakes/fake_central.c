@@ -0,0 +1,188 @@
+#include "fake_central.h"
+#include <string.h>
+
+#define CENTRAL_MAX 4
+
+typedef struct {
+  uint16_t conn_handle;
+  uint32_t count;
+  fake_notification_t log[FAKE_CENTRAL_LOG_LEN];
+} central_t;
+
+static central_t centrals[CENTRAL_MAX];
+
+static central_t *central_find(uint16_t conn_handle) {
+  for (size_t i = 0; i < CENTRAL_MAX; i++) {
+    if (centrals[i].conn_handle == conn_handle) {
+      return &centrals[i];
+    }
+  }
+  return NULL;
+}
+
+static void central_rx(uint16_t conn_handle, uint16_t attr_handle,
+                       const uint8_t *data, uint16_t len, uint64_t now_us) {
+  central_t *c = central_find(conn_handle);
+  if (c == NULL || c->count == FAKE_CENTRAL_LOG_LEN) {
+    return;
+  }
+  fake_notification_t *n = &c->log[c->count++];
+  n->at_us = now_us;
+  n->handle = attr_handle;
+  n->len = len;
+  memcpy(n->data, data, len < FAKE_CENTRAL_DATA_MAX ? len
+                                                    : FAKE_CENTRAL_DATA_MAX);
+}
+
+ble_addr_t fake_central_addr(uint8_t n) {
+  return (ble_addr_t){.type = BLE_ADDR_PUBLIC,
+                      .val = {n, 0xc0, 0xde, 0x00, 0x42, 0xa0}};
+}
+
+uint16_t fake_central_connect(uint8_t n) {
+  fake_peer_cfg_t cfg = FAKE_PEER_CFG_DEFAULT;
+  return fake_central_connect_cfg(n, &cfg);
+}
+
+uint16_t fake_central_connect_cfg(uint8_t n, const fake_peer_cfg_t *cfg) {
+  ble_addr_t addr = fake_central_addr(n);
+  central_t *c = central_find(0);
+
+  fake_link_set_rx(central_rx);
+  if (c == NULL) {
+    return BLE_HS_CONN_HANDLE_NONE;
+  }
+  uint16_t conn_handle = fake_link_connect(&addr, cfg);
+  if (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+    *c = (central_t){.conn_handle = conn_handle};
+  }
+  return conn_handle;
+}
+
+void fake_central_disconnect(uint16_t conn_handle) {
+  central_t *c = central_find(conn_handle);
+  fake_link_disconnect(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+  if (c != NULL) {
+    c->conn_handle = 0;
+  }
+}
+
+void fake_central_pair(uint16_t conn_handle) {
+  fake_link_encrypt(conn_handle, true, true);
+}
+
+static bool attr_is16(const fake_attr_t *attr, uint16_t uuid16) {
+  return attr->uuid->type == BLE_UUID_TYPE_16 &&
+         ble_uuid_u16(attr->uuid) == uuid16;
+}
+
+uint16_t fake_central_find_chr16(uint16_t svc_uuid16, uint16_t chr_uuid16) {
+  bool in_svc = svc_uuid16 == 0;
+
+  for (uint16_t h = 1; fake_gatts_attr(h) != NULL; h++) {
+    const fake_attr_t *attr = fake_gatts_attr(h);
+    if (attr->kind == FAKE_ATTR_SVC && svc_uuid16 != 0) {
+      in_svc = attr_is16(attr, svc_uuid16);
+    } else if (in_svc && attr->kind == FAKE_ATTR_VAL &&
+               attr_is16(attr, chr_uuid16)) {
+      return h;
+    }
+  }
+  return 0;
+}
+
+uint16_t fake_central_find_chr128(const ble_uuid128_t *uuid) {
+  for (uint16_t h = 1; fake_gatts_attr(h) != NULL; h++) {
+    const fake_attr_t *attr = fake_gatts_attr(h);
+    if (attr->kind == FAKE_ATTR_VAL && ble_uuid_cmp(attr->uuid, &uuid->u) == 0) {
+      return h;
+    }
+  }
+  return 0;
+}
+
+uint16_t fake_central_find_report(uint16_t conn_handle, uint8_t id,
+                                  uint8_t type) {
+  uint16_t report = 0;
+
+  for (uint16_t h = 1; fake_gatts_attr(h) != NULL; h++) {
+    const fake_attr_t *attr = fake_gatts_attr(h);
+    if (attr->kind == FAKE_ATTR_VAL) {
+      report = attr_is16(attr, 0x2a4d) ? h : 0;
+    } else if (report != 0 && attr->kind == FAKE_ATTR_DSC &&
+               attr_is16(attr, 0x2908)) {
+      uint8_t ref[2];
+      uint16_t len;
+      if (fake_link_read(conn_handle, h, 0, ref, sizeof(ref), &len) == 0 &&
+          len == 2 && ref[0] == id && ref[1] == type) {
+        return report;
+      }
+    }
+  }
+  return 0;
+}
+
+int fake_central_read(uint16_t conn_handle, uint16_t handle, uint8_t *buf,
+                      uint16_t max, uint16_t *len) {
+  uint16_t blob_max = fake_link_mtu(conn_handle) - 1;
+  uint16_t blob;
+  int rc;
+
+  // A long read: Read, then Read Blob from where the value got to while the
+  // responses come back full. The host task handles whatever else is queued
+  // between the requests, as it does between connection events
+  *len = 0;
+  do {
+    uint16_t room = max - *len < blob_max ? max - *len : blob_max;
+    rc = fake_link_read(conn_handle, handle, *len, buf + *len, room, &blob);
+    *len += blob;
+    fake_nimble_run();
+  } while (rc == 0 && blob == blob_max && *len < max);
+  return rc;
+}
+
+int fake_central_write(uint16_t conn_handle, uint16_t handle, const void *data,
+                       uint16_t len) {
+  return fake_link_write(conn_handle, handle, data, len);
+}
+
+int fake_central_subscribe(uint16_t conn_handle, uint16_t handle, bool notify) {
+  const fake_attr_t *cccd = fake_gatts_attr(handle + 1);
+  uint8_t value[2] = {notify ? 1 : 0, 0};
+
+  if (cccd == NULL || cccd->kind != FAKE_ATTR_CCCD) {
+    return BLE_ATT_ERR_INVALID_HANDLE;
+  }
+  return fake_link_write(conn_handle, handle + 1, value, sizeof(value));
+}
+
+uint32_t fake_central_count(uint16_t conn_handle) {
+  central_t *c = central_find(conn_handle);
+  return c != NULL ? c->count : 0;
+}
+
+const fake_notification_t *fake_central_get(uint16_t conn_handle, uint32_t i) {
+  central_t *c = central_find(conn_handle);
+  return c != NULL && i < c->count ? &c->log[i] : NULL;
+}
+
+const fake_notification_t *fake_central_last(uint16_t conn_handle,
+                                             uint16_t handle) {
+  central_t *c = central_find(conn_handle);
+  if (c == NULL) {
+    return NULL;
+  }
+  for (uint32_t i = c->count; i-- > 0;) {
+    if (c->log[i].handle == handle) {
+      return &c->log[i];
+    }
+  }
+  return NULL;
+}
+
+void fake_central_clear(uint16_t conn_handle) {
+  central_t *c = central_find(conn_handle);
+  if (c != NULL) {
+    c->count = 0;
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef FAKE_CENTRAL_H
+#define FAKE_CENTRAL_H
+
+#include "fake_nimble.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A scripted HID host on the other end of a fake_nimble.h link: connects,
+// discovers, reads and subscribes, and logs every notification it receives
+// with the time its connection event sent it.
+
+#define FAKE_CENTRAL_LOG_LEN 1024
+#define FAKE_CENTRAL_DATA_MAX 32
+
+typedef struct {
+  uint64_t at_us;
+  uint16_t handle;
+  uint16_t len;
+  uint8_t data[FAKE_CENTRAL_DATA_MAX];
+} fake_notification_t;
+
+// Peer address n, public
+ble_addr_t fake_central_addr(uint8_t n);
+
+// Connects as peer n with FAKE_PEER_CFG_DEFAULT, or cfg. The handle, or
+// BLE_HS_CONN_HANDLE_NONE if the keyboard did not take the connection
+uint16_t fake_central_connect(uint8_t n);
+uint16_t fake_central_connect_cfg(uint8_t n, const fake_peer_cfg_t *cfg);
+void fake_central_disconnect(uint16_t conn_handle);
+// Pairs with MITM protection and bonds
+void fake_central_pair(uint16_t conn_handle);
+
+// Value handle of the first characteristic with this UUID after svc_uuid16's
+// service starts (0 for any service), 0 if there is none
+uint16_t fake_central_find_chr16(uint16_t svc_uuid16, uint16_t chr_uuid16);
+uint16_t fake_central_find_chr128(const ble_uuid128_t *uuid);
+// Value handle of the HID Report characteristic whose Report Reference reads
+// (id, type), 0 if there is none
+uint16_t fake_central_find_report(uint16_t conn_handle, uint8_t id,
+                                  uint8_t type);
+
+// ATT read and write, 0 or an ATT error. Both run the event queue after
+int fake_central_read(uint16_t conn_handle, uint16_t handle, uint8_t *buf,
+                      uint16_t max, uint16_t *len);
+int fake_central_write(uint16_t conn_handle, uint16_t handle, const void *data,
+                       uint16_t len);
+// Writes the CCCD of the value handle
+int fake_central_subscribe(uint16_t conn_handle, uint16_t handle, bool notify);
+
+// Notifications received on a link, oldest first
+uint32_t fake_central_count(uint16_t conn_handle);
+const fake_notification_t *fake_central_get(uint16_t conn_handle, uint32_t i);
+// Last one with this handle, NULL if none
+const fake_notification_t *fake_central_last(uint16_t conn_handle,
+                                             uint16_t handle);
+void fake_central_clear(uint16_t conn_handle);
+
+#endif
@@ -0,0 +1,159 @@
+#include "fake_esp.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "fake_nimble.h"
+#include "freertos/task.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct fake_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *param;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notify;
+};
+
+static _Atomic esp_log_level_t log_level = ESP_LOG_ERROR;
+static atomic_uint log_lines;
+static void (*_Atomic log_hook)(const char *line);
+
+void fake_log_level_set(esp_log_level_t level) { log_level = level; }
+
+uint32_t fake_log_lines(void) { return log_lines; }
+
+void fake_log_hook_set(void (*hook)(const char *line)) { log_hook = hook; }
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) {
+  char line[256];
+  va_list ap;
+
+  // Formatted either way, so a dropped line costs what a printed one does
+  // minus the write
+  va_start(ap, format);
+  vsnprintf(line, sizeof(line), format, ap);
+  va_end(ap);
+  void (*hook)(const char *line) = log_hook;
+  if (hook != NULL) {
+    hook(line);
+  }
+  log_lines++;
+  if (level <= log_level) {
+    fputs(line, stderr);
+  }
+}
+
+uint32_t esp_log_timestamp(void) {
+  return (uint32_t)(fake_nimble_now_us() / 1000);
+}
+
+int64_t esp_timer_get_time(void) { return (int64_t)fake_nimble_now_us(); }
+
+uint32_t esp_cpu_get_cycle_count(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+// Threads the tests start themselves get a task the first time they ask
+static _Thread_local struct fake_task *self;
+
+static struct fake_task *task_new(TaskFunction_t fn, void *param) {
+  struct fake_task *task = calloc(1, sizeof(*task));
+  if (task == NULL) {
+    return NULL;
+  }
+  task->fn = fn;
+  task->param = param;
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->cond, NULL);
+  return task;
+}
+
+static void *task_main(void *arg) {
+  self = arg;
+  self->fn(self->param);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *param,
+                                   UBaseType_t prio, TaskHandle_t *handle,
+                                   BaseType_t core) {
+  struct fake_task *task = task_new(fn, param);
+  if (task == NULL) {
+    return pdFAIL;
+  }
+  if (handle != NULL) {
+    *handle = task;
+  }
+  if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (self == NULL) {
+    self = task_new(NULL, NULL);
+  }
+  return self;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+  pthread_mutex_lock(&task->lock);
+  task->notify++;
+  pthread_cond_signal(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+  struct fake_task *task = xTaskGetCurrentTaskHandle();
+  uint32_t value;
+
+  pthread_mutex_lock(&task->lock);
+  if (wait == portMAX_DELAY) {
+    while (task->notify == 0) {
+      pthread_cond_wait(&task->cond, &task->lock);
+    }
+  } else if (task->notify == 0 && wait > 0) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += wait / 1000;
+    until.tv_nsec += (long)(wait % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    while (task->notify == 0 &&
+           pthread_cond_timedwait(&task->cond, &task->lock, &until) == 0) {
+    }
+  }
+  value = task->notify;
+  if (value > 0) {
+    task->notify = clear ? 0 : value - 1;
+  }
+  pthread_mutex_unlock(&task->lock);
+  return value;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  struct timespec ts = {.tv_sec = ticks / 1000,
+                        .tv_nsec = (long)(ticks % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t max,
+                                 configRUN_TIME_COUNTER_TYPE *total) {
+  if (total != NULL) {
+    *total = (configRUN_TIME_COUNTER_TYPE)fake_nimble_now_us();
+  }
+  return 0;
+}
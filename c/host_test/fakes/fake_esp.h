@@ -0,0 +1,17 @@
+#ifndef FAKE_ESP_H
+#define FAKE_ESP_H
+
+#include "esp_log.h"
+#include <stdint.h>
+
+// Stand-in for the ESP-IDF and FreeRTOS calls of the sources under test.
+// Tasks are threads, esp_timer_get_time() is the fake_nimble.h clock.
+
+// Lines above this level are formatted and dropped, ESP_LOG_ERROR by default
+void fake_log_level_set(esp_log_level_t level);
+// Lines esp_log_write() was called with, printed or not
+uint32_t fake_log_lines(void);
+// Called with every formatted line on the thread that wrote it, NULL for none
+void fake_log_hook_set(void (*hook)(const char *line));
+
+#endif
@@ -0,0 +1,11 @@
+#include "fake_input.h"
+
+static struct matrix_scanner_stats scanner_stats;
+
+void fake_input_set_scanner_stats(const struct matrix_scanner_stats *stats) {
+  scanner_stats = *stats;
+}
+
+void matrix_scanner_get_stats(struct matrix_scanner_stats *stats) {
+  *stats = scanner_stats;
+}
@@ -0,0 +1,11 @@
+#ifndef FAKE_INPUT_H
+#define FAKE_INPUT_H
+
+#include "matrix_scanner.h"
+
+// The input drivers' stats getters on the host, where there is no GPIO
+// matrix. They return what the test last set, zeros until then.
+
+void fake_input_set_scanner_stats(const struct matrix_scanner_stats *stats);
+
+#endif
@@ -0,0 +1,1413 @@
+#include "fake_nimble.h"
+#include "host/ble_hs_id.h"
+#include "host/util/util.h"
+#include "nimble/nimble_port.h"
+#include "os/endian.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Where the clock starts, so no timestamp is 0
+#define FAKE_START_US 1000000
+// CCCD bits
+#define FAKE_CCCD_NOTIFY 0x0001
+#define FAKE_CCCD_INDICATE 0x0002
+// Our side of the MTU exchange, CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU
+#define FAKE_OUR_MTU 517
+
+struct ble_hs_cfg ble_hs_cfg;
+
+static uint64_t now_us = FAKE_START_US;
+
+// ---------------------------------------------------------------------------
+// Memory pools and mbufs
+
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks,
+                    uint32_t block_size, void *membuf, const char *name) {
+  uint32_t size = OS_ALIGN(block_size, sizeof(os_membuf_t));
+  uint8_t *block = membuf;
+
+  if (mp == NULL || membuf == NULL || block_size == 0) {
+    return OS_INVALID_PARM;
+  }
+  *mp = (struct os_mempool){
+      .mp_block_size = size,
+      .mp_num_blocks = blocks,
+      .mp_num_free = blocks,
+      .mp_min_free = blocks,
+      .mp_membuf_addr = (uintptr_t)membuf,
+      .name = name,
+  };
+  for (uint16_t i = 0; i < blocks; i++) {
+    struct os_memblock *mb = (struct os_memblock *)(block + i * size);
+    mb->mb_next = mp->mp_head;
+    mp->mp_head = mb;
+  }
+  return OS_OK;
+}
+
+void *os_memblock_get(struct os_mempool *mp) {
+  struct os_memblock *mb = mp->mp_head;
+  if (mb == NULL) {
+    return NULL;
+  }
+  mp->mp_head = mb->mb_next;
+  mp->mp_num_free--;
+  if (mp->mp_num_free < mp->mp_min_free) {
+    mp->mp_min_free = mp->mp_num_free;
+  }
+  return mb;
+}
+
+int os_memblock_put(struct os_mempool *mp, void *block) {
+  uintptr_t addr = (uintptr_t)block;
+  uintptr_t end = mp->mp_membuf_addr + mp->mp_num_blocks * mp->mp_block_size;
+
+  // A block from another pool would corrupt both
+  if (addr < mp->mp_membuf_addr || addr >= end ||
+      (addr - mp->mp_membuf_addr) % mp->mp_block_size != 0 ||
+      mp->mp_num_free >= mp->mp_num_blocks) {
+    fprintf(stderr, "os_memblock_put: bad block for pool %s\n", mp->name);
+    abort();
+  }
+  struct os_memblock *mb = block;
+  mb->mb_next = mp->mp_head;
+  mp->mp_head = mb;
+  mp->mp_num_free++;
+  return OS_OK;
+}
+
+int os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp,
+                      uint16_t buf_len, uint16_t nbufs) {
+  omp->omp_databuf_len = buf_len - sizeof(struct os_mbuf);
+  omp->omp_pool = mp;
+  return 0;
+}
+
+struct os_mbuf *os_mbuf_get(struct os_mbuf_pool *omp, uint16_t leadingspace) {
+  if (leadingspace > omp->omp_databuf_len) {
+    return NULL;
+  }
+  struct os_mbuf *om = os_memblock_get(omp->omp_pool);
+  if (om == NULL) {
+    return NULL;
+  }
+  om->om_next = NULL;
+  om->om_flags = 0;
+  om->om_pkthdr_len = 0;
+  om->om_len = 0;
+  om->om_data = om->om_databuf + leadingspace;
+  om->om_omp = omp;
+  return om;
+}
+
+struct os_mbuf *os_mbuf_get_pkthdr(struct os_mbuf_pool *omp,
+                                   uint8_t user_pkthdr_len) {
+  uint16_t pkthdr_len = sizeof(struct os_mbuf_pkthdr) + user_pkthdr_len;
+  if (pkthdr_len > omp->omp_databuf_len) {
+    return NULL;
+  }
+  struct os_mbuf *om = os_mbuf_get(omp, 0);
+  if (om == NULL) {
+    return NULL;
+  }
+  om->om_pkthdr_len = pkthdr_len;
+  om->om_data += pkthdr_len;
+  struct os_mbuf_pkthdr *hdr = OS_MBUF_PKTHDR(om);
+  hdr->omp_len = 0;
+  hdr->omp_flags = 0;
+  hdr->omp_next = NULL;
+  return om;
+}
+
+int os_mbuf_free(struct os_mbuf *om) {
+  return os_memblock_put(om->om_omp->omp_pool, om);
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om) {
+  while (om != NULL) {
+    struct os_mbuf *next = om->om_next;
+    os_mbuf_free(om);
+    om = next;
+  }
+  return 0;
+}
+
+uint16_t os_mbuf_leadingspace(struct os_mbuf *om) {
+  return om->om_data - (om->om_databuf + om->om_pkthdr_len);
+}
+
+uint16_t os_mbuf_trailingspace(struct os_mbuf *om) {
+  return (om->om_databuf + om->om_omp->omp_databuf_len) -
+         (om->om_data + om->om_len);
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len) {
+  const uint8_t *src = data;
+  struct os_mbuf *last = om;
+
+  while (last->om_next != NULL) {
+    last = last->om_next;
+  }
+
+  uint16_t space = os_mbuf_trailingspace(last);
+  uint16_t take = space < len ? space : len;
+  memcpy(last->om_data + last->om_len, src, take);
+  last->om_len += take;
+  src += take;
+  len -= take;
+
+  while (len > 0) {
+    struct os_mbuf *next = os_mbuf_get(om->om_omp, 0);
+    if (next == NULL) {
+      break;
+    }
+    last->om_next = next;
+    last = next;
+    take = last->om_omp->omp_databuf_len < len ? last->om_omp->omp_databuf_len
+                                               : len;
+    memcpy(last->om_data, src, take);
+    last->om_len = take;
+    src += take;
+    len -= take;
+  }
+
+  if (OS_MBUF_IS_PKTHDR(om)) {
+    OS_MBUF_PKTHDR(om)->omp_len += src - (const uint8_t *)data;
+  }
+  return len == 0 ? 0 : OS_ENOMEM;
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst) {
+  uint8_t *out = dst;
+
+  while (om != NULL && off >= om->om_len) {
+    off -= om->om_len;
+    om = om->om_next;
+  }
+  while (len > 0 && om != NULL) {
+    int take = om->om_len - off < len ? om->om_len - off : len;
+    memcpy(out, om->om_data + off, take);
+    out += take;
+    len -= take;
+    off = 0;
+    om = om->om_next;
+  }
+  return len > 0 ? -1 : 0;
+}
+
+void os_mbuf_concat(struct os_mbuf *first, struct os_mbuf *second) {
+  struct os_mbuf *cur = first;
+
+  while (cur->om_next != NULL) {
+    cur = cur->om_next;
+  }
+  cur->om_next = second;
+
+  if (OS_MBUF_IS_PKTHDR(first)) {
+    if (OS_MBUF_IS_PKTHDR(second)) {
+      OS_MBUF_PKTHDR(first)->omp_len += OS_MBUF_PKTLEN(second);
+    } else {
+      for (cur = second; cur != NULL; cur = cur->om_next) {
+        OS_MBUF_PKTHDR(first)->omp_len += cur->om_len;
+      }
+    }
+  }
+  second->om_pkthdr_len = 0;
+}
+
+static os_membuf_t
+    msys_mem[OS_MEMPOOL_SIZE(FAKE_MSYS_COUNT, FAKE_MSYS_BLOCK_SIZE)];
+static struct os_mempool msys_mempool;
+static struct os_mbuf_pool msys_mbuf_pool;
+static uint32_t msys_enomem;
+
+static void msys_init(void) {
+  if (msys_mbuf_pool.omp_pool != NULL) {
+    return;
+  }
+  os_mempool_init(&msys_mempool, FAKE_MSYS_COUNT, FAKE_MSYS_BLOCK_SIZE,
+                  msys_mem, "msys_1");
+  os_mbuf_pool_init(&msys_mbuf_pool, &msys_mempool, FAKE_MSYS_BLOCK_SIZE,
+                    FAKE_MSYS_COUNT);
+}
+
+struct os_mbuf *os_msys_get(uint16_t dsize, uint16_t leadingspace) {
+  msys_init();
+  return os_mbuf_get(&msys_mbuf_pool, leadingspace);
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len) {
+  msys_init();
+  return os_mbuf_get_pkthdr(&msys_mbuf_pool, user_hdr_len);
+}
+
+uint16_t fake_msys_free(void) {
+  msys_init();
+  return msys_mempool.mp_num_free;
+}
+
+uint16_t fake_msys_min_free(void) {
+  msys_init();
+  return msys_mempool.mp_min_free;
+}
+
+uint32_t fake_msys_enomem(void) { return msys_enomem; }
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len,
+                        uint16_t *out_copy_len) {
+  uint16_t len = OS_MBUF_PKTLEN(om);
+  uint16_t copy = len < max_len ? len : max_len;
+
+  os_mbuf_copydata(om, 0, copy, flat);
+  if (out_copy_len != NULL) {
+    *out_copy_len = copy;
+  }
+  return len > max_len ? BLE_HS_EMSGSIZE : 0;
+}
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len) {
+  struct os_mbuf *om = os_msys_get_pkthdr(len, 0);
+  if (om == NULL) {
+    return NULL;
+  }
+  if (os_mbuf_append(om, buf, len) != 0) {
+    os_mbuf_free_chain(om);
+    return NULL;
+  }
+  return om;
+}
+
+// ---------------------------------------------------------------------------
+// Porting layer
+
+static struct ble_npl_eventq dflt_eventq;
+static struct ble_npl_callout *callouts;
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void) {
+  return &dflt_eventq;
+}
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn,
+                        void *arg) {
+  *ev = (struct ble_npl_event){.fn = fn, .arg = arg};
+}
+
+void *ble_npl_event_get_arg(struct ble_npl_event *ev) { return ev->arg; }
+
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev) {
+  if (ev->queued) {
+    return;
+  }
+  ev->queued = true;
+  ev->next = NULL;
+  if (evq->tail != NULL) {
+    evq->tail->next = ev;
+  } else {
+    evq->head = ev;
+  }
+  evq->tail = ev;
+}
+
+static struct ble_npl_event *eventq_get(struct ble_npl_eventq *evq) {
+  struct ble_npl_event *ev = evq->head;
+  if (ev != NULL) {
+    evq->head = ev->next;
+    if (evq->head == NULL) {
+      evq->tail = NULL;
+    }
+    ev->queued = false;
+  }
+  return ev;
+}
+
+void ble_npl_callout_init(struct ble_npl_callout *co,
+                          struct ble_npl_eventq *evq, ble_npl_event_fn *fn,
+                          void *arg) {
+  bool listed = false;
+  for (struct ble_npl_callout *c = callouts; c != NULL; c = c->next) {
+    listed |= c == co;
+  }
+  struct ble_npl_callout *next = listed ? co->next : callouts;
+
+  *co = (struct ble_npl_callout){.evq = evq, .next = next};
+  ble_npl_event_init(&co->ev, fn, arg);
+  if (!listed) {
+    callouts = co;
+  }
+}
+
+ble_npl_error_t ble_npl_callout_reset(struct ble_npl_callout *co,
+                                      ble_npl_time_t ticks) {
+  co->active = true;
+  co->expiry_us = now_us + (uint64_t)ticks * 1000;
+  return BLE_NPL_OK;
+}
+
+void ble_npl_callout_stop(struct ble_npl_callout *co) { co->active = false; }
+
+bool ble_npl_callout_is_active(struct ble_npl_callout *co) {
+  return co->active;
+}
+
+ble_npl_time_t ble_npl_time_get(void) { return now_us / 1000; }
+
+uint64_t fake_nimble_now_us(void) { return now_us; }
+
+// ---------------------------------------------------------------------------
+// GATT server
+
+static const struct ble_gatt_svc_def *svc_defs[FAKE_MAX_SVCS];
+static size_t svc_count;
+static fake_attr_t attrs[FAKE_ATTR_MAX + 1]; // Indexed by handle
+static uint16_t attr_count;
+static bool started;
+
+static bool chr_has_cccd(const struct ble_gatt_chr_def *chr) {
+  return chr->flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE);
+}
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs) {
+  size_t count = 0;
+
+  for (const struct ble_gatt_svc_def *svc = defs;
+       svc->type != BLE_GATT_SVC_TYPE_END; svc++) {
+    if (svc->uuid == NULL) {
+      return BLE_HS_EINVAL;
+    }
+    count++;
+    for (const struct ble_gatt_chr_def *chr = svc->characteristics;
+         chr != NULL && chr->uuid != NULL; chr++) {
+      if (chr->access_cb == NULL) {
+        return BLE_HS_EINVAL;
+      }
+      count += 2 + chr_has_cccd(chr);
+      for (const struct ble_gatt_dsc_def *dsc = chr->descriptors;
+           dsc != NULL && dsc->uuid != NULL; dsc++) {
+        count++;
+      }
+    }
+  }
+  return count <= FAKE_ATTR_MAX ? 0 : BLE_HS_ENOMEM;
+}
+
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs) {
+  if (started) {
+    return BLE_HS_EBUSY;
+  }
+  if (svc_count == FAKE_MAX_SVCS) {
+    return BLE_HS_ENOMEM;
+  }
+  svc_defs[svc_count++] = svcs;
+  return 0;
+}
+
+static uint16_t attr_add(fake_attr_kind_t kind, const ble_uuid_t *uuid,
+                         const struct ble_gatt_svc_def *svc,
+                         const struct ble_gatt_chr_def *chr,
+                         const struct ble_gatt_dsc_def *dsc) {
+  if (attr_count == FAKE_ATTR_MAX) {
+    fprintf(stderr, "fake_nimble: more than %d attributes\n", FAKE_ATTR_MAX);
+    abort();
+  }
+  uint16_t handle = ++attr_count;
+  attrs[handle] = (fake_attr_t){
+      .handle = handle,
+      .kind = kind,
+      .uuid = uuid,
+      .svc = svc,
+      .chr = chr,
+      .dsc = dsc,
+  };
+  return handle;
+}
+
+static void register_event(struct ble_gatt_register_ctxt *ctxt) {
+  if (ble_hs_cfg.gatts_register_cb != NULL) {
+    ble_hs_cfg.gatts_register_cb(ctxt, ble_hs_cfg.gatts_register_arg);
+  }
+}
+
+// Same order as ble_gatts_start(): service declaration, then per
+// characteristic its declaration, value, CCCD and descriptors
+static void register_svc(const struct ble_gatt_svc_def *svc) {
+  uint16_t handle = attr_add(FAKE_ATTR_SVC, svc->uuid, svc, NULL, NULL);
+  register_event(&(struct ble_gatt_register_ctxt){
+      .op = BLE_GATT_REGISTER_OP_SVC,
+      .svc = {.handle = handle, .svc_def = svc},
+  });
+
+  for (const struct ble_gatt_chr_def *chr = svc->characteristics;
+       chr != NULL && chr->uuid != NULL; chr++) {
+    uint16_t def_handle = attr_add(FAKE_ATTR_CHR, chr->uuid, svc, chr, NULL);
+    uint16_t val_handle = attr_add(FAKE_ATTR_VAL, chr->uuid, svc, chr, NULL);
+    if (chr->val_handle != NULL) {
+      *chr->val_handle = val_handle;
+    }
+    register_event(&(struct ble_gatt_register_ctxt){
+        .op = BLE_GATT_REGISTER_OP_CHR,
+        .chr = {.def_handle = def_handle,
+                .val_handle = val_handle,
+                .chr_def = chr,
+                .svc_def = svc},
+    });
+    if (chr_has_cccd(chr)) {
+      attr_add(FAKE_ATTR_CCCD, BLE_UUID16_DECLARE(0x2902), svc, chr, NULL);
+    }
+    for (const struct ble_gatt_dsc_def *dsc = chr->descriptors;
+         dsc != NULL && dsc->uuid != NULL; dsc++) {
+      uint16_t dsc_handle = attr_add(FAKE_ATTR_DSC, dsc->uuid, svc, chr, dsc);
+      register_event(&(struct ble_gatt_register_ctxt){
+          .op = BLE_GATT_REGISTER_OP_DSC,
+          .dsc = {.handle = dsc_handle,
+                  .dsc_def = dsc,
+                  .chr_def = chr,
+                  .svc_def = svc},
+      });
+    }
+  }
+}
+
+const fake_attr_t *fake_gatts_attr(uint16_t handle) {
+  if (handle == 0 || handle > attr_count) {
+    return NULL;
+  }
+  return &attrs[handle];
+}
+
+// ---------------------------------------------------------------------------
+// Links
+
+typedef struct {
+  bool used;
+  struct ble_gap_conn_desc desc;
+  fake_peer_cfg_t peer;
+  ble_gap_event_fn *cb;
+  void *cb_arg;
+  uint16_t mtu;
+  uint64_t next_event_us;
+  uint8_t cccd[FAKE_ATTR_MAX + 1];
+  // Notifications waiting for a connection event
+  struct os_mbuf *txq[FAKE_TXQ_LEN];
+  uint16_t txq_handle[FAKE_TXQ_LEN];
+  uint8_t txq_head;
+  uint8_t txq_count;
+  // Procedures that complete at the next connection event
+  bool upd_pending;
+  struct ble_gap_upd_params upd;
+  bool phy_pending;
+  bool dle_pending;
+  bool mtu_pending;
+  bool term_pending;
+  uint8_t term_reason;
+} fake_conn_t;
+
+#define FAKE_MAX_CONNS MYNEWT_VAL(BLE_MAX_CONNECTIONS)
+
+static fake_conn_t conns[FAKE_MAX_CONNS];
+static uint16_t next_conn_handle = 1;
+static fake_rx_fn *link_rx;
+
+static fake_conn_t *conn_find(uint16_t conn_handle) {
+  for (size_t i = 0; i < FAKE_MAX_CONNS; i++) {
+    if (conns[i].used && conns[i].desc.conn_handle == conn_handle) {
+      return &conns[i];
+    }
+  }
+  return NULL;
+}
+
+static int gap_event(fake_conn_t *conn, struct ble_gap_event *event) {
+  if (conn->cb == NULL) {
+    return 0;
+  }
+  return conn->cb(event, conn->cb_arg);
+}
+
+void fake_link_set_rx(fake_rx_fn *rx) { link_rx = rx; }
+
+bool fake_link_connected(uint16_t conn_handle) {
+  return conn_find(conn_handle) != NULL;
+}
+
+uint16_t fake_link_pending(uint16_t conn_handle) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  return conn != NULL ? conn->txq_count : 0;
+}
+
+uint16_t fake_link_mtu(uint16_t conn_handle) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  return conn != NULL ? conn->mtu : BLE_ATT_MTU_DFLT;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle,
+                            struct os_mbuf *om) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  int rc = 0;
+
+  if (conn == NULL) {
+    os_mbuf_free_chain(om);
+    return BLE_HS_ENOTCONN;
+  }
+
+  // ble_att_clt_tx_notify(): the ATT header always comes from msys, the
+  // caller's mbuf is chained behind it
+  struct os_mbuf *txom = os_msys_get_pkthdr(3, 0);
+  if (txom == NULL) {
+    msys_enomem++;
+    os_mbuf_free_chain(om);
+    rc = BLE_HS_ENOMEM;
+  } else {
+    uint8_t hdr[3] = {0x1b}; // ATT Handle Value Notification
+    put_le16(hdr + 1, att_handle);
+    os_mbuf_append(txom, hdr, sizeof(hdr));
+    os_mbuf_concat(txom, om);
+
+    if (conn->txq_count == FAKE_TXQ_LEN) {
+      fprintf(stderr, "fake_nimble: tx queue of link %d overflows\n",
+              conn_handle);
+      abort();
+    }
+    uint8_t slot = (conn->txq_head + conn->txq_count) % FAKE_TXQ_LEN;
+    conn->txq[slot] = txom;
+    conn->txq_handle[slot] = att_handle;
+    conn->txq_count++;
+  }
+
+  // Like NimBLE, the result is reported right away
+  struct ble_gap_event event = {
+      .type = BLE_GAP_EVENT_NOTIFY_TX,
+      .notify_tx = {.status = rc,
+                    .conn_handle = conn_handle,
+                    .attr_handle = att_handle},
+  };
+  gap_event(conn, &event);
+  return rc;
+}
+
+// Sends what fits one connection event
+static void conn_tx(fake_conn_t *conn) {
+  for (int i = 0; i < FAKE_PKTS_PER_EVENT && conn->txq_count > 0; i++) {
+    struct os_mbuf *om = conn->txq[conn->txq_head];
+    uint16_t handle = conn->txq_handle[conn->txq_head];
+    conn->txq_head = (conn->txq_head + 1) % FAKE_TXQ_LEN;
+    conn->txq_count--;
+
+    uint8_t flat[BLE_ATT_MTU_MAX];
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    if (len > conn->mtu) {
+      // ble_att_tx() truncates to the MTU
+      len = conn->mtu;
+    }
+    os_mbuf_copydata(om, 0, len, flat);
+    os_mbuf_free_chain(om);
+    if (link_rx != NULL) {
+      link_rx(conn->desc.conn_handle, handle, flat + 3, len - 3, now_us);
+    }
+  }
+}
+
+static void conn_free(fake_conn_t *conn) {
+  while (conn->txq_count > 0) {
+    os_mbuf_free_chain(conn->txq[conn->txq_head]);
+    conn->txq_head = (conn->txq_head + 1) % FAKE_TXQ_LEN;
+    conn->txq_count--;
+  }
+  conn->used = false;
+}
+
+static void conn_broken(fake_conn_t *conn, int reason) {
+  struct ble_gap_conn_desc desc = conn->desc;
+  ble_gap_event_fn *cb = conn->cb;
+  void *cb_arg = conn->cb_arg;
+
+  // ble_gatts_connection_broken() ends every subscription first
+  for (uint16_t h = 1; h <= attr_count; h++) {
+    if (attrs[h].kind != FAKE_ATTR_CCCD || conn->cccd[h] == 0) {
+      continue;
+    }
+    struct ble_gap_event event = {
+        .type = BLE_GAP_EVENT_SUBSCRIBE,
+        .subscribe = {.conn_handle = desc.conn_handle,
+                      .attr_handle = h - 1,
+                      .reason = BLE_GAP_SUBSCRIBE_REASON_TERM,
+                      .prev_notify = !!(conn->cccd[h] & FAKE_CCCD_NOTIFY),
+                      .prev_indicate = !!(conn->cccd[h] & FAKE_CCCD_INDICATE)},
+    };
+    gap_event(conn, &event);
+  }
+
+  conn_free(conn);
+  struct ble_gap_event event = {
+      .type = BLE_GAP_EVENT_DISCONNECT,
+      .disconnect = {.reason = reason, .conn = desc},
+  };
+  if (cb != NULL) {
+    cb(&event, cb_arg);
+  }
+}
+
+static void conn_event(fake_conn_t *conn) {
+  uint16_t conn_handle = conn->desc.conn_handle;
+  struct ble_gap_event event;
+
+  if (conn->term_pending) {
+    conn_broken(conn, BLE_HS_HCI_ERR(BLE_ERR_CONN_TERM_LOCAL));
+    return;
+  }
+
+  conn_tx(conn);
+
+  if (conn->phy_pending) {
+    conn->phy_pending = false;
+    event = (struct ble_gap_event){
+        .type = BLE_GAP_EVENT_PHY_UPDATE_COMPLETE,
+        .phy_updated = {.status = conn->peer.no_2m
+                                      ? BLE_HS_HCI_ERR(
+                                            BLE_ERR_UNSUPP_REM_FEATURE)
+                                      : 0,
+                        .conn_handle = conn_handle,
+                        .tx_phy = conn->peer.no_2m ? BLE_GAP_LE_PHY_1M
+                                                   : BLE_GAP_LE_PHY_2M,
+                        .rx_phy = conn->peer.no_2m ? BLE_GAP_LE_PHY_1M
+                                                   : BLE_GAP_LE_PHY_2M},
+    };
+    gap_event(conn, &event);
+  }
+  if (conn->dle_pending && !conn->peer.no_dle) {
+    conn->dle_pending = false;
+    event = (struct ble_gap_event){
+        .type = BLE_GAP_EVENT_DATA_LEN_CHG,
+        .data_len_chg = {.conn_handle = conn_handle,
+                         .max_tx_octets = 251,
+                         .max_tx_time = 2120,
+                         .max_rx_octets = 251,
+                         .max_rx_time = 2120},
+    };
+    gap_event(conn, &event);
+  }
+  if (conn->mtu_pending) {
+    conn->mtu_pending = false;
+    conn->mtu = conn->peer.mtu < FAKE_OUR_MTU ? conn->peer.mtu : FAKE_OUR_MTU;
+    event = (struct ble_gap_event){
+        .type = BLE_GAP_EVENT_MTU,
+        .mtu = {.conn_handle = conn_handle, .channel_id = 4,
+                .value = conn->mtu},
+    };
+    gap_event(conn, &event);
+  }
+  if (conn->upd_pending) {
+    conn->upd_pending = false;
+    // The central picks the lowest interval it accepts in the range
+    uint16_t itvl = conn->upd.itvl_min > conn->peer.min_itvl
+                        ? conn->upd.itvl_min
+                        : conn->peer.min_itvl;
+    int status = 0;
+    if (conn->peer.reject_updates || itvl > conn->upd.itvl_max) {
+      status = BLE_HS_HCI_ERR(0x3b); // Unacceptable connection parameters
+    } else {
+      conn->desc.conn_itvl = itvl;
+      conn->desc.conn_latency = conn->upd.latency;
+      conn->desc.supervision_timeout = conn->upd.supervision_timeout;
+    }
+    event = (struct ble_gap_event){
+        .type = BLE_GAP_EVENT_CONN_UPDATE,
+        .conn_update = {.status = status, .conn_handle = conn_handle},
+    };
+    gap_event(conn, &event);
+  }
+
+  if (conn->used) {
+    conn->next_event_us += conn->desc.conn_itvl * 1250u;
+  }
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc) {
+  fake_conn_t *conn = conn_find(handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+  if (out_desc != NULL) {
+    *out_desc = conn->desc;
+  }
+  return 0;
+}
+
+int ble_gap_conn_find_by_addr(const ble_addr_t *addr,
+                              struct ble_gap_conn_desc *out_desc) {
+  for (size_t i = 0; i < FAKE_MAX_CONNS; i++) {
+    if (conns[i].used && ble_addr_cmp(&conns[i].desc.peer_id_addr, addr) == 0) {
+      if (out_desc != NULL) {
+        *out_desc = conns[i].desc;
+      }
+      return 0;
+    }
+  }
+  return BLE_HS_ENOTCONN;
+}
+
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+  conn->term_pending = true;
+  conn->term_reason = hci_reason;
+  return 0;
+}
+
+int ble_gap_update_params(uint16_t conn_handle,
+                          const struct ble_gap_upd_params *params) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+  if (conn->upd_pending) {
+    return BLE_HS_EALREADY;
+  }
+  if (params->itvl_min > params->itvl_max || params->itvl_min < 6) {
+    return BLE_HS_EINVAL;
+  }
+  conn->upd_pending = true;
+  conn->upd = *params;
+  return 0;
+}
+
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask,
+                                uint8_t rx_phys_mask, uint16_t phy_opts) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+  conn->phy_pending = true;
+  return 0;
+}
+
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets,
+                         uint16_t tx_time) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+  conn->dle_pending = true;
+  return 0;
+}
+
+int ble_gattc_exchange_mtu(uint16_t conn_handle, ble_gatt_mtu_fn *cb,
+                           void *cb_arg) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+  conn->mtu_pending = true;
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Advertising
+
+static struct {
+  bool active;
+  bool directed;
+  ble_addr_t peer;
+  uint64_t deadline_us; // 0 for no timeout
+  ble_gap_event_fn *cb;
+  void *cb_arg;
+} adv;
+
+static ble_addr_t bonds[MYNEWT_VAL(BLE_STORE_MAX_BONDS)];
+static int bond_count;
+
+static size_t adv_fields_len(const struct ble_hs_adv_fields *f) {
+  size_t len = 0;
+  len += f->flags != 0 ? 3 : 0;
+  len += f->name != NULL ? 2 + f->name_len : 0;
+  len += f->tx_pwr_lvl_is_present ? 3 : 0;
+  len += f->appearance_is_present ? 4 : 0;
+  len += f->le_role_is_present ? 3 : 0;
+  len += f->uri != NULL ? 2 + f->uri_len : 0;
+  len += f->adv_itvl_is_present ? 4 : 0;
+  return len;
+}
+
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *adv_fields) {
+  return adv_fields_len(adv_fields) <= BLE_HS_ADV_MAX_SZ ? 0 : BLE_HS_EMSGSIZE;
+}
+
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields) {
+  return adv_fields_len(rsp_fields) <= BLE_HS_ADV_MAX_SZ ? 0 : BLE_HS_EMSGSIZE;
+}
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr,
+                      int32_t duration_ms,
+                      const struct ble_gap_adv_params *adv_params,
+                      ble_gap_event_fn *cb, void *cb_arg) {
+  if (adv.active) {
+    return BLE_HS_EALREADY;
+  }
+  if (adv_params->conn_mode == BLE_GAP_CONN_MODE_DIR && direct_addr == NULL) {
+    return BLE_HS_EINVAL;
+  }
+  adv.active = true;
+  adv.directed = adv_params->conn_mode == BLE_GAP_CONN_MODE_DIR;
+  if (adv.directed) {
+    adv.peer = *direct_addr;
+  }
+  adv.deadline_us =
+      duration_ms == BLE_HS_FOREVER ? 0 : now_us + duration_ms * 1000ull;
+  adv.cb = cb;
+  adv.cb_arg = cb_arg;
+  return 0;
+}
+
+int ble_gap_adv_stop(void) {
+  if (!adv.active) {
+    return BLE_HS_EALREADY;
+  }
+  adv.active = false;
+  return 0;
+}
+
+int ble_gap_adv_active(void) { return adv.active; }
+
+bool fake_nimble_adv_active(void) { return adv.active; }
+
+bool fake_nimble_adv_directed(void) { return adv.active && adv.directed; }
+
+void fake_nimble_add_bond(const ble_addr_t *peer) {
+  for (int i = 0; i < bond_count; i++) {
+    if (ble_addr_cmp(&bonds[i], peer) == 0) {
+      return;
+    }
+  }
+  if (bond_count == MYNEWT_VAL(BLE_STORE_MAX_BONDS)) {
+    // The oldest bond makes room
+    memmove(bonds, bonds + 1, (bond_count - 1) * sizeof(bonds[0]));
+    bond_count--;
+  }
+  bonds[bond_count++] = *peer;
+}
+
+int ble_store_util_bonded_peers(ble_addr_t *out_peer_id_addrs,
+                                int *out_num_peers, int max_peers) {
+  int n = bond_count < max_peers ? bond_count : max_peers;
+  memcpy(out_peer_id_addrs, bonds, n * sizeof(bonds[0]));
+  *out_num_peers = n;
+  return 0;
+}
+
+uint16_t fake_link_connect(const ble_addr_t *peer,
+                           const fake_peer_cfg_t *cfg) {
+  if (!adv.active ||
+      (adv.directed && ble_addr_cmp(&adv.peer, peer) != 0)) {
+    return BLE_HS_CONN_HANDLE_NONE;
+  }
+
+  fake_conn_t *conn = NULL;
+  for (size_t i = 0; i < FAKE_MAX_CONNS && conn == NULL; i++) {
+    if (!conns[i].used) {
+      conn = &conns[i];
+    }
+  }
+  if (conn == NULL) {
+    return BLE_HS_CONN_HANDLE_NONE;
+  }
+
+  uint16_t conn_handle = next_conn_handle++;
+  bool bonded = false;
+  for (int i = 0; i < bond_count; i++) {
+    bonded |= ble_addr_cmp(&bonds[i], peer) == 0;
+  }
+  *conn = (fake_conn_t){
+      .used = true,
+      .desc = {.conn_handle = conn_handle,
+               .peer_id_addr = *peer,
+               .peer_ota_addr = *peer,
+               .conn_itvl = cfg->conn_itvl,
+               .conn_latency = 0,
+               .supervision_timeout = 400,
+               // A bonded host turns encryption on with its stored keys
+               .sec_state = {.encrypted = bonded, .bonded = bonded}},
+      .peer = *cfg,
+      .cb = adv.cb,
+      .cb_arg = adv.cb_arg,
+      .mtu = BLE_ATT_MTU_DFLT,
+      .next_event_us = now_us + cfg->conn_itvl * 1250u,
+  };
+  // The controller stops advertising on connect
+  adv.active = false;
+
+  struct ble_gap_event event = {
+      .type = BLE_GAP_EVENT_CONNECT,
+      .connect = {.status = 0, .conn_handle = conn_handle},
+  };
+  gap_event(conn, &event);
+  fake_nimble_run();
+  return conn_find(conn_handle) != NULL ? conn_handle
+                                        : BLE_HS_CONN_HANDLE_NONE;
+}
+
+void fake_link_disconnect(uint16_t conn_handle, uint8_t hci_reason) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn != NULL) {
+    conn_broken(conn, BLE_HS_HCI_ERR(hci_reason));
+    fake_nimble_run();
+  }
+}
+
+void fake_link_encrypt(uint16_t conn_handle, bool authenticated,
+                       bool bonded) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  if (conn == NULL) {
+    return;
+  }
+  conn->desc.sec_state.encrypted = 1;
+  conn->desc.sec_state.authenticated = authenticated;
+  conn->desc.sec_state.bonded = bonded;
+  conn->desc.sec_state.key_size = 16;
+  if (bonded) {
+    fake_nimble_add_bond(&conn->desc.peer_id_addr);
+  }
+  struct ble_gap_event event = {
+      .type = BLE_GAP_EVENT_ENC_CHANGE,
+      .enc_change = {.status = 0, .conn_handle = conn_handle},
+  };
+  gap_event(conn, &event);
+  fake_nimble_run();
+}
+
+// ---------------------------------------------------------------------------
+// ATT server
+
+// Checks the security the attribute asks for, like ble_att_svr_check_perms()
+static int att_perms(const fake_conn_t *conn, const fake_attr_t *attr,
+                     bool write) {
+  const struct ble_gap_sec_state *sec = &conn->desc.sec_state;
+  bool allowed;
+  bool enc;
+  bool authen;
+
+  if (attr->kind == FAKE_ATTR_DSC) {
+    uint8_t f = attr->dsc->att_flags;
+    allowed = f & (write ? BLE_ATT_F_WRITE : BLE_ATT_F_READ);
+    enc = f & (write ? BLE_ATT_F_WRITE_ENC : BLE_ATT_F_READ_ENC);
+    authen = f & (write ? BLE_ATT_F_WRITE_AUTHEN : BLE_ATT_F_READ_AUTHEN);
+  } else {
+    ble_gatt_chr_flags f = attr->chr->flags;
+    allowed = write ? f & (BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP)
+                    : f & BLE_GATT_CHR_F_READ;
+    enc = f & (write ? BLE_GATT_CHR_F_WRITE_ENC : BLE_GATT_CHR_F_READ_ENC);
+    authen =
+        f & (write ? BLE_GATT_CHR_F_WRITE_AUTHEN : BLE_GATT_CHR_F_READ_AUTHEN);
+  }
+
+  if (!allowed) {
+    return write ? BLE_ATT_ERR_WRITE_NOT_PERMITTED
+                 : BLE_ATT_ERR_READ_NOT_PERMITTED;
+  }
+  if ((enc || authen) && !sec->encrypted) {
+    return authen ? BLE_ATT_ERR_INSUFFICIENT_AUTHEN
+                  : BLE_ATT_ERR_INSUFFICIENT_ENC;
+  }
+  if (authen && !sec->authenticated) {
+    return BLE_ATT_ERR_INSUFFICIENT_AUTHEN;
+  }
+  return 0;
+}
+
+// Turns what an access callback returned into an ATT error
+static int att_rc(int rc) {
+  if (rc >= BLE_HS_ERR_ATT_BASE && rc < BLE_HS_ERR_HCI_BASE) {
+    return rc - BLE_HS_ERR_ATT_BASE;
+  }
+  return rc;
+}
+
+int fake_link_read(uint16_t conn_handle, uint16_t attr_handle, uint16_t offset,
+                   uint8_t *buf, uint16_t max, uint16_t *len) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  const fake_attr_t *attr = fake_gatts_attr(attr_handle);
+  int rc;
+
+  *len = 0;
+  if (conn == NULL || attr == NULL) {
+    return BLE_ATT_ERR_INVALID_HANDLE;
+  }
+
+  switch (attr->kind) {
+  case FAKE_ATTR_SVC:
+  case FAKE_ATTR_CHR:
+    // Discovery is done through fake_gatts_attr()
+    return BLE_ATT_ERR_READ_NOT_PERMITTED;
+  case FAKE_ATTR_CCCD:
+    if (offset != 0) {
+      return BLE_ATT_ERR_ATTR_NOT_LONG;
+    }
+    if (max < 2) {
+      return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    put_le16(buf, conn->cccd[attr_handle]);
+    *len = 2;
+    return 0;
+  default:
+    break;
+  }
+
+  rc = att_perms(conn, attr, false);
+  if (rc != 0) {
+    return rc;
+  }
+
+  struct os_mbuf *om = os_msys_get_pkthdr(0, 0);
+  if (om == NULL) {
+    return BLE_ATT_ERR_INSUFFICIENT_RES;
+  }
+  struct ble_gatt_access_ctxt ctxt = {.om = om};
+  ble_gatt_access_fn *cb;
+  void *arg;
+  if (attr->kind == FAKE_ATTR_DSC) {
+    ctxt.op = BLE_GATT_ACCESS_OP_READ_DSC;
+    ctxt.dsc = attr->dsc;
+    cb = attr->dsc->access_cb;
+    arg = attr->dsc->arg;
+  } else {
+    ctxt.op = BLE_GATT_ACCESS_OP_READ_CHR;
+    ctxt.chr = attr->chr;
+    cb = attr->chr->access_cb;
+    arg = attr->chr->arg;
+  }
+  rc = att_rc(cb(conn_handle, attr_handle, &ctxt, arg));
+  if (rc == 0) {
+    // The whole value every time, the response is the part from offset on
+    uint16_t value_len = OS_MBUF_PKTLEN(ctxt.om);
+    uint16_t n = value_len - offset;
+    if (n > conn->mtu - 1) {
+      n = conn->mtu - 1;
+    }
+    if (value_len > BLE_ATT_ATTR_MAX_LEN) {
+      rc = BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    } else if (offset > value_len) {
+      rc = BLE_ATT_ERR_INVALID_OFFSET;
+    } else if (n > max || os_mbuf_copydata(ctxt.om, offset, n, buf) != 0) {
+      rc = BLE_ATT_ERR_INSUFFICIENT_RES;
+    } else {
+      *len = n;
+    }
+  }
+  os_mbuf_free_chain(ctxt.om);
+  return rc;
+}
+
+static int cccd_write(fake_conn_t *conn, uint16_t attr_handle,
+                      const uint8_t *data, uint16_t len) {
+  const fake_attr_t *attr = fake_gatts_attr(attr_handle);
+  if (len != 2) {
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  }
+  uint16_t value = get_le16(data);
+  if (((value & FAKE_CCCD_NOTIFY) &&
+       !(attr->chr->flags & BLE_GATT_CHR_F_NOTIFY)) ||
+      ((value & FAKE_CCCD_INDICATE) &&
+       !(attr->chr->flags & BLE_GATT_CHR_F_INDICATE))) {
+    return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+  }
+
+  uint8_t prev = conn->cccd[attr_handle];
+  conn->cccd[attr_handle] = value & (FAKE_CCCD_NOTIFY | FAKE_CCCD_INDICATE);
+  if (prev == conn->cccd[attr_handle]) {
+    return 0;
+  }
+  struct ble_gap_event event = {
+      .type = BLE_GAP_EVENT_SUBSCRIBE,
+      .subscribe = {.conn_handle = conn->desc.conn_handle,
+                    // The value handle is right before its CCCD
+                    .attr_handle = attr_handle - 1,
+                    .reason = BLE_GAP_SUBSCRIBE_REASON_WRITE,
+                    .prev_notify = !!(prev & FAKE_CCCD_NOTIFY),
+                    .cur_notify = !!(value & FAKE_CCCD_NOTIFY),
+                    .prev_indicate = !!(prev & FAKE_CCCD_INDICATE),
+                    .cur_indicate = !!(value & FAKE_CCCD_INDICATE)},
+  };
+  gap_event(conn, &event);
+  return 0;
+}
+
+int fake_link_write(uint16_t conn_handle, uint16_t attr_handle,
+                    const void *data, uint16_t len) {
+  fake_conn_t *conn = conn_find(conn_handle);
+  const fake_attr_t *attr = fake_gatts_attr(attr_handle);
+  int rc;
+
+  if (conn == NULL || attr == NULL) {
+    return BLE_ATT_ERR_INVALID_HANDLE;
+  }
+  if (attr->kind == FAKE_ATTR_CCCD) {
+    rc = cccd_write(conn, attr_handle, data, len);
+    fake_nimble_run();
+    return rc;
+  }
+  if (attr->kind == FAKE_ATTR_SVC || attr->kind == FAKE_ATTR_CHR) {
+    return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+  }
+  if (len > conn->mtu - 3) {
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  }
+
+  rc = att_perms(conn, attr, true);
+  if (rc != 0) {
+    return rc;
+  }
+
+  struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+  if (om == NULL) {
+    return BLE_ATT_ERR_INSUFFICIENT_RES;
+  }
+  struct ble_gatt_access_ctxt ctxt = {.om = om};
+  if (attr->kind == FAKE_ATTR_DSC) {
+    ctxt.op = BLE_GATT_ACCESS_OP_WRITE_DSC;
+    ctxt.dsc = attr->dsc;
+    rc = attr->dsc->access_cb(conn_handle, attr_handle, &ctxt,
+                              attr->dsc->arg);
+  } else {
+    ctxt.op = BLE_GATT_ACCESS_OP_WRITE_CHR;
+    ctxt.chr = attr->chr;
+    rc = attr->chr->access_cb(conn_handle, attr_handle, &ctxt,
+                              attr->chr->arg);
+  }
+  os_mbuf_free_chain(ctxt.om);
+  fake_nimble_run();
+  return att_rc(rc);
+}
+
+// ---------------------------------------------------------------------------
+// Stack services and identity
+
+static char gap_name[32];
+static uint16_t gap_appearance;
+
+static int gap_svc_access(uint16_t conn_handle, uint16_t attr_handle,
+                          struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  uint16_t uuid = ble_uuid_u16(ctxt->chr->uuid);
+  if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+  if (uuid == BLE_SVC_GAP_CHR_UUID16_DEVICE_NAME) {
+    return os_mbuf_append(ctxt->om, gap_name, strlen(gap_name));
+  }
+  uint8_t appearance[2];
+  put_le16(appearance, gap_appearance);
+  return os_mbuf_append(ctxt->om, appearance, sizeof(appearance));
+}
+
+static const struct ble_gatt_svc_def gap_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(BLE_SVC_GAP_UUID16),
+        .characteristics =
+            (struct ble_gatt_chr_def[]){
+                {.uuid = BLE_UUID16_DECLARE(
+                     BLE_SVC_GAP_CHR_UUID16_DEVICE_NAME),
+                 .access_cb = gap_svc_access,
+                 .flags = BLE_GATT_CHR_F_READ},
+                {.uuid = BLE_UUID16_DECLARE(
+                     BLE_SVC_GAP_CHR_UUID16_APPEARANCE),
+                 .access_cb = gap_svc_access,
+                 .flags = BLE_GATT_CHR_F_READ},
+                {0}},
+    },
+    {0}};
+
+static int gatt_svc_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  return BLE_ATT_ERR_UNLIKELY;
+}
+
+static const struct ble_gatt_svc_def gatt_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = BLE_UUID16_DECLARE(BLE_SVC_GATT_UUID16),
+        .characteristics =
+            (struct ble_gatt_chr_def[]){
+                // Service Changed
+                {.uuid = BLE_UUID16_DECLARE(0x2a05),
+                 .access_cb = gatt_svc_access,
+                 .flags = BLE_GATT_CHR_F_INDICATE},
+                {0}},
+    },
+    {0}};
+
+void ble_svc_gap_init(void) {
+  static bool added;
+  if (!added) {
+    added = true;
+    ble_gatts_add_svcs(gap_svcs);
+  }
+}
+
+void ble_svc_gatt_init(void) {
+  static bool added;
+  if (!added) {
+    added = true;
+    ble_gatts_add_svcs(gatt_svcs);
+  }
+}
+
+const char *ble_svc_gap_device_name(void) { return gap_name; }
+
+int ble_svc_gap_device_name_set(const char *name) {
+  if (strlen(name) >= sizeof(gap_name)) {
+    return BLE_HS_EINVAL;
+  }
+  strcpy(gap_name, name);
+  return 0;
+}
+
+int ble_svc_gap_device_appearance_set(uint16_t appearance) {
+  gap_appearance = appearance;
+  return 0;
+}
+
+int ble_hs_util_ensure_addr(int prefer_random) { return 0; }
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type) {
+  *out_addr_type = BLE_OWN_ADDR_PUBLIC;
+  return 0;
+}
+
+int ble_hs_id_copy_addr(uint8_t id_addr_type, uint8_t *out_id_addr,
+                        int *out_is_nrpa) {
+  static const uint8_t addr[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+  memcpy(out_id_addr, addr, sizeof(addr));
+  if (out_is_nrpa != NULL) {
+    *out_is_nrpa = 0;
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+// UUIDs
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2) {
+  if (uuid1->type != uuid2->type) {
+    return uuid1->type - uuid2->type;
+  }
+  if (uuid1->type == BLE_UUID_TYPE_16) {
+    return BLE_UUID16(uuid1)->value - BLE_UUID16(uuid2)->value;
+  }
+  return memcmp(BLE_UUID128(uuid1)->value, BLE_UUID128(uuid2)->value, 16);
+}
+
+void ble_uuid_copy(ble_uuid_any_t *dst, const ble_uuid_t *src) {
+  if (src->type == BLE_UUID_TYPE_16) {
+    dst->u16 = *BLE_UUID16(src);
+  } else {
+    dst->u128 = *BLE_UUID128(src);
+  }
+}
+
+char *ble_uuid_to_str(const ble_uuid_t *uuid, char *dst) {
+  if (uuid->type == BLE_UUID_TYPE_16) {
+    snprintf(dst, BLE_UUID_STR_LEN, "0x%04x", BLE_UUID16(uuid)->value);
+    return dst;
+  }
+  const uint8_t *u = BLE_UUID128(uuid)->value;
+  snprintf(dst, BLE_UUID_STR_LEN,
+           "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+           "%02x%02x%02x%02x%02x%02x",
+           u[15], u[14], u[13], u[12], u[11], u[10], u[9], u[8], u[7], u[6],
+           u[5], u[4], u[3], u[2], u[1], u[0]);
+  return dst;
+}
+
+uint16_t ble_uuid_u16(const ble_uuid_t *uuid) {
+  return uuid->type == BLE_UUID_TYPE_16 ? BLE_UUID16(uuid)->value : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Running
+
+int fake_nimble_start(void) {
+  if (started) {
+    return BLE_HS_EALREADY;
+  }
+  started = true;
+  msys_init();
+  for (size_t i = 0; i < svc_count; i++) {
+    for (const struct ble_gatt_svc_def *svc = svc_defs[i];
+         svc->type != BLE_GATT_SVC_TYPE_END; svc++) {
+      register_svc(svc);
+    }
+  }
+  if (ble_hs_cfg.sync_cb != NULL) {
+    ble_hs_cfg.sync_cb();
+  }
+  fake_nimble_run();
+  return 0;
+}
+
+static void fire_callouts(void) {
+  for (struct ble_npl_callout *co = callouts; co != NULL; co = co->next) {
+    if (co->active && co->expiry_us <= now_us) {
+      co->active = false;
+      ble_npl_eventq_put(co->evq, &co->ev);
+    }
+  }
+}
+
+void fake_nimble_run(void) {
+  for (;;) {
+    fire_callouts();
+    struct ble_npl_event *ev = eventq_get(&dflt_eventq);
+    if (ev == NULL) {
+      break;
+    }
+    ev->fn(ev);
+  }
+}
+
+void fake_nimble_advance(uint64_t us) {
+  uint64_t target = now_us + us;
+
+  for (;;) {
+    uint64_t next = target;
+    for (struct ble_npl_callout *co = callouts; co != NULL; co = co->next) {
+      if (co->active && co->expiry_us < next) {
+        next = co->expiry_us;
+      }
+    }
+    for (size_t i = 0; i < FAKE_MAX_CONNS; i++) {
+      if (conns[i].used && conns[i].next_event_us < next) {
+        next = conns[i].next_event_us;
+      }
+    }
+    if (adv.active && adv.deadline_us != 0 && adv.deadline_us < next) {
+      next = adv.deadline_us;
+    }
+    if (next > now_us) {
+      now_us = next;
+    }
+
+    for (size_t i = 0; i < FAKE_MAX_CONNS; i++) {
+      if (conns[i].used && conns[i].next_event_us <= now_us) {
+        conn_event(&conns[i]);
+      }
+    }
+    if (adv.active && adv.deadline_us != 0 && adv.deadline_us <= now_us) {
+      adv.active = false;
+      struct ble_gap_event event = {
+          .type = BLE_GAP_EVENT_ADV_COMPLETE,
+          .adv_complete = {.reason = BLE_HS_ETIMEOUT},
+      };
+      if (adv.cb != NULL) {
+        adv.cb(&event, adv.cb_arg);
+      }
+    }
+    fake_nimble_run();
+
+    if (now_us >= target) {
+      break;
+    }
+  }
+}
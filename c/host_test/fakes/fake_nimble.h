@@ -0,0 +1,112 @@
+#ifndef FAKE_NIMBLE_H
+#define FAKE_NIMBLE_H
+
+#include "host/ble_hs.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Stand-in for the NimBLE host and the controller below it, enough to run
+// gap.c, hogp_gatt_svr.c and the services on a PC. Nothing here allocates:
+// pools, attributes and links are static, like on target.
+//
+// There are no threads. The default event queue runs when a test calls
+// fake_nimble_run() or fake_nimble_advance(), the clock only moves in the
+// latter. Every link has connection events at its interval. A notification
+// holds its mbufs (the caller's plus an msys one for the ATT header, as
+// ble_att_clt_tx_notify() does) until the connection event that sends it,
+// at most FAKE_PKTS_PER_EVENT per event. Link layer procedures the keyboard
+// starts (parameter update, PHY, data length, MTU) complete at the next
+// connection event.
+
+// msys pool, the ESP-IDF NimBLE defaults
+#define FAKE_MSYS_COUNT 24
+#define FAKE_MSYS_BLOCK_SIZE 128
+// ACL packets a link sends per connection event
+#define FAKE_PKTS_PER_EVENT 4
+// Notifications waiting for the air per link
+#define FAKE_TXQ_LEN 64
+#define FAKE_ATTR_MAX 160
+#define FAKE_MAX_SVCS 8
+
+typedef enum {
+  FAKE_ATTR_SVC,
+  FAKE_ATTR_CHR, // Characteristic declaration
+  FAKE_ATTR_VAL, // Characteristic value
+  FAKE_ATTR_CCCD,
+  FAKE_ATTR_DSC,
+} fake_attr_kind_t;
+
+typedef struct {
+  uint16_t handle;
+  uint8_t kind; // fake_attr_kind_t
+  const ble_uuid_t *uuid;
+  const struct ble_gatt_svc_def *svc;
+  const struct ble_gatt_chr_def *chr;
+  const struct ble_gatt_dsc_def *dsc;
+} fake_attr_t;
+
+// What the central at the other end of a link does
+typedef struct {
+  uint16_t mtu;          // Its side of the MTU exchange
+  uint16_t conn_itvl;    // Interval it connects with, 1.25 ms units
+  uint16_t min_itvl;     // Parameter updates below this are rejected
+  bool no_2m;            // PHY update fails
+  bool no_dle;           // Data length stays at 27
+  bool reject_updates;   // Every parameter update is rejected
+} fake_peer_cfg_t;
+
+#define FAKE_PEER_CFG_DEFAULT                                                  \
+  {.mtu = 247, .conn_itvl = 24, .min_itvl = 6}
+
+// Called for every notification at the connection event that sends it
+typedef void fake_rx_fn(uint16_t conn_handle, uint16_t attr_handle,
+                        const uint8_t *data, uint16_t len, uint64_t now_us);
+
+// Registers the services added so far (ble_gatts_start) and calls
+// ble_hs_cfg.sync_cb. Once only
+int fake_nimble_start(void);
+
+// Runs the default event queue (and callouts due now) until it is empty
+void fake_nimble_run(void);
+// Moves the clock forward, with every connection event, callout and
+// advertising timeout on the way, running the queue after each
+void fake_nimble_advance(uint64_t us);
+uint64_t fake_nimble_now_us(void);
+
+// Attributes by handle, NULL past the last one
+const fake_attr_t *fake_gatts_attr(uint16_t handle);
+
+// Link side, for fake_central.c. A central can only connect while the
+// keyboard advertises, and only the peer it is directed to while that is
+// directed. Returns the connection handle or BLE_HS_CONN_HANDLE_NONE
+uint16_t fake_link_connect(const ble_addr_t *peer,
+                           const fake_peer_cfg_t *cfg);
+void fake_link_disconnect(uint16_t conn_handle, uint8_t hci_reason);
+// Encryption came up, bonded stores the peer as a bond
+void fake_link_encrypt(uint16_t conn_handle, bool authenticated, bool bonded);
+// ATT read and write of one attribute. 0 or an ATT error. A read is one
+// Read (offset 0) or Read Blob request: the access callback runs and the
+// response is its value from offset on, at most ATT_MTU - 1 bytes, as
+// NimBLE serves it
+int fake_link_read(uint16_t conn_handle, uint16_t attr_handle, uint16_t offset,
+                   uint8_t *buf, uint16_t max, uint16_t *len);
+int fake_link_write(uint16_t conn_handle, uint16_t attr_handle,
+                    const void *data, uint16_t len);
+void fake_link_set_rx(fake_rx_fn *rx);
+bool fake_link_connected(uint16_t conn_handle);
+// Notifications handed to the stack and not sent yet
+uint16_t fake_link_pending(uint16_t conn_handle);
+// ATT MTU of the link, the default one if it is not connected
+uint16_t fake_link_mtu(uint16_t conn_handle);
+
+// Bonds ble_store_util_bonded_peers() returns, oldest first
+void fake_nimble_add_bond(const ble_addr_t *peer);
+bool fake_nimble_adv_active(void);
+bool fake_nimble_adv_directed(void);
+
+uint16_t fake_msys_free(void);
+uint16_t fake_msys_min_free(void);
+// Notifications that found msys empty
+uint32_t fake_msys_enomem(void);
+
+#endif
@@ -0,0 +1,75 @@
+#include "fake_power_mgr.h"
+#include "config.h"
+#include "fake_nimble.h"
+#include "nimble/nimble_port.h"
+
+static void power_set_sleep(bool allowed, void *arg);
+
+static const power_policy_cfg_t power_cfg = {
+    .awake_ua = POWER_AWAKE_UA,
+    .sleep_ua = POWER_SLEEP_UA,
+    .radio_event_nc = POWER_RADIO_EVENT_NC,
+    .link_hold_ms = POWER_LINK_HOLD_MS,
+};
+
+static const power_policy_ops_t power_ops = {
+    .set_sleep = power_set_sleep,
+};
+
+static power_policy_t power;
+static bool power_ready;
+static bool sleep_allowed;
+static struct ble_npl_callout power_timer;
+
+static inline uint32_t now_ms(void) {
+  return (uint32_t)(fake_nimble_now_us() / 1000);
+}
+
+static void power_set_sleep(bool allowed, void *arg) { sleep_allowed = allowed; }
+
+static void power_run(void) {
+  uint32_t next = power_policy_tick(&power, now_ms());
+
+  ble_npl_callout_stop(&power_timer);
+  if (next != UINT32_MAX) {
+    ble_npl_callout_reset(&power_timer, ble_npl_time_ms_to_ticks32(next));
+  }
+}
+
+static void power_timer_cb(struct ble_npl_event *ev) { power_run(); }
+
+int power_mgr_init(void) {
+  ble_npl_callout_init(&power_timer, nimble_port_get_dflt_eventq(),
+                       power_timer_cb, NULL);
+  power_policy_init(&power, &power_cfg, &power_ops, now_ms());
+  power_ready = true;
+  return 0;
+}
+
+void power_mgr_hold(power_hold_t hold, bool held) {
+  if (!power_ready) {
+    return;
+  }
+  power_policy_hold(&power, hold, held, now_ms());
+  if (hold == POWER_HOLD_LINK) {
+    power_run();
+  }
+}
+
+void power_mgr_radio(uint32_t radio_mhz) {
+  if (power_ready) {
+    power_policy_radio(&power, radio_mhz, now_ms());
+  }
+}
+
+void power_mgr_get_stats(power_stats_t *stats) {
+  if (!power_ready) {
+    *stats = (power_stats_t){0};
+    return;
+  }
+  power_policy_stats(&power, now_ms(), stats);
+}
+
+bool fake_power_sleep_allowed(void) { return sleep_allowed; }
+
+uint32_t fake_power_holds(void) { return power.holds; }
@@ -0,0 +1,15 @@
+#ifndef FAKE_POWER_MGR_H
+#define FAKE_POWER_MGR_H
+
+#include "power_mgr.h"
+
+// power_mgr.h on the host: the real power_policy.c with the config.h
+// currents, on the fake_nimble.h clock. Its timeouts run from a callout on
+// the default event queue, where power_mgr.c uses an esp_timer.
+
+// Whether the policy currently allows light sleep
+bool fake_power_sleep_allowed(void);
+// power_hold_t bits held right now
+uint32_t fake_power_holds(void);
+
+#endif
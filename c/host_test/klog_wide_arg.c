@@ -0,0 +1,8 @@
+// Must not compile: KLOG arguments wider than 32 bits are rejected. Built
+// by the klog_wide_arg test, which passes when the build fails
+#include "klog.h"
+
+void klog_wide_arg(void) {
+  int64_t wide = 1;
+  KLOG_I(GAP, "wide=%d", wide);
+}
@@ -0,0 +1,65 @@
+// Plays macro stores through main/macro.c for test_macro_compile.py. For
+// every store given it prints the macro_store_check() result and, for a
+// store that passed, every step of every macro:
+//
+//   store 0 2         result (macro_err_t) and macro count
+//   macro 0
+//   down 04           key change, usage in hex
+//   up 04
+//   delay 50          ms
+//
+// Usage: macro_play <store.bin>...
+#include "macro.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STORE_MAX (64 * 1024)
+
+static uint8_t store[STORE_MAX];
+
+static int play_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  size_t size = fread(store, 1, sizeof(store), f);
+  fclose(f);
+
+  uint8_t count;
+  macro_err_t err = macro_store_check(store, size, &count);
+  printf("store %d %u\n", err, count);
+  if (err != MACRO_OK) {
+    return 0;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    macro_player_t p;
+    macro_step_t step;
+    if (macro_player_start(&p, store, i) != MACRO_OK) {
+      return -1;
+    }
+    printf("macro %u\n", i);
+    while (macro_player_next(&p, &step)) {
+      if (step.type == MACRO_STEP_DELAY) {
+        printf("delay %u\n", step.delay_ms);
+      } else {
+        printf("%s %02x\n", step.pressed ? "down" : "up", step.usage);
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: macro_play <store.bin>...\n");
+    return 2;
+  }
+  for (int i = 1; i < argc; i++) {
+    if (play_file(argv[i]) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
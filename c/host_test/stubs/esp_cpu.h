@@ -0,0 +1,9 @@
+#ifndef ESP_CPU_H
+#define ESP_CPU_H
+
+#include <stdint.h>
+
+// Host stand-in, counts nanoseconds of the host's monotonic clock
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif
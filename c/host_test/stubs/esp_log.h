@@ -0,0 +1,38 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+// Host stand-in for the ESP-IDF logging macros. Lines are formatted like on
+// target and written to stderr up to the level fake_esp.h sets, so a log
+// call costs what it costs on target minus the UART
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+                   ...) __attribute__((format(printf, 3, 4)));
+uint32_t esp_log_timestamp(void);
+
+#define ESP_LOG_LINE(letter, level, tag, format, ...)                          \
+  esp_log_write(level, tag, #letter " (%lu) %s: " format "\n",                 \
+                (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...)                                             \
+  ESP_LOG_LINE(E, ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                             \
+  ESP_LOG_LINE(W, ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                             \
+  ESP_LOG_LINE(I, ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                             \
+  ESP_LOG_LINE(D, ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                                             \
+  ESP_LOG_LINE(V, ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+// Host stand-in. The clock is the fake one of fake_nimble.h, it only moves
+// when a test advances it
+int64_t esp_timer_get_time(void);
+
+#endif
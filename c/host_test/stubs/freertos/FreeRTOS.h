@@ -0,0 +1,46 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include "esp_err.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Host stand-in for the FreeRTOS types and critical sections the sources use.
+// Tasks are threads (fake_esp.c), a critical section is a spinlock
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configRUN_TIME_COUNTER_TYPE uint32_t
+#define tskNO_AFFINITY 0x7fffffff
+
+typedef struct {
+  atomic_flag locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {ATOMIC_FLAG_INIT}
+
+static inline void fake_mux_enter(portMUX_TYPE *mux) {
+  while (atomic_flag_test_and_set_explicit(&mux->locked,
+                                           memory_order_acquire)) {
+  }
+}
+
+static inline void fake_mux_exit(portMUX_TYPE *mux) {
+  atomic_flag_clear_explicit(&mux->locked, memory_order_release);
+}
+
+#define portENTER_CRITICAL(mux) fake_mux_enter(mux)
+#define portEXIT_CRITICAL(mux) fake_mux_exit(mux)
+#define portENTER_CRITICAL_SAFE(mux) fake_mux_enter(mux)
+#define portEXIT_CRITICAL_SAFE(mux) fake_mux_exit(mux)
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in: a task is a thread, its notification a counting semaphore.
+// Core and priority are recorded but mean nothing
+typedef struct fake_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted } eTaskState;
+
+typedef struct {
+  TaskHandle_t xHandle;
+  const char *pcTaskName;
+  UBaseType_t xTaskNumber;
+  eTaskState eCurrentState;
+  UBaseType_t uxCurrentPriority;
+  UBaseType_t uxBasePriority;
+  configRUN_TIME_COUNTER_TYPE ulRunTimeCounter;
+  uint32_t usStackHighWaterMark;
+  BaseType_t xCoreID;
+} TaskStatus_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *param,
+                                   UBaseType_t prio, TaskHandle_t *handle,
+                                   BaseType_t core);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait);
+void vTaskDelay(TickType_t ticks);
+// No tasks are listed on the host
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t max,
+                                 configRUN_TIME_COUNTER_TYPE *total);
+
+#endif
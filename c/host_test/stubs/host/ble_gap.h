@@ -0,0 +1,166 @@
+#ifndef H_BLE_GAP_
+#define H_BLE_GAP_
+
+#include "host/ble_hs_adv.h"
+#include "nimble/ble.h"
+#include "os/os_mbuf.h"
+#include <stdint.h>
+
+// Host stand-in for the peripheral side of NimBLE GAP. fake_nimble.c plays
+// the controller, fake_central.h the other end of every link
+#define BLE_GAP_EVENT_CONNECT 0
+#define BLE_GAP_EVENT_DISCONNECT 1
+#define BLE_GAP_EVENT_CONN_UPDATE 3
+#define BLE_GAP_EVENT_CONN_UPDATE_REQ 4
+#define BLE_GAP_EVENT_ADV_COMPLETE 9
+#define BLE_GAP_EVENT_ENC_CHANGE 10
+#define BLE_GAP_EVENT_NOTIFY_TX 13
+#define BLE_GAP_EVENT_SUBSCRIBE 14
+#define BLE_GAP_EVENT_MTU 15
+#define BLE_GAP_EVENT_PHY_UPDATE_COMPLETE 18
+#define BLE_GAP_EVENT_DATA_LEN_CHG 34
+
+#define BLE_GAP_SUBSCRIBE_REASON_WRITE 1
+#define BLE_GAP_SUBSCRIBE_REASON_TERM 2
+
+#define BLE_GAP_CONN_MODE_NON 0
+#define BLE_GAP_CONN_MODE_DIR 1
+#define BLE_GAP_CONN_MODE_UND 2
+
+#define BLE_GAP_DISC_MODE_NON 0
+#define BLE_GAP_DISC_MODE_LTD 1
+#define BLE_GAP_DISC_MODE_GEN 2
+
+#define BLE_GAP_LE_PHY_1M 1
+#define BLE_GAP_LE_PHY_2M 2
+#define BLE_GAP_LE_PHY_CODED 3
+#define BLE_GAP_LE_PHY_1M_MASK 0x01
+#define BLE_GAP_LE_PHY_2M_MASK 0x02
+#define BLE_GAP_LE_PHY_CODED_MASK 0x04
+#define BLE_GAP_LE_PHY_CODED_ANY 0
+
+#define BLE_HCI_ADV_ITVL 625 // us
+#define BLE_GAP_ADV_ITVL_MS(t) ((t) * 1000 / BLE_HCI_ADV_ITVL)
+
+#define BLE_HS_FOREVER INT32_MAX
+
+struct ble_gap_sec_state {
+  unsigned encrypted : 1;
+  unsigned authenticated : 1;
+  unsigned bonded : 1;
+  unsigned key_size : 5;
+};
+
+struct ble_gap_conn_desc {
+  struct ble_gap_sec_state sec_state;
+  ble_addr_t our_id_addr;
+  ble_addr_t peer_id_addr;
+  ble_addr_t our_ota_addr;
+  ble_addr_t peer_ota_addr;
+  uint16_t conn_handle;
+  uint16_t conn_itvl;
+  uint16_t conn_latency;
+  uint16_t supervision_timeout;
+  uint8_t role;
+  uint8_t master_clock_accuracy;
+};
+
+struct ble_gap_upd_params {
+  uint16_t itvl_min;
+  uint16_t itvl_max;
+  uint16_t latency;
+  uint16_t supervision_timeout;
+  uint16_t min_ce_len;
+  uint16_t max_ce_len;
+};
+
+struct ble_gap_adv_params {
+  uint8_t conn_mode;
+  uint8_t disc_mode;
+  uint16_t itvl_min;
+  uint16_t itvl_max;
+  uint8_t channel_map;
+  uint8_t filter_policy;
+  uint8_t high_duty_cycle : 1;
+};
+
+struct ble_gap_event {
+  uint8_t type;
+  union {
+    struct {
+      int status;
+      uint16_t conn_handle;
+    } connect;
+    struct {
+      int reason;
+      struct ble_gap_conn_desc conn;
+    } disconnect;
+    struct {
+      int status;
+      uint16_t conn_handle;
+    } conn_update;
+    struct {
+      int reason;
+    } adv_complete;
+    struct {
+      int status;
+      uint16_t conn_handle;
+    } enc_change;
+    struct {
+      int status;
+      uint16_t conn_handle;
+      uint16_t attr_handle;
+      uint8_t indication : 1;
+    } notify_tx;
+    struct {
+      uint16_t conn_handle;
+      uint16_t attr_handle;
+      uint8_t reason;
+      uint8_t prev_notify : 1;
+      uint8_t cur_notify : 1;
+      uint8_t prev_indicate : 1;
+      uint8_t cur_indicate : 1;
+    } subscribe;
+    struct {
+      uint16_t conn_handle;
+      uint16_t channel_id;
+      uint16_t value;
+    } mtu;
+    struct {
+      int status;
+      uint16_t conn_handle;
+      uint8_t tx_phy;
+      uint8_t rx_phy;
+    } phy_updated;
+    struct {
+      uint16_t conn_handle;
+      uint16_t max_tx_octets;
+      uint16_t max_tx_time;
+      uint16_t max_rx_octets;
+      uint16_t max_rx_time;
+    } data_len_chg;
+  };
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr,
+                      int32_t duration_ms,
+                      const struct ble_gap_adv_params *adv_params,
+                      ble_gap_event_fn *cb, void *cb_arg);
+int ble_gap_adv_stop(void);
+int ble_gap_adv_active(void);
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *adv_fields);
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields);
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
+int ble_gap_conn_find_by_addr(const ble_addr_t *addr,
+                              struct ble_gap_conn_desc *out_desc);
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason);
+int ble_gap_update_params(uint16_t conn_handle,
+                          const struct ble_gap_upd_params *params);
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask,
+                                uint8_t rx_phys_mask, uint16_t phy_opts);
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets,
+                         uint16_t tx_time);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef H_BLE_HS_
+#define H_BLE_HS_
+
+// Host stand-in for the parts of the NimBLE host the keyboard uses. Error
+// codes and flags have their NimBLE values
+#include "host/ble_att.h"
+#include "host/ble_gap.h"
+#include "host/ble_gatt.h"
+#include "host/ble_hs_adv.h"
+#include "host/ble_hs_id.h"
+#include "host/ble_store.h"
+#include "host/ble_uuid.h"
+#include "nimble/ble.h"
+#include "nimble/nimble_npl.h"
+#include "os/os_mbuf.h"
+#include "syscfg/syscfg.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+
+#define BLE_HS_EAGAIN 1
+#define BLE_HS_EALREADY 2
+#define BLE_HS_EINVAL 3
+#define BLE_HS_EMSGSIZE 4
+#define BLE_HS_ENOENT 5
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_ENOTSUP 8
+#define BLE_HS_EAPP 9
+#define BLE_HS_EBADDATA 10
+#define BLE_HS_EOS 11
+#define BLE_HS_ECONTROLLER 12
+#define BLE_HS_ETIMEOUT 13
+#define BLE_HS_EDONE 14
+#define BLE_HS_EBUSY 15
+#define BLE_HS_EREJECT 16
+#define BLE_HS_EUNKNOWN 17
+#define BLE_HS_EENCRYPT 25
+#define BLE_HS_ESTALLED 31
+
+#define BLE_HS_ERR_ATT_BASE 0x100
+#define BLE_HS_ERR_HCI_BASE 0x200
+#define BLE_HS_ATT_ERR(x) ((x) ? BLE_HS_ERR_ATT_BASE + (x) : 0)
+#define BLE_HS_HCI_ERR(x) ((x) ? BLE_HS_ERR_HCI_BASE + (x) : 0)
+
+typedef void ble_hs_reset_fn(int reason);
+typedef void ble_hs_sync_fn(void);
+
+struct ble_hs_cfg {
+  ble_hs_reset_fn *reset_cb;
+  ble_hs_sync_fn *sync_cb;
+  ble_gatt_register_fn *gatts_register_cb;
+  void *gatts_register_arg;
+  uint8_t sm_io_cap;
+  unsigned sm_oob_data_flag : 1;
+  unsigned sm_bonding : 1;
+  unsigned sm_mitm : 1;
+  unsigned sm_sc : 1;
+  unsigned sm_keypress : 1;
+  uint8_t sm_our_key_dist;
+  uint8_t sm_their_key_dist;
+};
+
+extern struct ble_hs_cfg ble_hs_cfg;
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len,
+                        uint16_t *out_copy_len);
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef H_BLE_HS_ADV_
+#define H_BLE_HS_ADV_
+
+#include <stdint.h>
+
+// Host stand-in for the advertising data fields the keyboard sets
+#define BLE_HS_ADV_F_DISC_LTD 0x01
+#define BLE_HS_ADV_F_DISC_GEN 0x02
+#define BLE_HS_ADV_F_BREDR_UNSUP 0x04
+#define BLE_HS_ADV_TX_PWR_LVL_AUTO (-128)
+#define BLE_HS_ADV_MAX_SZ 31
+
+struct ble_hs_adv_fields {
+  uint8_t flags;
+  const uint8_t *name;
+  uint8_t name_len;
+  unsigned name_is_complete : 1;
+  int8_t tx_pwr_lvl;
+  unsigned tx_pwr_lvl_is_present : 1;
+  uint16_t appearance;
+  unsigned appearance_is_present : 1;
+  uint8_t le_role;
+  unsigned le_role_is_present : 1;
+  const uint8_t *uri;
+  uint8_t uri_len;
+  uint16_t adv_itvl;
+  unsigned adv_itvl_is_present : 1;
+};
+
+#endif
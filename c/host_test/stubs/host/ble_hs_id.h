@@ -0,0 +1,13 @@
+#ifndef H_BLE_HS_ID_
+#define H_BLE_HS_ID_
+
+#include <stdint.h>
+
+#define BLE_OWN_ADDR_PUBLIC 0x00
+#define BLE_OWN_ADDR_RANDOM 0x01
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type);
+int ble_hs_id_copy_addr(uint8_t id_addr_type, uint8_t *out_id_addr,
+                        int *out_is_nrpa);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef H_BLE_STORE_
+#define H_BLE_STORE_
+
+#include "nimble/ble.h"
+
+// Bonds are whatever fake_nimble_add_bond() put there, oldest first
+int ble_store_util_bonded_peers(ble_addr_t *out_peer_id_addrs, int *out_num_peers,
+                                int max_peers);
+
+#endif
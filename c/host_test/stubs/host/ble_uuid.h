@@ -0,0 +1,50 @@
+#ifndef H_BLE_UUID_
+#define H_BLE_UUID_
+
+#include <stdint.h>
+
+// Host stand-in for NimBLE UUIDs, 16 and 128-bit only
+#define BLE_UUID_TYPE_16 16
+#define BLE_UUID_TYPE_32 32
+#define BLE_UUID_TYPE_128 128
+
+typedef struct {
+  uint8_t type;
+} ble_uuid_t;
+
+typedef struct {
+  ble_uuid_t u;
+  uint16_t value;
+} ble_uuid16_t;
+
+typedef struct {
+  ble_uuid_t u;
+  uint8_t value[16];
+} ble_uuid128_t;
+
+typedef union {
+  ble_uuid_t u;
+  ble_uuid16_t u16;
+  ble_uuid128_t u128;
+} ble_uuid_any_t;
+
+#define BLE_UUID16_INIT(uuid16)                                                \
+  {.u = {.type = BLE_UUID_TYPE_16}, .value = (uuid16)}
+#define BLE_UUID128_INIT(uuid128...)                                           \
+  {.u = {.type = BLE_UUID_TYPE_128}, .value = {uuid128}}
+#define BLE_UUID16_DECLARE(uuid16)                                             \
+  ((const ble_uuid_t *)(&(ble_uuid16_t)BLE_UUID16_INIT(uuid16)))
+#define BLE_UUID128_DECLARE(uuid128...)                                        \
+  ((const ble_uuid_t *)(&(ble_uuid128_t)BLE_UUID128_INIT(uuid128)))
+
+#define BLE_UUID16(u) ((const ble_uuid16_t *)(u))
+#define BLE_UUID128(u) ((const ble_uuid128_t *)(u))
+
+#define BLE_UUID_STR_LEN 37
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2);
+void ble_uuid_copy(ble_uuid_any_t *dst, const ble_uuid_t *src);
+char *ble_uuid_to_str(const ble_uuid_t *uuid, char *dst);
+uint16_t ble_uuid_u16(const ble_uuid_t *uuid);
+
+#endif
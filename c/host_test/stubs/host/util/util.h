@@ -0,0 +1,6 @@
+#ifndef H_HOST_UTIL_
+#define H_HOST_UTIL_
+
+int ble_hs_util_ensure_addr(int prefer_random);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef NIMBLE_BLE_H
+#define NIMBLE_BLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Host stand-in: addresses and the HCI error codes the sources use
+#define BLE_ADDR_PUBLIC 0x00
+#define BLE_ADDR_RANDOM 0x01
+
+typedef struct {
+  uint8_t type;
+  uint8_t val[6];
+} ble_addr_t;
+
+static inline int ble_addr_cmp(const ble_addr_t *a, const ble_addr_t *b) {
+  int type_diff = a->type - b->type;
+  if (type_diff != 0) {
+    return type_diff;
+  }
+  return memcmp(a->val, b->val, sizeof(a->val));
+}
+
+#define BLE_ERR_SUCCESS 0x00
+#define BLE_ERR_CONN_LIMIT 0x09
+#define BLE_ERR_REM_USER_CONN_TERM 0x13
+#define BLE_ERR_CONN_TERM_LOCAL 0x16
+#define BLE_ERR_UNSUPP_REM_FEATURE 0x1a
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef NIMBLE_NPL_H
+#define NIMBLE_NPL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Host stand-in for the NimBLE porting layer: one event queue that a test
+// runs by hand and callouts on the fake clock. One tick is one ms
+typedef uint32_t ble_npl_time_t;
+typedef int32_t ble_npl_stime_t;
+
+typedef enum {
+  BLE_NPL_OK = 0,
+  BLE_NPL_ENOMEM = 1,
+  BLE_NPL_EINVAL = 2,
+} ble_npl_error_t;
+
+struct ble_npl_event;
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+
+struct ble_npl_event {
+  bool queued;
+  ble_npl_event_fn *fn;
+  void *arg;
+  struct ble_npl_event *next;
+};
+
+struct ble_npl_eventq {
+  struct ble_npl_event *head;
+  struct ble_npl_event *tail;
+};
+
+struct ble_npl_callout {
+  struct ble_npl_event ev;
+  struct ble_npl_eventq *evq;
+  bool active;
+  uint64_t expiry_us;
+  struct ble_npl_callout *next; // Every callout ever initialised
+};
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn,
+                        void *arg);
+void *ble_npl_event_get_arg(struct ble_npl_event *ev);
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+
+void ble_npl_callout_init(struct ble_npl_callout *co,
+                          struct ble_npl_eventq *evq, ble_npl_event_fn *fn,
+                          void *arg);
+ble_npl_error_t ble_npl_callout_reset(struct ble_npl_callout *co,
+                                      ble_npl_time_t ticks);
+void ble_npl_callout_stop(struct ble_npl_callout *co);
+bool ble_npl_callout_is_active(struct ble_npl_callout *co);
+
+ble_npl_time_t ble_npl_time_get(void);
+
+static inline uint32_t ble_npl_time_ms_to_ticks32(uint32_t ms) { return ms; }
+static inline uint32_t ble_npl_time_ticks_to_ms32(ble_npl_time_t ticks) {
+  return ticks;
+}
+
+#endif
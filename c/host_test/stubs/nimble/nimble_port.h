@@ -0,0 +1,8 @@
+#ifndef NIMBLE_PORT_H
+#define NIMBLE_PORT_H
+
+#include "nimble/nimble_npl.h"
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef OS_ENDIAN_H
+#define OS_ENDIAN_H
+
+#include <stdint.h>
+
+// Host stand-in for NimBLE's byte order helpers
+static inline void put_le16(void *buf, uint16_t x) {
+  uint8_t *u8ptr = buf;
+  u8ptr[0] = (uint8_t)x;
+  u8ptr[1] = (uint8_t)(x >> 8);
+}
+
+static inline void put_le32(void *buf, uint32_t x) {
+  uint8_t *u8ptr = buf;
+  u8ptr[0] = (uint8_t)x;
+  u8ptr[1] = (uint8_t)(x >> 8);
+  u8ptr[2] = (uint8_t)(x >> 16);
+  u8ptr[3] = (uint8_t)(x >> 24);
+}
+
+static inline uint16_t get_le16(const void *buf) {
+  const uint8_t *u8ptr = buf;
+  return (uint16_t)(u8ptr[0] | (u8ptr[1] << 8));
+}
+
+static inline uint32_t get_le32(const void *buf) {
+  const uint8_t *u8ptr = buf;
+  return (uint32_t)u8ptr[0] | ((uint32_t)u8ptr[1] << 8) |
+         ((uint32_t)u8ptr[2] << 16) | ((uint32_t)u8ptr[3] << 24);
+}
+
+#endif
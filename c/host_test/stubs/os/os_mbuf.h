@@ -0,0 +1,58 @@
+#ifndef OS_MBUF_H
+#define OS_MBUF_H
+
+#include "os/os_mempool.h"
+#include <stdint.h>
+
+// Host stand-in for NimBLE mbufs: chains of fixed blocks taken from an
+// os_mempool, the first one with a packet header. Same layout rules as the
+// real ones, so leading space and chaining behave the same
+struct os_mbuf_pool {
+  uint16_t omp_databuf_len;
+  struct os_mempool *omp_pool;
+};
+
+struct os_mbuf_pkthdr {
+  uint16_t omp_len;
+  uint16_t omp_flags;
+  struct os_mbuf_pkthdr *omp_next;
+};
+
+struct os_mbuf {
+  uint8_t *om_data;
+  uint8_t om_flags;
+  uint8_t om_pkthdr_len;
+  uint16_t om_len;
+  struct os_mbuf_pool *om_omp;
+  struct os_mbuf *om_next;
+  uint8_t om_databuf[];
+};
+
+#define OS_MBUF_PKTHDR(om)                                                     \
+  ((struct os_mbuf_pkthdr *)(void *)((uint8_t *)&(om)->om_data +               \
+                                     sizeof(struct os_mbuf)))
+#define OS_MBUF_IS_PKTHDR(om)                                                  \
+  ((om)->om_pkthdr_len >= sizeof(struct os_mbuf_pkthdr))
+#define OS_MBUF_PKTLEN(om) (OS_MBUF_PKTHDR(om)->omp_len)
+#define OS_MBUF_DATA(om, type) ((type)(om)->om_data)
+#define OS_MBUF_LEADINGSPACE(om) os_mbuf_leadingspace(om)
+#define OS_MBUF_TRAILINGSPACE(om) os_mbuf_trailingspace(om)
+
+int os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp,
+                      uint16_t buf_len, uint16_t nbufs);
+struct os_mbuf *os_mbuf_get(struct os_mbuf_pool *omp, uint16_t leadingspace);
+struct os_mbuf *os_mbuf_get_pkthdr(struct os_mbuf_pool *omp,
+                                   uint8_t user_pkthdr_len);
+int os_mbuf_free(struct os_mbuf *om);
+int os_mbuf_free_chain(struct os_mbuf *om);
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
+void os_mbuf_concat(struct os_mbuf *first, struct os_mbuf *second);
+uint16_t os_mbuf_leadingspace(struct os_mbuf *om);
+uint16_t os_mbuf_trailingspace(struct os_mbuf *om);
+
+// The shared msys pool, see fake_nimble.h for its size
+struct os_mbuf *os_msys_get(uint16_t dsize, uint16_t leadingspace);
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef OS_MEMPOOL_H
+#define OS_MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Host stand-in for the NimBLE fixed block pool. Blocks are 8-byte aligned,
+// a host mbuf header holds pointers
+#define OS_ALIGNMENT 8
+#define OS_ALIGN(n, a)                                                         \
+  ((((n) & ((a) - 1)) == 0) ? (n) : ((n) + ((a) - ((n) & ((a) - 1)))))
+
+typedef uint64_t os_membuf_t;
+
+#define OS_MEMPOOL_SIZE(n, blksize)                                            \
+  ((((blksize) + (sizeof(os_membuf_t) - 1)) / sizeof(os_membuf_t)) * (n))
+#define OS_MEMPOOL_BYTES(n, blksize)                                           \
+  (sizeof(os_membuf_t) * OS_MEMPOOL_SIZE((n), (blksize)))
+
+#define OS_OK 0
+#define OS_ENOMEM 1
+#define OS_EINVAL 2
+#define OS_INVALID_PARM 3
+
+struct os_memblock {
+  struct os_memblock *mb_next;
+};
+
+struct os_mempool {
+  uint32_t mp_block_size;
+  uint16_t mp_num_blocks;
+  uint16_t mp_num_free;
+  uint16_t mp_min_free;
+  uintptr_t mp_membuf_addr;
+  struct os_memblock *mp_head;
+  const char *name;
+};
+
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks,
+                    uint32_t block_size, void *membuf, const char *name);
+void *os_memblock_get(struct os_mempool *mp);
+int os_memblock_put(struct os_mempool *mp, void *block);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Host stand-in for the generated sdkconfig.h. Only options the sources test
+// with #if are listed, everything else is unset
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_FREERTOS_HZ 1000
+
+#endif
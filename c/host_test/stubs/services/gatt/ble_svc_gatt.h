@@ -0,0 +1,8 @@
+#ifndef H_BLE_SVC_GATT_
+#define H_BLE_SVC_GATT_
+
+#define BLE_SVC_GATT_UUID16 0x1801
+
+void ble_svc_gatt_init(void);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef SYSCFG_H
+#define SYSCFG_H
+
+// Host stand-in for the NimBLE syscfg values the keyboard reads, set like
+// sdkconfig.defaults
+#define MYNEWT_VAL(name) MYNEWT_VAL_##name
+#define MYNEWT_VAL_BLE_MAX_CONNECTIONS 3
+#define MYNEWT_VAL_BLE_STORE_MAX_BONDS 3
+#define MYNEWT_VAL_BLE_L2CAP_COC_MAX_NUM 1
+
+#endif
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Tests of tools/bulk_xfer.py against main/bulk.c and main/macro.c.
+
+Every command of the tool runs against its --stand-in, which is the
+firmware's bulk protocol and store check built for the host as bulk_sim:
+uploads read back the same, a damaged store is refused at commit, dumps
+and the bench move every byte.
+
+Usage: test_bulk_xfer.py <libbulk_sim.so> [unittest options]
+"""
+
+import contextlib
+import io
+import os
+import struct
+import sys
+import tempfile
+import unittest
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOOLS = os.path.join(HERE, "..", "tools")
+sys.path.insert(0, TOOLS)
+
+import bulk_xfer  # noqa: E402
+import macro_compile as mc  # noqa: E402
+
+LIB = None
+
+SOURCE = r'''
+macro login
+  text "admin\t"
+  delay 50
+  text "Hunter2!\n"
+end
+
+macro copy
+  press lctrl
+  tap c
+end
+'''
+
+
+def with_crc(store):
+    store = bytearray(store)
+    length = struct.unpack_from("<I", store, 8)[0]
+    struct.pack_into("<I", store, 12, zlib.crc32(store[16:length]))
+    return bytes(store)
+
+
+class StandIn(unittest.TestCase):
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.store = mc.build_store(mc.parse(SOURCE, "source"))
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def path(self, name, data=None):
+        path = os.path.join(self.tmp.name, name)
+        if data is not None:
+            with open(path, "wb") as f:
+                f.write(data)
+        return path
+
+    def tool(self, *args):
+        """Runs bulk_xfer.py on a fresh stand-in, returns (rc, stdout)."""
+        out = io.StringIO()
+        with contextlib.redirect_stdout(out), \
+                contextlib.redirect_stderr(out):
+            rc = bulk_xfer.main(["bulk_xfer.py", "--stand-in", "--lib", LIB] +
+                                list(args))
+        return rc, out.getvalue()
+
+    def test_verify(self):
+        rc, out = self.tool("verify", self.path("store.bin", self.store))
+        self.assertEqual(rc, 0, out)
+        self.assertIn("read back, same", out)
+
+    def test_large_store(self):
+        # More than one SDU and one flash sector
+        source = "".join(f'macro m{i}\n  text "{"x" * 200}"\nend\n'
+                         for i in range(40))
+        store = mc.build_store(mc.parse(source, "source"))
+        self.assertGreater(len(store), 4096)
+        rc, out = self.tool("verify", self.path("store.bin", store))
+        self.assertEqual(rc, 0, out)
+
+    def test_damaged_store(self):
+        cases = {
+            "crc": self.store[:12] + bytes([self.store[12] ^ 1]) +
+                   self.store[13:],
+            "unknown op": with_crc(self.store[:-1] + b"\x07"),
+            "version": with_crc(self.store[:4] + b"\x02" + self.store[5:]),
+        }
+        for name, store in cases.items():
+            with self.subTest(name):
+                rc, out = self.tool("verify", self.path("bad.bin", store))
+                self.assertEqual(rc, 1, out)
+                self.assertIn("commit refused: rejected by target", out)
+
+    def test_too_large(self):
+        store = self.store + bytes(bulk_xfer.PARTITION_SIZE)
+        rc, out = self.tool("upload", self.path("big.bin", store))
+        self.assertEqual(rc, 1, out)
+        self.assertIn("begin refused: out of range", out)
+
+    def test_dump_empty(self):
+        rc, out = self.tool("dump", "macros", self.path("macros.bin"))
+        self.assertEqual(rc, 0, out)
+        self.assertEqual(os.path.getsize(self.path("macros.bin")), 0)
+        rc, out = self.tool("dump", "trace", self.path("trace.bin"))
+        self.assertEqual(rc, 0, out)
+        with open(self.path("trace.bin"), "rb") as f:
+            self.assertEqual(f.read(), bytes(4))
+
+    def test_bench(self):
+        rc, out = self.tool("bench", str(300 * 1024 + 5))
+        self.assertEqual(rc, 0, out)
+        self.assertIn("upload    307205 bytes", out)
+        self.assertIn("dump      307205 bytes", out)
+        self.assertIn("not the radio's", out)
+
+    def test_usage(self):
+        for args in (["--stand-in", "bench"], ["--lib", LIB, "bench"]):
+            with self.subTest(args=args):
+                err = io.StringIO()
+                with contextlib.redirect_stderr(err):
+                    rc = bulk_xfer.main(["bulk_xfer.py"] + args)
+                self.assertEqual(rc, 2)
+                self.assertTrue(err.getvalue().startswith("Usage:"))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        sys.exit(2)
+    LIB = sys.argv.pop(1)
+    unittest.main()
@@ -0,0 +1,362 @@
+// conn_params against a fake GAP: a central that takes a while to answer,
+// may refuse short intervals and may have another procedure running. Time
+// is stepped a millisecond at a time and tick() run when it asks to be
+#include "check.h"
+#include "conn_params.h"
+#include "config.h"
+
+#define CONN 3
+// The fake central answers an update this long after it was started
+#define ANSWER_MS 40
+
+static const conn_params_cfg_t cfg = {
+    .active = {.itvl_min = CONN_ACTIVE_ITVL_MIN,
+               .itvl_max = CONN_ACTIVE_ITVL_MAX,
+               .latency = 0,
+               .supervision_timeout = CONN_SUPERVISION_TIMEOUT},
+    .idle = {.itvl_min = CONN_IDLE_ITVL_MIN,
+             .itvl_max = CONN_IDLE_ITVL_MAX,
+             .latency = CONN_IDLE_LATENCY,
+             .supervision_timeout = CONN_SUPERVISION_TIMEOUT},
+    .idle_after_ms = CONN_IDLE_AFTER_MS,
+    .retry_min_ms = CONN_RETRY_MIN_MS,
+    .retry_max_ms = CONN_RETRY_MAX_MS,
+    .active_itvl_cap = CONN_ACTIVE_ITVL_CAP,
+};
+
+// The fake GAP and the central behind it
+typedef struct {
+  uint16_t min_itvl; // Requests with a narrower itvl_max are refused
+  bool busy;         // Another procedure is running, requests fail
+  bool refuse_all;
+  int requests;      // Started update procedures
+  int busy_refusals; // Requests that failed to start
+  conn_params_req_t last;
+  uint32_t answer_at; // 0 if no procedure is running
+  uint16_t itvl;      // What the link runs with
+  uint16_t latency;
+} fake_gap_t;
+static fake_gap_t gap;
+
+static uint32_t now;
+static uint32_t tick_at;
+
+static int fake_request(uint16_t conn_handle, const conn_params_req_t *req,
+                        void *arg) {
+  CHECK_EQ(conn_handle, CONN);
+  // conn_params never starts a second procedure while one is running
+  CHECK_EQ(gap.answer_at, 0);
+  if (gap.busy) {
+    gap.busy_refusals++;
+    return 1;
+  }
+  gap.requests++;
+  gap.last = *req;
+  gap.answer_at = now + ANSWER_MS;
+  return 0;
+}
+
+static const conn_params_ops_t ops = {.request = fake_request};
+static conn_params_t cp;
+
+static void run_tick(void) {
+  uint32_t next = conn_params_tick(&cp, now);
+  tick_at = next == UINT32_MAX ? 0 : now + next;
+}
+
+static void reset(uint32_t start) {
+  gap = (fake_gap_t){.itvl = 24};
+  now = start;
+  tick_at = 0;
+  conn_params_init(&cp, &cfg, &ops);
+}
+
+static void connect(void) {
+  conn_params_connected(&cp, CONN, now);
+  run_tick();
+}
+
+// Steps time by ms, answering updates and running tick() when it is due,
+// the way gap.c does from its callout and GAP event handler
+static void advance(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    now++;
+    if (gap.answer_at != 0 && now == gap.answer_at) {
+      gap.answer_at = 0;
+      int status = 0;
+      if (gap.refuse_all || gap.last.itvl_max < gap.min_itvl) {
+        status = 0x3b; // Unacceptable connection parameters
+      } else {
+        gap.itvl = gap.last.itvl_max;
+        gap.latency = gap.last.latency;
+      }
+      conn_params_update_done(&cp, status, gap.itvl, gap.latency, now);
+      run_tick();
+    }
+    if (tick_at != 0 && now == tick_at) {
+      run_tick();
+    }
+  }
+}
+
+static void test_active_then_idle(void) {
+  reset(1000);
+  connect();
+  CHECK_EQ(gap.requests, 1);
+  CHECK_EQ(cp.requested, CONN_PARAMS_ACTIVE);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(gap.itvl, CONN_ACTIVE_ITVL_MAX);
+  CHECK_EQ(gap.latency, 0);
+  // Next wake is the idle switch
+  CHECK_EQ(tick_at, 1000 + CONN_IDLE_AFTER_MS);
+
+  // Typing keeps it active
+  advance(CONN_IDLE_AFTER_MS - 100);
+  conn_params_activity(&cp, now);
+  run_tick();
+  advance(CONN_IDLE_AFTER_MS - 1);
+  CHECK_EQ(cp.target, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(gap.requests, 1);
+
+  // Then goes idle once, with peripheral latency
+  advance(1 + ANSWER_MS);
+  CHECK_EQ(gap.requests, 2);
+  CHECK_EQ(cp.applied, CONN_PARAMS_IDLE);
+  CHECK_EQ(gap.itvl, CONN_IDLE_ITVL_MAX);
+  CHECK_EQ(gap.latency, CONN_IDLE_LATENCY);
+  CHECK_EQ(tick_at, 0);
+  advance(60000);
+  CHECK_EQ(gap.requests, 2);
+
+  // A key brings the short interval straight back
+  conn_params_activity(&cp, now);
+  CHECK_EQ(gap.requests, 3);
+  CHECK_EQ(gap.last.itvl_max, CONN_ACTIVE_ITVL_MAX);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(cp.rejections, 0);
+}
+
+// A key pressed while the idle update is in flight is not lost: the active
+// request follows as soon as the central answers
+static void test_activity_while_pending(void) {
+  reset(1000);
+  connect();
+  advance(CONN_IDLE_AFTER_MS);
+  CHECK_EQ(cp.requested, CONN_PARAMS_IDLE);
+  CHECK(cp.pending);
+
+  conn_params_activity(&cp, now);
+  CHECK_EQ(gap.requests, 2);
+  advance(ANSWER_MS);
+  CHECK_EQ(gap.requests, 3);
+  CHECK_EQ(cp.requested, CONN_PARAMS_ACTIVE);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(gap.itvl, CONN_ACTIVE_ITVL_MAX);
+}
+
+// Suspend from the host goes idle without waiting for the timeout, a key
+// press brings the active parameters back
+static void test_suspend(void) {
+  reset(1000);
+  connect();
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+
+  conn_params_suspend(&cp, now);
+  run_tick();
+  CHECK_EQ(gap.requests, 2);
+  CHECK_EQ(cp.requested, CONN_PARAMS_IDLE);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_IDLE);
+  CHECK_EQ(gap.latency, CONN_IDLE_LATENCY);
+  CHECK_EQ(tick_at, 0);
+
+  // Already idle, nothing to ask for
+  conn_params_suspend(&cp, now);
+  CHECK_EQ(gap.requests, 2);
+
+  conn_params_activity(&cp, now);
+  CHECK_EQ(gap.requests, 3);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+}
+
+// A central that will not go below 15 ms: the active range widens by half
+// per rejection, with the retry back-off doubling, until one is accepted
+static void test_rejection_widens(void) {
+  reset(1000);
+  gap.min_itvl = 12;
+  connect();
+
+  uint16_t itvl_max[4];
+  uint32_t asked_at[4];
+  int n = 0;
+  int seen = 0;
+  for (uint32_t ms = 0; ms < 4000 && n < 4; ms++) {
+    if (gap.requests != seen) {
+      seen = gap.requests;
+      itvl_max[n] = gap.last.itvl_max;
+      asked_at[n++] = now;
+    }
+    advance(1);
+  }
+  CHECK_EQ(n, 3);
+  CHECK_EQ(itvl_max[0], 6);
+  CHECK_EQ(itvl_max[1], 9);
+  CHECK_EQ(itvl_max[2], 13);
+  CHECK_EQ(asked_at[1] - asked_at[0], ANSWER_MS + CONN_RETRY_MIN_MS);
+  CHECK_EQ(asked_at[2] - asked_at[1], ANSWER_MS + 2 * CONN_RETRY_MIN_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(cp.rejections, 2);
+  CHECK_EQ(gap.itvl, 13);
+  // Accepted, the back-off starts over
+  CHECK_EQ(cp.backoff_ms, CONN_RETRY_MIN_MS);
+}
+
+// A central that refuses everything: while typing goes on the active range
+// stops at the cap and the back-off at retry_max, and the idle switch still
+// happens once it stops
+static void test_refuse_all(void) {
+  reset(1000);
+  gap.refuse_all = true;
+  connect();
+  for (int i = 0; i < 300; i++) {
+    conn_params_activity(&cp, now);
+    run_tick();
+    advance(1000);
+  }
+  CHECK_EQ(cp.active_itvl_max, CONN_ACTIVE_ITVL_CAP);
+  CHECK_EQ(cp.backoff_ms, CONN_RETRY_MAX_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_NONE);
+  // Retries are spaced by the back-off, not a busy loop
+  CHECK(gap.requests < 5 + 300000 / CONN_RETRY_MAX_MS);
+
+  advance(CONN_IDLE_AFTER_MS + CONN_RETRY_MAX_MS + ANSWER_MS);
+  CHECK_EQ(cp.target, CONN_PARAMS_IDLE);
+  CHECK_EQ(gap.last.itvl_max, CONN_IDLE_ITVL_MAX);
+  gap.refuse_all = false;
+  advance(CONN_RETRY_MAX_MS + ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_IDLE);
+}
+
+// The stack refusing to start a procedure is retried after the back-off
+static void test_busy(void) {
+  reset(1000);
+  gap.busy = true;
+  connect();
+  CHECK_EQ(gap.busy_refusals, 1);
+  CHECK_EQ(gap.requests, 0);
+  CHECK_EQ(tick_at, 1000 + CONN_RETRY_MIN_MS);
+
+  gap.busy = false;
+  advance(CONN_RETRY_MIN_MS - 1);
+  CHECK_EQ(gap.requests, 0);
+  advance(1);
+  CHECK_EQ(gap.requests, 1);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(cp.rejections, 0);
+}
+
+// An update the central started on its own: a failed one changes nothing,
+// a successful one is what the link runs with now. Moved off the active
+// parameters, they are asked for again after the back-off
+static void test_central_initiated(void) {
+  reset(1000);
+  connect();
+  advance(ANSWER_MS);
+  conn_params_update_done(&cp, 0x3b, 24, 0, now);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(cp.rejections, 0);
+  CHECK_EQ(cp.retry_at_ms, 0);
+  conn_params_update_done(&cp, 0, CONN_ACTIVE_ITVL_MAX, 0, now);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(cp.retry_at_ms, 0);
+  CHECK_EQ(gap.requests, 1);
+
+  gap.itvl = 24;
+  conn_params_update_done(&cp, 0, gap.itvl, gap.latency, now);
+  run_tick();
+  CHECK_EQ(cp.applied, CONN_PARAMS_NONE);
+  CHECK_EQ(cp.rejections, 0);
+  CHECK_EQ(gap.requests, 1);
+  advance(CONN_RETRY_MIN_MS);
+  CHECK_EQ(gap.requests, 2);
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  CHECK_EQ(gap.itvl, CONN_ACTIVE_ITVL_MAX);
+
+  // Idle parameters of its own while idle are fine as they are
+  advance(CONN_IDLE_AFTER_MS + ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_IDLE);
+  int requests = gap.requests;
+  conn_params_update_done(&cp, 0, CONN_IDLE_ITVL_MIN, 0, now);
+  run_tick();
+  CHECK_EQ(cp.applied, CONN_PARAMS_IDLE);
+  CHECK_EQ(cp.retry_at_ms, 0);
+  advance(60000);
+  CHECK_EQ(gap.requests, requests);
+}
+
+static void test_disconnect(void) {
+  reset(1000);
+  connect();
+  conn_params_disconnected(&cp);
+  gap.answer_at = 0;
+  CHECK_EQ(conn_params_tick(&cp, now), UINT32_MAX);
+  conn_params_activity(&cp, now);
+  CHECK_EQ(gap.requests, 1);
+
+  // A new connection starts from scratch
+  gap.min_itvl = 12;
+  connect();
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.rejections, 1);
+  conn_params_disconnected(&cp);
+  gap.answer_at = 0;
+  gap.min_itvl = 0;
+  connect();
+  CHECK_EQ(gap.last.itvl_max, CONN_ACTIVE_ITVL_MAX);
+  CHECK_EQ(cp.rejections, 0);
+  CHECK_EQ(cp.retry_at_ms, 0);
+}
+
+// The ms clock wraps after 49 days, timeouts across it still fire on time
+static void test_clock_wrap(void) {
+  reset(UINT32_MAX - CONN_IDLE_AFTER_MS / 2);
+  connect();
+  advance(ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_ACTIVE);
+  advance(CONN_IDLE_AFTER_MS - ANSWER_MS - 1);
+  CHECK_EQ(cp.target, CONN_PARAMS_ACTIVE);
+  advance(1 + ANSWER_MS);
+  CHECK_EQ(cp.applied, CONN_PARAMS_IDLE);
+
+  // A retry scheduled across the wrap, including one landing on 0
+  reset(UINT32_MAX - CONN_RETRY_MIN_MS + 1);
+  gap.busy = true;
+  connect();
+  CHECK_EQ(cp.retry_at_ms, 1); // 0 would mean none scheduled
+  gap.busy = false;
+  advance(CONN_RETRY_MIN_MS);
+  CHECK_EQ(now, 0);
+  CHECK_EQ(gap.requests, 0);
+  advance(1);
+  CHECK_EQ(gap.requests, 1);
+}
+
+int main(void) {
+  test_active_then_idle();
+  test_activity_while_pending();
+  test_suspend();
+  test_rejection_widens();
+  test_refuse_all();
+  test_busy();
+  test_central_initiated();
+  test_disconnect();
+  test_clock_wrap();
+  CHECK_DONE();
+}
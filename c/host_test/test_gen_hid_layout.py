@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""Tests of tools/gen_hid_layout.py.
+
+Both report maps of main/hid_vars.c are parsed, encoded back into a minimal
+descriptor and parsed again, and the generated header is read back and
+compared with the parse. Malformed descriptors have to fail.
+
+Usage: test_gen_hid_layout.py [unittest options]
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import unittest
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOOLS = os.path.join(HERE, "..", "tools")
+HID_VARS = os.path.join(HERE, "..", "main", "hid_vars.c")
+sys.path.insert(0, TOOLS)
+
+import gen_hid_layout as g  # noqa: E402
+
+DEFINE_RE = re.compile(r"#define (\w+) (.+)")
+
+
+def item(kind, tag, value, size=None):
+    """One short item, in the smallest size that holds value as signed."""
+    if size is None:
+        if value == 0:
+            size = 0
+        elif -0x80 <= value <= 0x7F:
+            size = 1
+        elif -0x8000 <= value <= 0x7FFF:
+            size = 2
+        else:
+            size = 4
+    code = {0: 0, 1: 1, 2: 2, 4: 3}[size]
+    return bytes([(tag << 4) | (kind << 2) | code]) + \
+        (value & ((1 << (8 * size)) - 1)).to_bytes(size, "little")
+
+
+def glob(tag, value):
+    return item(g.GLOBAL, tag, value)
+
+
+def local(tag, value):
+    return item(g.LOCAL, tag, value)
+
+
+def main_item(tag, value=0):
+    return item(g.MAIN, tag, value)
+
+
+COLLECTION = main_item(g.MAIN_COLLECTION, 1)
+END = main_item(g.MAIN_END_COLLECTION)
+TYPE_TAGS = {rtype: tag for tag, rtype in g.MAIN_REPORTS.items()}
+
+
+def encode(reports):
+    """A descriptor that describes reports the way the generator parsed them."""
+    out = bytearray(COLLECTION)
+    for (rid, rtype), report in reports.items():
+        for field in report["fields"]:
+            if rid:
+                out += glob(g.G_REPORT_ID, rid)
+            out += glob(g.G_USAGE_PAGE, field["page"])
+            out += glob(g.G_LOGICAL_MIN, field["lmin"])
+            out += glob(g.G_LOGICAL_MAX, field["lmax"])
+            out += glob(g.G_REPORT_SIZE, field["size"])
+            out += glob(g.G_REPORT_COUNT, field["count"])
+            out += local(g.L_USAGE_MIN, field["usage_min"])
+            out += local(g.L_USAGE_MAX, field["usage_max"])
+            out += main_item(TYPE_TAGS[rtype], field["flags"])
+    out += END
+    return bytes(out)
+
+
+def keyboard(*middle):
+    """A one report keyboard with extra items before its Input."""
+    return bytes(COLLECTION + glob(g.G_REPORT_ID, 1) +
+                 glob(g.G_USAGE_PAGE, 7) + glob(g.G_REPORT_SIZE, 8) +
+                 glob(g.G_REPORT_COUNT, 1) + b"".join(middle) +
+                 main_item(8, 0) + END)
+
+
+class RoundTrip(unittest.TestCase):
+    def setUp(self):
+        with open(HID_VARS) as f:
+            self.maps = g.extract_maps(f.read())
+
+    def test_both_maps_found(self):
+        names = [name for _, name, _ in self.maps]
+        self.assertEqual(names, ["BOOT", "COMPLEX"])
+
+    def test_encode_parse(self):
+        for array, _, desc in self.maps:
+            with self.subTest(array):
+                reports = g.parse(desc)
+                self.assertEqual(g.parse(encode(reports)), reports)
+
+    def test_known_layouts(self):
+        boot = g.parse(self.maps[0][2])
+        complex_ = g.parse(self.maps[1][2])
+        self.assertEqual(boot[(0, 1)]["bits"], 64)  # Boot keyboard input
+        self.assertEqual(boot[(0, 2)]["bits"], 8)   # LEDs
+        self.assertEqual(complex_[(4, 1)]["bits"] // 8, 16)
+        for report in list(boot.values()) + list(complex_.values()):
+            end = 0
+            for field in report["fields"]:
+                self.assertEqual(field["offset"], end)
+                end += field["size"] * field["count"]
+            self.assertEqual(end, report["bits"])
+
+    def test_header_matches_parse(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            out = os.path.join(tmp, "hid_layout.h")
+            subprocess.run([sys.executable, os.path.join(TOOLS,
+                                                          "gen_hid_layout.py"),
+                            HID_VARS, out], check=True)
+            with open(out) as f:
+                defines = dict(DEFINE_RE.findall(f.read()))
+
+        for _, name, desc in self.maps:
+            reports = g.parse(desc)
+            prefix = f"HID_{name}"
+            self.assertEqual(int(defines[f"{prefix}_REPORT_MAP_SIZE"]),
+                             len(desc))
+            self.assertEqual(int(defines[f"{prefix}_REPORT_COUNT"]),
+                             len(reports))
+            for (rid, rtype), report in reports.items():
+                rname = f"{prefix}_R{rid}_{g.TYPE_SUFFIX[rtype]}"
+                self.assertEqual(int(defines[f"{rname}_LEN"]),
+                                 report["bits"] // 8)
+                for i, field in enumerate(report["fields"]):
+                    fname = f"{rname}_F{i}"
+                    self.assertEqual(int(defines[f"{fname}_OFFSET"]),
+                                     field["offset"])
+                    self.assertEqual(int(defines[f"{fname}_SIZE"]),
+                                     field["size"])
+                    self.assertEqual(int(defines[f"{fname}_COUNT"]),
+                                     field["count"])
+                    self.assertEqual(int(defines[f"{fname}_USAGE_MIN"], 16),
+                                     field["usage_min"])
+                    self.assertEqual(int(defines[f"{fname}_USAGE_MAX"], 16),
+                                     field["usage_max"])
+                    self.assertEqual(
+                        int(defines[f"{fname}_LOGICAL_MIN"].strip("()")),
+                        field["lmin"])
+
+
+class Malformed(unittest.TestCase):
+    def assert_fails(self, desc, message):
+        with self.assertRaisesRegex(g.DescriptorError, message):
+            g.parse(desc)
+
+    def test_truncated(self):
+        desc = keyboard()
+        # Every cut that ends inside an item
+        for cut in range(1, len(desc)):
+            reports = None
+            try:
+                reports = g.parse(desc[:cut])
+            except g.DescriptorError:
+                continue
+            # Cuts between items may parse, but never into a report
+            self.assertFalse(reports, f"cut at {cut}")
+        self.assert_fails(desc[:-1] + bytes([0x26]), "truncated item")
+        self.assert_fails(bytes([0xFE, 0x04]), "truncated long item")
+
+    def test_unbalanced_collections(self):
+        self.assert_fails(keyboard() + END, "without Collection")
+        self.assert_fails(COLLECTION + keyboard(), "unterminated")
+
+    def test_push_pop(self):
+        pushed = keyboard(glob(g.G_PUSH, 0), glob(g.G_REPORT_SIZE, 16),
+                          glob(g.G_POP, 0))
+        self.assertEqual(g.parse(pushed)[(1, 1)]["fields"][0]["size"], 8)
+        self.assert_fails(keyboard(glob(g.G_POP, 0)), "Pop without Push")
+        self.assert_fails(keyboard(glob(g.G_PUSH, 0)), "Push without Pop")
+
+    def test_report_id_zero(self):
+        self.assert_fails(keyboard(glob(g.G_REPORT_ID, 0)),
+                          "invalid Report ID 0")
+        self.assert_fails(keyboard(item(g.GLOBAL, g.G_REPORT_ID, 0x100, 2)),
+                          "invalid Report ID")
+
+    def test_mixed_report_ids(self):
+        no_id = glob(g.G_REPORT_SIZE, 8) + glob(g.G_REPORT_COUNT, 1) + \
+            main_item(8, 0)
+        self.assert_fails(no_id + keyboard(), "without a Report ID")
+
+    def test_partial_byte(self):
+        self.assert_fails(keyboard(glob(g.G_REPORT_SIZE, 3)),
+                          "whole number of bytes")
+
+    def test_wide_field(self):
+        self.assert_fails(keyboard(glob(g.G_REPORT_SIZE, 64)), "64 bits")
+        # Constant padding may be any width
+        pad = keyboard(glob(g.G_REPORT_SIZE, 64))[:-2] + main_item(8, 1) + END
+        self.assertEqual(g.parse(pad)[(1, 1)]["bits"], 64)
+
+    def test_usage_range(self):
+        # The consumer report's: a Logical Maximum well past the usages
+        consumer = keyboard(local(g.L_USAGE_MIN, 0),
+                            local(g.L_USAGE_MAX, 0x2FF),
+                            glob(g.G_LOGICAL_MAX, 0x7FFF),
+                            glob(g.G_REPORT_SIZE, 16))
+        field = g.parse(consumer)[(1, 1)]["fields"][0]
+        self.assertEqual((field["usage_min"], field["usage_max"]), (0, 0x2FF))
+        # Single usages: the first and the last
+        usages = keyboard(local(g.L_USAGE, 0xE2), local(g.L_USAGE, 0xE9))
+        field = g.parse(usages)[(1, 1)]["fields"][0]
+        self.assertEqual((field["usage_min"], field["usage_max"]),
+                         (0xE2, 0xE9))
+        self.assert_fails(keyboard(local(g.L_USAGE_MIN, 5),
+                                   local(g.L_USAGE_MAX, 4)),
+                          "Usage Maximum below Usage Minimum")
+
+    def test_cli_fails(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            src = os.path.join(tmp, "hid_vars.c")
+            with open(src, "w") as f:
+                f.write("const uint8_t HID_BAD_REPORT_MAP[] = {0xC0};\n")
+            result = subprocess.run(
+                [sys.executable, os.path.join(TOOLS, "gen_hid_layout.py"),
+                 src, os.path.join(tmp, "out.h")],
+                capture_output=True, text=True)
+            self.assertEqual(result.returncode, 1)
+            self.assertIn("HID_BAD_REPORT_MAP", result.stderr)
+            self.assertFalse(os.path.exists(os.path.join(tmp, "out.h")))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,513 @@
+// The GATT server and GAP against the NimBLE stand-in, driven by a scripted
+// central: connect, discovery, report map, subscriptions and notifications
+#include "check.h"
+#include "config.h"
+#include "diag_svc.h"
+#include "fake_central.h"
+#include "fake_input.h"
+#include "fake_nimble.h"
+#include "fake_power_mgr.h"
+#include "gap.h"
+#include "hid_vars.h"
+#include "hogp_conn.h"
+#include "hogp_gatt_svr.h"
+#include "key_event_ring.h"
+#include "key_trace.h"
+#include "key_trace_svc.h"
+#include "klog.h"
+#include "os/endian.h"
+#include "report_builder.h"
+#include "report_pool.h"
+#include <string.h>
+
+#define HID_SVC 0x1812
+#define REPORT_MAP_CHR 0x2a4b
+#define HID_CTRL_POINT_CHR 0x2a4c
+#define PRTCL_MODE_CHR 0x2a4e
+#define BOOT_KBD_INP_CHR 0x2a22
+
+// The trace service's UUIDs, see key_trace_svc.c
+#define KEY_TRACE_UUID(id)                                                     \
+  BLE_UUID128_INIT(id, 0x00, 0x20, 0x69, 0x4c, 0x85, 0x1b, 0x8f, 0xf6, 0x4a,   \
+                   0x33, 0x54, 0xcf, 0x77, 0x7a, 0x37)
+
+// The diagnostics service's Stats characteristic, see diag_svc.c
+#define DIAG_UUID(id)                                                          \
+  BLE_UUID128_INIT(id, 0x00, 0x5c, 0x2b, 0x8e, 0x0f, 0xd6, 0xa1, 0x57, 0x4e,   \
+                   0xb8, 0x93, 0x41, 0x0c, 0x2f, 0x6d)
+#define DIAG_STATS_UUID DIAG_UUID(0x02)
+#define DIAG_TASKS_UUID DIAG_UUID(0x03)
+
+#define KEY_A 0x04
+#define KEY_B 0x05
+
+static void on_sync(void) { adv_init(); }
+
+// As main.c does
+static void register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
+  hogp_gatt_svr_register_cb(ctxt, arg);
+  diag_svc_register_cb(ctxt, arg);
+  key_trace_svc_register_cb(ctxt, arg);
+}
+
+static void setup(void) {
+  ble_hs_cfg.sync_cb = on_sync;
+  ble_hs_cfg.gatts_register_cb = register_cb;
+
+  CHECK_EQ(power_mgr_init(), 0);
+  CHECK_EQ(gap_init(), 0);
+  CHECK_EQ(hogp_gatt_svr_init(), 0);
+  CHECK_EQ(diag_svc_init(), 0);
+  CHECK_EQ(key_trace_svc_init(), 0);
+  CHECK_EQ(fake_nimble_start(), 0);
+}
+
+static bool nkro_has(const fake_notification_t *n, uint8_t usage) {
+  uint8_t bit = usage - KBD_NKRO_USAGE_MIN;
+  return n != NULL && n->len == KBD_NKRO_REPORT_LEN &&
+         (n->data[1 + bit / 8] & (1u << (bit % 8)));
+}
+
+static bool nkro_empty(const fake_notification_t *n) {
+  static const uint8_t zero[KBD_NKRO_REPORT_LEN];
+  return n != NULL && n->len == KBD_NKRO_REPORT_LEN &&
+         memcmp(n->data, zero, sizeof(zero)) == 0;
+}
+
+// Connects, checks the report map and subscribes to the NKRO input report.
+// Returns its value handle through nkro
+static uint16_t connect_host(uint8_t peer, uint16_t *nkro) {
+  uint16_t conn = fake_central_connect(peer);
+  CHECK(conn != BLE_HS_CONN_HANDLE_NONE);
+
+  uint16_t map = fake_central_find_chr16(HID_SVC, REPORT_MAP_CHR);
+  uint8_t buf[BLE_ATT_ATTR_MAX_LEN];
+  uint16_t len;
+  CHECK(map != 0);
+  CHECK_EQ(fake_central_read(conn, map, buf, sizeof(buf), &len), 0);
+  CHECK_EQ(len, HID_COMPLEX_REPORT_MAP_LEN);
+  CHECK(memcmp(buf, HID_COMPLEX_REPORT_MAP, len) == 0);
+
+  *nkro = fake_central_find_report(conn, KBD_NKRO_REPORT_ID, 1);
+  CHECK(*nkro != 0);
+  CHECK_EQ(fake_central_subscribe(conn, *nkro, true), 0);
+  // Parameter, PHY, data length and MTU procedures
+  fake_nimble_advance(200000);
+  return conn;
+}
+
+static void test_press_release(uint16_t conn, uint16_t nkro) {
+  fake_central_clear(conn);
+  CHECK_EQ(hogp_gatt_svr_post_key(KEY_A, true), 0);
+  fake_nimble_advance(50000);
+  CHECK(nkro_has(fake_central_last(conn, nkro), KEY_A));
+
+  CHECK_EQ(hogp_gatt_svr_post_key(KEY_A, false), 0);
+  fake_nimble_advance(50000);
+  CHECK(nkro_empty(fake_central_last(conn, nkro)));
+  CHECK_EQ(fake_central_count(conn), 2);
+}
+
+// More keys down at once than the key ring takes: the presses it refuses
+// lose their releases too, every key it took comes back up
+static void test_ring_full(uint16_t conn, uint16_t nkro) {
+  int refused = 0;
+
+  fake_central_clear(conn);
+  for (uint8_t key = KEY_A; key < KEY_A + KEY_EVENT_RING_SIZE; key++) {
+    refused += hogp_gatt_svr_post_key(key, true) != 0;
+  }
+  for (uint8_t key = KEY_A; key < KEY_A + KEY_EVENT_RING_SIZE; key++) {
+    CHECK_EQ(hogp_gatt_svr_post_key(key, false), 0);
+  }
+  CHECK(refused > 0);
+  fake_nimble_advance(500000);
+  CHECK(nkro_has(fake_central_get(conn, 0), KEY_A));
+  CHECK(nkro_empty(fake_central_last(conn, nkro)));
+}
+
+static void test_link_setup(uint16_t conn) {
+  const struct gap_link_info *link = gap_link_info(conn);
+  CHECK(link != NULL);
+  if (link != NULL) {
+    CHECK_EQ(link->mtu, 247);
+    CHECK_EQ(link->tx_phy, BLE_GAP_LE_PHY_2M);
+    CHECK_EQ(link->max_tx_octets, 251);
+    CHECK_EQ(link->conn_itvl, CONN_ACTIVE_ITVL_MIN);
+  }
+}
+
+static void test_boot_protocol(uint16_t conn) {
+  uint16_t mode = fake_central_find_chr16(HID_SVC, PRTCL_MODE_CHR);
+  uint16_t boot = fake_central_find_chr16(HID_SVC, BOOT_KBD_INP_CHR);
+  uint8_t value = HID_PROTOCOL_MODE_BOOT;
+
+  CHECK(mode != 0 && boot != 0);
+  CHECK_EQ(fake_central_write(conn, mode, &value, 1), 0);
+  CHECK_EQ(fake_central_subscribe(conn, boot, true), 0);
+
+  fake_central_clear(conn);
+  hogp_gatt_svr_post_key(KEY_B, true);
+  fake_nimble_advance(50000);
+  const fake_notification_t *n = fake_central_last(conn, boot);
+  CHECK(n != NULL);
+  if (n != NULL) {
+    CHECK_EQ(n->len, KBD_BOOT_REPORT_LEN);
+    CHECK_EQ(n->data[2], KEY_B);
+  }
+  hogp_gatt_svr_post_key(KEY_B, false);
+  fake_nimble_advance(50000);
+  n = fake_central_last(conn, boot);
+  CHECK(n != NULL && n->data[2] == 0);
+
+  value = HID_PROTOCOL_MODE_REPORT;
+  CHECK_EQ(fake_central_write(conn, mode, &value, 1), 0);
+}
+
+// Suspend drops the link to the idle parameters right away, Exit Suspend
+// brings the active ones back. Reserved commands change nothing
+static void test_host_suspend(uint16_t conn) {
+  uint16_t ctrl = fake_central_find_chr16(HID_SVC, HID_CTRL_POINT_CHR);
+  const struct gap_link_info *link = gap_link_info(conn);
+  uint8_t cmd = 0x00;
+
+  CHECK(ctrl != 0 && link != NULL);
+  CHECK_EQ(fake_central_write(conn, ctrl, &cmd, 1), 0);
+  fake_nimble_advance(100000);
+  CHECK_EQ(link->conn_itvl, CONN_IDLE_ITVL_MIN);
+  CHECK_EQ(link->conn_latency, CONN_IDLE_LATENCY);
+
+  cmd = 0x02;
+  CHECK_EQ(fake_central_write(conn, ctrl, &cmd, 1), 0);
+  fake_nimble_advance(100000);
+  CHECK_EQ(link->conn_latency, CONN_IDLE_LATENCY);
+  const uint8_t two[2] = {0x01, 0x01};
+  CHECK_EQ(fake_central_write(conn, ctrl, two, 2),
+           BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+
+  cmd = 0x01;
+  CHECK_EQ(fake_central_write(conn, ctrl, &cmd, 1), 0);
+  fake_nimble_advance(100000);
+  CHECK_EQ(link->conn_itvl, CONN_ACTIVE_ITVL_MIN);
+  CHECK_EQ(link->conn_latency, 0);
+}
+
+// A long read of the records is one snapshot, even though the host task
+// adds records between its blobs. A write takes a new one
+static void test_trace_snapshot(uint16_t conn) {
+  ble_uuid128_t uuid = KEY_TRACE_UUID(0x03);
+  uint16_t records = fake_central_find_chr128(&uuid);
+  key_trace_rec_t want[KEY_TRACE_RING_SIZE];
+  uint8_t buf[BLE_ATT_ATTR_MAX_LEN];
+  uint16_t len = 0;
+  uint8_t any = 0;
+
+  // Enough for more than one blob
+  for (int i = 0; i < 40; i++) {
+    hogp_gatt_svr_post_key(KEY_A, i % 2 == 0);
+    fake_nimble_advance(20000);
+  }
+  CHECK(key_trace_total() > BLE_ATT_ATTR_MAX_LEN / sizeof(key_trace_rec_t));
+
+  CHECK_EQ(fake_central_write(conn, records, &any, 1), 0);
+  uint32_t total = key_trace_total();
+  size_t n =
+      key_trace_dump(want, (BLE_ATT_ATTR_MAX_LEN - 4) / sizeof(want[0]));
+  // Drained between the blobs
+  hogp_gatt_svr_post_key(KEY_B, true);
+  CHECK_EQ(fake_central_read(conn, records, buf, sizeof(buf), &len), 0);
+  CHECK(len > fake_link_mtu(conn) - 1);
+  // The most recent records as of the write, however many fit
+  size_t k = (len - 4) / sizeof(want[0]);
+  CHECK(k > 0 && k <= n);
+  CHECK_EQ(get_le32(buf), total);
+  CHECK(memcmp(buf + 4, want + n - k, k * sizeof(want[0])) == 0);
+  CHECK(key_trace_total() > total);
+
+  // Reads keep serving it until the next write
+  CHECK_EQ(fake_central_read(conn, records, buf, sizeof(buf), &len), 0);
+  CHECK_EQ(get_le32(buf), total);
+  CHECK_EQ(fake_central_write(conn, records, &any, 1), 0);
+  CHECK_EQ(fake_central_read(conn, records, buf, sizeof(buf), &len), 0);
+  CHECK_EQ(get_le32(buf), key_trace_total());
+
+  hogp_gatt_svr_post_key(KEY_B, false);
+  fake_nimble_advance(50000);
+}
+
+// Tasks reads return the sample the last write took, each sample restarts
+// the CPU time window
+static void test_tasks_snapshot(uint16_t conn) {
+  ble_uuid128_t uuid = DIAG_TASKS_UUID;
+  uint16_t tasks = fake_central_find_chr128(&uuid);
+  uint8_t first[BLE_ATT_ATTR_MAX_LEN], again[BLE_ATT_ATTR_MAX_LEN];
+  uint16_t first_len = 0, again_len = 0;
+  uint8_t any = 0;
+
+  CHECK(tasks != 0);
+  CHECK_EQ(fake_central_write(conn, tasks, &any, 1), 0);
+  CHECK_EQ(fake_central_read(conn, tasks, first, sizeof(first), &first_len),
+           0);
+  CHECK(first_len >= 4);
+  fake_nimble_advance(100000);
+  CHECK_EQ(fake_central_read(conn, tasks, again, sizeof(again), &again_len),
+           0);
+  CHECK_EQ(again_len, first_len);
+  CHECK(memcmp(first, again, first_len) == 0);
+
+  CHECK_EQ(fake_central_write(conn, tasks, &any, 1), 0);
+  CHECK_EQ(fake_central_read(conn, tasks, again, sizeof(again), &again_len),
+           0);
+  // The window since the first write
+  CHECK(get_le32(again) >= 100000);
+}
+
+// Reads the Stats characteristic, returns its length
+static uint16_t read_all_stats(uint16_t conn, uint8_t *buf) {
+  ble_uuid128_t uuid = DIAG_STATS_UUID;
+  uint16_t len = 0;
+
+  uint16_t chr = fake_central_find_chr128(&uuid);
+  CHECK(chr != 0);
+  CHECK_EQ(fake_central_read(conn, chr, buf, BLE_ATT_ATTR_MAX_LEN, &len), 0);
+  return len;
+}
+
+// Reads one counter source off the Stats characteristic into values
+static void read_stats(uint16_t conn, diag_stats_type_t type,
+                       uint32_t *values, size_t count) {
+  uint8_t buf[BLE_ATT_ATTR_MAX_LEN];
+  uint16_t len = read_all_stats(conn, buf);
+
+  memset(values, 0, count * sizeof(values[0]));
+  for (uint16_t off = 0; off + 2 <= len; off += 2 + buf[off + 1]) {
+    if (buf[off] == type) {
+      CHECK_EQ(buf[off + 1], count * 4);
+      CHECK(off + 2 + buf[off + 1] <= len);
+      memcpy(values, buf + off + 2, count * 4);
+      return;
+    }
+  }
+  CHECK(!"no such stats record");
+}
+
+// Every source once, records back to back to the end of the value
+static void test_stats_layout(uint16_t conn) {
+  static const uint8_t counters[] = {
+      [DIAG_STATS_TX] = 7,      [DIAG_STATS_RECONNECT] = 4,
+      [DIAG_STATS_SCANNER] = 8, [DIAG_STATS_KLOG] = 2,
+      [DIAG_STATS_POWER] = 6,   [DIAG_STATS_POOL] = 6,
+  };
+  uint8_t seen[sizeof(counters)] = {0};
+  uint8_t buf[BLE_ATT_ATTR_MAX_LEN];
+  uint16_t len = read_all_stats(conn, buf);
+  uint16_t off = 0;
+
+  while (off + 2 <= len) {
+    uint8_t type = buf[off];
+    if (type == 0 || type >= sizeof(counters)) {
+      CHECK(!"unknown stats type");
+      return;
+    }
+    CHECK_EQ(buf[off + 1], counters[type] * 4);
+    seen[type]++;
+    off += 2 + buf[off + 1];
+  }
+  CHECK_EQ(off, len);
+  for (size_t type = 1; type < sizeof(counters); type++) {
+    CHECK_EQ(seen[type], 1);
+  }
+}
+
+// The trace service is for bonded hosts only, and its records do not say
+// which keys were typed
+static void test_trace_privacy(uint16_t conn) {
+  ble_uuid128_t uuid = KEY_TRACE_UUID(0x03);
+  uint8_t buf[BLE_ATT_ATTR_MAX_LEN];
+  uint16_t len = 0;
+  uint16_t records = fake_central_find_chr128(&uuid);
+
+  CHECK(records != 0);
+  CHECK_EQ(fake_central_read(conn, records, buf, sizeof(buf), &len),
+           BLE_ATT_ERR_INSUFFICIENT_ENC);
+  fake_central_pair(conn);
+  CHECK_EQ(fake_central_read(conn, records, buf, sizeof(buf), &len), 0);
+
+  int keys = 0;
+  for (uint16_t off = 4; off + sizeof(key_trace_rec_t) <= len;
+       off += sizeof(key_trace_rec_t)) {
+    key_trace_rec_t rec;
+    memcpy(&rec, buf + off, sizeof(rec));
+    if (rec.stage == KEY_TRACE_DETECTED || rec.stage == KEY_TRACE_BUILT) {
+      CHECK_EQ(rec.arg, 0);
+      keys++;
+    }
+  }
+  CHECK(keys > 0);
+}
+
+// The Stats characteristic reads back the report delivery counters
+static void test_tx_stats(uint16_t conn) {
+  struct hogp_tx_stats stats;
+  uint32_t values[7];
+
+  read_stats(conn, DIAG_STATS_TX, values, 7);
+  hogp_gatt_svr_get_tx_stats(&stats);
+  CHECK(stats.reports_sent > 0);
+  CHECK_EQ(values[1], stats.reports_sent);
+  CHECK_EQ(values[6], stats.busy);
+}
+
+static void test_scanner_stats(uint16_t conn) {
+  struct matrix_scanner_stats stats = {
+      .wakeups = 1, .scans = 2, .dropped = 3,
+      .keymap = {.taps = 4, .holds = 5, .combos = 6, .forced = 7,
+                 .max_wait_us = 8}};
+  uint32_t values[8];
+
+  fake_input_set_scanner_stats(&stats);
+  read_stats(conn, DIAG_STATS_SCANNER, values, 8);
+  for (int i = 0; i < 8; i++) {
+    CHECK_EQ(values[i], i + 1);
+  }
+}
+
+static void test_klog_stats(uint16_t conn) {
+  struct klog_stats stats;
+  uint32_t values[2];
+
+  // The GAP logs connects at KLOG_INFO
+  klog_get_stats(&stats);
+  CHECK(stats.written > 0);
+  read_stats(conn, DIAG_STATS_KLOG, values, 2);
+  CHECK_EQ(values[0], stats.written);
+  CHECK_EQ(values[1], stats.dropped);
+}
+
+static void test_power_stats(uint16_t conn) {
+  power_stats_t stats;
+  uint32_t values[6];
+
+  read_stats(conn, DIAG_STATS_POWER, values, 6);
+  power_mgr_get_stats(&stats);
+  // The host is connected, the radio runs
+  CHECK(stats.radio_mhz > 0);
+  CHECK_EQ(values[2], stats.radio_mhz);
+  CHECK(values[0] > 0);
+}
+
+// msys running dry holds a report back, it goes out once the ATT header
+// gets an mbuf again
+static void test_pool_stats(uint16_t conn, uint16_t nkro) {
+  struct os_mbuf *taken[FAKE_MSYS_COUNT];
+  uint16_t count = 0;
+  uint32_t before[6];
+  uint32_t values[6];
+
+  read_stats(conn, DIAG_STATS_POOL, before, 6);
+  while (count < FAKE_MSYS_COUNT &&
+         (taken[count] = os_msys_get_pkthdr(0, 0)) != NULL) {
+    count++;
+  }
+  CHECK_EQ(fake_msys_free(), 0);
+  fake_central_clear(conn);
+  hogp_gatt_svr_post_key(KEY_A, true);
+  fake_nimble_advance(20000);
+  CHECK_EQ(fake_central_count(conn), 0);
+
+  while (count > 0) {
+    os_mbuf_free_chain(taken[--count]);
+  }
+  hogp_gatt_svr_post_key(KEY_A, false);
+  fake_nimble_advance(100000);
+  CHECK_EQ(fake_central_count(conn), 2);
+  CHECK(nkro_has(fake_central_get(conn, 0), KEY_A));
+  CHECK(nkro_empty(fake_central_get(conn, 1)));
+
+  read_stats(conn, DIAG_STATS_POOL, values, 6);
+  CHECK(values[2] > before[2]);
+  CHECK_EQ(values[0] - before[0], 2 + values[2] - before[2]);
+  CHECK_EQ(values[3], REPORT_POOL_COUNT);
+  CHECK_EQ(values[5], 0);
+}
+
+static void test_two_hosts(uint16_t conn1, uint16_t nkro) {
+  // Advertising went on after the first connect, there is room for more
+  CHECK(fake_nimble_adv_active());
+  uint16_t nkro2;
+  uint16_t conn2 = connect_host(2, &nkro2);
+  CHECK_EQ(nkro2, nkro);
+
+  fake_central_clear(conn1);
+  fake_central_clear(conn2);
+  hogp_gatt_svr_post_key(KEY_A, true);
+  hogp_gatt_svr_post_key(KEY_A, false);
+  fake_nimble_advance(100000);
+  CHECK_EQ(fake_central_count(conn1), 2);
+  CHECK_EQ(fake_central_count(conn2), 2);
+  CHECK(nkro_has(fake_central_get(conn2, 0), KEY_A));
+  CHECK(nkro_empty(fake_central_get(conn2, 1)));
+
+  fake_central_disconnect(conn2);
+  CHECK(!fake_link_connected(conn2));
+  CHECK(fake_nimble_adv_active());
+}
+
+// A bonded host dropping gets directed advertising, and the time to its first
+// report is on the Stats characteristic
+static void test_reconnect(uint16_t conn1) {
+  uint32_t stats[4];
+  uint16_t nkro;
+  uint16_t conn = connect_host(3, &nkro);
+
+  fake_central_pair(conn);
+  fake_central_disconnect(conn);
+  CHECK(fake_nimble_adv_directed());
+  read_stats(conn1, DIAG_STATS_RECONNECT, stats, 4);
+  CHECK_EQ(stats[0], 0);
+
+  fake_nimble_advance(100000);
+  conn = connect_host(3, &nkro);
+  hogp_gatt_svr_post_key(KEY_A, true);
+  hogp_gatt_svr_post_key(KEY_A, false);
+  fake_nimble_advance(50000);
+  read_stats(conn1, DIAG_STATS_RECONNECT, stats, 4);
+  CHECK_EQ(stats[0], 1); // count
+  CHECK_EQ(stats[1], 1); // directed
+  // Disconnect to the first report: the wait, link setup and the report
+  CHECK(stats[2] >= 300 && stats[2] < 400);
+  CHECK_EQ(stats[3], stats[2]);
+  fake_central_disconnect(conn);
+}
+
+int main(void) {
+  setup();
+  CHECK(fake_nimble_adv_active());
+
+  uint16_t nkro;
+  uint16_t conn = connect_host(1, &nkro);
+  test_link_setup(conn);
+  test_press_release(conn, nkro);
+  test_boot_protocol(conn);
+  test_host_suspend(conn);
+  test_press_release(conn, nkro);
+  test_trace_privacy(conn);
+  test_trace_snapshot(conn);
+  test_tasks_snapshot(conn);
+  test_stats_layout(conn);
+  test_tx_stats(conn);
+  test_scanner_stats(conn);
+  test_klog_stats(conn);
+  test_power_stats(conn);
+  test_pool_stats(conn, nkro);
+  test_ring_full(conn, nkro);
+  test_two_hosts(conn, nkro);
+  test_reconnect(conn);
+
+  fake_central_disconnect(conn);
+  fake_nimble_advance(100000);
+  CHECK(fake_nimble_adv_active());
+  // Every notification gave its mbufs back
+  CHECK_EQ(fake_msys_free(), FAKE_MSYS_COUNT);
+  CHECK_DONE();
+}
@@ -0,0 +1,184 @@
+// hogp_tx against scripted notify results: bursts, BUSY retries, drops, and
+// that a report that never reached the host is not treated as its last one
+#include "check.h"
+#include "hogp_tx.h"
+#include <string.h>
+
+#define CONN 1
+#define VAL 10
+#define BIT 0x1
+
+static struct gap_link_info link = {
+    .conn_handle = CONN, .conn_itvl = 6, .mtu = 247};
+static bool link_up = true;
+static int notify_rc; // What the next notify returns
+static int notified;
+static int sent;
+static uint8_t last_sent[HOGP_CONN_LAST_REPORT_LEN];
+
+static int fake_notify(uint16_t conn_handle, uint16_t val_handle,
+                       const uint8_t *data, uint8_t len, void *arg) {
+  notified++;
+  if (notify_rc == 0) {
+    memcpy(last_sent, data, len);
+  }
+  return notify_rc;
+}
+
+static const struct gap_link_info *fake_link(uint16_t conn_handle,
+                                             void *arg) {
+  return link_up && conn_handle == CONN ? &link : NULL;
+}
+
+static void fake_sent(uint16_t conn_handle, void *arg) { sent++; }
+
+static const hogp_tx_ops_t ops = {
+    .notify = fake_notify, .link = fake_link, .sent = fake_sent};
+static const hogp_tx_trace_t untraced;
+
+static hogp_tx_t tx;
+static hogp_conn_t *conn;
+
+static void reset(void) {
+  hogp_conn_init();
+  hogp_tx_init(&tx, &ops);
+  conn = hogp_conn_add(CONN);
+  conn->notify_mask = BIT;
+  link = (struct gap_link_info){.conn_handle = CONN, .conn_itvl = 6,
+                                .mtu = 247};
+  link_up = true;
+  notify_rc = 0;
+  notified = sent = 0;
+}
+
+static void queue(uint8_t key) {
+  uint8_t report[8] = {0, 0, key};
+  hogp_tx_queue(&tx, conn, VAL, BIT, report, sizeof(report), &untraced);
+}
+
+static uint32_t flush(void) {
+  bool made_room;
+  return hogp_tx_flush(&tx, 0, &made_room);
+}
+
+static void test_repeat_skipped(void) {
+  reset();
+  queue(4);
+  queue(4);
+  CHECK_EQ(tx.count, 1);
+  CHECK_EQ(flush(), UINT32_MAX);
+  queue(4);
+  CHECK_EQ(tx.count, 0);
+  // Not subscribed
+  conn->notify_mask = 0;
+  queue(5);
+  CHECK_EQ(tx.count, 0);
+}
+
+static void test_burst(void) {
+  reset();
+  for (uint8_t k = 1; k <= 10; k++) {
+    queue(k);
+  }
+  // One connection interval (7.5 ms, rounded up) until the rest
+  CHECK_EQ(flush(), 8);
+  CHECK_EQ(sent, HOGP_TX_BURST_MAX);
+  flush();
+  flush();
+  CHECK_EQ(sent, 10);
+  CHECK_EQ(last_sent[2], 10);
+
+  struct hogp_tx_stats stats;
+  hogp_tx_get_stats(&tx, &stats);
+  CHECK_EQ(stats.flushes, 3);
+  CHECK_EQ(stats.reports_sent, 10);
+  CHECK_EQ(stats.max_reports_per_flush, HOGP_TX_BURST_MAX);
+  CHECK_EQ(stats.max_queue_depth, 10);
+}
+
+static void test_busy_retried(void) {
+  reset();
+  queue(4);
+  notify_rc = HOGP_TX_BUSY;
+  CHECK(flush() != UINT32_MAX);
+  CHECK_EQ(tx.count, 1);
+  // Still queued, so still a repeat
+  queue(4);
+  CHECK_EQ(tx.count, 1);
+  notify_rc = 0;
+  CHECK_EQ(flush(), UINT32_MAX);
+  CHECK_EQ(sent, 1);
+
+  // The one in flight keeps its trace record, the refused one leaves none
+  queue(5);
+  flush();
+  queue(6);
+  notify_rc = HOGP_TX_BUSY;
+  flush();
+  CHECK_EQ(conn->trace_count, 2);
+  hogp_tx_done(conn, VAL, 0, 0);
+  hogp_tx_done(conn, VAL, 0, 0);
+  CHECK_EQ(conn->trace_count, 0);
+}
+
+static void test_drop_forgets(void) {
+  // Refused by the stack
+  reset();
+  queue(4);
+  notify_rc = BLE_HS_ENOTCONN;
+  flush();
+  CHECK_EQ(sent, 0);
+  notify_rc = 0;
+  queue(4);
+  CHECK_EQ(tx.count, 1);
+  flush();
+  CHECK_EQ(sent, 1);
+
+  // Larger than the MTU allows
+  reset();
+  link.mtu = 8;
+  queue(5);
+  flush();
+  CHECK_EQ(notified, 0);
+  link.mtu = 247;
+  queue(5);
+  flush();
+  CHECK_EQ(sent, 1);
+  CHECK_EQ(last_sent[2], 5);
+
+  // Taken by the stack, then failed
+  reset();
+  queue(6);
+  flush();
+  hogp_tx_done(conn, VAL, BLE_HS_ETIMEOUT, 0);
+  queue(6);
+  CHECK_EQ(tx.count, 1);
+
+  // Completed fine, still a repeat
+  reset();
+  queue(7);
+  flush();
+  hogp_tx_done(conn, VAL, 0, 0);
+  queue(7);
+  CHECK_EQ(tx.count, 0);
+}
+
+static void test_disconnected(void) {
+  reset();
+  queue(4);
+  link_up = false;
+  CHECK_EQ(flush(), UINT32_MAX);
+  CHECK_EQ(notified, 0);
+  struct hogp_tx_stats stats;
+  hogp_tx_get_stats(&tx, &stats);
+  CHECK_EQ(stats.dropped, 1);
+}
+
+int main(void) {
+  test_repeat_skipped();
+  test_burst();
+  test_busy_retried();
+  test_drop_forgets();
+  test_disconnected();
+  CHECK_DONE();
+}
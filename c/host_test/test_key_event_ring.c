@@ -0,0 +1,226 @@
+// Two-thread stress of the SPSC key ring: a producer thread pushes millions of
+// numbered events while the consumer drains in batches, like the input task
+// and the NimBLE host task do. Checks nothing is lost, repeated or reordered
+// when the producer retries on a full ring, and that refused pushes are the
+// only losses when it does not. Then the held key tracking of
+// key_event_ring_push_key() on a full ring.
+//
+// Usage: test_key_event_ring [events]
+#include "check.h"
+#include "key_event_ring.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define DEFAULT_EVENTS 4000000
+#define BATCH 16
+
+static key_event_ring_t ring;
+static uint32_t total;
+static bool retry;
+static _Atomic bool producer_done;
+static uint32_t refused;
+
+// Spreads the sequence number over every field, so a torn slot shows up
+static key_event_t seq_event(uint32_t seq) {
+  return (key_event_t){
+      .timestamp_us = seq,
+      .usage = (uint16_t)(seq * 2654435761u >> 16),
+      .page = (uint8_t)(seq >> 3),
+      .pressed = seq & 1,
+  };
+}
+
+static bool seq_intact(const key_event_t *e) {
+  key_event_t want = seq_event(e->timestamp_us);
+  return e->usage == want.usage && e->page == want.page &&
+         e->pressed == want.pressed;
+}
+
+static void *producer(void *arg) {
+  for (uint32_t seq = 0; seq < total; seq++) {
+    key_event_t e = seq_event(seq);
+    while (!key_event_ring_push(&ring, &e)) {
+      // Either way give the consumer a go, on a single core it would
+      // otherwise only run once the producer's time slice is up
+      sched_yield();
+      if (!retry) {
+        refused++;
+        break;
+      }
+    }
+  }
+  atomic_store(&producer_done, true);
+  return NULL;
+}
+
+// Returns how many events arrived
+static uint32_t consume(void) {
+  key_event_t out[BATCH];
+  uint32_t received = 0;
+  uint32_t next = 0; // Lowest sequence number still allowed
+  uint32_t bad_order = 0;
+  uint32_t torn = 0;
+
+  for (;;) {
+    // Read before popping, so a pop after the producer finished sees all
+    bool done = atomic_load(&producer_done);
+    size_t n = key_event_ring_pop_batch(&ring, out, BATCH);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t seq = out[i].timestamp_us;
+      if (retry ? seq != next : seq < next) {
+        bad_order++;
+      }
+      if (!seq_intact(&out[i])) {
+        torn++;
+      }
+      next = seq + 1;
+    }
+    received += n;
+    if (n == 0) {
+      if (done) {
+        break;
+      }
+      sched_yield();
+    }
+  }
+  CHECK_EQ(bad_order, 0);
+  CHECK_EQ(torn, 0);
+  return received;
+}
+
+static void run(bool retry_full) {
+  pthread_t thread;
+
+  key_event_ring_init(&ring);
+  retry = retry_full;
+  refused = 0;
+  atomic_store(&producer_done, false);
+
+  CHECK_EQ(pthread_create(&thread, NULL, producer, NULL), 0);
+  uint32_t received = consume();
+  pthread_join(thread, NULL);
+
+  if (retry_full) {
+    CHECK_EQ(received, total);
+  } else {
+    CHECK_EQ(received + refused, total);
+  }
+  printf("%s: %u events, %u received, %u refused\n",
+         retry_full ? "retry" : "drop", total, received, refused);
+}
+
+static void test_single_thread(void) {
+  key_event_t out[KEY_EVENT_RING_SIZE + 1];
+
+  key_event_ring_init(&ring);
+  CHECK_EQ(key_event_ring_pop_batch(&ring, out, 4), 0);
+  // Fills up to exactly its size, across the index wrap
+  for (uint32_t round = 0; round < 3; round++) {
+    for (uint32_t i = 0; i < KEY_EVENT_RING_SIZE; i++) {
+      key_event_t e = seq_event(i);
+      CHECK(key_event_ring_push(&ring, &e));
+    }
+    key_event_t e = seq_event(KEY_EVENT_RING_SIZE);
+    CHECK(!key_event_ring_push(&ring, &e));
+    CHECK_EQ(key_event_ring_pop_batch(&ring, out, KEY_EVENT_RING_SIZE + 1),
+             KEY_EVENT_RING_SIZE);
+    CHECK_EQ(out[KEY_EVENT_RING_SIZE - 1].timestamp_us,
+             KEY_EVENT_RING_SIZE - 1);
+  }
+}
+
+static key_event_t key_event(uint16_t usage, bool pressed) {
+  return (key_event_t){.usage = usage, .page = 0x07, .pressed = pressed};
+}
+
+// Presses into a ring nobody drains: each one going in must leave room for
+// the release of every key held, and no release may be refused
+static void test_held_keys(void) {
+  key_event_t out[KEY_EVENT_RING_SIZE];
+  key_event_t e;
+  uint16_t accepted = 0;
+
+  key_event_ring_init(&ring);
+  // Fill with other traffic first, as a burst of taps would
+  for (int i = 0; i < KEY_EVENT_RING_SIZE / 4; i++) {
+    e = key_event(0x100, i % 2 == 0);
+    CHECK(key_event_ring_push_key(&ring, &e));
+  }
+  for (uint16_t usage = 1; usage <= KEY_EVENT_RING_SIZE; usage++) {
+    e = key_event(usage, true);
+    if (!key_event_ring_push_key(&ring, &e)) {
+      break;
+    }
+    accepted++;
+  }
+  CHECK(accepted > 0);
+  CHECK(accepted < KEY_EVENT_RING_HELD_MAX);
+
+  // Refused, and its release goes nowhere
+  uint16_t refused_key = accepted + 1;
+  e = key_event(refused_key, true);
+  CHECK(!key_event_ring_push_key(&ring, &e));
+  e = key_event(refused_key, false);
+  CHECK(key_event_ring_push_key(&ring, &e));
+  // Repeat of a held key does not take a release's slot either
+  e = key_event(1, true);
+  CHECK(!key_event_ring_push_key(&ring, &e));
+
+  // Every accepted press gets its release in, the ring ends up full
+  for (uint16_t usage = accepted; usage >= 1; usage--) {
+    e = key_event(usage, false);
+    CHECK(key_event_ring_push_key(&ring, &e));
+  }
+  e = key_event(0x101, false);
+  CHECK(!key_event_ring_push(&ring, &e));
+
+  int down = 0;
+  int refused_seen = 0;
+  size_t n;
+  while ((n = key_event_ring_pop_batch(&ring, out, KEY_EVENT_RING_SIZE)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      if (out[i].usage == 0x100) {
+        continue;
+      }
+      down += out[i].pressed ? 1 : -1;
+      refused_seen += out[i].usage == refused_key;
+    }
+  }
+  CHECK_EQ(down, 0);
+  CHECK_EQ(refused_seen, 0);
+
+  // Drained, presses go in again
+  e = key_event(refused_key, true);
+  CHECK(key_event_ring_push_key(&ring, &e));
+}
+
+// No more held keys than it tracks, however much room the ring has
+static void test_held_max(void) {
+  key_event_t out[KEY_EVENT_RING_SIZE];
+  key_event_t e;
+
+  key_event_ring_init(&ring);
+  for (uint16_t usage = 1; usage <= KEY_EVENT_RING_HELD_MAX; usage++) {
+    e = key_event(usage, true);
+    CHECK(key_event_ring_push_key(&ring, &e));
+    key_event_ring_pop_batch(&ring, out, KEY_EVENT_RING_SIZE);
+  }
+  e = key_event(KEY_EVENT_RING_HELD_MAX + 1, true);
+  CHECK(!key_event_ring_push_key(&ring, &e));
+  e = key_event(1, false);
+  CHECK(key_event_ring_push_key(&ring, &e));
+  e = key_event(KEY_EVENT_RING_HELD_MAX + 1, true);
+  CHECK(key_event_ring_push_key(&ring, &e));
+}
+
+int main(int argc, char **argv) {
+  total = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : DEFAULT_EVENTS;
+
+  test_single_thread();
+  test_held_keys();
+  test_held_max();
+  run(true);
+  run(false);
+  CHECK_DONE();
+}
@@ -0,0 +1,187 @@
+// key_matrix on synthetic bounce traces (bounce_trace.h) over random matrix
+// sizes, rows straddling words included: every scan is checked against a
+// one-key-at-a-time model of the integrators, and every real press and
+// release has to come out exactly once within the debounce window. Then
+// pure noise against the model.
+//
+// Usage: test_key_matrix [matrices]
+#include "bounce_trace.h"
+#include "check.h"
+#include "key_matrix.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_MATRICES 300
+#define SAMPLES 3000
+#define MAX_EDGES (SAMPLES / BOUNCE_TRACE_STABLE_MIN)
+#define SCAN_US 1000
+
+typedef struct {
+  uint16_t key;
+  bool pressed;
+} event_t;
+
+static uint8_t rows, cols;
+static uint8_t raw[KEY_MATRIX_MAX_KEYS][SAMPLES];
+static uint32_t sample;
+static uint32_t seed = 1;
+
+// What the last scan emitted
+static event_t events[KEY_MATRIX_MAX_KEYS];
+static int event_count;
+static uint32_t event_us;
+
+// The integrators one key at a time: a reading that disagrees with the
+// debounced state counts down from 3 and toggles it past 0, one that agrees
+// puts it back to 3
+static bool model_state[KEY_MATRIX_MAX_KEYS];
+static uint8_t model_count[KEY_MATRIX_MAX_KEYS];
+
+static uint32_t read_row(uint8_t row, void *arg) {
+  uint32_t bits = 0;
+  for (uint8_t col = 0; col < cols; col++) {
+    bits |= (uint32_t)raw[row * cols + col][sample] << col;
+  }
+  // Lines past the last column float, the driver has to mask them
+  return bits | bounce_trace_rand(&seed) << cols;
+}
+
+static void emit(uint16_t key, bool pressed, uint32_t timestamp_us,
+                 void *arg) {
+  CHECK(event_count < KEY_MATRIX_MAX_KEYS);
+  if (event_count < KEY_MATRIX_MAX_KEYS) {
+    events[event_count++] = (event_t){key, pressed};
+  }
+  event_us = timestamp_us;
+}
+
+static const key_matrix_ops_t ops = {.read_row = read_row, .emit = emit};
+
+static void model_reset(void) {
+  memset(model_state, 0, sizeof(model_state));
+  memset(model_count, 3, sizeof(model_count));
+}
+
+// Runs the model on one reading per key and checks the scan's events and
+// result against it
+static void model_check(const bool *reading, bool busy, uint32_t now_us) {
+  int n = 0;
+  bool model_busy = false;
+
+  for (uint16_t key = 0; key < rows * cols; key++) {
+    if (reading[key] == model_state[key]) {
+      model_count[key] = 3;
+    } else if (model_count[key] > 0) {
+      model_count[key]--;
+    } else {
+      model_state[key] = reading[key];
+      model_count[key] = 3;
+      // Events come out in key order
+      CHECK(n < event_count);
+      if (n < event_count) {
+        CHECK_EQ(events[n].key, key);
+        CHECK_EQ(events[n].pressed, model_state[key]);
+      }
+      n++;
+    }
+    model_busy |= model_state[key] || model_count[key] != 3;
+  }
+  CHECK_EQ(event_count, n);
+  CHECK_EQ(busy, model_busy);
+  if (event_count > 0) {
+    CHECK_EQ(event_us, now_us);
+  }
+}
+
+static void test_bounce(uint8_t r, uint8_t c, uint32_t start_us) {
+  static bounce_edge_t edges[KEY_MATRIX_MAX_KEYS][MAX_EDGES];
+  static size_t edge_count[KEY_MATRIX_MAX_KEYS];
+  static size_t next_edge[KEY_MATRIX_MAX_KEYS];
+  key_matrix_t km;
+  bool busy = false;
+
+  rows = r;
+  cols = c;
+  for (uint16_t key = 0; key < rows * cols; key++) {
+    edge_count[key] = bounce_trace_key(raw[key], SAMPLES, edges[key], &seed);
+    next_edge[key] = 0;
+  }
+  key_matrix_init(&km, rows, cols, &ops);
+  model_reset();
+
+  for (sample = 0; sample < SAMPLES; sample++) {
+    uint32_t now_us = start_us + sample * SCAN_US;
+    bool reading[KEY_MATRIX_MAX_KEYS];
+
+    event_count = 0;
+    busy = key_matrix_scan(&km, now_us);
+    for (uint16_t key = 0; key < rows * cols; key++) {
+      reading[key] = raw[key][sample];
+    }
+    model_check(reading, busy, now_us);
+
+    // Every event is the next real change of its key, in the window
+    for (int i = 0; i < event_count; i++) {
+      uint16_t key = events[i].key;
+      if (key >= rows * cols || next_edge[key] == edge_count[key]) {
+        CHECK(!"event without a real change");
+        continue;
+      }
+      const bounce_edge_t *edge = &edges[key][next_edge[key]++];
+      CHECK_EQ(events[i].pressed, edge->pressed);
+      CHECK(sample >= edge->at + KEY_MATRIX_DEBOUNCE_SAMPLES - 1);
+      CHECK(sample <= edge->at + edge->bounce + KEY_MATRIX_DEBOUNCE_SAMPLES - 1);
+    }
+  }
+
+  for (uint16_t key = 0; key < rows * cols; key++) {
+    CHECK_EQ(next_edge[key], edge_count[key]);
+  }
+  // All released and settled, scanning may stop
+  CHECK(!busy);
+}
+
+// Random readings, every key at once, against the model
+static void test_noise(uint32_t samples) {
+  key_matrix_t km;
+  uint32_t words[KEY_MATRIX_WORDS];
+
+  rows = KEY_MATRIX_MAX_ROWS;
+  cols = KEY_MATRIX_MAX_COLS;
+  key_matrix_init(&km, rows, cols, &ops);
+  model_reset();
+
+  for (uint32_t i = 0; i < samples; i++) {
+    bool reading[KEY_MATRIX_MAX_KEYS];
+    // Mostly agreeing with the last reading, so some keys get through
+    uint32_t flip = bounce_trace_rand(&seed) % 8 == 0 ? 0xFFFFFFFF : 0;
+    for (int w = 0; w < KEY_MATRIX_WORDS; w++) {
+      words[w] = (i == 0 ? 0 : words[w]) ^
+                 (bounce_trace_rand(&seed) & bounce_trace_rand(&seed) &
+                  bounce_trace_rand(&seed) & flip);
+    }
+    for (uint16_t key = 0; key < KEY_MATRIX_MAX_KEYS; key++) {
+      reading[key] = (words[key / 32] >> (key % 32)) & 1;
+    }
+    event_count = 0;
+    model_check(reading, key_matrix_sample(&km, words, i), i);
+  }
+}
+
+int main(int argc, char **argv) {
+  int matrices = argc > 1 ? atoi(argv[1]) : DEFAULT_MATRICES;
+
+  // The largest and smallest matrices, 7 x 13 straddles words, and one
+  // across the us clock wrapping
+  test_bounce(KEY_MATRIX_MAX_ROWS, KEY_MATRIX_MAX_COLS, 0);
+  test_bounce(1, 1, 0);
+  test_bounce(7, 13, 0);
+  test_bounce(4, 4, UINT32_MAX - SAMPLES / 2 * SCAN_US);
+  for (int i = 0; i < matrices; i++) {
+    test_bounce(1 + bounce_trace_rand(&seed) % KEY_MATRIX_MAX_ROWS,
+                1 + bounce_trace_rand(&seed) % KEY_MATRIX_MAX_COLS,
+                bounce_trace_rand(&seed));
+  }
+  test_noise(200000);
+  CHECK_DONE();
+}
@@ -0,0 +1,436 @@
+// keymap on timed traces, driven the way matrix_scanner.c does: a scan every
+// ms delivers the key changes of that scan, then ticks the keymap. Every
+// usage change is checked against the expected ones, with the timestamp it
+// carries and the scan it came out in. Then random traces: no usage pressed
+// twice or left down, and no key change waiting longer than the tapping
+// term plus one scan.
+//
+// Usage: test_keymap [runs]
+#include "check.h"
+#include "config.h"
+#include "keymap.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_RUNS 20000
+#define SCAN_US 1000
+#define TAPPING_US (KEYMAP_TAPPING_TERM_MS * 1000)
+#define COMBO_US (KEYMAP_COMBO_TERM_MS * 1000)
+#define MAX_WAIT_US ((TAPPING_US > COMBO_US ? TAPPING_US : COMBO_US) + SCAN_US)
+
+#define K(usage) KEYMAP_ACTION(KEYMAP_KEY, usage)
+#define ___ KEYMAP_ACTION(KEYMAP_TRANS, 0)
+#define CONSUMER_VOL_UP 0xE9
+
+enum {
+  POS_A,
+  POS_B,
+  POS_LT,  // lt(1, c)
+  POS_MT,  // mt(lshift, d)
+  POS_OSM, // osm(lctrl)
+  POS_E,   // combo with POS_F
+  POS_F,
+  POS_MO,  // mo(1)
+  POS_TG,  // tg(2)
+  POS_VOL, // cc(volup)
+  POS_MACRO,
+  POS_G,
+  KEYS,
+};
+
+static const uint16_t actions[3 * KEYS] = {
+    // Layer 0
+    K(0x04), K(0x05), KEYMAP_ACTION(KEYMAP_LT, 1 << 8 | 0x06),
+    KEYMAP_ACTION(KEYMAP_MT, 1 << 8 | 0x07), KEYMAP_ACTION(KEYMAP_OSM, 0x01),
+    K(0x08), K(0x09), KEYMAP_ACTION(KEYMAP_MO, 1),
+    KEYMAP_ACTION(KEYMAP_TG, 2),
+    KEYMAP_ACTION(KEYMAP_CONSUMER, CONSUMER_VOL_UP),
+    KEYMAP_ACTION(KEYMAP_MACRO, 3), K(0x0A),
+    // Layer 1
+    K(0x1E), ___, ___, ___, ___, ___, ___, ___, ___, ___, ___, KEYMAP_NONE,
+    // Layer 2
+    K(0x1F), ___, ___, ___, ___, ___, ___, ___, ___, ___, ___, ___};
+
+static const keymap_combo_t combos[] = {
+    {.keys = {POS_E, POS_F}, .count = 2, .action = K(0x2A)},
+};
+
+static const keymap_def_t def = {
+    .layers = 3,
+    .keys = KEYS,
+    .actions = actions,
+    .combos = combos,
+    .combo_count = 1,
+};
+
+static const keymap_cfg_t cfg = {
+    .tapping_term_us = TAPPING_US,
+    .combo_term_us = COMBO_US,
+};
+
+// A usage change as the keymap gave it, control usages with their page in
+// the top bits
+typedef struct {
+  uint32_t usage;
+  bool pressed;
+  uint32_t ts_ms; // Timestamp it carries, from the start of the trace
+  uint32_t at_ms; // Scan it came out in
+} out_t;
+
+#define OUT_MAX 64
+#define PAGE(page, usage) ((uint32_t)(page) << 16 | (usage))
+
+static keymap_t km;
+static uint32_t start_us;
+static uint32_t now_us;
+static out_t outs[OUT_MAX];
+static int out_count;
+static uint8_t macros_played;
+static bool down[0x200]; // Key usages, then the control ones' low byte
+static uint32_t max_wait_us;
+
+static void record(uint32_t usage, bool pressed, uint32_t timestamp_us) {
+  bool *d = &down[usage < 0x100 ? usage : 0x100 | (usage & 0xFF)];
+
+  // The keymap counts usages, a change is always a real one
+  CHECK(*d != pressed);
+  *d = pressed;
+  CHECK((int32_t)(now_us - timestamp_us) >= 0);
+  if (now_us - timestamp_us > max_wait_us) {
+    max_wait_us = now_us - timestamp_us;
+  }
+  if (out_count < OUT_MAX) {
+    outs[out_count++] = (out_t){usage, pressed,
+                                (timestamp_us - start_us) / 1000,
+                                (now_us - start_us) / 1000};
+  }
+}
+
+static void on_key(uint8_t usage, bool pressed, uint32_t timestamp_us,
+                   void *arg) {
+  record(usage, pressed, timestamp_us);
+}
+
+static void on_control(uint8_t page, uint16_t usage, bool pressed,
+                       uint32_t timestamp_us, void *arg) {
+  record(PAGE(page, usage), pressed, timestamp_us);
+}
+
+static void on_macro(uint8_t index, void *arg) {
+  CHECK_EQ(index, 3);
+  macros_played++;
+}
+
+static const keymap_ops_t ops = {
+    .key = on_key,
+    .control = on_control,
+    .macro = on_macro,
+};
+
+// One key change of a trace, at ms from its start
+typedef struct {
+  uint32_t ms;
+  uint8_t pos;
+  bool pressed;
+} step_t;
+
+static void reset(uint32_t start) {
+  start_us = now_us = start;
+  out_count = 0;
+  macros_played = 0;
+  max_wait_us = 0;
+  memset(down, 0, sizeof(down));
+  keymap_init(&km, &def, &cfg, &ops);
+}
+
+// One scan: the key changes it found, then the tick
+static void scan(const step_t *steps, size_t count, size_t *next) {
+  while (*next < count && steps[*next].ms * 1000 == now_us - start_us) {
+    keymap_event(&km, steps[*next].pos, steps[*next].pressed, now_us);
+    (*next)++;
+  }
+  keymap_tick(&km, now_us);
+}
+
+// Scans from now until end_ms, steps must be sorted and not before now
+static void run(const step_t *steps, size_t count, uint32_t end_ms) {
+  size_t next = 0;
+  while (now_us - start_us <= end_ms * 1000) {
+    scan(steps, count, &next);
+    now_us += SCAN_US;
+    // Nothing pending, skip the scans that would find nothing
+    if (km.queue_len == 0 && next < count) {
+      now_us = start_us + steps[next].ms * 1000;
+    }
+  }
+  CHECK_EQ(next, count);
+}
+
+#define RUN(steps, end_ms) run(steps, sizeof(steps) / sizeof(steps[0]), end_ms)
+
+static void expect(const out_t *want, int count) {
+  CHECK_EQ(out_count, count);
+  for (int i = 0; i < count && i < out_count; i++) {
+    CHECK_EQ(outs[i].usage, want[i].usage);
+    CHECK_EQ(outs[i].pressed, want[i].pressed);
+    CHECK_EQ(outs[i].ts_ms, want[i].ts_ms);
+    CHECK_EQ(outs[i].at_ms, want[i].at_ms);
+  }
+}
+
+#define EXPECT(...)                                                            \
+  do {                                                                         \
+    const out_t want[] = {__VA_ARGS__};                                        \
+    expect(want, sizeof(want) / sizeof(want[0]));                              \
+  } while (0)
+
+static void test_plain(void) {
+  const step_t steps[] = {
+      {10, POS_A, true}, {15, POS_B, true}, {30, POS_A, false},
+      {40, POS_B, false}, {50, POS_VOL, true}, {60, POS_VOL, false},
+      {70, POS_MACRO, true}, {80, POS_MACRO, false},
+  };
+  reset(1000);
+  RUN(steps, 100);
+  EXPECT({0x04, true, 10, 10}, {0x05, true, 15, 15}, {0x04, false, 30, 30},
+         {0x05, false, 40, 40}, {PAGE(0x0C, CONSUMER_VOL_UP), true, 50, 50},
+         {PAGE(0x0C, CONSUMER_VOL_UP), false, 60, 60});
+  CHECK_EQ(macros_played, 1);
+  CHECK_EQ(max_wait_us, 0);
+}
+
+static void test_tap(void) {
+  // Released inside the term: the tap key, when the release comes
+  const step_t steps[] = {{0, POS_LT, true}, {120, POS_LT, false}};
+  reset(1000);
+  RUN(steps, 300);
+  EXPECT({0x06, true, 0, 120}, {0x06, false, 120, 120});
+  CHECK_EQ(km.stats.taps, 1);
+  CHECK_EQ(km.stats.max_wait_us, 120000);
+}
+
+static void test_hold_by_term(void) {
+  // Held past the term: layer 1 from then on. The key pressed on it keeps
+  // its layer 1 usage after the layer goes
+  const step_t steps[] = {
+      {0, POS_LT, true}, {250, POS_A, true}, {300, POS_LT, false},
+      {350, POS_A, false}, {400, POS_A, true}, {410, POS_A, false},
+  };
+  reset(1000);
+  RUN(steps, 500);
+  EXPECT({0x1E, true, 250, 250}, {0x1E, false, 350, 350},
+         {0x04, true, 400, 400}, {0x04, false, 410, 410});
+  CHECK_EQ(km.stats.holds, 1);
+  CHECK_EQ(km.stats.max_wait_us, TAPPING_US);
+}
+
+static void test_permissive_hold(void) {
+  // Another key down and up inside it: hold, decided at that release, the
+  // other key on layer 1 with its own timestamps
+  const step_t steps[] = {
+      {0, POS_LT, true}, {20, POS_A, true}, {60, POS_A, false},
+      {100, POS_LT, false},
+  };
+  reset(1000);
+  RUN(steps, 300);
+  EXPECT({0x1E, true, 20, 60}, {0x1E, false, 60, 60});
+  CHECK_EQ(km.stats.holds, 1);
+}
+
+static void test_rolling(void) {
+  // Released before the key pressed inside it: tap, in the original order
+  const step_t steps[] = {
+      {0, POS_LT, true}, {20, POS_A, true}, {40, POS_LT, false},
+      {60, POS_A, false},
+  };
+  reset(1000);
+  RUN(steps, 300);
+  EXPECT({0x06, true, 0, 40}, {0x04, true, 20, 40}, {0x06, false, 40, 40},
+         {0x04, false, 60, 60});
+}
+
+static void test_mod_tap(void) {
+  const step_t steps[] = {
+      {0, POS_MT, true}, {230, POS_A, true}, {240, POS_A, false},
+      {260, POS_MT, false}, {300, POS_MT, true}, {350, POS_MT, false},
+  };
+  reset(1000);
+  RUN(steps, 400);
+  EXPECT({0xE1, true, 0, 200}, {0x04, true, 230, 230},
+         {0x04, false, 240, 240}, {0xE1, false, 260, 260},
+         {0x07, true, 300, 350}, {0x07, false, 350, 350});
+}
+
+static void test_one_shot(void) {
+  const step_t steps[] = {
+      // Tapped: down until the next key is
+      {0, POS_OSM, true}, {10, POS_OSM, false}, {50, POS_A, true},
+      {60, POS_A, false},
+      // Tapped twice: cancelled
+      {100, POS_OSM, true}, {110, POS_OSM, false}, {120, POS_OSM, true},
+      {130, POS_OSM, false},
+      // Held through a key: a plain modifier
+      {200, POS_OSM, true}, {210, POS_B, true}, {220, POS_B, false},
+      {230, POS_OSM, false},
+  };
+  reset(1000);
+  RUN(steps, 300);
+  EXPECT({0xE0, true, 0, 0}, {0x04, true, 50, 50}, {0xE0, false, 50, 50},
+         {0x04, false, 60, 60}, {0xE0, true, 100, 100},
+         {0xE0, false, 120, 120}, {0xE0, true, 200, 200},
+         {0x05, true, 210, 210}, {0x05, false, 220, 220},
+         {0xE0, false, 230, 230});
+}
+
+static void test_combo(void) {
+  const step_t steps[] = {
+      // Both inside the combo term, the other key's release does nothing
+      {0, POS_E, true}, {15, POS_F, true}, {50, POS_F, false},
+      {60, POS_E, false},
+      // Alone: the key itself once the term is up
+      {100, POS_E, true}, {170, POS_E, false},
+      // Broken by another key
+      {200, POS_F, true}, {205, POS_A, true}, {210, POS_A, false},
+      {215, POS_F, false},
+      // Too late for the combo, the second key then waits on its own until
+      // its release rules the combo out
+      {300, POS_E, true}, {350, POS_F, true}, {360, POS_F, false},
+      {370, POS_E, false},
+  };
+  reset(1000);
+  RUN(steps, 400);
+  EXPECT({0x2A, true, 0, 15}, {0x2A, false, 60, 60}, {0x08, true, 100, 140},
+         {0x08, false, 170, 170}, {0x09, true, 200, 205},
+         {0x04, true, 205, 205}, {0x04, false, 210, 210},
+         {0x09, false, 215, 215}, {0x08, true, 300, 340},
+         {0x09, true, 350, 360}, {0x09, false, 360, 360},
+         {0x08, false, 370, 370});
+  CHECK_EQ(km.stats.combos, 1);
+  CHECK_EQ(km.stats.max_wait_us, COMBO_US);
+}
+
+static void test_forced(void) {
+  // Presses queue behind the tap-hold key until the queue is full
+  const step_t steps[] = {
+      {0, POS_LT, true},   {10, POS_A, true},  {11, POS_B, true},
+      {12, POS_G, true},   {13, POS_VOL, true}, {14, POS_MT, true},
+      {15, POS_E, true},   {16, POS_OSM, true}, {20, POS_A, false},
+      {21, POS_B, false},  {22, POS_G, false},  {23, POS_VOL, false},
+      {24, POS_MT, false}, {25, POS_E, false},  {26, POS_OSM, false},
+      {30, POS_LT, false},
+  };
+  reset(1000);
+  RUN(steps, 300);
+  CHECK(km.stats.forced >= 1);
+  CHECK_EQ(km.stats.holds, 1);
+  // Held on layer 1: A is 0x1E and G does nothing, decided at the 8th press
+  CHECK_EQ(outs[0].usage, 0x1E);
+  CHECK_EQ(outs[0].at_ms, 16);
+  CHECK(!down[0x1E] && !down[0x0A] && !down[0x05]);
+  CHECK(km.queue_len == 0);
+}
+
+static void test_layers(void) {
+  const step_t steps[] = {
+      // mo(1), A released after the layer went
+      {0, POS_MO, true}, {10, POS_A, true}, {20, POS_MO, false},
+      {30, POS_A, false},
+      // tg(2) on and off again
+      {50, POS_TG, true}, {55, POS_TG, false}, {60, POS_A, true},
+      {65, POS_A, false}, {70, POS_TG, true}, {75, POS_TG, false},
+      {80, POS_A, true}, {85, POS_A, false},
+  };
+  reset(1000);
+  RUN(steps, 100);
+  EXPECT({0x1E, true, 10, 10}, {0x1E, false, 30, 30}, {0x1F, true, 60, 60},
+         {0x1F, false, 65, 65}, {0x04, true, 80, 80}, {0x04, false, 85, 85});
+  CHECK_EQ(km.layers, 1);
+}
+
+static void test_clock_wrap(void) {
+  const step_t steps[] = {{0, POS_LT, true}, {250, POS_LT, false},
+                          {300, POS_LT, true}, {320, POS_LT, false}};
+  reset(UINT32_MAX - 100000);
+  RUN(steps, 400);
+  CHECK_EQ(km.stats.holds, 1);
+  CHECK_EQ(km.stats.taps, 1);
+  EXPECT({0x06, true, 300, 320}, {0x06, false, 320, 320});
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rand_next(void) {
+  // xorshift32
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Random presses and releases of random keys at random gaps, bursts of
+// keys in the same scan included, everything released at the end
+static void fuzz_run(void) {
+  step_t steps[96];
+  bool held[KEYS] = {false};
+  size_t count = 0;
+  uint32_t ms = 0;
+
+  reset(rand_next());
+  while (count < 80) {
+    uint32_t gap = rand_next() % 4;
+    ms += gap == 0 ? 0 : gap == 1 ? rand_next() % 10 : rand_next() % 300;
+    uint8_t pos = rand_next() % KEYS;
+    steps[count++] = (step_t){ms, pos, !held[pos]};
+    held[pos] = !held[pos];
+  }
+  for (uint8_t pos = 0; pos < KEYS; pos++) {
+    if (held[pos]) {
+      ms += rand_next() % 50;
+      steps[count++] = (step_t){ms, pos, false};
+    }
+  }
+  // Past the terms, then one key to use up an armed one-shot modifier
+  ms += TAPPING_US / 1000 + 1;
+  steps[count++] = (step_t){ms, POS_B, true};
+  steps[count++] = (step_t){ms + 1, POS_B, false};
+  run(steps, count, ms + TAPPING_US / 1000 + 2);
+
+  CHECK(km.queue_len == 0);
+  for (size_t i = 0; i < sizeof(down); i++) {
+    CHECK(!down[i]);
+  }
+  if (km.stats.max_wait_us > max_wait_us) {
+    max_wait_us = km.stats.max_wait_us;
+  }
+}
+
+int main(int argc, char **argv) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  uint32_t worst = 0;
+
+  test_plain();
+  test_tap();
+  test_hold_by_term();
+  test_permissive_hold();
+  test_rolling();
+  test_mod_tap();
+  test_one_shot();
+  test_combo();
+  test_forced();
+  test_layers();
+  test_clock_wrap();
+
+  int i = 0;
+  for (int failures = check_failures; i < runs; i++) {
+    fuzz_run();
+    if (max_wait_us > worst) {
+      worst = max_wait_us;
+    }
+    if (check_failures != failures) {
+      break;
+    }
+  }
+  printf("%d runs, worst decision latency %u us\n", i, worst);
+  CHECK(worst <= MAX_WAIT_US);
+  CHECK_DONE();
+}
@@ -0,0 +1,121 @@
+// Several writer threads log numbered records at once while the klog task
+// prints them, like the report path on both cores does. Checks every record
+// is either printed whole or counted as dropped, and that each writer's
+// records come out in the order it wrote them. Then the argument
+// conversions: narrow and negative values print as their format says.
+//
+// Usage: test_klog [records per writer]
+#include "check.h"
+#include "fake_esp.h"
+#include "klog.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_RECORDS 200000
+#define WRITERS 4
+
+static uint32_t records;
+// Next sequence number each writer may print, and lines that did not match
+static int32_t next_seq[WRITERS];
+static _Atomic uint32_t bad_lines;
+static char last_line[128];
+// Lines printed before the klog task started
+static uint32_t lines_start;
+
+// Lines end in "GAP: <message>\n"
+static const char *message(const char *line) {
+  const char *msg = strstr(line, "GAP: ");
+  return msg != NULL ? msg + 5 : "";
+}
+
+static void check_line(const char *line) {
+  int w, seq, check;
+
+  // The sequence number and its negated xor, so a torn record shows up
+  if (sscanf(message(line), "w=%d seq=%d check=%d", &w, &seq, &check) != 3 ||
+      w < 0 || w >= WRITERS || check != -(seq ^ w) || seq < next_seq[w]) {
+    bad_lines++;
+    return;
+  }
+  next_seq[w] = seq + 1;
+}
+
+static void keep_line(const char *line) {
+  snprintf(last_line, sizeof(last_line), "%s", message(line));
+}
+
+static void *writer(void *arg) {
+  int w = (int)(intptr_t)arg;
+
+  for (uint32_t seq = 0; seq < records; seq++) {
+    KLOG_I(GAP, "w=%d seq=%d check=%d", w, (int)seq, -((int)seq ^ w));
+    if (seq % 64 == 63) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+// Waits for the klog task to print everything written so far
+static void drain(void) {
+  struct klog_stats stats;
+  klog_get_stats(&stats);
+  while (fake_log_lines() - lines_start < stats.written) {
+    sched_yield();
+  }
+}
+
+static void test_writers(void) {
+  pthread_t threads[WRITERS];
+  struct klog_stats before, after;
+  uint32_t lines_before = fake_log_lines();
+
+  klog_get_stats(&before);
+  fake_log_hook_set(check_line);
+  for (int w = 0; w < WRITERS; w++) {
+    pthread_create(&threads[w], NULL, writer, (void *)(intptr_t)w);
+  }
+  for (int w = 0; w < WRITERS; w++) {
+    pthread_join(threads[w], NULL);
+  }
+  drain();
+  fake_log_hook_set(NULL);
+
+  klog_get_stats(&after);
+  uint32_t written = after.written - before.written;
+  uint32_t dropped = after.dropped - before.dropped;
+  CHECK_EQ(written + dropped, WRITERS * records);
+  CHECK_EQ(fake_log_lines() - lines_before, written);
+  CHECK_EQ(bad_lines, 0);
+  printf("%u records, %u printed, %u dropped\n", WRITERS * records, written,
+         dropped);
+}
+
+static void test_conversions(void) {
+  uint8_t u8 = 0xfe;
+  int16_t i16 = -2;
+
+  fake_log_hook_set(keep_line);
+  KLOG_I(GAP, "%u %d %d 0x%x", u8, i16, -70000, 0xdeadbeefu);
+  drain();
+  CHECK(strcmp(last_line, "254 -2 -70000 0xdeadbeef\n") == 0);
+
+  KLOG_I(GAP, "no arguments");
+  drain();
+  CHECK(strcmp(last_line, "no arguments\n") == 0);
+  fake_log_hook_set(NULL);
+}
+
+int main(int argc, char **argv) {
+  records = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_RECORDS;
+  fake_log_level_set(ESP_LOG_NONE);
+  lines_start = fake_log_lines();
+  CHECK_EQ(klog_init(), 0);
+
+  test_writers();
+  test_conversions();
+  CHECK_DONE();
+}
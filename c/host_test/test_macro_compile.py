@@ -0,0 +1,247 @@
+#!/usr/bin/env python3
+"""Tests of tools/macro_compile.py against main/macro.c.
+
+Stores compiled by the tool are played by the firmware's player, built for
+the host as macro_play, and every key change and delay has to match what
+--simulate prints and what the tool's own player yields. Corrupted stores
+have to be rejected by macro_store_check(): every single bit flip outside
+the reserved header field, and damaged stores with a valid CRC.
+
+Usage: test_macro_compile.py <macro_play> [unittest options]
+"""
+
+import os
+import random
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOOLS = os.path.join(HERE, "..", "tools")
+sys.path.insert(0, TOOLS)
+
+import macro_compile as mc  # noqa: E402
+
+MACRO_PLAY = None
+
+# macro_err_t, main/macro.h
+MACRO_OK, MACRO_ERR_HEADER, MACRO_ERR_CRC, MACRO_ERR_OPS = range(4)
+
+# Header bytes macro_store_check() does not look at
+RESERVED = range(6, 8)
+
+SOURCE = r'''
+macro login
+  text "admin\t"
+  delay 50
+  text "Hunter2!\n"
+end
+
+# Keys left down are released by the player
+macro copy
+  press lctrl
+  tap c
+end
+
+macro mixed
+  tap enter esc
+  press lshift
+  tap a 0x1e
+  release lshift
+  delay 3
+  text "{[(Quote \" back\\slash ~`)]}"
+  delay 70000
+  press f13 ralt
+end
+'''
+
+TIMELINE_RE = re.compile(r"\s*([\d.]+) ms  (down|up)\s+(\S+)$")
+
+
+def play_c(*stores):
+    """Runs the stores through macro.c, returns (err, [steps per macro])."""
+    with tempfile.TemporaryDirectory() as tmp:
+        paths = []
+        for i, store in enumerate(stores):
+            paths.append(os.path.join(tmp, f"{i}.bin"))
+            with open(paths[-1], "wb") as f:
+                f.write(store)
+        out = subprocess.run([MACRO_PLAY] + paths, check=True,
+                             capture_output=True, text=True).stdout
+
+    results = []
+    for line in out.splitlines():
+        word, *args = line.split()
+        if word == "store":
+            results.append((int(args[0]), []))
+        elif word == "macro":
+            results[-1][1].append([])
+        elif word == "delay":
+            results[-1][1][-1].append(("delay", int(args[0])))
+        else:
+            results[-1][1][-1].append(("key", int(args[0], 16),
+                                       word == "down"))
+    return results
+
+
+def play_py(store):
+    return [list(mc.play(store, i)) for i in range(store[5])]
+
+
+def with_crc(store):
+    """store with its CRC fixed up, so only the damage is left to find."""
+    store = bytearray(store)
+    length = struct.unpack_from("<I", store, 8)[0]
+    struct.pack_into("<I", store, 12, zlib.crc32(store[16:length]))
+    return bytes(store)
+
+
+def random_macro(rng):
+    ops = bytearray()
+    for _ in range(rng.randrange(1, 20)):
+        op = rng.choice([mc.OP_PRESS, mc.OP_RELEASE, mc.OP_TAP,
+                         mc.OP_DELAY, mc.OP_TEXT])
+        if op == mc.OP_DELAY:
+            ops += struct.pack("<BH", op, rng.randrange(0x10000))
+        elif op == mc.OP_TEXT:
+            text = "".join(rng.choice(list(mc.ASCII))
+                           for _ in range(rng.randrange(256)))
+            ops += bytes([op, len(text)]) + text.encode("ascii")
+        else:
+            ops += bytes([op, rng.randrange(256)])
+    return ("random", ops + bytes([mc.OP_END]))
+
+
+class Compare(unittest.TestCase):
+    def setUp(self):
+        self.store = mc.build_store(mc.parse(SOURCE, "source"))
+
+    def test_player_matches(self):
+        ((err, steps),) = play_c(self.store)
+        self.assertEqual(err, MACRO_OK)
+        self.assertEqual(steps, play_py(self.store))
+
+    def test_random_stores(self):
+        rng = random.Random(1)
+        stores = [mc.build_store([random_macro(rng)
+                                  for _ in range(rng.randrange(1, 8))])
+                  for _ in range(200)]
+        for i, (err, steps) in enumerate(play_c(*stores)):
+            with self.subTest(store=i):
+                self.assertEqual(err, MACRO_OK)
+                self.assertEqual(steps, play_py(stores[i]))
+
+    def test_simulate_matches(self):
+        ((_, steps),) = play_c(self.store)
+        with tempfile.TemporaryDirectory() as tmp:
+            src = os.path.join(tmp, "macros.txt")
+            with open(src, "w") as f:
+                f.write(SOURCE)
+            for index, want in enumerate(steps):
+                out = subprocess.run(
+                    [sys.executable, os.path.join(TOOLS, "macro_compile.py"),
+                     "--simulate", str(index), src],
+                    check=True, capture_output=True, text=True).stdout
+                timeline = [m.groups() for m in map(TIMELINE_RE.match,
+                                                    out.splitlines()) if m]
+                with self.subTest(macro=index):
+                    self.check_timeline(timeline, want)
+
+    def check_timeline(self, timeline, want):
+        """The printed timeline against macro.c's steps: same key changes
+        in the same order, at most TX_BURST_MAX per interval, and a delay
+        step at least its ms (one interval if shorter) after the last key"""
+        keys = [(mc.parse_key(name, "timeline"), kind == "down")
+                for _, kind, name in timeline]
+        self.assertEqual(keys, [(s[1], s[2]) for s in want if s[0] == "key"])
+
+        times = [float(t) for t, _, _ in timeline]
+        for t in set(times):
+            self.assertLessEqual(times.count(t), mc.TX_BURST_MAX)
+        i = 0
+        for step in want:
+            if step[0] == "key":
+                i += 1
+            elif 0 < i < len(times):
+                # Rounded to 0.01 ms in the printout
+                self.assertGreaterEqual(times[i] - times[i - 1] + 0.01,
+                                        max(step[1], 7.5))
+
+    def test_typed_text(self):
+        timeline = mc.simulate(self.store, 0, 7.5)
+        self.assertEqual(mc.typed_text(timeline), "admin\tHunter2!\n")
+
+
+class Corrupted(unittest.TestCase):
+    def setUp(self):
+        self.store = mc.build_store(mc.parse(SOURCE, "source"))
+
+    def test_every_bit_flip(self):
+        flipped = []
+        for off in range(len(self.store)):
+            for bit in range(8):
+                store = bytearray(self.store)
+                store[off] ^= 1 << bit
+                flipped.append((off, bit, bytes(store)))
+        results = play_c(*[store for _, _, store in flipped])
+        for (off, bit, _), (err, _) in zip(flipped, results):
+            with self.subTest(offset=off, bit=bit):
+                if off in RESERVED:
+                    self.assertEqual(err, MACRO_OK)
+                else:
+                    self.assertNotEqual(err, MACRO_OK)
+
+    def test_truncated(self):
+        stores = [self.store[:n] for n in range(len(self.store))]
+        for n, (err, _) in enumerate(play_c(*stores)):
+            with self.subTest(length=n):
+                self.assertEqual(err, MACRO_ERR_HEADER)
+
+    def test_damage_behind_valid_crc(self):
+        ops_start = 16 + 4 * self.store[5]
+        (first,) = struct.unpack_from("<I", self.store, 16)
+        end = len(self.store)
+
+        def patched(off, data):
+            store = bytearray(self.store)
+            store[off:off + len(data)] = data
+            return with_crc(store)
+
+        cases = {
+            "unknown op": (patched(first, b"\x07"), MACRO_ERR_OPS),
+            "untypeable text": (patched(first + 2, b"\x80"), MACRO_ERR_OPS),
+            "offset into table": (patched(20, struct.pack("<I", 16)),
+                                  MACRO_ERR_OPS),
+            "offset past end": (patched(20, struct.pack("<I", end)),
+                                MACRO_ERR_OPS),
+            "first offset moved": (patched(16, struct.pack("<I", first + 2)),
+                                   MACRO_ERR_HEADER),
+            "no end op": (with_crc(self.store[:-1] + b"\x03"),
+                          MACRO_ERR_OPS),
+            "text past end": (with_crc(self.store[:-1] + b"\x05\x09ab"),
+                              MACRO_ERR_OPS),
+            "length past file": (patched(8, struct.pack("<I", end + 1)),
+                                 MACRO_ERR_HEADER),
+            "length into table": (patched(8, struct.pack("<I",
+                                                         ops_start - 1)),
+                                  MACRO_ERR_HEADER),
+            "macro dropped": (patched(5, b"\x02"), MACRO_ERR_HEADER),
+            "version": (patched(4, b"\x02"), MACRO_ERR_HEADER),
+        }
+        names = list(cases)
+        results = play_c(*[cases[n][0] for n in names])
+        for name, (err, _) in zip(names, results):
+            with self.subTest(name):
+                self.assertEqual(err, cases[name][1])
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        sys.exit(2)
+    MACRO_PLAY = sys.argv.pop(1)
+    unittest.main()
@@ -0,0 +1,250 @@
+// power_policy on a simulated timeline: a chip that light sleeps whenever
+// the policy lets it and wakes for every radio event, driven through a
+// connect, typing, going idle and a USB keyboard. Hold and sleep decisions
+// are checked as they happen, the current estimate against the charge the
+// simulation adds up on its own.
+#include "check.h"
+#include "config.h"
+#include "power_policy.h"
+
+static const power_policy_cfg_t cfg = {
+    .awake_ua = POWER_AWAKE_UA,
+    .sleep_ua = POWER_SLEEP_UA,
+    .radio_event_nc = POWER_RADIO_EVENT_NC,
+    .link_hold_ms = POWER_LINK_HOLD_MS,
+};
+
+static int set_sleep_calls;
+static bool sleep_allowed;
+
+static void set_sleep(bool allowed, void *arg) {
+  set_sleep_calls++;
+  sleep_allowed = allowed;
+}
+
+static const power_policy_ops_t ops = {.set_sleep = set_sleep};
+
+// The simulated chip
+static power_policy_t p;
+static uint32_t now;
+static uint32_t tick_at;    // 0 if the policy has nothing scheduled
+static uint32_t period_us;  // Radio event period, 0 for none
+static uint64_t next_event; // us
+static uint64_t sim_us;
+static uint64_t sim_asleep_us;
+static uint64_t sim_events;
+static uint32_t sim_wakes;
+
+static void run_tick(void) {
+  uint32_t next = power_policy_tick(&p, now);
+  tick_at = next == UINT32_MAX ? 0 : now + next;
+}
+
+static void reset(uint32_t start) {
+  now = start;
+  tick_at = 0;
+  period_us = 0;
+  sim_us = sim_asleep_us = 0;
+  sim_events = sim_wakes = 0;
+  set_sleep_calls = 0;
+  power_policy_init(&p, &cfg, &ops, now);
+}
+
+static void radio(uint32_t period) {
+  period_us = period;
+  next_event = sim_us + period;
+  power_policy_radio(&p, power_rate_mhz(period), now);
+}
+
+static void hold(power_hold_t h, bool held) {
+  power_policy_hold(&p, h, held, now);
+  run_tick();
+}
+
+// Runs the timeline ms by ms. While allowed the chip sleeps through every
+// ms that has no radio event in it, the way tickless idle would, and books
+// each stretch of sleep as one timer wake when it ends
+static void advance(uint32_t ms) {
+  uint64_t slept = 0;
+
+  for (uint32_t i = 0; i < ms; i++) {
+    bool event = false;
+    sim_us += 1000;
+    while (period_us != 0 && next_event <= sim_us) {
+      sim_events++;
+      next_event += period_us;
+      event = true;
+    }
+    if (sleep_allowed && !event) {
+      slept += 1000;
+    } else if (slept != 0) {
+      power_policy_wake(&p, POWER_WAKE_TIMER, 1, slept);
+      sim_asleep_us += slept;
+      sim_wakes++;
+      slept = 0;
+    }
+    now++;
+    if (tick_at != 0 && now == tick_at) {
+      run_tick();
+    }
+  }
+  if (slept != 0) {
+    power_policy_wake(&p, POWER_WAKE_TIMER, 1, slept);
+    sim_asleep_us += slept;
+    sim_wakes++;
+  }
+}
+
+// The estimate against the charge the simulation counted
+static void check_estimate(void) {
+  power_stats_t stats;
+  uint64_t awake = sim_us - sim_asleep_us;
+  uint64_t charge_pc = awake * cfg.awake_ua + sim_asleep_us * cfg.sleep_ua +
+                       sim_events * cfg.radio_event_nc * 1000;
+  uint32_t want_ua = (uint32_t)(charge_pc / sim_us);
+
+  power_policy_stats(&p, now, &stats);
+  // The policy books radio charge at the event rate, the simulation per
+  // whole event, so they may differ by the events of a ms
+  CHECK(stats.avg_ua + 20 >= want_ua && stats.avg_ua <= want_ua + 20);
+  CHECK_EQ(stats.sleep_permille, sim_asleep_us * 1000 / sim_us);
+  CHECK_EQ(stats.wakes[POWER_WAKE_TIMER], sim_wakes);
+  CHECK_EQ(stats.radio_mhz, power_rate_mhz(period_us));
+}
+
+static void test_holds(void) {
+  reset(1000);
+  // Nothing held, sleep is allowed right away
+  CHECK_EQ(set_sleep_calls, 1);
+  CHECK(sleep_allowed);
+
+  hold(POWER_HOLD_SCAN, true);
+  CHECK(!sleep_allowed);
+  hold(POWER_HOLD_USB, true);
+  hold(POWER_HOLD_SCAN, false);
+  CHECK(!sleep_allowed);
+  // Dropping what is not held and taking what is changes nothing
+  hold(POWER_HOLD_SCAN, false);
+  hold(POWER_HOLD_USB, true);
+  CHECK_EQ(set_sleep_calls, 2);
+  hold(POWER_HOLD_USB, false);
+  CHECK(sleep_allowed);
+  CHECK_EQ(set_sleep_calls, 3);
+  CHECK_EQ(tick_at, 0);
+}
+
+static void test_link_hold(void) {
+  reset(1000);
+  hold(POWER_HOLD_LINK, true);
+  CHECK(!sleep_allowed);
+  CHECK_EQ(tick_at, 1000 + POWER_LINK_HOLD_MS);
+
+  // Taken again by a second connection, the timeout restarts
+  advance(1000);
+  hold(POWER_HOLD_LINK, true);
+  CHECK_EQ(tick_at, 2000 + POWER_LINK_HOLD_MS);
+  advance(POWER_LINK_HOLD_MS - 1);
+  CHECK(!sleep_allowed);
+  // The central never settled, the hold lapses by itself
+  advance(1);
+  CHECK(sleep_allowed);
+  CHECK_EQ(tick_at, 0);
+
+  // Settled in time, dropped before it lapses
+  hold(POWER_HOLD_LINK, true);
+  advance(200);
+  hold(POWER_HOLD_LINK, false);
+  CHECK(sleep_allowed);
+  CHECK_EQ(tick_at, 0);
+
+  // The lapse leaves other holds alone
+  hold(POWER_HOLD_LINK, true);
+  hold(POWER_HOLD_SCAN, true);
+  advance(POWER_LINK_HOLD_MS);
+  CHECK(!sleep_allowed);
+  CHECK_EQ(p.holds, POWER_HOLD_SCAN);
+
+  // Across the ms clock wrapping
+  reset(UINT32_MAX - 100);
+  hold(POWER_HOLD_LINK, true);
+  advance(POWER_LINK_HOLD_MS - 1);
+  CHECK(!sleep_allowed);
+  advance(1);
+  CHECK(sleep_allowed);
+}
+
+// A session: advertising, a host connecting, typing, idle, a USB keyboard
+static void test_session(void) {
+  power_stats_t stats;
+
+  reset(5000);
+  power_policy_stats(&p, now, &stats);
+  CHECK_EQ(stats.avg_ua, 0);
+  CHECK_EQ(stats.sleep_permille, 0);
+
+  radio(POWER_ADV_ITVL_MS * 1000);
+  advance(10000);
+  check_estimate();
+  power_policy_stats(&p, now, &stats);
+  // Advertising alone sleeps almost all the time
+  CHECK(stats.sleep_permille > 950);
+  CHECK(stats.avg_ua < POWER_SLEEP_UA + 1000);
+
+  // Connected at 7.5 ms, awake until the parameters settle
+  radio(7500);
+  hold(POWER_HOLD_LINK, true);
+  advance(400);
+  hold(POWER_HOLD_LINK, false);
+  check_estimate();
+
+  // Typing: a key down holds the scanner awake for 80 ms at a time
+  for (int i = 0; i < 50; i++) {
+    hold(POWER_HOLD_SCAN, true);
+    advance(80);
+    hold(POWER_HOLD_SCAN, false);
+    advance(120);
+  }
+  check_estimate();
+
+  // Idle: 70 ms interval with 10 events of latency
+  radio(70000 * 11);
+  advance(60000);
+  check_estimate();
+  power_policy_stats(&p, now, &stats);
+  CHECK(stats.sleep_permille > 900);
+
+  // A USB keyboard keeps the chip up the whole time it is plugged in
+  uint64_t asleep = sim_asleep_us;
+  hold(POWER_HOLD_USB, true);
+  advance(30000);
+  CHECK_EQ(sim_asleep_us, asleep);
+  hold(POWER_HOLD_USB, false);
+  advance(1000);
+  check_estimate();
+
+  // Key wakes are counted apart from timer ones
+  power_policy_wake(&p, POWER_WAKE_KEY, 3, 0);
+  power_policy_stats(&p, now, &stats);
+  CHECK_EQ(stats.wakes[POWER_WAKE_KEY], 3);
+  CHECK_EQ(stats.wakes[POWER_WAKE_TIMER], sim_wakes);
+}
+
+// Sleep is counted in us and time in ms, more sleep than time is capped
+static void test_sleep_capped(void) {
+  power_stats_t stats;
+
+  reset(1000);
+  now += 100;
+  power_policy_wake(&p, POWER_WAKE_TIMER, 1, 100500);
+  power_policy_stats(&p, now, &stats);
+  CHECK_EQ(stats.sleep_permille, 1000);
+  CHECK_EQ(stats.avg_ua, POWER_SLEEP_UA);
+}
+
+int main(void) {
+  test_holds();
+  test_link_hold();
+  test_session();
+  test_sleep_capped();
+  CHECK_DONE();
+}
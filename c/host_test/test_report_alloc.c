@@ -0,0 +1,94 @@
+// The report path makes no heap allocation once the first report went out.
+// Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, so every call
+// the firmware sources and the stand-in make is counted here
+#include "check.h"
+#include "control_report.h"
+#include "fake_central.h"
+#include "fake_nimble.h"
+#include "gap.h"
+#include "hogp_gatt_svr.h"
+#include "key_trace_svc.h"
+#include "power_mgr.h"
+#include "report_builder.h"
+#include "report_pool.h"
+#include <stdlib.h>
+
+#define VOLUME_UP 0xe9
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static unsigned allocs;
+
+void *__wrap_malloc(size_t size) {
+  allocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  allocs++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocs++;
+  return __real_realloc(ptr, size);
+}
+
+static void on_sync(void) { adv_init(); }
+
+int main(void) {
+  ble_hs_cfg.sync_cb = on_sync;
+  ble_hs_cfg.gatts_register_cb = hogp_gatt_svr_register_cb;
+  CHECK_EQ(power_mgr_init(), 0);
+  CHECK_EQ(gap_init(), 0);
+  CHECK_EQ(hogp_gatt_svr_init(), 0);
+  CHECK_EQ(key_trace_svc_init(), 0);
+  CHECK_EQ(fake_nimble_start(), 0);
+
+  uint16_t conn = fake_central_connect(1);
+  uint16_t nkro = fake_central_find_report(conn, KBD_NKRO_REPORT_ID, 1);
+  uint16_t consumer = fake_central_find_report(conn, CONSUMER_REPORT_ID, 1);
+  CHECK(nkro != 0 && consumer != 0);
+  CHECK_EQ(fake_central_subscribe(conn, nkro, true), 0);
+  CHECK_EQ(fake_central_subscribe(conn, consumer, true), 0);
+  fake_nimble_advance(200000);
+
+  // The first report, and whatever setup it takes
+  hogp_gatt_svr_post_key(0x04, true);
+  hogp_gatt_svr_post_key(0x04, false);
+  fake_nimble_advance(100000);
+  fake_central_clear(conn);
+
+  allocs = 0;
+  unsigned sent = 0;
+  unsigned received = 0;
+  for (int round = 0; round < 200; round++) {
+    uint8_t key = 0x04 + round % 26;
+    // Faster than the link takes them, so reports wait for mbufs too
+    for (int i = 0; i < 3; i++) {
+      hogp_gatt_svr_post_key(key + i, true);
+    }
+    hogp_gatt_svr_post_control(HID_PAGE_CONSUMER, VOLUME_UP, true);
+    hogp_gatt_svr_post_control(HID_PAGE_CONSUMER, VOLUME_UP, false);
+    for (int i = 0; i < 3; i++) {
+      hogp_gatt_svr_post_key(key + i, false);
+    }
+    sent += 8;
+    fake_nimble_advance(round % 4 == 0 ? 3000 : 30000);
+    received += fake_central_count(conn);
+    fake_central_clear(conn);
+  }
+  fake_nimble_advance(200000);
+  received += fake_central_count(conn);
+  CHECK_EQ(allocs, 0);
+  // Held back, never dropped
+  CHECK_EQ(received, sent);
+
+  struct report_pool_stats stats;
+  report_pool_get_stats(&stats);
+  CHECK_EQ(stats.free, REPORT_POOL_COUNT);
+  CHECK_EQ(stats.heap_allocs, 0);
+  CHECK_DONE();
+}
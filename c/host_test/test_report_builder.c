@@ -0,0 +1,136 @@
+// report_builder against a plain model of the held keys: fixed cases for the
+// boot slots and rollover, then a long random run checked after every event
+#include "check.h"
+#include "report_builder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_A 0x04
+#define KEY_B 0x05
+#define KEY_C 0x06
+#define KEY_LEFT_SHIFT 0xE1
+#define RANDOM_EVENTS 1000000
+
+#define BOOT_KEYS (HID_BOOT_R0_IN_F2_OFFSET / 8)
+
+static bool held[256];
+
+static bool nkro_bit(const report_builder_t *rb, uint8_t usage) {
+  uint32_t bit = HID_COMPLEX_R4_IN_F1_OFFSET + usage - KBD_NKRO_USAGE_MIN;
+  return (rb->nkro[bit / 8] >> (bit % 8)) & 1;
+}
+
+// Everything the reports say has to follow from the held keys
+static int check_model(const report_builder_t *rb) {
+  int before = check_failures;
+  uint8_t mods = 0;
+  int keys = 0;
+
+  for (int u = 1; u < 256; u++) {
+    if (u >= HID_KEY_LEFT_CTRL && u <= HID_KEY_RIGHT_GUI) {
+      mods |= held[u] << (u - HID_KEY_LEFT_CTRL);
+    } else {
+      keys += held[u];
+      if (u >= KBD_NKRO_USAGE_MIN &&
+          u < KBD_NKRO_USAGE_MIN + KBD_NKRO_USAGE_COUNT) {
+        CHECK_EQ(nkro_bit(rb, u), held[u]);
+      }
+    }
+  }
+  CHECK_EQ(rb->boot[0], mods);
+  CHECK_EQ(rb->nkro[0], mods);
+  CHECK_EQ(rb->key_count, keys);
+  CHECK_EQ(report_builder_rollover(rb), keys > KBD_BOOT_REPORT_KEYS);
+
+  const uint8_t *slots = &rb->boot[BOOT_KEYS];
+  if (keys > KBD_BOOT_REPORT_KEYS) {
+    for (int i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+      CHECK_EQ(slots[i], HID_KEY_ERR_ROLLOVER);
+    }
+  } else {
+    // Packed to the front, every held key exactly once
+    bool seen[256] = {0};
+    for (int i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+      if (i < keys) {
+        CHECK(held[slots[i]] && !seen[slots[i]]);
+        seen[slots[i]] = true;
+      } else {
+        CHECK_EQ(slots[i], HID_KEY_NONE);
+      }
+    }
+  }
+  return check_failures - before;
+}
+
+static bool apply(report_builder_t *rb, uint8_t usage, bool pressed) {
+  if (usage != HID_KEY_NONE) {
+    held[usage] = pressed;
+  }
+  return report_builder_apply(rb, usage, pressed);
+}
+
+static void test_fixed(void) {
+  report_builder_t rb;
+  report_builder_init(&rb);
+  memset(held, 0, sizeof(held));
+
+  CHECK(!apply(&rb, HID_KEY_NONE, true));
+  CHECK(apply(&rb, KEY_A, true));
+  CHECK(!apply(&rb, KEY_A, true)); // Repeat
+  CHECK(apply(&rb, KEY_LEFT_SHIFT, true));
+  CHECK(apply(&rb, KEY_B, true));
+  CHECK(apply(&rb, KEY_C, true));
+  CHECK_EQ(rb.boot[BOOT_KEYS], KEY_A);
+  CHECK_EQ(rb.boot[BOOT_KEYS + 1], KEY_B);
+  CHECK_EQ(rb.boot[BOOT_KEYS + 2], KEY_C);
+
+  // Releasing the middle one keeps press order
+  CHECK(apply(&rb, KEY_B, false));
+  CHECK_EQ(rb.boot[BOOT_KEYS], KEY_A);
+  CHECK_EQ(rb.boot[BOOT_KEYS + 1], KEY_C);
+  CHECK_EQ(rb.boot[BOOT_KEYS + 2], HID_KEY_NONE);
+  CHECK(!apply(&rb, KEY_B, false));
+  check_model(&rb);
+
+  // Into rollover and back out
+  for (uint8_t u = 0x10; u < 0x10 + KBD_BOOT_REPORT_KEYS; u++) {
+    apply(&rb, u, true);
+    check_model(&rb);
+  }
+  CHECK(report_builder_rollover(&rb));
+  apply(&rb, KEY_A, false);
+  apply(&rb, KEY_C, false);
+  CHECK(!report_builder_rollover(&rb));
+  check_model(&rb);
+  CHECK_EQ(rb.boot[BOOT_KEYS], 0x10);
+}
+
+static void test_random(void) {
+  report_builder_t rb;
+  report_builder_init(&rb);
+  memset(held, 0, sizeof(held));
+  srand(1);
+
+  for (int i = 0; i < RANDOM_EVENTS; i++) {
+    // Mostly a small set of keys, so chords and rollover happen a lot
+    uint8_t usage = rand() % 4 == 0 ? rand() % 256 : 0x04 + rand() % 12;
+    if (rand() % 8 == 0) {
+      usage = HID_KEY_LEFT_CTRL + rand() % 8;
+    }
+    bool pressed = rand() % 2;
+    bool changed = usage != HID_KEY_NONE && held[usage] != pressed;
+
+    CHECK_EQ(apply(&rb, usage, pressed), changed);
+    if (check_model(&rb) != 0) {
+      fprintf(stderr, "after event %d: usage 0x%02x %s\n", i, usage,
+              pressed ? "down" : "up");
+      break;
+    }
+  }
+}
+
+int main(void) {
+  test_fixed();
+  test_random();
+  CHECK_DONE();
+}
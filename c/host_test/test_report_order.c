@@ -0,0 +1,271 @@
+// Keyboard, consumer and system keys share the key ring, so the host has to
+// see their reports in the order the keys changed. A fixed interleaving
+// first, then a random run against a plain model of the three reports,
+// posted in bursts larger than a connection event takes
+#include "check.h"
+#include "control_report.h"
+#include "fake_central.h"
+#include "fake_nimble.h"
+#include "gap.h"
+#include "hogp_gatt_svr.h"
+#include "key_trace_svc.h"
+#include "power_mgr.h"
+#include "report_builder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_A 0x04
+#define KEY_B 0x05
+#define MUTE 0xe2
+#define VOLUME_UP 0xe9
+#define SYSTEM_SLEEP 0x82
+#define RANDOM_EVENTS 20000
+
+// Keys the random run presses, from every page
+static const struct {
+  uint8_t page;
+  uint16_t usage;
+} keys[] = {
+    {HID_PAGE_KEYBOARD, 0x04},         {HID_PAGE_KEYBOARD, 0x05},
+    {HID_PAGE_KEYBOARD, 0x06},         {HID_PAGE_KEYBOARD, 0x2c},
+    {HID_PAGE_KEYBOARD, 0x28},         {HID_PAGE_CONSUMER, 0xcd},
+    {HID_PAGE_CONSUMER, 0xe2},         {HID_PAGE_CONSUMER, 0xe9},
+    {HID_PAGE_CONSUMER, 0xea},         {HID_PAGE_CONSUMER, 0xb5},
+    {HID_PAGE_CONSUMER, 0xb6},         {HID_PAGE_GENERIC_DESKTOP, 0x81},
+    {HID_PAGE_GENERIC_DESKTOP, 0x82},  {HID_PAGE_GENERIC_DESKTOP, 0x83},
+};
+#define KEY_COUNT (sizeof(keys) / sizeof(keys[0]))
+
+typedef struct {
+  uint16_t handle;
+  uint8_t len;
+  uint8_t data[FAKE_CENTRAL_DATA_MAX];
+} expected_t;
+
+static uint16_t conn;
+static uint16_t nkro;
+static uint16_t consumer;
+static uint16_t system_h;
+
+// The model: held keys per page, and what each report says right now
+static bool kbd_held[256];
+static uint16_t consumer_held[CONSUMER_HELD_MAX];
+static uint8_t consumer_count;
+static uint8_t system_bits;
+static uint16_t consumer_value;
+
+// Reports the model says are on their way, oldest first
+// Every event makes one report at most, plus the fixed cases and cleanup
+static expected_t expected[RANDOM_EVENTS + 64];
+static uint32_t expected_head;
+static uint32_t expected_count;
+
+static void on_sync(void) { adv_init(); }
+
+static void expect_nkro(void) {
+  expected_t *e = &expected[expected_count++];
+  e->handle = nkro;
+  e->len = KBD_NKRO_REPORT_LEN;
+  memset(e->data, 0, sizeof(e->data));
+  for (int u = KBD_NKRO_USAGE_MIN;
+       u < KBD_NKRO_USAGE_MIN + KBD_NKRO_USAGE_COUNT; u++) {
+    uint8_t bit = u - KBD_NKRO_USAGE_MIN;
+    if (kbd_held[u]) {
+      e->data[1 + bit / 8] |= 1u << (bit % 8);
+    }
+  }
+}
+
+static void expect_consumer(void) {
+  expected_t *e = &expected[expected_count++];
+  e->handle = consumer;
+  e->len = CONSUMER_REPORT_LEN;
+  e->data[0] = consumer_value & 0xff;
+  e->data[1] = consumer_value >> 8;
+}
+
+static void expect_system(void) {
+  expected_t *e = &expected[expected_count++];
+  e->handle = system_h;
+  e->len = SYSTEM_REPORT_LEN;
+  e->data[0] = system_bits;
+}
+
+static void consumer_remove(uint16_t usage) {
+  for (uint8_t i = 0; i < consumer_count; i++) {
+    if (consumer_held[i] == usage) {
+      memmove(&consumer_held[i], &consumer_held[i + 1],
+              (consumer_count - i - 1) * sizeof(consumer_held[0]));
+      consumer_count--;
+      return;
+    }
+  }
+}
+
+// What a key change should send, if anything
+static void model_apply(uint8_t page, uint16_t usage, bool pressed) {
+  if (page == HID_PAGE_KEYBOARD) {
+    if (kbd_held[usage] != pressed) {
+      kbd_held[usage] = pressed;
+      expect_nkro();
+    }
+  } else if (page == HID_PAGE_CONSUMER) {
+    // The last one pressed and still held is the one reported
+    consumer_remove(usage);
+    if (pressed) {
+      if (consumer_count == CONSUMER_HELD_MAX) {
+        consumer_remove(consumer_held[0]);
+      }
+      consumer_held[consumer_count++] = usage;
+    }
+    uint16_t top = consumer_count > 0 ? consumer_held[consumer_count - 1] : 0;
+    if (top != consumer_value) {
+      consumer_value = top;
+      expect_consumer();
+    }
+  } else {
+    uint8_t bits = system_bits;
+    uint8_t bit = 1u << (usage - SYSTEM_USAGE_MIN);
+    bits = pressed ? bits | bit : bits & ~bit;
+    if (bits != system_bits) {
+      system_bits = bits;
+      expect_system();
+    }
+  }
+}
+
+static int post(uint8_t page, uint16_t usage, bool pressed) {
+  int rc = hogp_gatt_svr_post_control(page, usage, pressed);
+  if (rc == 0) {
+    model_apply(page, usage, pressed);
+  }
+  return rc;
+}
+
+// Takes what arrived off the link and checks it against the expected
+// reports, in order. Returns false at the first mismatch
+static bool received(void) {
+  uint32_t count = fake_central_count(conn);
+  bool ok = true;
+
+  for (uint32_t i = 0; i < count && ok; i++) {
+    const fake_notification_t *n = fake_central_get(conn, i);
+    if (expected_head == expected_count) {
+      fprintf(stderr, "report %u: not expected\n", expected_head);
+      ok = false;
+      break;
+    }
+    const expected_t *e = &expected[expected_head++];
+    ok = n->handle == e->handle && n->len == e->len &&
+         memcmp(n->data, e->data, e->len) == 0;
+    if (!ok) {
+      fprintf(stderr, "report %u: handle %u len %u, expected handle %u\n",
+              expected_head - 1, n->handle, n->len, e->handle);
+    }
+  }
+  fake_central_clear(conn);
+  CHECK(ok);
+  return ok;
+}
+
+static void test_interleaved(void) {
+  CHECK_EQ(post(HID_PAGE_KEYBOARD, KEY_A, true), 0);
+  CHECK_EQ(post(HID_PAGE_CONSUMER, MUTE, true), 0);
+  CHECK_EQ(post(HID_PAGE_KEYBOARD, KEY_A, false), 0);
+  CHECK_EQ(post(HID_PAGE_GENERIC_DESKTOP, SYSTEM_SLEEP, true), 0);
+  CHECK_EQ(post(HID_PAGE_CONSUMER, VOLUME_UP, true), 0);
+  CHECK_EQ(post(HID_PAGE_KEYBOARD, KEY_B, true), 0);
+  // Back to mute, then nothing held
+  CHECK_EQ(post(HID_PAGE_CONSUMER, VOLUME_UP, false), 0);
+  CHECK_EQ(post(HID_PAGE_GENERIC_DESKTOP, SYSTEM_SLEEP, false), 0);
+  CHECK_EQ(post(HID_PAGE_CONSUMER, MUTE, false), 0);
+  CHECK_EQ(post(HID_PAGE_KEYBOARD, KEY_B, false), 0);
+  CHECK_EQ(expected_count, 10);
+
+  fake_nimble_advance(200000);
+  CHECK_EQ(fake_central_count(conn), 10);
+  const uint16_t order[] = {nkro,     consumer, nkro,     system_h, consumer,
+                            nkro,     consumer, system_h, consumer, nkro};
+  for (int i = 0; i < 10; i++) {
+    CHECK_EQ(fake_central_get(conn, i)->handle, order[i]);
+  }
+  CHECK(received());
+  CHECK_EQ(expected_head, expected_count);
+}
+
+// Usages past the consumer report's Usage Maximum never reach the host, the
+// last one in range does
+static void test_consumer_range(void) {
+  CHECK_EQ(CONSUMER_USAGE_MAX, 0x2ff);
+  CHECK_EQ(hogp_gatt_svr_post_control(HID_PAGE_CONSUMER, 0x300, true), 0);
+  CHECK_EQ(hogp_gatt_svr_post_control(HID_PAGE_CONSUMER, 0x300, false), 0);
+  fake_nimble_advance(200000);
+  CHECK_EQ(fake_central_count(conn), 0);
+
+  CHECK_EQ(post(HID_PAGE_CONSUMER, CONSUMER_USAGE_MAX, true), 0);
+  CHECK_EQ(post(HID_PAGE_CONSUMER, CONSUMER_USAGE_MAX, false), 0);
+  fake_nimble_advance(200000);
+  CHECK_EQ(fake_central_count(conn), 2);
+  CHECK(received());
+  CHECK_EQ(expected_head, expected_count);
+}
+
+// Repeats, presses of held keys and releases of keys that are up included:
+// only changes may reach the host
+static void test_random(void) {
+  bool down[KEY_COUNT] = {false};
+
+  srand(1);
+  for (uint32_t done = 0; done < RANDOM_EVENTS;) {
+    int burst = 1 + rand() % 12;
+    for (int i = 0; i < burst; i++, done++) {
+      int k = rand() % KEY_COUNT;
+      bool pressed = rand() % 8 == 0 ? down[k] : !down[k];
+      if (post(keys[k].page, keys[k].usage, pressed) == 0) {
+        down[k] = pressed;
+      }
+    }
+    // Sometimes less than a connection event, so reports queue up
+    fake_nimble_advance(rand() % 4 == 0 ? 1000 : 7500 * (1 + rand() % 3));
+    if (!received()) {
+      return;
+    }
+  }
+  for (size_t k = 0; k < KEY_COUNT; k++) {
+    if (down[k]) {
+      CHECK_EQ(post(keys[k].page, keys[k].usage, false), 0);
+    }
+  }
+  fake_nimble_advance(500000);
+  CHECK(received());
+  CHECK_EQ(expected_head, expected_count);
+  CHECK_EQ(consumer_value, 0);
+  CHECK_EQ(system_bits, 0);
+  printf("%u events, %u reports in order\n", RANDOM_EVENTS, expected_count);
+}
+
+int main(void) {
+  ble_hs_cfg.sync_cb = on_sync;
+  ble_hs_cfg.gatts_register_cb = hogp_gatt_svr_register_cb;
+  CHECK_EQ(power_mgr_init(), 0);
+  CHECK_EQ(gap_init(), 0);
+  CHECK_EQ(hogp_gatt_svr_init(), 0);
+  CHECK_EQ(key_trace_svc_init(), 0);
+  CHECK_EQ(fake_nimble_start(), 0);
+
+  conn = fake_central_connect(1);
+  nkro = fake_central_find_report(conn, KBD_NKRO_REPORT_ID, 1);
+  consumer = fake_central_find_report(conn, CONSUMER_REPORT_ID, 1);
+  system_h = fake_central_find_report(conn, SYSTEM_REPORT_ID, 1);
+  CHECK(nkro != 0 && consumer != 0 && system_h != 0);
+  CHECK_EQ(fake_central_subscribe(conn, nkro, true), 0);
+  CHECK_EQ(fake_central_subscribe(conn, consumer, true), 0);
+  CHECK_EQ(fake_central_subscribe(conn, system_h, true), 0);
+  fake_nimble_advance(200000);
+  fake_central_clear(conn);
+
+  test_interleaved();
+  test_consumer_range();
+  test_random();
+  CHECK_DONE();
+}
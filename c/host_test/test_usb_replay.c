@@ -0,0 +1,237 @@
+// Replays USB keyboard report streams through usb_kbd_translate() into a
+// report_builder, as usb_bridge.c does, and checks after every report that:
+//
+//  - the keys the report builder holds are the ones the report has down
+//  - releases come before presses, and no more keys are ever held than the
+//    previous or the new report had
+//  - nothing is pressed twice or released while up
+//  - rollover and short reports change nothing, an unplug releases all
+//
+// Streams are text, one step per line, # starts a comment:
+//
+//   r 02 00 04 05 00 00 00 00   a report, in hex as the keyboard sent it
+//   e -05 +e1 +06               the events the report before must give, in
+//                               order ("e" alone for none)
+//   unplug                      the keyboard went away mid-stream
+//
+// Usage: test_usb_replay <stream>...
+#include "check.h"
+#include "report_builder.h"
+#include "usb_kbd_translate.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_REPORT_LEN 64
+#define MAX_EVENTS 32
+
+typedef struct {
+  uint8_t usage;
+  bool pressed;
+} event_t;
+
+static const char *path;
+static int line_no;
+
+static usb_kbd_translator_t translator;
+static report_builder_t rb;
+static event_t events[MAX_EVENTS];
+static size_t event_count;
+static int held;     // Usages down in rb, modifiers included
+static int held_max; // Most that may be down while applying this report
+
+#define FAIL(...)                                                              \
+  do {                                                                         \
+    fprintf(stderr, "%s:%d: ", path, line_no);                                 \
+    fprintf(stderr, __VA_ARGS__);                                              \
+    fputc('\n', stderr);                                                       \
+    check_failures++;                                                          \
+  } while (0)
+
+static bool rb_held(uint8_t usage) {
+  return (rb.pressed[usage / 32] >> (usage % 32)) & 1;
+}
+
+static void on_key(uint8_t usage, bool pressed, void *arg) {
+  if (event_count == MAX_EVENTS) {
+    FAIL("more than %d events for one report", MAX_EVENTS);
+    return;
+  }
+  if (event_count > 0 && pressed < events[event_count - 1].pressed) {
+    FAIL("release of %02x after a press", usage);
+  }
+  if (rb_held(usage) == pressed) {
+    FAIL("%s of %02x, which is already %s", pressed ? "press" : "release",
+         usage, pressed ? "down" : "up");
+  }
+  events[event_count++] = (event_t){usage, pressed};
+  report_builder_apply(&rb, usage, pressed);
+  held += pressed ? 1 : -1;
+  if (held > held_max) {
+    FAIL("%d keys held, the reports had at most %d", held, held_max);
+  }
+}
+
+// Usages down in a boot report, modifiers as 0xE0-0xE7
+static int report_keys(const uint8_t *report, bool *down) {
+  int n = 0;
+  memset(down, 0, 256 * sizeof(down[0]));
+  for (int i = 0; i < 8; i++) {
+    if (report[0] & (1u << i)) {
+      down[HID_KEY_LEFT_CTRL + i] = true;
+      n++;
+    }
+  }
+  for (int i = 2; i < USB_KBD_REPORT_LEN; i++) {
+    if (report[i] != HID_KEY_NONE && !down[report[i]]) {
+      down[report[i]] = true;
+      n++;
+    }
+  }
+  return n;
+}
+
+static void check_held(const bool *down) {
+  for (int usage = 0; usage < 256; usage++) {
+    if (rb_held(usage) != down[usage]) {
+      FAIL("%02x is %s, the keyboard has it %s", usage,
+           rb_held(usage) ? "down" : "up", down[usage] ? "down" : "up");
+    }
+  }
+}
+
+static void replay_report(const uint8_t *report, size_t len) {
+  bool down[256];
+  bool before[256];
+
+  for (int usage = 0; usage < 256; usage++) {
+    before[usage] = rb_held(usage);
+  }
+  event_count = 0;
+  if (len < USB_KBD_REPORT_LEN || report[2] == HID_KEY_ERR_ROLLOVER) {
+    held_max = held;
+    size_t n = usb_kbd_translate(&translator, report, len, on_key, NULL);
+    if (n != 0 || event_count != 0) {
+      FAIL("%s report gave %zu events",
+           len < USB_KBD_REPORT_LEN ? "short" : "rollover", event_count);
+    }
+    check_held(before);
+    return;
+  }
+
+  int keys = report_keys(report, down);
+  held_max = keys > held ? keys : held;
+  size_t n = usb_kbd_translate(&translator, report, len, on_key, NULL);
+  if (n != event_count) {
+    FAIL("returned %zu, gave %zu events", n, event_count);
+  }
+  check_held(down);
+}
+
+static void replay_unplug(void) {
+  bool none[256] = {false};
+
+  event_count = 0;
+  held_max = held;
+  size_t n = usb_kbd_release_all(&translator, on_key, NULL);
+  if (n != event_count) {
+    FAIL("returned %zu, gave %zu events", n, event_count);
+  }
+  for (size_t i = 0; i < event_count; i++) {
+    if (events[i].pressed) {
+      FAIL("unplug pressed %02x", events[i].usage);
+    }
+  }
+  check_held(none);
+  CHECK_EQ(held, 0);
+}
+
+static void expect_events(char *args) {
+  event_t want[MAX_EVENTS];
+  size_t count = 0;
+
+  for (char *tok = strtok(args, " \t\n"); tok != NULL;
+       tok = strtok(NULL, " \t\n")) {
+    if ((tok[0] != '+' && tok[0] != '-') || count == MAX_EVENTS) {
+      FAIL("bad event %s", tok);
+      return;
+    }
+    want[count++] = (event_t){(uint8_t)strtoul(tok + 1, NULL, 16),
+                              tok[0] == '+'};
+  }
+  if (count != event_count) {
+    FAIL("%zu events, expected %zu", event_count, count);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (want[i].usage != events[i].usage ||
+        want[i].pressed != events[i].pressed) {
+      FAIL("event %zu is %c%02x, expected %c%02x", i,
+           events[i].pressed ? '+' : '-', events[i].usage,
+           want[i].pressed ? '+' : '-', want[i].usage);
+    }
+  }
+}
+
+static void replay(const char *stream) {
+  char line[256];
+  FILE *f = fopen(stream, "r");
+
+  path = stream;
+  line_no = 0;
+  if (f == NULL) {
+    FAIL("can not open");
+    return;
+  }
+  usb_kbd_translator_init(&translator);
+  report_builder_init(&rb);
+  held = 0;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line_no++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char *cmd = line;
+    while (isspace((unsigned char)*cmd)) {
+      cmd++;
+    }
+    if (*cmd == '\0') {
+      continue;
+    }
+    bool has_args = cmd[1] == '\0' || isspace((unsigned char)cmd[1]);
+
+    if (strncmp(cmd, "unplug", 6) == 0) {
+      replay_unplug();
+    } else if (cmd[0] == 'e' && has_args) {
+      expect_events(cmd + 1);
+    } else if (cmd[0] == 'r' && has_args) {
+      uint8_t report[MAX_REPORT_LEN];
+      size_t len = 0;
+      for (char *tok = strtok(cmd + 1, " \t\n"); tok != NULL;
+           tok = strtok(NULL, " \t\n")) {
+        if (len == MAX_REPORT_LEN) {
+          FAIL("report longer than %d bytes", MAX_REPORT_LEN);
+          break;
+        }
+        report[len++] = (uint8_t)strtoul(tok, NULL, 16);
+      }
+      replay_report(report, len);
+    } else {
+      FAIL("unknown step: %s", cmd);
+    }
+  }
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: test_usb_replay <stream>...\n");
+    return 2;
+  }
+  for (int i = 1; i < argc; i++) {
+    replay(argv[i]);
+  }
+  CHECK_DONE();
+}
@@ -0,0 +1,264 @@
+#include "bench.h"
+#include "hogp_conn.h"
+#include "hogp_tx.h"
+#include "macro.h"
+#include "report_builder.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_CONN 1
+#define BENCH_VAL_HANDLE 10
+#define BENCH_NOTIFY_BIT 0x1
+// Key events built and queued before the queue is flushed
+#define BENCH_BATCH_MAX HOGP_TX_QUEUE_LEN
+
+#define BENCH_MACRO_TEXT                                                       \
+  "The quick brown fox jumps over the lazy dog, 1234567890 times. "
+
+typedef struct {
+  uint8_t usage;
+  uint8_t pressed;
+} bench_event_t;
+
+typedef enum {
+  BENCH_TYPING,
+  BENCH_CHORDS,
+  BENCH_MACRO,
+  BENCH_WORKLOAD_COUNT
+} bench_workload_t;
+
+static const char *const bench_names[] = {
+    [BENCH_TYPING] = "typing",
+    [BENCH_CHORDS] = "chords",
+    [BENCH_MACRO] = "macro",
+};
+
+typedef struct {
+  bench_workload_t workload;
+  uint32_t seed;
+  // typing: keys down, oldest first
+  uint8_t held[2];
+  uint8_t held_count;
+  // chords: keys of the chord down right now
+  uint8_t chord[5];
+  uint8_t chord_len;
+  // macro
+  macro_player_t player;
+} bench_gen_t;
+
+// A store of one macro typing BENCH_MACRO_TEXT. Built here, so the player
+// is started on it without macro_store_check()
+static uint8_t bench_store[MACRO_STORE_HDR_LEN + 4 + 2 +
+                           sizeof(BENCH_MACRO_TEXT)];
+
+static const struct gap_link_info bench_link = {
+    .conn_handle = BENCH_CONN, .conn_itvl = 6, .mtu = 247};
+static uint32_t bench_notified;
+
+static int bench_notify(uint16_t conn_handle, uint16_t val_handle,
+                        const uint8_t *data, uint8_t len, void *arg) {
+  bench_notified++;
+  return 0;
+}
+
+static const struct gap_link_info *bench_link_info(uint16_t conn_handle,
+                                                   void *arg) {
+  return conn_handle == BENCH_CONN ? &bench_link : NULL;
+}
+
+static void bench_sent(uint16_t conn_handle, void *arg) {}
+
+static const hogp_tx_ops_t bench_tx_ops = {
+    .notify = bench_notify,
+    .link = bench_link_info,
+    .sent = bench_sent,
+};
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void bench_store_build(void) {
+  uint8_t *p = bench_store;
+  uint8_t text_len = sizeof(BENCH_MACRO_TEXT) - 1;
+
+  put_u32(p, MACRO_STORE_MAGIC);
+  p[4] = MACRO_STORE_VERSION;
+  p[5] = 1;
+  put_u32(p + 8, sizeof(bench_store));
+  put_u32(p + MACRO_STORE_HDR_LEN, MACRO_STORE_HDR_LEN + 4);
+  p += MACRO_STORE_HDR_LEN + 4;
+  *p++ = MACRO_OP_TEXT;
+  *p++ = text_len;
+  memcpy(p, BENCH_MACRO_TEXT, text_len);
+  p[text_len] = MACRO_OP_END;
+}
+
+static uint32_t bench_rand(bench_gen_t *g) {
+  // xorshift32
+  g->seed ^= g->seed << 13;
+  g->seed ^= g->seed >> 17;
+  g->seed ^= g->seed << 5;
+  return g->seed;
+}
+
+// Letters and digits
+static uint8_t bench_key(bench_gen_t *g) { return 0x04 + bench_rand(g) % 36; }
+
+static size_t gen_typing(bench_gen_t *g, bench_event_t *events) {
+  if (g->held_count == 0 ||
+      (g->held_count == 1 && bench_rand(g) % 5 == 0)) {
+    uint8_t key = bench_key(g);
+    if (g->held_count == 1 && key == g->held[0]) {
+      key = key == 0x04 ? 0x05 : key - 1;
+    }
+    g->held[g->held_count++] = key;
+    events[0] = (bench_event_t){key, 1};
+  } else {
+    events[0] = (bench_event_t){g->held[0], 0};
+    g->held[0] = g->held[1];
+    g->held_count--;
+  }
+  return 1;
+}
+
+static size_t gen_chords(bench_gen_t *g, bench_event_t *events) {
+  size_t n = 0;
+
+  if (g->chord_len > 0) {
+    // Up together, in random order
+    while (g->chord_len > 0) {
+      uint8_t j = bench_rand(g) % g->chord_len;
+      events[n++] = (bench_event_t){g->chord[j], 0};
+      g->chord[j] = g->chord[--g->chord_len];
+    }
+    return n;
+  }
+
+  uint8_t size = 2 + bench_rand(g) % 4;
+  for (uint8_t i = 0; i < size; i++) {
+    uint8_t key = i == 0 && bench_rand(g) % 3 == 0
+                      ? HID_KEY_LEFT_CTRL + bench_rand(g) % 8
+                      : bench_key(g);
+    bool dup = false;
+    for (uint8_t j = 0; j < g->chord_len; j++) {
+      dup |= g->chord[j] == key;
+    }
+    if (!dup) {
+      g->chord[g->chord_len++] = key;
+      events[n++] = (bench_event_t){key, 1};
+    }
+  }
+  return n;
+}
+
+static size_t gen_macro(bench_gen_t *g, bench_event_t *events, size_t max) {
+  size_t n = 0;
+  macro_step_t step;
+
+  while (n < max) {
+    if (!macro_player_next(&g->player, &step)) {
+      // Over again
+      macro_player_start(&g->player, bench_store, 0);
+      if (n > 0) {
+        break;
+      }
+      continue;
+    }
+    if (step.type == MACRO_STEP_KEY) {
+      events[n++] = (bench_event_t){step.usage, step.pressed};
+    }
+  }
+  return n;
+}
+
+static size_t gen_next(bench_gen_t *g, bench_event_t *events, size_t max) {
+  switch (g->workload) {
+  case BENCH_TYPING:
+    return gen_typing(g, events);
+  case BENCH_CHORDS:
+    return gen_chords(g, events);
+  default:
+    return gen_macro(g, events, max);
+  }
+}
+
+static int bench_workload(const bench_ops_t *ops, bench_workload_t workload,
+                          uint32_t events) {
+  static const hogp_tx_trace_t untraced;
+  static hogp_tx_t tx;
+  static bench_gen_t gen;
+  report_builder_t rb;
+  bench_event_t batch[BENCH_BATCH_MAX];
+  uint64_t cycles = 0;
+  uint32_t done = 0;
+  uint32_t changed = 0;
+
+  hogp_conn_init();
+  hogp_conn_t *conn = hogp_conn_add(BENCH_CONN);
+  if (conn == NULL) {
+    return -1;
+  }
+  conn->notify_mask = BENCH_NOTIFY_BIT;
+  hogp_tx_init(&tx, &bench_tx_ops);
+  report_builder_init(&rb);
+  memset(&gen, 0, sizeof(gen));
+  gen.workload = workload;
+  gen.seed = 1;
+  macro_player_start(&gen.player, bench_store, 0);
+  bench_notified = 0;
+
+  while (done < events) {
+    size_t max = events - done < BENCH_BATCH_MAX ? events - done
+                                                 : BENCH_BATCH_MAX;
+    size_t n = gen_next(&gen, batch, max);
+    bool made_room;
+
+    uint32_t start = ops->cycles(ops->arg);
+    for (size_t i = 0; i < n; i++) {
+      if (report_builder_apply(&rb, batch[i].usage, batch[i].pressed)) {
+        hogp_tx_queue(&tx, conn, BENCH_VAL_HANDLE, BENCH_NOTIFY_BIT, rb.nkro,
+                      KBD_NKRO_REPORT_LEN, &untraced);
+        changed++;
+      }
+    }
+    while (tx.count > 0 &&
+           hogp_tx_flush(&tx, 0, &made_room) != UINT32_MAX && made_room) {
+    }
+    cycles += (uint32_t)(ops->cycles(ops->arg) - start);
+    done += n;
+  }
+
+  // Fixed point, two decimals
+  uint64_t per_event = cycles * 100 / done;
+  uint64_t ns = cycles * 100000 / ops->cpu_mhz / done;
+  char line[256];
+  snprintf(line, sizeof(line),
+           "{\"bench\": \"report_path\", \"workload\": \"%s\", "
+           "\"events\": %lu, \"reports\": %lu, \"cpu_mhz\": %lu, "
+           "\"cycles_per_event\": %lu.%02lu, \"ns_per_event\": %lu.%02lu}",
+           bench_names[workload], (unsigned long)done,
+           (unsigned long)bench_notified, (unsigned long)ops->cpu_mhz,
+           (unsigned long)(per_event / 100), (unsigned long)(per_event % 100),
+           (unsigned long)(ns / 100), (unsigned long)(ns % 100));
+  ops->print(line, ops->arg);
+
+  hogp_conn_init();
+  // Every change made a report, and every report went out
+  return tx.count == 0 && bench_notified == changed ? 0 : -1;
+}
+
+int bench_run(const bench_ops_t *ops, uint32_t events) {
+  int rc = 0;
+
+  bench_store_build();
+  for (int w = 0; w < BENCH_WORKLOAD_COUNT; w++) {
+    if (bench_workload(ops, w, events) != 0) {
+      rc = -1;
+    }
+  }
+  return rc;
+}
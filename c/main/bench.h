@@ -0,0 +1,40 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// Report path benchmark: key events through report_builder and hogp_tx, the
+// way the NimBLE host task turns them into notifications, with a notify op
+// that takes every report. Three workloads:
+//
+//  - typing: one key at a time, the next key sometimes down before the last
+//    one is up
+//  - chords: 2 to 5 keys, sometimes with a modifier, down together and up
+//    together
+//  - macro: a text macro played by macro.h as fast as the queue takes it
+//
+// Every workload prints one JSON line:
+//
+//   {"bench": "report_path", "workload": "typing", "events": 100000,
+//    "reports": 100000, "cpu_mhz": 160, "cycles_per_event": 412.35,
+//    "ns_per_event": 2577.18}
+//
+// It does not touch the hardware, the cycle counter and the output go
+// through bench_ops_t, so the same code runs on target (bench_mgr.h) and on
+// a PC (host_test/bench_report_path.c). It uses the hogp_conn.h table, so
+// on target it runs before hogp_gatt_svr_init().
+
+typedef struct {
+  // Free running cycle counter, wrapping at 32 bits
+  uint32_t (*cycles)(void *arg);
+  // Prints one line of JSON, without the newline
+  void (*print)(const char *line, void *arg);
+  void *arg;
+  uint32_t cpu_mhz; // Counter ticks per us
+} bench_ops_t;
+
+// Runs every workload with events key events. Returns 0, or -1 if a
+// workload lost a report on the way
+int bench_run(const bench_ops_t *ops, uint32_t events);
+
+#endif
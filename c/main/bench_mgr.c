@@ -0,0 +1,38 @@
+#include "bench_mgr.h"
+#include "bench.h"
+#include "config.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+
+static TaskHandle_t bench_waiter;
+static int bench_rc;
+
+static uint32_t bench_cycles(void *arg) { return esp_cpu_get_cycle_count(); }
+
+static void bench_print(const char *line, void *arg) { printf("%s\n", line); }
+
+static const bench_ops_t bench_ops = {
+    .cycles = bench_cycles,
+    .print = bench_print,
+    .cpu_mhz = POWER_MAX_FREQ_MHZ,
+};
+
+static void bench_task_fn(void *param) {
+  bench_rc = bench_run(&bench_ops, BENCH_EVENTS);
+  xTaskNotifyGive(bench_waiter);
+  vTaskDelete(NULL);
+}
+
+int bench_mgr_run(void) {
+  bench_waiter = xTaskGetCurrentTaskHandle();
+  if (xTaskCreatePinnedToCore(bench_task_fn, "bench", BENCH_TASK_STACK, NULL,
+                              BENCH_TASK_PRIO, NULL, CORE_INPUT) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start the bench task");
+    return -1;
+  }
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  return bench_rc;
+}
@@ -0,0 +1,12 @@
+#ifndef BENCH_MGR_H
+#define BENCH_MGR_H
+
+// ESP-IDF side of bench.h. Runs the report path bench on CORE_INPUT with
+// the CPU at POWER_MAX_FREQ_MHZ and prints its JSON lines to the console.
+// Built in with BENCH_REPORT_PATH (config.h).
+
+// Call before hogp_gatt_svr_init(), returns once the bench is done. 0 if
+// every workload got all its reports out
+int bench_mgr_run(void);
+
+#endif
@@ -0,0 +1,206 @@
+#include "bulk.h"
+#include <string.h>
+
+static uint32_t get_u32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+void bulk_init(bulk_t *b, const bulk_ops_t *ops) {
+  memset(b, 0, sizeof(*b));
+  b->ops = ops;
+}
+
+void bulk_open(bulk_t *b, uint16_t mtu) {
+  b->mtu = mtu < BULK_SDU_MAX ? mtu : BULK_SDU_MAX;
+  b->state = BULK_STATE_IDLE;
+}
+
+static void bulk_status(bulk_t *b, uint8_t op, bulk_err_t err, uint32_t bytes,
+                        uint32_t elapsed_us) {
+  uint8_t status[BULK_STATUS_LEN] = {BULK_OP_STATUS, op, err};
+
+  put_u32(status + 3, bytes);
+  put_u32(status + 7, elapsed_us);
+  b->ops->send(status, sizeof(status), b->ops->arg);
+}
+
+static void bulk_abort(bulk_t *b) {
+  if (b->state != BULK_STATE_IDLE) {
+    b->ops->abort(b->target, b->ops->arg);
+    b->state = BULK_STATE_IDLE;
+  }
+}
+
+void bulk_close(bulk_t *b) {
+  if (b->state == BULK_STATE_UPLOAD) {
+    b->stats.failed++;
+  }
+  bulk_abort(b);
+  b->mtu = 0;
+}
+
+// The first error sticks until COMMIT or ABORT, later data is dropped
+static void bulk_fail(bulk_t *b, uint8_t op, bulk_err_t err) {
+  b->state = BULK_STATE_FAILED;
+  b->err = err;
+  b->stats.failed++;
+  bulk_status(b, op, err, b->offset, 0);
+}
+
+static void bulk_begin(bulk_t *b, const uint8_t *sdu, uint16_t len,
+                       uint32_t now_us) {
+  if (len < BULK_BEGIN_LEN) {
+    bulk_status(b, BULK_OP_BEGIN, BULK_ERR_OP, 0, 0);
+    return;
+  }
+  // A new upload replaces one that was never committed
+  bulk_abort(b);
+
+  uint8_t target = sdu[1];
+  uint32_t total = get_u32(sdu + 2);
+  bulk_err_t err = b->ops->begin(target, total, b->ops->arg);
+  if (err == BULK_OK) {
+    b->state = BULK_STATE_UPLOAD;
+    b->target = target;
+    b->len = total;
+    b->offset = 0;
+    b->begin_us = now_us;
+  }
+  bulk_status(b, BULK_OP_BEGIN, err, 0, 0);
+}
+
+static void bulk_data(bulk_t *b, const uint8_t *data, uint16_t len) {
+  if (b->state == BULK_STATE_FAILED) {
+    return;
+  }
+  if (b->state != BULK_STATE_UPLOAD) {
+    bulk_status(b, BULK_OP_DATA, BULK_ERR_STATE, 0, 0);
+    return;
+  }
+  if (len > b->len - b->offset) {
+    bulk_fail(b, BULK_OP_DATA, BULK_ERR_RANGE);
+    return;
+  }
+  bulk_err_t err =
+      b->ops->write(b->target, b->offset, data, len, b->ops->arg);
+  if (err != BULK_OK) {
+    bulk_fail(b, BULK_OP_DATA, err);
+    return;
+  }
+  b->offset += len;
+  b->stats.bytes_in += len;
+}
+
+static void bulk_commit(bulk_t *b, uint32_t now_us) {
+  bulk_err_t err;
+
+  if (b->state == BULK_STATE_IDLE) {
+    bulk_status(b, BULK_OP_COMMIT, BULK_ERR_STATE, 0, 0);
+    return;
+  }
+  if (b->state == BULK_STATE_FAILED) {
+    err = b->err;
+    bulk_abort(b);
+  } else if (b->offset != b->len) {
+    err = BULK_ERR_RANGE;
+    b->stats.failed++;
+    bulk_abort(b);
+  } else {
+    err = b->ops->commit(b->target, b->ops->arg);
+    b->state = BULK_STATE_IDLE;
+    if (err == BULK_OK) {
+      b->stats.uploads++;
+    } else {
+      b->stats.failed++;
+    }
+  }
+  bulk_status(b, BULK_OP_COMMIT, err, b->offset, now_us - b->begin_us);
+}
+
+// Streams the whole source out before the next SDU is looked at. The send
+// op waits for credits, so the peer paces it
+static void bulk_dump(bulk_t *b, const uint8_t *sdu, uint16_t len) {
+  if (len < BULK_DUMP_LEN) {
+    bulk_status(b, BULK_OP_DUMP, BULK_ERR_OP, 0, 0);
+    return;
+  }
+  if (b->state != BULK_STATE_IDLE) {
+    bulk_status(b, BULK_OP_DUMP, BULK_ERR_STATE, 0, 0);
+    return;
+  }
+
+  uint8_t source = sdu[1];
+  uint32_t max = get_u32(sdu + 2);
+  uint32_t offset = 0;
+  bulk_err_t err = BULK_OK;
+  for (;;) {
+    uint16_t room = b->mtu - 1;
+    if (max != 0 && max - offset < room) {
+      room = max - offset;
+    }
+    if (room == 0) {
+      break;
+    }
+    int n = b->ops->read(source, offset, b->buf + 1, room, b->ops->arg);
+    if (n < 0) {
+      err = BULK_ERR_TARGET;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    b->buf[0] = BULK_OP_DATA;
+    if (b->ops->send(b->buf, n + 1, b->ops->arg) != 0) {
+      err = BULK_ERR_LINK;
+      break;
+    }
+    offset += n;
+    b->stats.bytes_out += n;
+  }
+
+  if (err == BULK_OK) {
+    b->stats.dumps++;
+  } else {
+    b->stats.failed++;
+  }
+  bulk_status(b, BULK_OP_DUMP, err, offset, 0);
+}
+
+void bulk_rx(bulk_t *b, const uint8_t *sdu, uint16_t len, uint32_t now_us) {
+  if (len == 0) {
+    return;
+  }
+
+  switch (sdu[0]) {
+  case BULK_OP_BEGIN:
+    bulk_begin(b, sdu, len, now_us);
+    break;
+  case BULK_OP_DATA:
+    bulk_data(b, sdu + 1, len - 1);
+    break;
+  case BULK_OP_COMMIT:
+    bulk_commit(b, now_us);
+    break;
+  case BULK_OP_DUMP:
+    bulk_dump(b, sdu, len);
+    break;
+  case BULK_OP_ABORT:
+    bulk_abort(b);
+    bulk_status(b, BULK_OP_ABORT, BULK_OK, b->offset, 0);
+    break;
+  default:
+    bulk_status(b, sdu[0], BULK_ERR_OP, 0, 0);
+    break;
+  }
+}
+
+void bulk_get_stats(const bulk_t *b, struct bulk_stats *stats) {
+  *stats = b->stats;
+}
@@ -0,0 +1,118 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include <stdint.h>
+
+// Bulk transfer protocol, spoken over one L2CAP connection-oriented channel
+// (bulk_mgr.h). L2CAP keeps SDU boundaries, delivers them in order and flow
+// controls them with credits, so every SDU is one message and nothing needs
+// to be acknowledged. All fields are little endian, every SDU starts with an
+// op:
+//
+//   BEGIN  (peer): u8 target, u32 length. Starts an upload
+//   DATA   (both): the next bytes of an upload or a dump, up to the MTU
+//   COMMIT (peer): ends an upload, the target checks and takes it
+//   DUMP   (peer): u8 source, u32 max length (0 for all). Answered with
+//          DATA SDUs, then a STATUS
+//   ABORT  (peer): drops the upload
+//   STATUS (device): u8 op answered, u8 result (bulk_err_t), u32 bytes
+//          moved, u32 us from BEGIN to COMMIT (0 for anything else)
+//
+// BEGIN, COMMIT, DUMP and ABORT are answered with a STATUS. DATA is only
+// answered when it fails, once per upload, so the peer can stop early.
+//
+// It does not know about L2CAP or flash, everything goes through
+// bulk_ops_t and time is passed in, so it can run against a stand-in peer.
+
+#define BULK_OP_BEGIN 0x01
+#define BULK_OP_DATA 0x02
+#define BULK_OP_COMMIT 0x03
+#define BULK_OP_DUMP 0x04
+#define BULK_OP_ABORT 0x05
+#define BULK_OP_STATUS 0x80
+
+#define BULK_BEGIN_LEN 6
+#define BULK_DUMP_LEN 6
+#define BULK_STATUS_LEN 11
+
+// Largest SDU either side sends
+#define BULK_SDU_MAX 2048
+
+// Upload targets
+#define BULK_TARGET_MACROS 0 // Macro store, see macro_mgr.h
+#define BULK_TARGET_SINK 1   // Thrown away, for throughput tests
+
+// Dump sources
+#define BULK_SOURCE_MACROS 0    // The macro store in use
+#define BULK_SOURCE_KEY_TRACE 1 // u32 total, then the key_trace_rec_t ring
+#define BULK_SOURCE_PATTERN 2   // Byte n is n & 0xFF, for throughput tests
+
+typedef enum {
+  BULK_OK,
+  BULK_ERR_OP,       // Unknown op or short SDU
+  BULK_ERR_STATE,    // Not allowed right now
+  BULK_ERR_TARGET,   // No such target or source
+  BULK_ERR_RANGE,    // More data than announced, or less at COMMIT
+  BULK_ERR_FLASH,
+  BULK_ERR_REJECTED, // The target refused the upload at COMMIT
+  BULK_ERR_LINK,     // Could not send
+} bulk_err_t;
+
+typedef struct {
+  // Upload of len bytes to target, then its data in order. They return
+  // BULK_OK or why not
+  bulk_err_t (*begin)(uint8_t target, uint32_t len, void *arg);
+  bulk_err_t (*write)(uint8_t target, uint32_t offset, const uint8_t *data,
+                      uint16_t len, void *arg);
+  bulk_err_t (*commit)(uint8_t target, void *arg);
+  void (*abort)(uint8_t target, void *arg);
+  // Copies up to max bytes of source from offset. Returns how many, 0 at
+  // the end, or -1 if there is no such source
+  int (*read)(uint8_t source, uint32_t offset, uint8_t *data, uint16_t max,
+              void *arg);
+  // Sends one SDU, waiting for credits. 0 if it was taken
+  int (*send)(const uint8_t *data, uint16_t len, void *arg);
+  void *arg;
+} bulk_ops_t;
+
+struct bulk_stats {
+  uint32_t uploads; // Committed
+  uint32_t dumps;
+  uint32_t failed;  // Uploads and dumps that ended with an error
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+};
+
+typedef enum {
+  BULK_STATE_IDLE,
+  BULK_STATE_UPLOAD,
+  BULK_STATE_FAILED, // Upload hit an error, waits for COMMIT or ABORT
+} bulk_state_t;
+
+typedef struct {
+  const bulk_ops_t *ops;
+  uint16_t mtu; // Peer's, SDUs we send are at most this long
+  uint8_t state;
+  uint8_t target;
+  uint8_t err;  // Of a failed upload
+  uint32_t len; // Announced upload length
+  uint32_t offset;
+  uint32_t begin_us;
+  struct bulk_stats stats;
+  uint8_t buf[BULK_SDU_MAX];
+} bulk_t;
+
+void bulk_init(bulk_t *b, const bulk_ops_t *ops);
+
+// A channel opened, mtu is the largest SDU the peer takes
+void bulk_open(bulk_t *b, uint16_t mtu);
+
+// The channel closed, an upload that was not committed is aborted
+void bulk_close(bulk_t *b);
+
+// Handles one SDU from the peer
+void bulk_rx(bulk_t *b, const uint8_t *sdu, uint16_t len, uint32_t now_us);
+
+void bulk_get_stats(const bulk_t *b, struct bulk_stats *stats);
+
+#endif
@@ -0,0 +1,384 @@
+#include "bulk_mgr.h"
+#include "config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "host/ble_gap.h"
+#include "host/ble_hs.h"
+#include "host/ble_l2cap.h"
+#include "key_trace.h"
+#include "macro_mgr.h"
+#include "nimble/nimble_port.h"
+#include "os/os_mempool.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Receive buffers: the one the stack fills and the ones waiting for the bulk
+// task
+#define BULK_RX_SDUS 3
+
+#define BULK_BLOCK_SIZE                                                        \
+  OS_ALIGN(sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) +            \
+               BULK_SDU_MAX,                                                   \
+           OS_ALIGNMENT)
+
+// Waiting this long for credits means the peer is gone
+#define BULK_TX_TIMEOUT_MS 5000
+
+_Static_assert(BULK_SDU_MAX <= UINT16_MAX, "SDU does not fit an L2CAP MTU");
+
+typedef enum {
+  BULK_MSG_OPEN,
+  BULK_MSG_SDU,
+  BULK_MSG_CLOSE,
+} bulk_msg_type_t;
+
+typedef struct {
+  uint8_t type; // bulk_msg_type_t
+  uint16_t mtu; // BULK_MSG_OPEN: peer's
+  struct os_mbuf *sdu;
+} bulk_msg_t;
+
+static os_membuf_t bulk_rx_mem[OS_MEMPOOL_SIZE(BULK_RX_SDUS, BULK_BLOCK_SIZE)];
+static struct os_mempool bulk_rx_mempool;
+static struct os_mbuf_pool bulk_rx_pool;
+// Sent one at a time, the stack copies it out before the next
+static os_membuf_t bulk_tx_mem[OS_MEMPOOL_SIZE(1, BULK_BLOCK_SIZE)];
+static struct os_mempool bulk_tx_mempool;
+static struct os_mbuf_pool bulk_tx_pool;
+
+static _Atomic(struct ble_l2cap_chan *) bulk_chan;
+
+// Only touched by the NimBLE host task. Set when the stack had no buffer to
+// receive into, bulk_rx_ev hands it one once the bulk task frees one
+static bool bulk_rx_starved;
+static struct ble_npl_event bulk_rx_ev;
+
+static QueueHandle_t bulk_queue;
+static TaskHandle_t bulk_task;
+
+static bulk_err_t bulk_begin(uint8_t target, uint32_t len, void *arg);
+static bulk_err_t bulk_write(uint8_t target, uint32_t offset,
+                             const uint8_t *data, uint16_t len, void *arg);
+static bulk_err_t bulk_commit(uint8_t target, void *arg);
+static void bulk_abort(uint8_t target, void *arg);
+static int bulk_read(uint8_t source, uint32_t offset, uint8_t *data,
+                     uint16_t max, void *arg);
+static int bulk_send(const uint8_t *data, uint16_t len, void *arg);
+
+static const bulk_ops_t bulk_ops = {
+    .begin = bulk_begin,
+    .write = bulk_write,
+    .commit = bulk_commit,
+    .abort = bulk_abort,
+    .read = bulk_read,
+    .send = bulk_send,
+};
+
+// Only touched by the bulk task
+static bulk_t bulk;
+static uint8_t bulk_sdu[BULK_SDU_MAX];
+
+// Key trace snapshot for a dump. The trace belongs to the host task, it is
+// copied over there
+static uint8_t bulk_trace[4 + KEY_TRACE_RING_SIZE * sizeof(key_trace_rec_t)];
+static uint32_t bulk_trace_len;
+static struct ble_npl_event bulk_trace_ev;
+static SemaphoreHandle_t bulk_trace_done;
+static StaticSemaphore_t bulk_trace_sem;
+
+static bulk_err_t bulk_macro_err(macro_err_t err) {
+  switch (err) {
+  case MACRO_OK:
+    return BULK_OK;
+  case MACRO_ERR_STATE:
+    return BULK_ERR_STATE;
+  case MACRO_ERR_RANGE:
+    return BULK_ERR_RANGE;
+  case MACRO_ERR_FLASH:
+    return BULK_ERR_FLASH;
+  default:
+    return BULK_ERR_REJECTED;
+  }
+}
+
+static bulk_err_t bulk_begin(uint8_t target, uint32_t len, void *arg) {
+  switch (target) {
+  case BULK_TARGET_MACROS:
+    return bulk_macro_err(macro_mgr_upload_begin(len));
+  case BULK_TARGET_SINK:
+    return BULK_OK;
+  default:
+    return BULK_ERR_TARGET;
+  }
+}
+
+static bulk_err_t bulk_write(uint8_t target, uint32_t offset,
+                             const uint8_t *data, uint16_t len, void *arg) {
+  if (target == BULK_TARGET_MACROS) {
+    return bulk_macro_err(macro_mgr_upload_write(offset, data, len));
+  }
+  return BULK_OK;
+}
+
+static bulk_err_t bulk_commit(uint8_t target, void *arg) {
+  if (target == BULK_TARGET_MACROS) {
+    macro_err_t err = macro_mgr_upload_commit();
+    ESP_LOGI(TAG, "bulk macro upload of %lu bytes, result %d",
+             (unsigned long)bulk.len, err);
+    return bulk_macro_err(err);
+  }
+  return BULK_OK;
+}
+
+static void bulk_abort(uint8_t target, void *arg) {
+  if (target == BULK_TARGET_MACROS) {
+    macro_mgr_upload_abort();
+  }
+}
+
+static void bulk_trace_cb(struct ble_npl_event *ev) {
+  uint32_t total = key_trace_total();
+  size_t n = key_trace_dump((key_trace_rec_t *)(bulk_trace + 4),
+                            KEY_TRACE_RING_SIZE);
+
+  memcpy(bulk_trace, &total, sizeof(total));
+  bulk_trace_len = 4 + n * sizeof(key_trace_rec_t);
+  xSemaphoreGive(bulk_trace_done);
+}
+
+static int bulk_read(uint8_t source, uint32_t offset, uint8_t *data,
+                     uint16_t max, void *arg) {
+  switch (source) {
+  case BULK_SOURCE_MACROS:
+    return macro_mgr_read(offset, data, max);
+  case BULK_SOURCE_KEY_TRACE:
+    if (offset == 0) {
+      ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &bulk_trace_ev);
+      xSemaphoreTake(bulk_trace_done, portMAX_DELAY);
+    }
+    if (offset >= bulk_trace_len) {
+      return 0;
+    }
+    if (max > bulk_trace_len - offset) {
+      max = bulk_trace_len - offset;
+    }
+    memcpy(data, bulk_trace + offset, max);
+    return max;
+  case BULK_SOURCE_PATTERN:
+    for (uint16_t i = 0; i < max; i++) {
+      data[i] = offset + i;
+    }
+    return max;
+  default:
+    return -1;
+  }
+}
+
+// From the bulk task. Waits while the peer has no credits left for us
+static int bulk_send(const uint8_t *data, uint16_t len, void *arg) {
+  struct ble_l2cap_chan *chan = atomic_load(&bulk_chan);
+  if (chan == NULL) {
+    return BLE_HS_ENOTCONN;
+  }
+
+  struct os_mbuf *om = os_mbuf_get_pkthdr(&bulk_tx_pool, 0);
+  if (om == NULL) {
+    return BLE_HS_ENOMEM;
+  }
+  // Fits the block, so this is a plain copy and can not fail
+  os_mbuf_append(om, data, len);
+
+  // Drops a wakeup left over from an earlier stall
+  ulTaskNotifyTake(pdTRUE, 0);
+  int rc = ble_l2cap_send(chan, om);
+  if (rc == BLE_HS_ESTALLED) {
+    // The stack keeps the SDU and sends the rest as credits come in
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BULK_TX_TIMEOUT_MS)) == 0 ||
+        atomic_load(&bulk_chan) == NULL) {
+      return BLE_HS_ETIMEOUT;
+    }
+    return 0;
+  }
+  if (rc != 0) {
+    os_mbuf_free_chain(om);
+  }
+  return rc;
+}
+
+static void bulk_task_fn(void *param) {
+  bulk_msg_t msg;
+
+  for (;;) {
+    xQueueReceive(bulk_queue, &msg, portMAX_DELAY);
+    switch (msg.type) {
+    case BULK_MSG_OPEN:
+      bulk_open(&bulk, msg.mtu);
+      break;
+    case BULK_MSG_SDU: {
+      uint16_t len = OS_MBUF_PKTLEN(msg.sdu);
+      if (len <= sizeof(bulk_sdu) &&
+          os_mbuf_copydata(msg.sdu, 0, len, bulk_sdu) == 0) {
+        bulk_rx(&bulk, bulk_sdu, len, (uint32_t)esp_timer_get_time());
+      }
+      os_mbuf_free_chain(msg.sdu);
+      // A buffer is free again, in case the stack ran out
+      ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &bulk_rx_ev);
+      break;
+    }
+    case BULK_MSG_CLOSE:
+      bulk_close(&bulk);
+      break;
+    }
+  }
+}
+
+static void bulk_post(const bulk_msg_t *msg) {
+  if (xQueueSend(bulk_queue, msg, 0) != pdTRUE) {
+    // Only opens and closes can pile up, SDUs are bounded by the pool
+    ESP_LOGE(TAG, "bulk queue full, dropped message %d", msg->type);
+    if (msg->sdu != NULL) {
+      os_mbuf_free_chain(msg->sdu);
+    }
+  }
+}
+
+// Hands the stack a buffer for the next SDU, which lets it return credits
+// to the peer
+static int bulk_rx_give(struct ble_l2cap_chan *chan) {
+  struct os_mbuf *om = os_mbuf_get_pkthdr(&bulk_rx_pool, 0);
+  if (om == NULL) {
+    bulk_rx_starved = true;
+    return BLE_HS_ENOMEM;
+  }
+  bulk_rx_starved = false;
+
+  int rc = ble_l2cap_recv_ready(chan, om);
+  if (rc != 0) {
+    os_mbuf_free_chain(om);
+  }
+  return rc;
+}
+
+static void bulk_rx_cb(struct ble_npl_event *ev) {
+  struct ble_l2cap_chan *chan = atomic_load(&bulk_chan);
+  if (bulk_rx_starved && chan != NULL) {
+    bulk_rx_give(chan);
+  }
+}
+
+static bool bulk_link_encrypted(uint16_t conn_handle) {
+  struct ble_gap_conn_desc desc;
+  return ble_gap_conn_find(conn_handle, &desc) == 0 &&
+         desc.sec_state.encrypted;
+}
+
+static int bulk_l2cap_event(struct ble_l2cap_event *event, void *arg) {
+  struct ble_l2cap_chan_info info;
+
+  switch (event->type) {
+  case BLE_L2CAP_EVENT_COC_ACCEPT:
+    if (!bulk_link_encrypted(event->accept.conn_handle)) {
+      return BLE_HS_EENCRYPT;
+    }
+    if (atomic_load(&bulk_chan) != NULL) {
+      return BLE_HS_ENOMEM;
+    }
+    return bulk_rx_give(event->accept.chan);
+
+  case BLE_L2CAP_EVENT_COC_CONNECTED:
+    if (event->connect.status != 0) {
+      return 0;
+    }
+    if (ble_l2cap_get_chan_info(event->connect.chan, &info) != 0) {
+      ble_l2cap_disconnect(event->connect.chan);
+      return 0;
+    }
+    atomic_store(&bulk_chan, event->connect.chan);
+    bulk_post(&(bulk_msg_t){.type = BULK_MSG_OPEN,
+                            .mtu = info.peer_coc_mtu});
+    ESP_LOGI(TAG, "bulk channel open, conn %d, mtu %d/%d",
+             event->connect.conn_handle, info.our_coc_mtu,
+             info.peer_coc_mtu);
+    return 0;
+
+  case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+    if (event->disconnect.chan != atomic_load(&bulk_chan)) {
+      return 0;
+    }
+    atomic_store(&bulk_chan, NULL);
+    bulk_rx_starved = false;
+    bulk_post(&(bulk_msg_t){.type = BULK_MSG_CLOSE});
+    // Wakes the bulk task if it waits for credits
+    xTaskNotifyGive(bulk_task);
+    ESP_LOGI(TAG, "bulk channel closed");
+    return 0;
+
+  case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+    bulk_post(&(bulk_msg_t){.type = BULK_MSG_SDU,
+                            .sdu = event->receive.sdu_rx});
+    bulk_rx_give(event->receive.chan);
+    return 0;
+
+  case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+    xTaskNotifyGive(bulk_task);
+    return 0;
+
+  default:
+    return 0;
+  }
+}
+
+int bulk_mgr_init(void) {
+  int rc;
+
+  rc = os_mempool_init(&bulk_rx_mempool, BULK_RX_SDUS, BULK_BLOCK_SIZE,
+                       bulk_rx_mem, "bulk_rx");
+  if (rc == 0) {
+    rc = os_mbuf_pool_init(&bulk_rx_pool, &bulk_rx_mempool, BULK_BLOCK_SIZE,
+                           BULK_RX_SDUS);
+  }
+  if (rc == 0) {
+    rc = os_mempool_init(&bulk_tx_mempool, 1, BULK_BLOCK_SIZE, bulk_tx_mem,
+                         "bulk_tx");
+  }
+  if (rc == 0) {
+    rc = os_mbuf_pool_init(&bulk_tx_pool, &bulk_tx_mempool, BULK_BLOCK_SIZE,
+                           1);
+  }
+  if (rc != 0) {
+    ESP_LOGE(TAG, "failed to init bulk mbuf pools, error code: %d", rc);
+    return rc;
+  }
+
+  bulk_init(&bulk, &bulk_ops);
+  bulk_trace_done = xSemaphoreCreateBinaryStatic(&bulk_trace_sem);
+  ble_npl_event_init(&bulk_rx_ev, bulk_rx_cb, NULL);
+  ble_npl_event_init(&bulk_trace_ev, bulk_trace_cb, NULL);
+
+  // Room for every SDU of the pool and a few opens and closes
+  bulk_queue = xQueueCreate(BULK_RX_SDUS + 4, sizeof(bulk_msg_t));
+  if (bulk_queue == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  if (xTaskCreatePinnedToCore(bulk_task_fn, "bulk", BULK_TASK_STACK, NULL,
+                              BULK_TASK_PRIO, &bulk_task,
+                              CORE_INPUT) != pdPASS) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  rc = ble_l2cap_create_server(BULK_PSM, BULK_SDU_MAX, bulk_l2cap_event, NULL);
+  if (rc != 0) {
+    ESP_LOGE(TAG, "failed to create L2CAP server, error code: %d", rc);
+    return rc;
+  }
+  return 0;
+}
+
+void bulk_mgr_get_stats(struct bulk_stats *stats) {
+  bulk_get_stats(&bulk, stats);
+}
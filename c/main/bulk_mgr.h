@@ -0,0 +1,28 @@
+#ifndef BULK_MGR_H
+#define BULK_MGR_H
+
+#include "bulk.h"
+
+// ESP-IDF side of bulk.h: an L2CAP connection-oriented channel server on
+// BULK_PSM, for macro store uploads and diagnostic dumps at far more than
+// GATT reads and writes of feature reports move (tools/bulk_xfer.py).
+//
+// The NimBLE host task only moves SDUs between the stack and a queue. The
+// protocol, flash erases and writes and dumps run on their own low priority
+// task on CORE_INPUT, so the host task is never busy with them. That does not
+// keep flash work off the HID path: while a sector is erased or written the
+// flash cache is off on both cores, and every task running from flash, the
+// host task and the scan task included, stalls until it is done. A 4 KiB
+// erase takes tens of ms, so keys typed during an upload can be that late.
+// Received SDUs land in a small static pool. The stack only returns credits to the peer
+// when it gets a buffer back, so a peer sending faster than flash takes the
+// data is held back by the credit flow control, nothing is dropped.
+//
+// The channel needs an encrypted link, so only a bonded host can use it.
+
+// Call after macro_mgr_init()
+int bulk_mgr_init(void);
+
+void bulk_mgr_get_stats(struct bulk_stats *stats);
+
+#endif
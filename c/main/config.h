@@ -1,2 +1,91 @@
 #define DEVICE_NAME "ESP32-Keyboard"
 #define TAG "kbd-bt"
+
+// Compile-time log levels of the subsystems that log through klog.h, one of
+// KLOG_NONE, KLOG_ERROR, KLOG_WARN, KLOG_INFO or KLOG_DEBUG
+#define KLOG_LEVEL_GATT KLOG_WARN
+#define KLOG_LEVEL_GAP KLOG_INFO
+#define KLOG_LEVEL_USB KLOG_INFO
+
+// Task layout. The BLE controller and the NimBLE host own CORE_BLE, the
+// input side (matrix scan, debounce, keymap, USB bridge) and the log printer
+// CORE_INPUT, so radio work never delays a scan. Input hands key events to
+// the host through the lock-free key ring and power holds through atomics
+// (power_mgr.h), a macro key posts one event to the host's queue. Input
+// never waits on a lock the host holds. task_stats.h shows where the
+// time goes and how late the scan task wakes. Stack sizes are in bytes, the
+// trace service reports how much of each is left unused
+#define CORE_BLE 0 // Must match CONFIG_BT_CTRL_PINNED_TO_CORE
+#define CORE_INPUT 1
+#define NIMBLE_HOST_TASK_PRIO 5
+#define NIMBLE_HOST_TASK_STACK 4096
+#define MATRIX_SCAN_TASK_PRIO 6
+#define MATRIX_SCAN_TASK_STACK 4096
+#define USB_BRIDGE_TASK_PRIO 5
+#define USB_BRIDGE_TASK_STACK 4096
+#define USB_HID_TASK_PRIO 6 // Input reports are handled in the HID driver task
+#define USB_HID_TASK_STACK 4096
+#define KLOG_TASK_PRIO 1
+#define KLOG_TASK_STACK 3072
+#define BULK_TASK_PRIO 2 // Flash writes, below everything on the input path
+#define BULK_TASK_STACK 4096
+#define INPUT_INIT_TASK_STACK 4096 // Brings up the input side, then exits
+
+// Key latency tracing into a RAM ring, see key_trace.h. Read out through the
+// trace service (key_trace_svc.h)
+#define KEY_TRACE_ENABLED 1
+
+// Report path bench, see bench_mgr.h. 1 runs it once at boot, before the
+// HID service comes up, and prints its JSON to the console
+#define BENCH_REPORT_PATH 0
+#define BENCH_EVENTS 100000 // Key events per workload
+#define BENCH_TASK_PRIO 5
+#define BENCH_TASK_STACK 4096
+
+// Connection parameter policy, see conn_params.h. Intervals are in 1.25 ms
+// units, the supervision timeout in 10 ms units
+#define CONN_ACTIVE_ITVL_MIN 6  // 7.5 ms
+#define CONN_ACTIVE_ITVL_MAX 6  // 7.5 ms
+#define CONN_ACTIVE_ITVL_CAP 24 // 30 ms, widest we fall back to on rejection
+#define CONN_IDLE_ITVL_MIN 40   // 50 ms
+#define CONN_IDLE_ITVL_MAX 56   // 70 ms
+#define CONN_IDLE_LATENCY 10
+#define CONN_SUPERVISION_TIMEOUT 400 // 4 s
+#define CONN_IDLE_AFTER_MS 5000
+#define CONN_RETRY_MIN_MS 1000
+#define CONN_RETRY_MAX_MS 30000
+
+// Power management, see power_mgr.h. The chip light sleeps between radio
+// events while no key is down. The currents are rough ESP32-S3 figures and
+// only feed the average current estimate
+#define POWER_LIGHT_SLEEP 1
+#define POWER_MAX_FREQ_MHZ 160
+#define POWER_MIN_FREQ_MHZ 40
+#define POWER_AWAKE_UA 25000       // CPU running, radio off
+#define POWER_SLEEP_UA 1200        // Light sleep, main XTAL kept on for BT
+#define POWER_RADIO_EVENT_NC 20000 // ~8 mA for 2.5 ms
+#define POWER_ADV_ITVL_MS 45       // NimBLE's default interval is 30-60 ms
+#define POWER_LINK_HOLD_MS 3000    // Most a new connection keeps us awake
+
+// Macros, see macro_mgr.h. Label of the flash partition holding the store
+// (partitions.csv)
+#define MACRO_PARTITION "macros"
+
+// Bulk channel, see bulk_mgr.h. LE PSM of its L2CAP server, in the dynamic
+// range 0x0080-0x00FF
+#define BULK_PSM 0x00A1
+
+// Input source: 0 for the key matrix, 1 to bridge a USB keyboard on the OTG
+// port (see usb_bridge.h). Exactly one of them feeds the key ring
+#define INPUT_USB_BRIDGE 0
+
+// Key matrix, see matrix_scanner.h. Rows are driven, columns have pull-ups
+#define MATRIX_ROWS 4
+#define MATRIX_COLS 4
+#define MATRIX_ROW_PINS {4, 5, 6, 7}
+#define MATRIX_COL_PINS {15, 16, 17, 18}
+#define MATRIX_SCAN_PERIOD_US 1000 // Debounce time is 4 scans
+#define MATRIX_SETTLE_US 2         // Row select to column read
+// Keymap resolver, see keymap.h. The keymap itself is in keymap.def
+#define KEYMAP_TAPPING_TERM_MS 200
+#define KEYMAP_COMBO_TERM_MS 40
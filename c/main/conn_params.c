@@ -0,0 +1,162 @@
+#include "conn_params.h"
+
+#define CONN_HANDLE_NONE 0xFFFF
+
+// True if time a is at or after time b, wrap-around safe
+static inline bool time_reached(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) >= 0;
+}
+
+static void schedule_retry(conn_params_t *cp, uint32_t now_ms) {
+  cp->retry_at_ms = now_ms + cp->backoff_ms;
+  if (cp->retry_at_ms == 0) {
+    // 0 means "no retry scheduled"
+    cp->retry_at_ms = 1;
+  }
+
+  cp->backoff_ms *= 2;
+  if (cp->backoff_ms > cp->cfg->retry_max_ms) {
+    cp->backoff_ms = cp->cfg->retry_max_ms;
+  }
+}
+
+// Starts an update towards the target mode if one is needed and allowed
+static void request_target(conn_params_t *cp, uint32_t now_ms) {
+  if (cp->conn_handle == CONN_HANDLE_NONE || cp->pending ||
+      cp->target == cp->applied || cp->retry_at_ms != 0) {
+    return;
+  }
+
+  conn_params_req_t req;
+  if (cp->target == CONN_PARAMS_ACTIVE) {
+    req = cp->cfg->active;
+    req.itvl_max = cp->active_itvl_max;
+  } else {
+    req = cp->cfg->idle;
+  }
+
+  if (cp->ops->request(cp->conn_handle, &req, cp->ops->arg) == 0) {
+    cp->pending = true;
+    cp->requested = cp->target;
+  } else {
+    // Usually another procedure is still running, try again later
+    schedule_retry(cp, now_ms);
+  }
+}
+
+void conn_params_init(conn_params_t *cp, const conn_params_cfg_t *cfg,
+                      const conn_params_ops_t *ops) {
+  *cp = (conn_params_t){
+      .cfg = cfg,
+      .ops = ops,
+      .conn_handle = CONN_HANDLE_NONE,
+  };
+}
+
+void conn_params_connected(conn_params_t *cp, uint16_t conn_handle,
+                           uint32_t now_ms) {
+  cp->conn_handle = conn_handle;
+  cp->applied = CONN_PARAMS_NONE;
+  cp->target = CONN_PARAMS_ACTIVE; // The host usually talks to us right away
+  cp->pending = false;
+  cp->active_itvl_max = cp->cfg->active.itvl_max;
+  cp->last_activity_ms = now_ms;
+  cp->retry_at_ms = 0;
+  cp->backoff_ms = cp->cfg->retry_min_ms;
+  cp->rejections = 0;
+
+  request_target(cp, now_ms);
+}
+
+void conn_params_disconnected(conn_params_t *cp) {
+  conn_params_init(cp, cp->cfg, cp->ops);
+}
+
+void conn_params_activity(conn_params_t *cp, uint32_t now_ms) {
+  cp->last_activity_ms = now_ms;
+  if (cp->target != CONN_PARAMS_ACTIVE) {
+    cp->target = CONN_PARAMS_ACTIVE;
+    request_target(cp, now_ms);
+  }
+}
+
+void conn_params_suspend(conn_params_t *cp, uint32_t now_ms) {
+  if (cp->target != CONN_PARAMS_IDLE) {
+    cp->target = CONN_PARAMS_IDLE;
+    request_target(cp, now_ms);
+  }
+}
+
+// Which of our parameter sets the link runs with, NONE if neither
+static conn_params_mode_t mode_of(const conn_params_t *cp, uint16_t itvl,
+                                  uint16_t latency) {
+  const conn_params_cfg_t *cfg = cp->cfg;
+
+  if (itvl >= cfg->active.itvl_min && itvl <= cp->active_itvl_max &&
+      latency <= cfg->active.latency) {
+    return CONN_PARAMS_ACTIVE;
+  }
+  if (itvl >= cfg->idle.itvl_min && itvl <= cfg->idle.itvl_max &&
+      latency <= cfg->idle.latency) {
+    return CONN_PARAMS_IDLE;
+  }
+  return CONN_PARAMS_NONE;
+}
+
+void conn_params_update_done(conn_params_t *cp, int status, uint16_t itvl,
+                             uint16_t latency, uint32_t now_ms) {
+  bool ours = cp->pending;
+  cp->pending = false;
+
+  if (status == 0) {
+    cp->applied = mode_of(cp, itvl, latency);
+    if (ours && cp->applied == cp->requested) {
+      cp->backoff_ms = cp->cfg->retry_min_ms;
+    } else if (cp->applied != cp->target) {
+      // The central picked parameters of its own, give it a while before
+      // asking again
+      schedule_retry(cp, now_ms);
+    }
+  } else if (ours) {
+    cp->rejections++;
+    if (cp->requested == CONN_PARAMS_ACTIVE &&
+        cp->active_itvl_max < cp->cfg->active_itvl_cap) {
+      // Ask for a wider range next time, some centrals refuse 7.5 ms
+      cp->active_itvl_max += cp->active_itvl_max / 2;
+      if (cp->active_itvl_max > cp->cfg->active_itvl_cap) {
+        cp->active_itvl_max = cp->cfg->active_itvl_cap;
+      }
+    }
+    schedule_retry(cp, now_ms);
+  } else {
+    // A procedure the central started failed, the link is unchanged
+    return;
+  }
+
+  request_target(cp, now_ms);
+}
+
+uint32_t conn_params_tick(conn_params_t *cp, uint32_t now_ms) {
+  if (cp->conn_handle == CONN_HANDLE_NONE) {
+    return UINT32_MAX;
+  }
+
+  uint32_t idle_at = cp->last_activity_ms + cp->cfg->idle_after_ms;
+  if (cp->target == CONN_PARAMS_ACTIVE && time_reached(now_ms, idle_at)) {
+    cp->target = CONN_PARAMS_IDLE;
+  }
+  if (cp->retry_at_ms != 0 && time_reached(now_ms, cp->retry_at_ms)) {
+    cp->retry_at_ms = 0;
+  }
+
+  request_target(cp, now_ms);
+
+  uint32_t next = UINT32_MAX;
+  if (cp->target == CONN_PARAMS_ACTIVE) {
+    next = idle_at - now_ms;
+  }
+  if (cp->retry_at_ms != 0 && cp->retry_at_ms - now_ms < next) {
+    next = cp->retry_at_ms - now_ms;
+  }
+  return next;
+}
@@ -0,0 +1,83 @@
+#ifndef CONN_PARAMS_H
+#define CONN_PARAMS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Connection parameter policy: ask for the shortest connection interval
+// while keys are being pressed, drop to a long interval with peripheral
+// latency once idle, and back off when the central rejects a request.
+//
+// It does not call NimBLE directly, requests go through conn_params_ops_t
+// and time is passed in, so it can run against a fake GAP.
+
+typedef struct {
+  uint16_t itvl_min;            // 1.25 ms units
+  uint16_t itvl_max;            // 1.25 ms units
+  uint16_t latency;             // Connection events the peripheral may skip
+  uint16_t supervision_timeout; // 10 ms units
+} conn_params_req_t;
+
+typedef struct {
+  // Starts a connection parameter update, returns 0 if it was started
+  int (*request)(uint16_t conn_handle, const conn_params_req_t *req,
+                 void *arg);
+  void *arg;
+} conn_params_ops_t;
+
+typedef struct {
+  conn_params_req_t active;
+  conn_params_req_t idle;
+  uint32_t idle_after_ms;   // No key activity for this long -> idle
+  uint32_t retry_min_ms;    // First back-off after a rejection
+  uint32_t retry_max_ms;    // Back-off doubles up to this
+  uint16_t active_itvl_cap; // Rejected active requests widen up to this
+} conn_params_cfg_t;
+
+typedef enum {
+  CONN_PARAMS_NONE,
+  CONN_PARAMS_ACTIVE,
+  CONN_PARAMS_IDLE,
+} conn_params_mode_t;
+
+typedef struct {
+  const conn_params_cfg_t *cfg;
+  const conn_params_ops_t *ops;
+  uint16_t conn_handle;
+  conn_params_mode_t applied;   // What the link currently runs with
+  conn_params_mode_t target;    // What we want it to run with
+  conn_params_mode_t requested; // What the pending update asks for
+  bool pending;                 // An update procedure is in progress
+  uint16_t active_itvl_max;     // Current (possibly widened) active max
+  uint32_t last_activity_ms;
+  uint32_t retry_at_ms;         // 0 if no retry is scheduled
+  uint32_t backoff_ms;
+  uint32_t rejections;
+} conn_params_t;
+
+void conn_params_init(conn_params_t *cp, const conn_params_cfg_t *cfg,
+                      const conn_params_ops_t *ops);
+
+void conn_params_connected(conn_params_t *cp, uint16_t conn_handle,
+                           uint32_t now_ms);
+void conn_params_disconnected(conn_params_t *cp);
+
+// Key activity, switches to the active parameters if not already there
+void conn_params_activity(conn_params_t *cp, uint32_t now_ms);
+
+// The host suspended (HID Control Point), switches to the idle parameters
+// now instead of after idle_after_ms. Key activity brings the active ones
+// back
+void conn_params_suspend(conn_params_t *cp, uint32_t now_ms);
+
+// Result of an update procedure (BLE_GAP_EVENT_CONN_UPDATE), ours or one the
+// central started. status 0 means the link now runs with itvl and latency,
+// which set the applied mode whoever asked for them
+void conn_params_update_done(conn_params_t *cp, int status, uint16_t itvl,
+                             uint16_t latency, uint32_t now_ms);
+
+// Runs timeouts (idle switch, retries). Returns how many ms until it needs
+// to run again, or UINT32_MAX if nothing is scheduled
+uint32_t conn_params_tick(conn_params_t *cp, uint32_t now_ms);
+
+#endif
@@ -0,0 +1,102 @@
+#include "control_report.h"
+#include <string.h>
+
+// The packing below follows the report map, fail the build if it changes
+_Static_assert(HID_COMPLEX_R1_IN_F0_OFFSET == 0 &&
+                   HID_COMPLEX_R1_IN_F0_SIZE == 1 &&
+                   HID_COMPLEX_R1_IN_F0_COUNT <= 8 &&
+                   HID_COMPLEX_R1_IN_F0_USAGE_PAGE == HID_PAGE_GENERIC_DESKTOP,
+               "system controls are not one bit each in the first byte");
+_Static_assert(HID_COMPLEX_R2_IN_F0_OFFSET == 0 &&
+                   HID_COMPLEX_R2_IN_F0_SIZE == 16 &&
+                   HID_COMPLEX_R2_IN_F0_COUNT == 1 &&
+                   HID_COMPLEX_R2_IN_F0_USAGE_PAGE == HID_PAGE_CONSUMER,
+               "consumer control is not one 16-bit usage");
+_Static_assert(CONSUMER_USAGE_MAX <= HID_COMPLEX_R2_IN_F0_LOGICAL_MAX,
+               "consumer usages past the Logical Maximum");
+
+void control_report_init(control_report_t *cr) {
+  memset(cr, 0, sizeof(*cr));
+}
+
+bool control_report_page(uint8_t page) {
+  return page == HID_PAGE_GENERIC_DESKTOP || page == HID_PAGE_CONSUMER;
+}
+
+static bool system_apply(control_report_t *cr, uint16_t usage, bool pressed) {
+  if (usage < SYSTEM_USAGE_MIN ||
+      usage >= SYSTEM_USAGE_MIN + SYSTEM_USAGE_COUNT) {
+    return false;
+  }
+  uint8_t bit = 1u << (usage - SYSTEM_USAGE_MIN);
+  if (pressed) {
+    cr->system |= bit;
+  } else {
+    cr->system &= ~bit;
+  }
+
+  if (cr->system_value[0] == cr->system) {
+    return false;
+  }
+  cr->system_value[0] = cr->system;
+  return true;
+}
+
+static void consumer_remove(control_report_t *cr, uint16_t usage) {
+  for (uint8_t i = 0; i < cr->consumer_count; i++) {
+    if (cr->consumer[i] == usage) {
+      memmove(&cr->consumer[i], &cr->consumer[i + 1],
+              (cr->consumer_count - i - 1) * sizeof(cr->consumer[0]));
+      cr->consumer_count--;
+      return;
+    }
+  }
+}
+
+static bool consumer_apply(control_report_t *cr, uint16_t usage,
+                           bool pressed) {
+  if (usage == 0 || usage > CONSUMER_USAGE_MAX) {
+    return false;
+  }
+  // A repeated press moves the key to the top, it does not add it twice
+  consumer_remove(cr, usage);
+  if (pressed) {
+    if (cr->consumer_count == CONSUMER_HELD_MAX) {
+      consumer_remove(cr, cr->consumer[0]);
+    }
+    cr->consumer[cr->consumer_count++] = usage;
+  }
+
+  uint16_t top =
+      cr->consumer_count > 0 ? cr->consumer[cr->consumer_count - 1] : 0;
+  uint8_t value[CONSUMER_REPORT_LEN] = {top & 0xFF, top >> 8};
+  if (memcmp(cr->consumer_value, value, sizeof(value)) == 0) {
+    return false;
+  }
+  memcpy(cr->consumer_value, value, sizeof(value));
+  return true;
+}
+
+uint8_t control_report_apply(control_report_t *cr, uint8_t page,
+                             uint16_t usage, bool pressed) {
+  if (page == HID_PAGE_GENERIC_DESKTOP) {
+    return system_apply(cr, usage, pressed) ? SYSTEM_REPORT_ID : 0;
+  }
+  if (page == HID_PAGE_CONSUMER) {
+    return consumer_apply(cr, usage, pressed) ? CONSUMER_REPORT_ID : 0;
+  }
+  return 0;
+}
+
+const uint8_t *control_report_value(const control_report_t *cr,
+                                    uint8_t report_id, uint8_t *len) {
+  if (report_id == SYSTEM_REPORT_ID) {
+    *len = SYSTEM_REPORT_LEN;
+    return cr->system_value;
+  }
+  if (report_id == CONSUMER_REPORT_ID) {
+    *len = CONSUMER_REPORT_LEN;
+    return cr->consumer_value;
+  }
+  return NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef CONTROL_REPORT_H
+#define CONTROL_REPORT_H
+
+#include "hid_layout.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// HID usage pages a key event can be on
+#define HID_PAGE_GENERIC_DESKTOP 0x01
+#define HID_PAGE_KEYBOARD 0x07
+#define HID_PAGE_CONSUMER 0x0C
+
+// System control report (Report ID 1 of HID_COMPLEX_REPORT_MAP): one bit per
+// usage starting at System Power Down (0x81), then Sleep and Wake Up
+#define SYSTEM_REPORT_ID 1
+#define SYSTEM_REPORT_LEN HID_COMPLEX_R1_IN_LEN
+#define SYSTEM_USAGE_MIN HID_COMPLEX_R1_IN_F0_USAGE_MIN
+#define SYSTEM_USAGE_COUNT HID_COMPLEX_R1_IN_F0_COUNT
+
+// Consumer control report (Report ID 2): the one consumer usage held, 0 for
+// none. Usages past the descriptor's Usage Maximum are refused, hosts would
+// not know them even though the Logical Maximum lets them through
+#define CONSUMER_REPORT_ID 2
+#define CONSUMER_REPORT_LEN HID_COMPLEX_R2_IN_LEN
+#define CONSUMER_USAGE_MAX HID_COMPLEX_R2_IN_F0_USAGE_MAX
+
+// Consumer keys held at once. The report carries the last one pressed,
+// releasing it brings back the one held before
+#define CONSUMER_HELD_MAX 4
+
+// Keeps the held system and consumer keys and the last value sent of each
+// report. A key change only yields a report if that value changes, so key
+// repeat and a held volume key cost nothing on the link.
+//
+// Like report_builder.h it only builds the reports, sending is up to the
+// caller.
+typedef struct {
+  uint8_t system; // Bit n = usage SYSTEM_USAGE_MIN + n held
+  uint16_t consumer[CONSUMER_HELD_MAX]; // Held, oldest first
+  uint8_t consumer_count;
+  uint8_t system_value[SYSTEM_REPORT_LEN];     // Last sent
+  uint8_t consumer_value[CONSUMER_REPORT_LEN]; // Last sent
+} control_report_t;
+
+void control_report_init(control_report_t *cr);
+
+// True for the pages control_report_apply() takes
+bool control_report_page(uint8_t page);
+
+// Applies a key down/up on the Generic Desktop or Consumer page. Returns the
+// Report ID whose value changed, or 0 if neither did
+uint8_t control_report_apply(control_report_t *cr, uint8_t page,
+                             uint16_t usage, bool pressed);
+
+// Value of Report ID report_id (without the ID), NULL if it is not one of
+// these. *len is set to its length
+const uint8_t *control_report_value(const control_report_t *cr,
+                                    uint8_t report_id, uint8_t *len);
+
+#endif
@@ -0,0 +1,301 @@
+#include "diag_svc.h"
+#include "gap.h"
+#include "hogp_gatt_svr.h"
+#include "host/ble_hs.h"
+#include "klog.h"
+#include "matrix_scanner.h"
+#include "os/endian.h"
+#include "power_mgr.h"
+#include "report_pool.h"
+#include "task_stats.h"
+#include <assert.h>
+#include <stdbool.h>
+
+// Longest counter source
+#define DIAG_STATS_COUNTERS_MAX 16
+
+_Static_assert(4 + TASK_STATS_MAX_TASKS * sizeof(task_stats_task_t) <=
+                   BLE_ATT_ATTR_MAX_LEN,
+               "task stats do not fit one attribute value");
+
+static int diag_svc_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// 6d2f0c41-93b8-4e57-a1d6-0f8e2b5cxxxx
+#define DIAG_UUID(id)                                                          \
+  BLE_UUID128_INIT(id, 0x00, 0x5c, 0x2b, 0x8e, 0x0f, 0xd6, 0xa1, 0x57, 0x4e,   \
+                   0xb8, 0x93, 0x41, 0x0c, 0x2f, 0x6d)
+
+static const ble_uuid128_t diag_svc_uuid = DIAG_UUID(0x01);
+static const ble_uuid128_t diag_stats_uuid = DIAG_UUID(0x02);
+static const ble_uuid128_t diag_tasks_uuid = DIAG_UUID(0x03);
+static const ble_uuid128_t diag_jitter_uuid = DIAG_UUID(0x04);
+
+static const struct ble_gatt_chr_def diag_chrs[] = {
+    {.uuid = &diag_stats_uuid.u,
+     .access_cb = diag_svc_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC},
+    {.uuid = &diag_tasks_uuid.u,
+     .access_cb = diag_svc_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |
+              BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC},
+    {.uuid = &diag_jitter_uuid.u,
+     .access_cb = diag_svc_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC},
+    {0} /* No more characteristics */
+};
+#define DIAG_CHR_COUNT (sizeof(diag_chrs) / sizeof(diag_chrs[0]) - 1)
+
+static const struct ble_gatt_svc_def diag_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &diag_svc_uuid.u,
+        .characteristics = diag_chrs,
+    },
+    {0} /* No more services */
+};
+
+// Puts one source's record, its counters as little endian uint32s
+static uint8_t *diag_stats_put(uint8_t *p, diag_stats_type_t type,
+                               const uint32_t *values, size_t count) {
+  assert(count <= DIAG_STATS_COUNTERS_MAX);
+  p[0] = type;
+  p[1] = count * sizeof(uint32_t);
+  p += 2;
+  for (size_t i = 0; i < count; i++) {
+    put_le32(p, values[i]);
+    p += 4;
+  }
+  return p;
+}
+
+#define DIAG_STATS_PUT(p, type, values)                                        \
+  diag_stats_put(p, type, values, sizeof(values) / sizeof(values[0]))
+
+static uint8_t *diag_tx_put(uint8_t *p) {
+  struct hogp_tx_stats stats;
+
+  hogp_gatt_svr_get_tx_stats(&stats);
+  const uint32_t values[] = {
+      stats.flushes,
+      stats.reports_sent,
+      stats.dropped,
+      stats.max_reports_per_flush,
+      stats.queue_depth,
+      stats.max_queue_depth,
+      stats.busy,
+  };
+  return DIAG_STATS_PUT(p, DIAG_STATS_TX, values);
+}
+
+static uint8_t *diag_reconnect_put(uint8_t *p) {
+  struct gap_reconnect_stats stats;
+
+  gap_get_reconnect_stats(&stats);
+  const uint32_t values[] = {stats.count, stats.directed, stats.last_ms,
+                             stats.max_ms};
+  return DIAG_STATS_PUT(p, DIAG_STATS_RECONNECT, values);
+}
+
+static uint8_t *diag_scanner_put(uint8_t *p) {
+  struct matrix_scanner_stats stats;
+
+  matrix_scanner_get_stats(&stats);
+  const uint32_t values[] = {
+      stats.wakeups,       stats.scans,         stats.dropped,
+      stats.keymap.taps,   stats.keymap.holds,  stats.keymap.combos,
+      stats.keymap.forced, stats.keymap.max_wait_us,
+  };
+  return DIAG_STATS_PUT(p, DIAG_STATS_SCANNER, values);
+}
+
+static uint8_t *diag_klog_put(uint8_t *p) {
+  struct klog_stats stats;
+
+  klog_get_stats(&stats);
+  const uint32_t values[] = {stats.written, stats.dropped};
+  return DIAG_STATS_PUT(p, DIAG_STATS_KLOG, values);
+}
+
+static uint8_t *diag_power_put(uint8_t *p) {
+  power_stats_t stats;
+
+  power_mgr_get_stats(&stats);
+  const uint32_t values[] = {
+      stats.avg_ua,
+      stats.sleep_permille,
+      stats.radio_mhz,
+      stats.wakes[POWER_WAKE_KEY],
+      stats.wakes[POWER_WAKE_TIMER],
+      stats.wakes[POWER_WAKE_OTHER],
+  };
+  return DIAG_STATS_PUT(p, DIAG_STATS_POWER, values);
+}
+
+static uint8_t *diag_pool_put(uint8_t *p) {
+  struct report_pool_stats stats;
+
+  report_pool_get_stats(&stats);
+  const uint32_t values[] = {
+      stats.taken, stats.empty,    stats.msys_empty,
+      stats.free,  stats.min_free, stats.heap_allocs,
+  };
+  return DIAG_STATS_PUT(p, DIAG_STATS_POOL, values);
+}
+
+// Every counter source, in the order they go out
+static uint8_t *(*const diag_stats_sources[])(uint8_t *p) = {
+    diag_tx_put,
+    diag_reconnect_put,
+    diag_scanner_put,
+    diag_klog_put,
+    diag_power_put,
+    diag_pool_put,
+};
+
+#define DIAG_STATS_SOURCE_COUNT                                                \
+  (sizeof(diag_stats_sources) / sizeof(diag_stats_sources[0]))
+// Type, length and counters of every source
+#define DIAG_STATS_LEN_MAX                                                     \
+  (DIAG_STATS_SOURCE_COUNT * (2 + DIAG_STATS_COUNTERS_MAX * sizeof(uint32_t)))
+
+_Static_assert(DIAG_STATS_LEN_MAX <= BLE_ATT_ATTR_MAX_LEN,
+               "stats do not fit one attribute value");
+
+static int diag_stats_read(struct os_mbuf *om) {
+  uint8_t buf[DIAG_STATS_LEN_MAX];
+  uint8_t *p = buf;
+
+  for (size_t i = 0; i < DIAG_STATS_SOURCE_COUNT; i++) {
+    p = diag_stats_sources[i](p);
+  }
+  return os_mbuf_append(om, buf, p - buf);
+}
+
+// The sample a write took. Every blob of a long read calls the access
+// callback again, and a sample restarts the CPU time window, so reads serve
+// this instead of sampling
+static struct {
+  bool taken;
+  uint8_t elapsed[4];
+  size_t count;
+  task_stats_task_t tasks[TASK_STATS_MAX_TASKS];
+} diag_tasks_snap;
+
+static void diag_tasks_take(void) {
+  uint32_t elapsed_us;
+
+  diag_tasks_snap.count = task_stats_sample(
+      diag_tasks_snap.tasks, TASK_STATS_MAX_TASKS, &elapsed_us);
+  put_le32(diag_tasks_snap.elapsed, elapsed_us);
+  diag_tasks_snap.taken = true;
+}
+
+// Task entries are little endian structs already (task_stats_task_t)
+static int diag_tasks_read(struct os_mbuf *om) {
+  if (!diag_tasks_snap.taken) {
+    diag_tasks_take();
+  }
+  if (os_mbuf_append(om, diag_tasks_snap.elapsed,
+                     sizeof(diag_tasks_snap.elapsed)) != 0) {
+    return BLE_HS_ENOMEM;
+  }
+  return os_mbuf_append(om, diag_tasks_snap.tasks,
+                        diag_tasks_snap.count *
+                            sizeof(diag_tasks_snap.tasks[0]));
+}
+
+static int diag_jitter_read(struct os_mbuf *om) {
+  uint8_t buf[TASK_JITTER_COUNT * (2 + TASK_STATS_JITTER_BUCKETS) *
+              sizeof(uint32_t)];
+  uint8_t *p = buf;
+
+  for (int src = 0; src < TASK_JITTER_COUNT; src++) {
+    task_jitter_stats_t stats;
+    task_stats_jitter_get(src, &stats);
+    put_le32(p, stats.count);
+    put_le32(p + 4, stats.max_us);
+    p += 8;
+    for (int i = 0; i < TASK_STATS_JITTER_BUCKETS; i++) {
+      put_le32(p, stats.buckets[i]);
+      p += 4;
+    }
+  }
+  return os_mbuf_append(om, buf, sizeof(buf));
+}
+
+typedef struct {
+  int (*read)(struct os_mbuf *om);
+  // Takes the snapshot reads return, NULL if reads are live
+  void (*take)(void);
+} diag_chr_t;
+
+// Handlers of each characteristic, in diag_chrs order
+static const diag_chr_t diag_chr_ops[DIAG_CHR_COUNT] = {
+    {.read = diag_stats_read},
+    {.read = diag_tasks_read, .take = diag_tasks_take},
+    {.read = diag_jitter_read},
+};
+
+// Service declaration, then a declaration and a value per characteristic
+#define DIAG_ATTR_MAX (1 + DIAG_CHR_COUNT * 2)
+
+// Dispatch table, indexed by attribute handle - diag_base_handle. Filled in
+// as NimBLE registers the service (diag_svc_register_cb)
+static const diag_chr_t *diag_attrs[DIAG_ATTR_MAX];
+static uint16_t diag_base_handle;
+
+static int diag_svc_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  uint16_t idx = attr_handle - diag_base_handle;
+  const diag_chr_t *chr = idx < DIAG_ATTR_MAX ? diag_attrs[idx] : NULL;
+
+  if (chr == NULL) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+  if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+    return chr->read(ctxt->om) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+  } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR && chr->take != NULL) {
+    // Whatever was written, it only asks for a fresh sample
+    chr->take();
+    return 0;
+  }
+  return BLE_ATT_ERR_UNLIKELY;
+}
+
+void diag_svc_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
+  switch (ctxt->op) {
+  case BLE_GATT_REGISTER_OP_SVC:
+    if (ctxt->svc.svc_def == &diag_svcs[0]) {
+      diag_base_handle = ctxt->svc.handle;
+    }
+    break;
+
+  case BLE_GATT_REGISTER_OP_CHR:
+    if (ctxt->chr.chr_def->access_cb == diag_svc_access) {
+      uint16_t idx = ctxt->chr.val_handle - diag_base_handle;
+      assert(idx < DIAG_ATTR_MAX);
+      diag_attrs[idx] = &diag_chr_ops[ctxt->chr.chr_def - diag_chrs];
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+int diag_svc_init(void) {
+  int rc;
+
+  rc = ble_gatts_count_cfg(diag_svcs);
+  if (rc != 0) {
+    return rc;
+  }
+
+  rc = ble_gatts_add_svcs(diag_svcs);
+  if (rc != 0) {
+    return rc;
+  }
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef DIAG_SVC_H
+#define DIAG_SVC_H
+
+#include "host/ble_gatt.h"
+
+// Vendor GATT service with the firmware's runtime counters, next to the key
+// latency trace (key_trace_svc.h). Every characteristic needs an encrypted
+// link, so only a bonded host can read it:
+//
+//  - Stats: one record per counter source, a type (diag_stats_type_t) and a
+//    length in bytes, each a uint8, then that many bytes of little endian
+//    uint32 counters. Readers skip the types they do not know, and sources
+//    may grow counters at the end
+//  - Tasks: wall time since the previous sample in us (uint32), then every
+//    task as task_stats_task_t: name, core, priority, least free stack and
+//    CPU time since the previous sample. Writing it (any value) takes a
+//    sample, and reads return that sample until the next write, so the
+//    blobs of a long read agree. The first read takes one itself
+//  - Jitter: for every task_jitter_t in order, count, max in us and the
+//    TASK_STATS_JITTER_BUCKETS log2 histogram buckets, each a little endian
+//    uint32
+//
+// tools/decode_key_trace.py turns them into tables or JSON.
+
+typedef enum {
+  // Report delivery (struct hogp_tx_stats): flushes, reports sent, dropped,
+  // max reports per flush, queue depth, max queue depth and busy
+  DIAG_STATS_TX = 1,
+  // Bonded host reconnects (struct gap_reconnect_stats): count, directed,
+  // last and max in ms
+  DIAG_STATS_RECONNECT = 2,
+  // Key matrix scanner (struct matrix_scanner_stats): wakeups, scans,
+  // dropped, then the keymap's taps, holds, combos, forced and max wait in us
+  DIAG_STATS_SCANNER = 3,
+  // Deferred log records (struct klog_stats): written and dropped
+  DIAG_STATS_KLOG = 4,
+  // Light sleep policy estimate (power_stats_t): average current in uA, per
+  // mille asleep, radio event rate in mHz, then wakes by key, timer and other
+  DIAG_STATS_POWER = 5,
+  // Report mbuf pool (struct report_pool_stats): reports taken, waits on an
+  // empty pool, waits on an empty msys, free and least free blocks, heap
+  // allocations on the report path
+  DIAG_STATS_POOL = 6,
+} diag_stats_type_t;
+
+void diag_svc_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
+
+int diag_svc_init(void);
+
+#endif
@@ -1,12 +1,17 @@
 #include "gap.h"
 #include "config.h"
+#include "conn_params.h"
 #include "esp_log.h"
 #include "hogp_gatt_svr.h"
+#include "klog.h"
+#include "power_mgr.h"
 #include "host/ble_gap.h"
 #include "host/ble_hs.h"
 #include "host/ble_hs_adv.h"
 #include "host/ble_hs_id.h"
+#include "host/ble_store.h"
 #include "host/util/util.h"
+#include "nimble/nimble_port.h"
 #include "services/gap/ble_svc_gap.h"
 
 static uint8_t own_addr_type;
@@ -29,6 +34,272 @@ static uint8_t uri[] = {BLE_GAP_URI_PREFIX_HTTPS,
                         'e',
                         'v'};
 
+static int conn_params_gap_request(uint16_t conn_handle,
+                                   const conn_params_req_t *req, void *arg);
+
+static const conn_params_cfg_t conn_params_cfg = {
+    .active = {.itvl_min = CONN_ACTIVE_ITVL_MIN,
+               .itvl_max = CONN_ACTIVE_ITVL_MAX,
+               .latency = 0,
+               .supervision_timeout = CONN_SUPERVISION_TIMEOUT},
+    .idle = {.itvl_min = CONN_IDLE_ITVL_MIN,
+             .itvl_max = CONN_IDLE_ITVL_MAX,
+             .latency = CONN_IDLE_LATENCY,
+             .supervision_timeout = CONN_SUPERVISION_TIMEOUT},
+    .idle_after_ms = CONN_IDLE_AFTER_MS,
+    .retry_min_ms = CONN_RETRY_MIN_MS,
+    .retry_max_ms = CONN_RETRY_MAX_MS,
+    .active_itvl_cap = CONN_ACTIVE_ITVL_CAP,
+};
+
+static const conn_params_ops_t conn_params_ops = {
+    .request = conn_params_gap_request,
+};
+
+// Largest LL payload and the time it takes on the 1M PHY (Core spec 4.5.10)
+#define DLE_MAX_TX_OCTETS 251
+#define DLE_MAX_TX_TIME 2120
+// Without data length extension
+#define DLE_DEFAULT_TX_OCTETS 27
+
+#define GAP_MAX_CONNS MYNEWT_VAL(BLE_MAX_CONNECTIONS)
+
+// Per connection link state and parameter policy. A slot is free when
+// link.conn_handle is BLE_HS_CONN_HANDLE_NONE
+typedef struct {
+  struct gap_link_info link;
+  conn_params_t conn_params;
+  struct ble_npl_callout conn_params_timer;
+} gap_conn_t;
+
+static gap_conn_t gap_conns[GAP_MAX_CONNS];
+
+// The controller stops high duty cycle directed advertising after 1.28 s
+#define ADV_DIRECTED_DURATION_MS 1280
+
+typedef enum {
+  ADV_MODE_NONE,
+  ADV_MODE_DIRECTED,
+  ADV_MODE_UNDIRECTED,
+} adv_mode_t;
+
+static adv_mode_t adv_mode;
+
+// Bonded host to reconnect to with directed advertising. reconnect_pending is
+// set on boot and when a bonded host drops, and cleared once directed
+// advertising has had its turn
+static ble_addr_t reconnect_peer;
+static bool reconnect_pending;
+
+// Disconnect (or boot) to first report timing. reconnect_conn is the
+// connection of the host that came back, until its first report is sent
+static struct gap_reconnect_stats reconnect_stats;
+static uint32_t reconnect_started_ms;
+static bool reconnect_timing;
+static bool reconnect_directed;
+static uint16_t reconnect_conn = BLE_HS_CONN_HANDLE_NONE;
+
+static gap_conn_t *gap_conn_find(uint16_t conn_handle) {
+  if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+    return NULL;
+  }
+  for (size_t i = 0; i < GAP_MAX_CONNS; i++) {
+    if (gap_conns[i].link.conn_handle == conn_handle) {
+      return &gap_conns[i];
+    }
+  }
+  return NULL;
+}
+
+static inline uint32_t now_ms(void) {
+  return ble_npl_time_ticks_to_ms32(ble_npl_time_get());
+}
+
+static int conn_params_gap_request(uint16_t conn_handle,
+                                   const conn_params_req_t *req, void *arg) {
+  struct ble_gap_upd_params params = {
+      .itvl_min = req->itvl_min,
+      .itvl_max = req->itvl_max,
+      .latency = req->latency,
+      .supervision_timeout = req->supervision_timeout,
+  };
+  int rc = ble_gap_update_params(conn_handle, &params);
+  if (rc != 0) {
+    KLOG_W(GAP, "failed to request connection parameters, error code: %d",
+           rc);
+  }
+  return rc;
+}
+
+// Runs the policy's timeouts and re-arms the timer for the next one
+static void conn_params_run(gap_conn_t *conn) {
+  uint32_t next = conn_params_tick(&conn->conn_params, now_ms());
+  if (next == UINT32_MAX) {
+    ble_npl_callout_stop(&conn->conn_params_timer);
+  } else {
+    ble_npl_callout_reset(&conn->conn_params_timer,
+                          ble_npl_time_ms_to_ticks32(next));
+  }
+}
+
+// The callout argument is the gap_conn_t it belongs to
+static void conn_params_timer_cb(struct ble_npl_event *ev) {
+  conn_params_run(ble_npl_event_get_arg(ev));
+}
+
+void gap_conn_activity(void) {
+  uint32_t now = now_ms();
+
+  for (size_t i = 0; i < GAP_MAX_CONNS; i++) {
+    gap_conn_t *conn = &gap_conns[i];
+    if (conn->link.conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+      continue;
+    }
+    // Cheap when already in the active mode, only the timestamp moves
+    bool was_active = conn->conn_params.target == CONN_PARAMS_ACTIVE;
+    conn_params_activity(&conn->conn_params, now);
+    if (!was_active) {
+      // The timer is not running while idle, arm it for the idle timeout
+      conn_params_run(conn);
+    }
+  }
+}
+
+void gap_host_suspend(uint16_t conn_handle, bool suspended) {
+  gap_conn_t *conn = gap_conn_find(conn_handle);
+  if (conn == NULL) {
+    return;
+  }
+  if (suspended) {
+    conn_params_suspend(&conn->conn_params, now_ms());
+  } else {
+    // It usually talks to us right after waking
+    conn_params_activity(&conn->conn_params, now_ms());
+  }
+  conn_params_run(conn);
+}
+
+static struct gap_link_info *gap_link_info_mut(uint16_t conn_handle) {
+  gap_conn_t *conn = gap_conn_find(conn_handle);
+  return conn != NULL ? &conn->link : NULL;
+}
+
+const struct gap_link_info *gap_link_info(uint16_t conn_handle) {
+  return gap_link_info_mut(conn_handle);
+}
+
+static gap_conn_t *gap_conn_free_slot(void) {
+  for (size_t i = 0; i < GAP_MAX_CONNS; i++) {
+    if (gap_conns[i].link.conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+      return &gap_conns[i];
+    }
+  }
+  return NULL;
+}
+
+// Tells the power manager how often the radio wakes up: every connection
+// event a link does not skip, plus advertising
+static void gap_power_update(void) {
+  uint32_t radio_mhz = 0;
+  bool settling = false;
+
+  for (size_t i = 0; i < GAP_MAX_CONNS; i++) {
+    const gap_conn_t *conn = &gap_conns[i];
+    if (conn->link.conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+      continue;
+    }
+    uint32_t period_us =
+        conn->link.conn_itvl * 1250u * (conn->link.conn_latency + 1u);
+    radio_mhz += power_rate_mhz(period_us);
+    settling |= conn->conn_params.applied == CONN_PARAMS_NONE;
+  }
+  if (ble_gap_adv_active()) {
+    radio_mhz += power_rate_mhz(POWER_ADV_ITVL_MS * 1000u);
+  }
+
+  power_mgr_radio(radio_mhz);
+  if (!settling) {
+    // Every link runs with parameters we asked for, nothing to stay up for
+    power_mgr_hold(POWER_HOLD_LINK, false);
+  }
+}
+
+// Keeps advertising while there is room for another central. A bonded host
+// waiting to reconnect takes priority over undirected advertising that is
+// already running
+static void adv_restart(void) {
+  if (gap_conn_free_slot() == NULL) {
+    return;
+  }
+  if (reconnect_pending && adv_mode == ADV_MODE_UNDIRECTED &&
+      ble_gap_adv_stop() == 0) {
+    adv_mode = ADV_MODE_NONE;
+  }
+  if (!ble_gap_adv_active()) {
+    adv_start();
+  }
+}
+
+// Starts the disconnect to first report clock for a bonded host
+static void reconnect_arm(const ble_addr_t *peer) {
+  reconnect_peer = *peer;
+  reconnect_pending = true;
+  reconnect_started_ms = now_ms();
+  reconnect_timing = true;
+  reconnect_directed = false;
+  reconnect_conn = BLE_HS_CONN_HANDLE_NONE;
+}
+
+void gap_report_sent(uint16_t conn_handle) {
+  if (conn_handle != reconnect_conn) {
+    return;
+  }
+
+  uint32_t elapsed = now_ms() - reconnect_started_ms;
+  reconnect_stats.count++;
+  reconnect_stats.last_ms = elapsed;
+  if (elapsed > reconnect_stats.max_ms) {
+    reconnect_stats.max_ms = elapsed;
+  }
+  if (reconnect_directed) {
+    reconnect_stats.directed++;
+  }
+  reconnect_conn = BLE_HS_CONN_HANDLE_NONE;
+  reconnect_timing = false;
+}
+
+void gap_get_reconnect_stats(struct gap_reconnect_stats *stats) {
+  *stats = reconnect_stats;
+}
+
+// Asks for 2M PHY, the largest LL payload and a large ATT MTU. Each of these
+// is optional: if the central (or its controller) does not support one, the
+// request fails or is answered with the old value and the link simply keeps
+// running on the defaults
+static void gap_link_negotiate(uint16_t conn_handle) {
+  int rc;
+
+  rc = ble_gap_set_prefered_le_phy(conn_handle, BLE_GAP_LE_PHY_2M_MASK,
+                                   BLE_GAP_LE_PHY_2M_MASK,
+                                   BLE_GAP_LE_PHY_CODED_ANY);
+  if (rc != 0) {
+    KLOG_W(GAP, "failed to request 2M PHY, error code: %d", rc);
+  }
+
+  rc = ble_gap_set_data_len(conn_handle, DLE_MAX_TX_OCTETS, DLE_MAX_TX_TIME);
+  if (rc != 0) {
+    KLOG_W(GAP, "failed to request data length extension, error code: %d",
+           rc);
+  }
+
+  // Our side of the exchange is CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU, the
+  // result arrives as BLE_GAP_EVENT_MTU
+  rc = ble_gattc_exchange_mtu(conn_handle, NULL, NULL);
+  if (rc != 0) {
+    KLOG_W(GAP, "failed to start MTU exchange, error code: %d", rc);
+  }
+}
+
 // Format the bluetooth address in a redable format
 inline static void format_addr(char *addr_str, uint8_t addr[]) {
   sprintf(addr_str, "%02X:%02X:%02X:%02X:%02X:%02X", addr[0], addr[1], addr[2],
@@ -38,66 +309,124 @@ inline static void format_addr(char *addr_str, uint8_t addr[]) {
 static int gap_event_handler(struct ble_gap_event *event, void *arg) {
   int rc = 0;
   struct ble_gap_conn_desc desc;
+  struct gap_link_info *link;
 
   switch (event->type) {
 
   case BLE_GAP_EVENT_CONNECT:
     // Two possibilities: a new connection or a failed connection
-    ESP_LOGI(TAG, "Connection %s: stauts=%d",
-             event->connect.status == 0 ? "established" : "failed",
-             event->connect.status);
+    KLOG_I(GAP, "connect; status=%d conn_handle=%d", event->connect.status,
+           event->connect.conn_handle);
 
     if (event->connect.status == 0) {
       // Connection succeeded, check connection handle
       rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
       if (rc != 0) {
-        ESP_LOGE(TAG, "failed to find connection by handle, error code: %d",
-                 rc);
+        KLOG_E(GAP, "failed to find connection by handle, error code: %d",
+               rc);
         return rc;
       }
 
       // print_conn_desc(&desc);
       // led_on();
 
-      // Try to update connection parameters
-      struct ble_gap_upd_params params = {.itvl_min = desc.conn_itvl,
-                                          .itvl_max = desc.conn_itvl,
-                                          .latency = 0,
-                                          .supervision_timeout =
-                                              desc.supervision_timeout};
-      rc = ble_gap_update_params(event->connect.conn_handle, &params);
-      if (rc != 0) {
-        ESP_LOGE(TAG, "failed to update connection parameters, error code: %d",
-                 rc);
-        return rc;
+      gap_conn_t *conn = gap_conn_free_slot();
+      if (conn == NULL ||
+          hogp_gatt_svr_connect_cb(event->connect.conn_handle) != 0) {
+        KLOG_W(GAP, "connection limit reached, dropping %d",
+               event->connect.conn_handle);
+        ble_gap_terminate(event->connect.conn_handle, BLE_ERR_CONN_LIMIT);
+        adv_mode = ADV_MODE_NONE;
+        return 0;
+      }
+
+      conn->link = (struct gap_link_info){
+          .conn_handle = event->connect.conn_handle,
+          .conn_itvl = desc.conn_itvl,
+          .conn_latency = desc.conn_latency,
+          .mtu = BLE_ATT_MTU_DFLT,
+          .max_tx_octets = DLE_DEFAULT_TX_OCTETS,
+          .tx_phy = BLE_GAP_LE_PHY_1M,
+          .rx_phy = BLE_GAP_LE_PHY_1M,
+      };
+      gap_link_negotiate(event->connect.conn_handle);
+      // Stay awake for the setup traffic until our parameters are in
+      power_mgr_hold(POWER_HOLD_LINK, true);
+
+      if (reconnect_timing &&
+          ble_addr_cmp(&desc.peer_id_addr, &reconnect_peer) == 0) {
+        // The host we were waiting for, time it up to its first report
+        reconnect_conn = event->connect.conn_handle;
+        reconnect_directed = adv_mode == ADV_MODE_DIRECTED;
+        reconnect_pending = false;
       }
-    } else {
-      // Connection failed, restart advertising
-      adv_start();
+
+      // Ask for the low latency parameters, the policy takes it from here
+      conn_params_connected(&conn->conn_params, event->connect.conn_handle,
+                            now_ms());
+      conn_params_run(conn);
     }
+    // Advertising stops on connect, keep going if another central fits
+    adv_mode = ADV_MODE_NONE;
+    adv_restart();
+    gap_power_update();
     return rc;
     break;
 
-  case BLE_GAP_EVENT_DISCONNECT:
-    ESP_LOGI(TAG, "Disconnected, reason=%d", event->disconnect.reason);
-    adv_start();
+  case BLE_GAP_EVENT_DISCONNECT: {
+    KLOG_I(GAP, "Disconnected, reason=%d", event->disconnect.reason);
+    hogp_gatt_svr_disconnect_cb(event->disconnect.conn.conn_handle);
+    gap_conn_t *conn = gap_conn_find(event->disconnect.conn.conn_handle);
+    if (conn != NULL) {
+      conn_params_disconnected(&conn->conn_params);
+      ble_npl_callout_stop(&conn->conn_params_timer);
+      conn->link.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    if (event->disconnect.conn.sec_state.bonded) {
+      reconnect_arm(&event->disconnect.conn.peer_id_addr);
+    } else if (event->disconnect.conn.conn_handle == reconnect_conn) {
+      // Gone again before its first report, that attempt does not count
+      reconnect_conn = BLE_HS_CONN_HANDLE_NONE;
+      reconnect_timing = false;
+    }
+    adv_restart();
+    gap_power_update();
     break;
+  }
 
-  case BLE_GAP_EVENT_CONN_UPDATE:
-    ESP_LOGI(TAG, "Connection updated: status=%d", event->conn_update.status);
+  case BLE_GAP_EVENT_CONN_UPDATE: {
+    KLOG_I(GAP, "Connection updated: status=%d", event->conn_update.status);
 
     rc = ble_gap_conn_find(event->conn_update.conn_handle, &desc);
     if (rc != 0) {
-      ESP_LOGE(TAG, "Failed to find conection by handle, error: %d", rc);
+      KLOG_E(GAP, "Failed to find conection by handle, error: %d", rc);
       return rc;
     }
+    KLOG_I(GAP, "itvl=%d latency=%d timeout=%d", desc.conn_itvl,
+           desc.conn_latency, desc.supervision_timeout);
+    gap_conn_t *conn = gap_conn_find(event->conn_update.conn_handle);
+    if (conn != NULL) {
+      conn->link.conn_itvl = desc.conn_itvl;
+      conn->link.conn_latency = desc.conn_latency;
+      conn_params_update_done(&conn->conn_params, event->conn_update.status,
+                              desc.conn_itvl, desc.conn_latency, now_ms());
+      conn_params_run(conn);
+    }
+    gap_power_update();
     return rc;
+  }
 
   /* Advertising complete event */
   case BLE_GAP_EVENT_ADV_COMPLETE:
     /* Advertising completed, restart advertising */
-    ESP_LOGI(TAG, "advertise complete; reason=%d", event->adv_complete.reason);
-    adv_start();
+    KLOG_I(GAP, "advertise complete; reason=%d", event->adv_complete.reason);
+    if (adv_mode == ADV_MODE_DIRECTED) {
+      // The bonded host did not answer in time, fall back to undirected
+      reconnect_pending = false;
+    }
+    adv_mode = ADV_MODE_NONE;
+    adv_restart();
+    gap_power_update();
     return rc;
 
   /* Notification sent event */
@@ -105,24 +434,24 @@ static int gap_event_handler(struct ble_gap_event *event, void *arg) {
     if ((event->notify_tx.status != 0) &&
         (event->notify_tx.status != BLE_HS_EDONE)) {
       /* Print notification info on error */
-      ESP_LOGI(TAG,
-               "notify event; conn_handle=%d attr_handle=%d "
-               "status=%d is_indication=%d",
-               event->notify_tx.conn_handle, event->notify_tx.attr_handle,
-               event->notify_tx.status, event->notify_tx.indication);
+      KLOG_I(GAP,
+             "notify event; conn_handle=%d attr_handle=%d "
+             "status=%d is_indication=%d",
+             event->notify_tx.conn_handle, event->notify_tx.attr_handle,
+             event->notify_tx.status, event->notify_tx.indication);
     }
+    hogp_gatt_svr_notify_tx_cb(event);
     return rc;
 
   /* Subscribe event */
   case BLE_GAP_EVENT_SUBSCRIBE:
     /* Print subscription info to log */
-    ESP_LOGI(TAG,
-             "subscribe event; conn_handle=%d attr_handle=%d "
-             "reason=%d prevn=%d curn=%d previ=%d curi=%d",
-             event->subscribe.conn_handle, event->subscribe.attr_handle,
-             event->subscribe.reason, event->subscribe.prev_notify,
-             event->subscribe.cur_notify, event->subscribe.prev_indicate,
-             event->subscribe.cur_indicate);
+    KLOG_I(GAP, "subscribe event; conn_handle=%d attr_handle=%d reason=%d",
+           event->subscribe.conn_handle, event->subscribe.attr_handle,
+           event->subscribe.reason);
+    KLOG_I(GAP, "subscribe event; prevn=%d curn=%d previ=%d curi=%d",
+           event->subscribe.prev_notify, event->subscribe.cur_notify,
+           event->subscribe.prev_indicate, event->subscribe.cur_indicate);
 
     /* GATT subscribe event callback */
     hogp_gatt_svr_subscribe_cb(event);
@@ -130,19 +459,48 @@ static int gap_event_handler(struct ble_gap_event *event, void *arg) {
 
   case BLE_GAP_EVENT_MTU:
     /* Print MTU update info to log */
-    ESP_LOGI(TAG, "mtu update event; conn_handle=%d cid=%d mtu=%d",
-             event->mtu.conn_handle, event->mtu.channel_id, event->mtu.value);
+    KLOG_I(GAP, "mtu update event; conn_handle=%d cid=%d mtu=%d",
+           event->mtu.conn_handle, event->mtu.channel_id, event->mtu.value);
+    link = gap_link_info_mut(event->mtu.conn_handle);
+    if (link != NULL) {
+      link->mtu = event->mtu.value;
+    }
     return rc;
+
+  case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+    KLOG_I(GAP, "phy update event; status=%d tx_phy=%d rx_phy=%d",
+           event->phy_updated.status, event->phy_updated.tx_phy,
+           event->phy_updated.rx_phy);
+    // On failure the link stays on whatever PHY it had
+    link = gap_link_info_mut(event->phy_updated.conn_handle);
+    if (event->phy_updated.status == 0 && link != NULL) {
+      link->tx_phy = event->phy_updated.tx_phy;
+      link->rx_phy = event->phy_updated.rx_phy;
+    }
+    return rc;
+
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+  case BLE_GAP_EVENT_DATA_LEN_CHG:
+    KLOG_I(GAP, "data length event; max_tx_octets=%d max_rx_octets=%d",
+           event->data_len_chg.max_tx_octets,
+           event->data_len_chg.max_rx_octets);
+    link = gap_link_info_mut(event->data_len_chg.conn_handle);
+    if (link != NULL) {
+      link->max_tx_octets = event->data_len_chg.max_tx_octets;
+    }
+    return rc;
+#endif
   }
   return rc;
 }
 
-int adv_start() {
+// Advertising and scan response data never change, so they are encoded and
+// handed to the controller once per host sync instead of on every start
+static int adv_set_payloads(void) {
   int rc = 0;
   const char *name;
   struct ble_hs_adv_fields adv_fields = {0};
   struct ble_hs_adv_fields rsp_fields = {0};
-  struct ble_gap_adv_params adv_params = {0};
 
   // Advertising flags (general discoverable & BR/EDR unsupported)
   adv_fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
@@ -186,21 +544,63 @@ int adv_start() {
     ESP_LOGE(TAG, "failed to set scan fields, error code: %d", rc);
     return rc;
   }
+  return 0;
+}
+
+static int adv_start_undirected(void) {
+  struct ble_gap_adv_params adv_params = {0};
 
-  // Set non-connetable and general discoverable mode to be a beacon
+  // Set connectable and general discoverable mode
   adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
   adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-  rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params,
-                         gap_event_handler, NULL);
+  int rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params,
+                             gap_event_handler, NULL);
   if (rc != 0) {
     ESP_LOGE(TAG, "failed to start advertising, error code: %d", rc);
     return rc;
   }
 
+  adv_mode = ADV_MODE_UNDIRECTED;
   ESP_LOGI(TAG, "Advertising started!");
   return 0;
 }
 
+// High duty cycle directed advertising, addressed to one bonded host. The
+// controller gives up after ADV_DIRECTED_DURATION_MS
+static int adv_start_directed(const ble_addr_t *peer) {
+  struct ble_gap_adv_params adv_params = {0};
+
+  adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+  adv_params.disc_mode = BLE_GAP_DISC_MODE_NON;
+  adv_params.high_duty_cycle = 1;
+  int rc = ble_gap_adv_start(own_addr_type, peer, ADV_DIRECTED_DURATION_MS,
+                             &adv_params, gap_event_handler, NULL);
+  if (rc != 0) {
+    ESP_LOGW(TAG, "failed to start directed advertising, error code: %d", rc);
+    return rc;
+  }
+
+  adv_mode = ADV_MODE_DIRECTED;
+  ESP_LOGI(TAG, "Directed advertising started!");
+  return 0;
+}
+
+// Directed advertising to the last bonded host first, if it is not already
+// connected, then undirected advertising for everyone else
+int adv_start() {
+  if (reconnect_pending) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find_by_addr(&reconnect_peer, &desc) != 0 &&
+        adv_start_directed(&reconnect_peer) == 0) {
+      return 0;
+    }
+    // Already back, or the controller can not do it. Either way there is
+    // nothing to wait for
+    reconnect_pending = false;
+  }
+  return adv_start_undirected();
+}
+
 int adv_init() {
   int rc = 0;
   char addr_str[18] = {0};
@@ -226,7 +626,23 @@ int adv_init() {
   format_addr(addr_str, addr_val);
   ESP_LOGI(TAG, "address: %s", addr_str);
 
+  rc = adv_set_payloads();
+  if (rc != 0) {
+    return rc;
+  }
+
+  // Coming out of reset, most likely a wake from sleep. The store lists bonds
+  // oldest first, the last one is the host we were most recently paired with
+  ble_addr_t bonded[MYNEWT_VAL(BLE_STORE_MAX_BONDS)];
+  int num_bonded = 0;
+  rc = ble_store_util_bonded_peers(bonded, &num_bonded,
+                                   MYNEWT_VAL(BLE_STORE_MAX_BONDS));
+  if (rc == 0 && num_bonded > 0) {
+    reconnect_arm(&bonded[num_bonded - 1]);
+  }
+
   adv_start();
+  gap_power_update();
 
   return 0;
 }
@@ -234,6 +650,15 @@ int adv_init() {
 int gap_init() {
   int rc = 0;
 
+  for (size_t i = 0; i < GAP_MAX_CONNS; i++) {
+    gap_conn_t *conn = &gap_conns[i];
+    conn->link.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    conn_params_init(&conn->conn_params, &conn_params_cfg, &conn_params_ops);
+    ble_npl_callout_init(&conn->conn_params_timer,
+                         nimble_port_get_dflt_eventq(), conn_params_timer_cb,
+                         conn);
+  }
+
   // Call NimBLE GAP initialization API
   ble_svc_gap_init();
 
@@ -1,10 +1,54 @@
+#ifndef GAP_H
+#define GAP_H
+
 #define BLE_GAP_APPEARANCE_GENERIC_TAG 0x0200
 #define BLE_GAP_APPEARANCE_KEYBOARD 0x03C1
 #define BLE_GAP_LE_ROLE_PERIPHERAL 0x00
 #define BLE_GAP_URI_PREFIX_HTTPS 0x17
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// What was negotiated for a connection. The report scheduler sizes its
+// batches from this
+struct gap_link_info {
+  uint16_t conn_handle;
+  uint16_t conn_itvl;     // 1.25 ms units
+  uint16_t conn_latency;  // Connection events we may skip
+  uint16_t mtu;           // ATT MTU
+  uint16_t max_tx_octets; // LL payload, 27 without data length extension
+  uint8_t tx_phy;         // BLE_GAP_LE_PHY_1M / BLE_GAP_LE_PHY_2M
+  uint8_t rx_phy;
+};
+
+// Time from a bonded host dropping (or from boot) until its first report went
+// out after it reconnected
+struct gap_reconnect_stats {
+  uint32_t count;
+  uint32_t directed; // Reconnects that came in on directed advertising
+  uint32_t last_ms;
+  uint32_t max_ms;
+};
+
 int gap_init();
 
 int adv_init();
 
 int adv_start();
+
+// Key activity, keeps the connection on the low latency parameters
+void gap_conn_activity(void);
+
+// The host on conn_handle wrote Suspend (true) or Exit Suspend (false) to the
+// HID Control Point
+void gap_host_suspend(uint16_t conn_handle, bool suspended);
+
+// NULL if conn_handle is not connected
+const struct gap_link_info *gap_link_info(uint16_t conn_handle);
+
+// A report was notified on conn_handle, ends a pending reconnect measurement
+void gap_report_sent(uint16_t conn_handle);
+
+void gap_get_reconnect_stats(struct gap_reconnect_stats *stats);
+
+#endif
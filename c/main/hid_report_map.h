@@ -0,0 +1,41 @@
+#ifndef HID_REPORT_MAP_H
+#define HID_REPORT_MAP_H
+
+#include <stdint.h>
+
+// Per report constants generated from hid_vars.c at build time
+#include "hid_layout.h"
+
+// Values match the second byte of the HOGP Report Reference descriptor
+typedef enum {
+  HID_REPORT_TYPE_INPUT = 0x01,
+  HID_REPORT_TYPE_OUTPUT = 0x02,
+  HID_REPORT_TYPE_FEATURE = 0x03,
+} hid_report_type_t;
+
+typedef struct {
+  uint8_t id;   // Report ID, 0 if the map does not use IDs
+  uint8_t type; // hid_report_type_t
+  uint16_t len; // Payload length in bytes, without the Report ID
+} hid_report_info_t;
+
+// Writes `value` into a little-endian bit field of a report. Called with the
+// _OFFSET/_SIZE constants from hid_layout.h this folds down to a couple of
+// precomputed shifts and masks
+static inline void hid_field_pack(uint8_t *report, uint32_t bit_offset,
+                                  uint8_t bit_size, uint32_t value) {
+  for (uint8_t done = 0; done < bit_size;) {
+    uint32_t pos = bit_offset + done;
+    uint8_t shift = pos & 7;
+    uint8_t take = 8 - shift;
+    if (take > bit_size - done) {
+      take = bit_size - done;
+    }
+    uint8_t mask = ((1u << take) - 1) << shift;
+    report[pos >> 3] =
+        (report[pos >> 3] & ~mask) | (((value >> done) << shift) & mask);
+    done += take;
+  }
+}
+
+#endif
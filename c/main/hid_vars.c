@@ -1,3 +1,4 @@
+#include "hid_layout.h"
 #include <hid_vars.h>
 
 const uint8_t HID_BOOT_REPORT_MAP[] = {
@@ -39,11 +40,11 @@ const uint8_t HID_BOOT_REPORT_MAP[] = {
     0x91, 0x03, //   Output (Const,Var,Abs,No Wrap,Linear,Preferred State,No
                 //   Null Position,Non-volatile)
     0xC0,       // End Collection
-
-    // 67 bytes
 };
 
 const size_t HID_BOOT_REPORT_MAP_LEN = sizeof(HID_BOOT_REPORT_MAP);
+_Static_assert(sizeof(HID_BOOT_REPORT_MAP) == HID_BOOT_REPORT_MAP_SIZE,
+               "hid_layout.h is stale");
 
 const uint8_t HID_COMPLEX_REPORT_MAP[] = {
     0x06, 0x01, 0x00, // Usage Page (Generic Desktop Ctrls)
@@ -93,14 +94,29 @@ const uint8_t HID_COMPLEX_REPORT_MAP[] = {
     0xA1, 0x01, // Collection (Application)
     0x85, 0x04, //   Report ID (4)
     0x05, 0x07, //   Usage Page (Kbrd/Keypad)
-    0x19, 0x04, //   Usage Minimum (0x04)
-    0x29, 0x70, //   Usage Maximum (0x70)
+    0x19, 0xE0, //   Usage Minimum (0xE0)
+    0x29, 0xE7, //   Usage Maximum (0xE7)
     0x15, 0x00, //   Logical Minimum (0)
     0x25, 0x01, //   Logical Maximum (1)
     0x75, 0x01, //   Report Size (1)
+    0x95, 0x08, //   Report Count (8)
+    0x81, 0x02, //   Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null
+                //   Position)
+    0x19, 0x04, //   Usage Minimum (0x04)
+    0x29, 0x7B, //   Usage Maximum (0x7B)
     0x95, 0x78, //   Report Count (120)
     0x81, 0x02, //   Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null
                 //   Position)
+    0x05, 0x08, //   Usage Page (LEDs)
+    0x19, 0x01, //   Usage Minimum (Num Lock)
+    0x29, 0x05, //   Usage Maximum (Kana)
+    0x95, 0x05, //   Report Count (5)
+    0x91, 0x02, //   Output (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null
+                //   Position,Non-volatile)
+    0x95, 0x01, //   Report Count (1)
+    0x75, 0x03, //   Report Size (3)
+    0x91, 0x03, //   Output (Const,Var,Abs,No Wrap,Linear,Preferred State,No
+                //   Null Position,Non-volatile)
     0xC0,       // End Collection
     0x06, 0x00, 0xFF, // Usage Page (Vendor Defined 0xFF00)
     0x09, 0x01,       // Usage (0x01)
@@ -181,8 +197,8 @@ const uint8_t HID_COMPLEX_REPORT_MAP[] = {
     0xB1, 0x02, //   Feature (Data,Var,Abs,No Wrap,Linear,Preferred State,No
                 //   Null Position,Non-volatile)
     0xC0,       // End Collection
-
-    // 251 bytes
 };
 
 const size_t HID_COMPLEX_REPORT_MAP_LEN = sizeof(HID_COMPLEX_REPORT_MAP);
+_Static_assert(sizeof(HID_COMPLEX_REPORT_MAP) == HID_COMPLEX_REPORT_MAP_SIZE,
+               "hid_layout.h is stale");
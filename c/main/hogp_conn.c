@@ -0,0 +1,102 @@
+#include "hogp_conn.h"
+
+// Open addressing with linear probing. Twice the connection count keeps probe
+// sequences at one or two slots
+#define HOGP_CONN_SLOTS 8
+#define HOGP_CONN_SLOT_MASK (HOGP_CONN_SLOTS - 1)
+
+_Static_assert((HOGP_CONN_SLOTS & HOGP_CONN_SLOT_MASK) == 0,
+               "HOGP_CONN_SLOTS must be a power of two");
+_Static_assert(HOGP_CONN_SLOTS >= 2 * HOGP_MAX_CONNS,
+               "HOGP_CONN_SLOTS too small for HOGP_MAX_CONNS");
+
+static hogp_conn_t hogp_conns[HOGP_CONN_SLOTS];
+static size_t hogp_conn_count;
+
+static inline size_t slot_of(uint16_t conn_handle) {
+  return conn_handle & HOGP_CONN_SLOT_MASK;
+}
+
+void hogp_conn_init(void) {
+  for (size_t i = 0; i < HOGP_CONN_SLOTS; i++) {
+    hogp_conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  }
+  hogp_conn_count = 0;
+}
+
+hogp_conn_t *hogp_conn_find(uint16_t conn_handle) {
+  if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+    return NULL;
+  }
+
+  for (size_t n = 0, i = slot_of(conn_handle); n < HOGP_CONN_SLOTS;
+       n++, i = (i + 1) & HOGP_CONN_SLOT_MASK) {
+    if (hogp_conns[i].conn_handle == conn_handle) {
+      return &hogp_conns[i];
+    }
+    if (hogp_conns[i].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+hogp_conn_t *hogp_conn_add(uint16_t conn_handle) {
+  hogp_conn_t *conn = hogp_conn_find(conn_handle);
+  if (conn != NULL) {
+    return conn;
+  }
+  if (conn_handle == BLE_HS_CONN_HANDLE_NONE ||
+      hogp_conn_count == HOGP_MAX_CONNS) {
+    return NULL;
+  }
+
+  size_t i = slot_of(conn_handle);
+  while (hogp_conns[i].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+    i = (i + 1) & HOGP_CONN_SLOT_MASK;
+  }
+
+  hogp_conns[i] = (hogp_conn_t){
+      .conn_handle = conn_handle,
+      .protocol_mode = HID_PROTOCOL_MODE_REPORT,
+  };
+  hogp_conn_count++;
+  return &hogp_conns[i];
+}
+
+void hogp_conn_remove(uint16_t conn_handle) {
+  hogp_conn_t *conn = hogp_conn_find(conn_handle);
+  if (conn == NULL) {
+    return;
+  }
+
+  // Backward shift deletion, so later entries of the same probe sequence
+  // stay reachable without tombstones
+  size_t hole = conn - hogp_conns;
+  size_t i = hole;
+  hogp_conns[hole].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  for (;;) {
+    i = (i + 1) & HOGP_CONN_SLOT_MASK;
+    if (hogp_conns[i].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+      break;
+    }
+    // Distance from home slot, if the hole is within it the entry can move
+    size_t home = slot_of(hogp_conns[i].conn_handle);
+    if (((i - home) & HOGP_CONN_SLOT_MASK) >=
+        ((i - hole) & HOGP_CONN_SLOT_MASK)) {
+      hogp_conns[hole] = hogp_conns[i];
+      hogp_conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+      hole = i;
+    }
+  }
+  hogp_conn_count--;
+}
+
+hogp_conn_t *hogp_conn_next(size_t *index) {
+  for (; *index < HOGP_CONN_SLOTS; (*index)++) {
+    if (hogp_conns[*index].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+      return &hogp_conns[*index];
+    }
+  }
+  return NULL;
+}
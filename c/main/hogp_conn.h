@@ -0,0 +1,56 @@
+#ifndef HOGP_CONN_H
+#define HOGP_CONN_H
+
+#include "host/ble_hs.h"
+#include <stdint.h>
+
+// Protocol Mode characteristic values
+#define HID_PROTOCOL_MODE_BOOT 0x00
+#define HID_PROTOCOL_MODE_REPORT 0x01
+
+#define HOGP_MAX_CONNS MYNEWT_VAL(BLE_MAX_CONNECTIONS)
+// Largest report remembered as the last one sent to a central
+#define HOGP_CONN_LAST_REPORT_LEN 16
+
+// Notifications handed to the stack and not yet confirmed by
+// BLE_GAP_EVENT_NOTIFY_TX, for key latency tracing
+#define HOGP_CONN_TRACE_DEPTH 4
+
+typedef struct {
+  uint32_t detected_us;
+  uint32_t queued_us;
+  uint16_t seq;
+  uint16_t val_handle;
+  uint8_t traced; // 0 for notifications that carry no key event
+} hogp_conn_trace_t;
+
+// HID state of one connected central. Everything the hot path needs sits in
+// the first bytes of the entry
+typedef struct {
+  uint16_t conn_handle; // BLE_HS_CONN_HANDLE_NONE if the slot is free
+  uint16_t notify_mask; // CCCD notify enabled, one bit per input report
+  uint8_t protocol_mode;
+  uint8_t led_state;
+  uint8_t last_report_len;
+  uint8_t last_report[HOGP_CONN_LAST_REPORT_LEN];
+  uint8_t trace_head;
+  uint8_t trace_count;
+  hogp_conn_trace_t trace[HOGP_CONN_TRACE_DEPTH];
+} hogp_conn_t;
+
+void hogp_conn_init(void);
+
+// O(1) lookup by connection handle, NULL if unknown
+hogp_conn_t *hogp_conn_find(uint16_t conn_handle);
+
+// Returns the existing entry or claims a fresh one (report protocol, nothing
+// subscribed). NULL if the table is full
+hogp_conn_t *hogp_conn_add(uint16_t conn_handle);
+
+void hogp_conn_remove(uint16_t conn_handle);
+
+// Iteration over the table: pass 0 first, then the previous index + 1. Returns
+// NULL when there are no more connections
+hogp_conn_t *hogp_conn_next(size_t *index);
+
+#endif
@@ -1,14 +1,30 @@
 #include "hogp_gatt_svr.h"
 #include "config.h"
+#include "control_report.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "gap.h"
+#include "hid_report_map.h"
 #include "hid_vars.h"
+#include "hogp_conn.h"
+#include "hogp_tx.h"
 #include "host/ble_att.h"
 #include "host/ble_gatt.h"
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
+#include "key_event_ring.h"
+#include "key_trace.h"
+#include "klog.h"
+#include "nimble/nimble_port.h"
 #include "os/os_mbuf.h"
+#include "report_builder.h"
+#include "report_pool.h"
 #include "services/gatt/ble_svc_gatt.h"
+#include "task_stats.h"
+#include <stdatomic.h>
 #include <stdint.h>
+#include <string.h>
 
 #define HID_SVC_UUID 0x1812
 #define HID_INFO_CHR_UUID 0x2A4A
@@ -20,192 +36,744 @@
 #define BOOT_KBD_OUTP_REPORT_CHR_UUID 0x2A33
 #define REPORT_REFERENCE_DSC_UUID 0x2908
 
+// HID Control Point commands
+#define HID_CTRL_POINT_SUSPEND 0x00
+#define HID_CTRL_POINT_EXIT_SUSPEND 0x01
+
+// Max number of key events handled per pass of the drain callback
+#define KEY_EVENT_BATCH 16
+
+#define HOGP_MAX_REPORTS HID_COMPLEX_REPORT_COUNT
+// Input and output reports keep their value in RAM, this is the largest
+#define HOGP_REPORT_VALUE_MAX_LEN 16
+
+// Bit of hogp_conn_t.notify_mask for the Boot Keyboard Input Report, the
+// Report characteristics use the bit of their index
+#define HOGP_NOTIFY_BOOT_KBD (1u << 15)
+
+_Static_assert(HOGP_MAX_REPORTS < 15, "notify_mask has no bit for a report");
+_Static_assert(HOGP_REPORT_VALUE_MAX_LEN <= HOGP_CONN_LAST_REPORT_LEN,
+               "report does not fit hogp_conn_t.last_report");
+_Static_assert(HID_COMPLEX_R1_IN_LEN <= HOGP_REPORT_VALUE_MAX_LEN &&
+                   HID_COMPLEX_R2_IN_LEN <= HOGP_REPORT_VALUE_MAX_LEN &&
+                   HID_COMPLEX_R3_IN_LEN <= HOGP_REPORT_VALUE_MAX_LEN &&
+                   HID_COMPLEX_R4_IN_LEN <= HOGP_REPORT_VALUE_MAX_LEN &&
+                   HID_COMPLEX_R4_OUT_LEN <= HOGP_REPORT_VALUE_MAX_LEN &&
+                   HID_COMPLEX_R7_IN_LEN <= HOGP_REPORT_VALUE_MAX_LEN,
+               "input/output report does not fit its value buffer");
+
 enum {
   HID_INFO_ATTR,
   REPORT_MAP_ATTR,
   HID_CTRL_POINT_ATTR,
-  REPORT_ATTR,
   PRTCL_MODE_ATTR,
   BOOT_KBD_INP_REPORT_ATTR,
   BOOT_KBD_OUTP_REPORT_ATTR,
   HID_IDX_COUNT
 };
 
-enum {
-  REPORT_CONN_STATUS,
-  BOOT_KBD_CONN_STATUS,
-  CONN_STATUS_COUNT,
-};
-
+// One Report characteristic, i.e. one (Report ID, type) pair of the map
 typedef struct {
-  uint8_t notify : 1;
-  uint8_t indicate : 1;
-  uint8_t reserved : 6;
-} cccd_subscription_state_t;
+  hid_report_info_t info;
+  uint8_t *value; // Current value, NULL for feature reports
+  uint16_t val_handle;
+  uint8_t ref[2];      // Report Reference descriptor: Report ID, type
+  uint16_t notify_bit; // Bit in hogp_conn_t.notify_mask
+} hogp_report_t;
 
-// Callback functions for access
-static int hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
-                              struct ble_gatt_access_ctxt *ctxt, void *arg);
+// CPU cycles for key_trace_cost()
+static inline uint32_t hogp_cycles(void) {
+  return KEY_TRACE_ENABLED ? esp_cpu_get_cycle_count() : 0;
+}
+
+static inline void hogp_cost(key_trace_cost_t cost, uint32_t start) {
+  if (KEY_TRACE_ENABLED) {
+    key_trace_cost(cost, esp_cpu_get_cycle_count() - start);
+  }
+}
+
+// Access callback of every attribute in the service, see hogp_attrs
+static int hogp_access(uint16_t conn_handle, uint16_t attr_handle,
+                       struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// Handles access to one attribute, arg is the hogp_attr_t's
+typedef int (*hogp_access_fn_t)(uint16_t conn_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// What an access to one attribute does: a read of a value that is served as
+// it is, or a handler for anything else. Unused slots have neither
+typedef struct {
+  hogp_access_fn_t fn;
+  void *arg;
+  const uint8_t *value;
+  uint16_t len;
+} hogp_attr_t;
 
 static uint16_t hogp_svr_handles[HID_IDX_COUNT];
 
-static uint16_t hogp_conn_handle = BLE_HS_CONN_HANDLE_NONE;
-static cccd_subscription_state_t hogp_subscription_states[CONN_STATUS_COUNT];
+// Which centrals get input, see hogp_gatt_svr_set_fanout()
+static hogp_fanout_t hogp_fanout = HOGP_FANOUT_ALL;
+static uint16_t hogp_active_conn = BLE_HS_CONN_HANDLE_NONE;
+
+// Told about LED (lock key) writes, see hogp_gatt_svr_set_led_cb()
+static hogp_led_cb_t hogp_led_cb;
 
-uint8_t last_report[8] = {
-    0x00,       // Byte 0: Modifiers (e.g., 0x02 for Left Shift)
-    0x00,       // Byte 1: Reserved (Always 0)
-    0x00, 0x00, // Byte 2-3: First two keys
-    0x00, 0x00, // Byte 4-5: Next two keys
-    0x00, 0x00  // Byte 6-7: Last two keys
+// Passes a host's LED write on, if that host is the one receiving input
+static void hogp_led_changed(const hogp_conn_t *conn) {
+  if (hogp_led_cb == NULL) {
+    return;
+  }
+  if (hogp_fanout == HOGP_FANOUT_ACTIVE &&
+      conn->conn_handle != hogp_active_conn) {
+    return;
+  }
+  hogp_led_cb(conn->led_state);
+}
+
+// Feature report reads and writes, see hogp_gatt_svr_set_feature_ops()
+static const hogp_feature_ops_t *hogp_feature_ops;
+
+// Feature reports are passed on flat, through this buffer. Only touched by
+// the NimBLE host task
+#define HOGP_FEATURE_MAX_LEN HID_COMPLEX_R6_FEAT_LEN
+_Static_assert(HID_COMPLEX_R5_FEAT_LEN <= HOGP_FEATURE_MAX_LEN &&
+                   HID_COMPLEX_R8_FEAT_LEN <= HOGP_FEATURE_MAX_LEN,
+               "feature report does not fit hogp_feature_buf");
+static uint8_t hogp_feature_buf[HOGP_FEATURE_MAX_LEN];
+
+// Reports served from HID_COMPLEX_REPORT_MAP, as laid out at build time
+static const hid_report_info_t hogp_report_infos[HOGP_MAX_REPORTS] =
+    HID_COMPLEX_REPORTS_INIT;
+static hogp_report_t hogp_reports[HOGP_MAX_REPORTS];
+static uint8_t hogp_report_values[HOGP_MAX_REPORTS][HOGP_REPORT_VALUE_MAX_LEN];
+
+// The keyboard input report, backed directly by the report builder
+static hogp_report_t *kbd_input_report;
+
+// The LED output report. Its value lives in hogp_conn_t.led_state, each host
+// has its own lock states. Shared by the boot and report protocol
+static hogp_report_t *kbd_led_report;
+
+// Where keyboard input is notified for each protocol mode. The report builder
+// keeps both reports up to date, so a connection switching modes only changes
+// which of these it is sent through
+typedef struct {
+  const uint16_t *val_handle;
+  uint16_t notify_bit;
+  const uint8_t *value;
+  uint8_t len;
+} kbd_input_path_t;
+
+static kbd_input_path_t kbd_input_paths[2];
+
+_Static_assert(KBD_BOOT_REPORT_LEN <= HOGP_REPORT_VALUE_MAX_LEN,
+               "boot report does not fit a tx queue entry");
+
+static int hogp_tx_notify(uint16_t conn_handle, uint16_t val_handle,
+                          const uint8_t *data, uint8_t len, void *arg);
+static const struct gap_link_info *hogp_tx_link(uint16_t conn_handle,
+                                                void *arg);
+static void hogp_tx_sent(uint16_t conn_handle, void *arg);
+
+static const hogp_tx_ops_t hogp_tx_ops = {
+    .notify = hogp_tx_notify,
+    .link = hogp_tx_link,
+    .sent = hogp_tx_sent,
 };
 
+// Reports to notify, only touched by the NimBLE host task
+static hogp_tx_t hogp_tx;
+static struct ble_npl_callout hogp_tx_callout;
+
+// Key event whose report is being queued right now, copied into the tx
+// entries so its latency can be followed up to NOTIFY_TX
+static hogp_tx_trace_t hogp_trace_cur;
+static uint16_t hogp_trace_seq;
+
+// Key events from the input task, drained by the NimBLE host task
+static key_event_ring_t key_ring;
+static struct ble_npl_event key_ring_ev;
+// When the input task first posted key_ring_ev since the last drain, 0 if it
+// has not. For the host task's wake jitter
+static _Atomic uint32_t key_ring_posted_us;
+
+// Pressed key state and the reports built from it. Only touched by the
+// NimBLE host task
+static report_builder_t kbd_reports;
+// Same for the system and consumer control reports
+static control_report_t ctrl_reports;
+
+static const ble_uuid16_t report_chr_uuid = BLE_UUID16_INIT(REPORT_CHR_UUID);
+static const ble_uuid16_t report_ref_dsc_uuid =
+    BLE_UUID16_INIT(REPORT_REFERENCE_DSC_UUID);
+
+// Characteristics that do not depend on the report map. The Report
+// characteristics are appended after these at init
+static const struct ble_gatt_chr_def hogp_fixed_chrs[] = {
+    {.uuid = BLE_UUID16_DECLARE(HID_INFO_CHR_UUID),
+     .access_cb = hogp_access,
+     .flags = BLE_GATT_CHR_F_READ,
+     .val_handle = &hogp_svr_handles[HID_INFO_ATTR]},
+
+    {.uuid = BLE_UUID16_DECLARE(REPORT_MAP_CHR_UUID),
+     .access_cb = hogp_access,
+     .flags = BLE_GATT_CHR_F_READ,
+     .val_handle = &hogp_svr_handles[REPORT_MAP_ATTR]},
+
+    {.uuid = BLE_UUID16_DECLARE(HID_CTRL_POINT_CHR_UUID),
+     .access_cb = hogp_access,
+     .flags = BLE_GATT_CHR_F_WRITE_NO_RSP,
+     .val_handle = &hogp_svr_handles[HID_CTRL_POINT_ATTR]},
+
+    {.uuid = BLE_UUID16_DECLARE(PRTCL_MODE_CHR_UUID),
+     .access_cb = hogp_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE_NO_RSP,
+     .val_handle = &hogp_svr_handles[PRTCL_MODE_ATTR]},
+
+    {.uuid = BLE_UUID16_DECLARE(BOOT_KBD_INP_REPORT_CHR_UUID),
+     .access_cb = hogp_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+     .val_handle = &hogp_svr_handles[BOOT_KBD_INP_REPORT_ATTR]},
+
+    {.uuid = BLE_UUID16_DECLARE(BOOT_KBD_OUTP_REPORT_CHR_UUID),
+     .access_cb = hogp_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+              BLE_GATT_CHR_F_WRITE_NO_RSP,
+     .val_handle = &hogp_svr_handles[BOOT_KBD_OUTP_REPORT_ATTR]},
+};
+
+#define HOGP_FIXED_CHR_COUNT                                                   \
+  (sizeof(hogp_fixed_chrs) / sizeof(hogp_fixed_chrs[0]))
+
+// Fixed characteristics, one per report, terminator
+static struct ble_gatt_chr_def
+    hogp_chrs[HOGP_FIXED_CHR_COUNT + HOGP_MAX_REPORTS + 1];
+// Report Reference descriptor and terminator for each report
+static struct ble_gatt_dsc_def hogp_report_dscs[HOGP_MAX_REPORTS][2];
+
 static const struct ble_gatt_svc_def hogp_svcs[] = {
     {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
         .uuid = BLE_UUID16_DECLARE(HID_SVC_UUID),
-        .characteristics =
-            (struct ble_gatt_chr_def[]){
-                {.uuid = BLE_UUID16_DECLARE(HID_INFO_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_READ,
-                 .val_handle = &hogp_svr_handles[HID_INFO_ATTR]},
-
-                {.uuid = BLE_UUID16_DECLARE(REPORT_MAP_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_READ,
-                 .val_handle = &hogp_svr_handles[REPORT_MAP_ATTR]},
-
-                {.uuid = BLE_UUID16_DECLARE(HID_CTRL_POINT_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_WRITE_NO_RSP,
-                 .val_handle = &hogp_svr_handles[HID_CTRL_POINT_ATTR]},
-
-                {.uuid = BLE_UUID16_DECLARE(REPORT_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
-                          BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY |
-                          BLE_GATT_CHR_F_INDICATE,
-                 .val_handle = &hogp_svr_handles[REPORT_ATTR],
-                 .descriptors =
-                     (struct ble_gatt_dsc_def[]){
-                         {
-                             .uuid =
-                                 BLE_UUID16_DECLARE(REPORT_REFERENCE_DSC_UUID),
-                             .att_flags = BLE_ATT_F_READ,
-                             .access_cb = hid_svr_chr_access,
-                         },
-                         {0}}},
-
-                {.uuid = BLE_UUID16_DECLARE(PRTCL_MODE_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE_NO_RSP,
-                 .val_handle = &hogp_svr_handles[PRTCL_MODE_ATTR]},
-
-                {.uuid = BLE_UUID16_DECLARE(BOOT_KBD_INP_REPORT_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
-                 .val_handle = &hogp_svr_handles[BOOT_KBD_INP_REPORT_ATTR]},
-
-                {.uuid = BLE_UUID16_DECLARE(BOOT_KBD_OUTP_REPORT_CHR_UUID),
-                 .access_cb = hid_svr_chr_access,
-                 .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
-                          BLE_GATT_CHR_F_WRITE_NO_RSP,
-                 .val_handle = &hogp_svr_handles[BOOT_KBD_OUTP_REPORT_ATTR]},
-
-                {0} /* No more characteristics */},
+        .characteristics = hogp_chrs,
     },
     {0} /* No more services */
 };
 
-static int hid_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
-                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
-  // Local variables
+// Service declaration, then per characteristic at most a declaration, its
+// value, a CCCD and a Report Reference descriptor
+#define HOGP_ATTR_MAX (1 + (HOGP_FIXED_CHR_COUNT + HOGP_MAX_REPORTS) * 4)
+
+// Dispatch table, indexed by attribute handle - hogp_base_handle. Filled in
+// as NimBLE registers the service (hogp_gatt_svr_register_cb), so an access
+// is one lookup however many reports there are
+static hogp_attr_t hogp_attrs[HOGP_ATTR_MAX];
+static uint16_t hogp_base_handle;
+
+static int hid_ctrl_point_access(uint16_t conn_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int hid_protocol_mode_access(uint16_t conn_handle,
+                                    struct ble_gatt_access_ctxt *ctxt,
+                                    void *arg);
+static int hid_boot_led_access(uint16_t conn_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int hid_report_access(uint16_t conn_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+static const uint8_t hid_info_data[] = {
+    0x11, 0x01, // bcdHID (1.11)
+    0x00,       // bCountryCode (universal)
+    0x02        // Flags (Normally connectable)
+};
+
+// Table entry of each characteristic value in hogp_chrs. The fixed ones are
+// in hogp_fixed_chrs order, the reports are added by hogp_build_report_chrs()
+static hogp_attr_t hogp_chr_attrs[HOGP_FIXED_CHR_COUNT + HOGP_MAX_REPORTS] = {
+    [HID_INFO_ATTR] = {.value = hid_info_data, .len = sizeof(hid_info_data)},
+    [REPORT_MAP_ATTR] = {.value = HID_COMPLEX_REPORT_MAP,
+                         .len = HID_COMPLEX_REPORT_MAP_SIZE},
+    [HID_CTRL_POINT_ATTR] = {.fn = hid_ctrl_point_access},
+    [PRTCL_MODE_ATTR] = {.fn = hid_protocol_mode_access},
+    [BOOT_KBD_INP_REPORT_ATTR] = {.value = kbd_reports.boot,
+                                  .len = sizeof(kbd_reports.boot)},
+    [BOOT_KBD_OUTP_REPORT_ATTR] = {.fn = hid_boot_led_access},
+};
+
+static int hid_ctrl_point_access(uint16_t conn_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  uint8_t cmd;
+
+  if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+  if (OS_MBUF_PKTLEN(ctxt->om) != sizeof(cmd) ||
+      ble_hs_mbuf_to_flat(ctxt->om, &cmd, sizeof(cmd), NULL) != 0) {
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  }
+  // The host going to sleep or waking up. Reserved values are ignored
+  if (cmd == HID_CTRL_POINT_SUSPEND || cmd == HID_CTRL_POINT_EXIT_SUSPEND) {
+    gap_host_suspend(conn_handle, cmd == HID_CTRL_POINT_SUSPEND);
+  }
+  return 0;
+}
+
+static int hid_protocol_mode_access(uint16_t conn_handle,
+                                    struct ble_gatt_access_ctxt *ctxt,
+                                    void *arg) {
   int rc;
-  uint16_t uuid16 = ble_uuid_u16(ctxt->chr->uuid);
 
-  ESP_LOGI(TAG, "GATT ACESSS, ACCESS TYPE: %d, ATTR: %d, UUID: %d", ctxt->op,
-           attr_handle, uuid16);
+  hogp_conn_t *conn = hogp_conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
 
-  if (uuid16 == REPORT_REFERENCE_DSC_UUID) {
-    const uint8_t rpt_ref_data[] = {0x00, 0x01};
-    rc = os_mbuf_append(ctxt->om, rpt_ref_data, sizeof(rpt_ref_data));
+  if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+    rc = os_mbuf_append(ctxt->om, &conn->protocol_mode,
+                        sizeof(conn->protocol_mode));
     return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+  } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+    uint8_t mode;
+    if (OS_MBUF_PKTLEN(ctxt->om) != sizeof(mode) ||
+        ble_hs_mbuf_to_flat(ctxt->om, &mode, sizeof(mode), NULL) != 0) {
+      return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    if (mode != HID_PROTOCOL_MODE_BOOT && mode != HID_PROTOCOL_MODE_REPORT) {
+      // Reserved values are ignored, as the HID service spec asks
+      return 0;
+    }
+    if (mode != conn->protocol_mode) {
+      conn->protocol_mode = mode;
+      // The other report layout was never sent to this host
+      conn->last_report_len = 0;
+    }
+    return 0;
   }
+  return BLE_ATT_ERR_UNLIKELY;
+}
+
+static int hid_boot_led_access(uint16_t conn_handle,
+                               struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  int rc;
 
-  if (attr_handle == hogp_svr_handles[HID_INFO_ATTR]) {
-    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
-      goto error;
+  hogp_conn_t *conn = hogp_conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+
+  if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+    rc = os_mbuf_append(ctxt->om, &conn->led_state, HID_BOOT_R0_OUT_LEN);
+    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+  } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+    if (OS_MBUF_PKTLEN(ctxt->om) != HID_BOOT_R0_OUT_LEN ||
+        ble_hs_mbuf_to_flat(ctxt->om, &conn->led_state, HID_BOOT_R0_OUT_LEN,
+                            NULL) != 0) {
+      return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
     }
+    hogp_led_changed(conn);
+    return 0;
+  }
+  return BLE_ATT_ERR_UNLIKELY;
+}
 
-    const uint8_t hid_info_data[] = {
-        0x11, 0x01, // bcdHID (1.11)
-        0x00,       // bCountryCode (universal)
-        0x02        // Flags (Normally connectable)
-    };
-    rc = os_mbuf_append(ctxt->om, hid_info_data, sizeof(hid_info_data));
+static int hid_feature_access(const hogp_report_t *report,
+                              struct ble_gatt_access_ctxt *ctxt) {
+  uint16_t len = report->info.len;
+  int rc;
+
+  if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+    memset(hogp_feature_buf, 0, len);
+    if (hogp_feature_ops != NULL) {
+      rc = hogp_feature_ops->get(report->info.id, hogp_feature_buf, len);
+      if (rc != 0) {
+        return rc;
+      }
+    }
+    rc = os_mbuf_append(ctxt->om, hogp_feature_buf, len);
     return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-  } else if (attr_handle == hogp_svr_handles[REPORT_MAP_ATTR]) {
-    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
-      goto error;
+  }
+  if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+
+  if (OS_MBUF_PKTLEN(ctxt->om) != len ||
+      ble_hs_mbuf_to_flat(ctxt->om, hogp_feature_buf, len, NULL) != 0) {
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  }
+  if (hogp_feature_ops == NULL) {
+    KLOG_W(GATT, "Feature report %d not supported", report->info.id);
+    return 0;
+  }
+  return hogp_feature_ops->set(report->info.id, hogp_feature_buf, len);
+}
+
+// Writes to the output and feature Report characteristics, reads of the
+// ones whose value is not served from the table. arg is the hogp_report_t
+static int hid_report_access(uint16_t conn_handle,
+                             struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  hogp_report_t *report = arg;
+  uint8_t *value = report->value;
+  int rc;
+
+  if (report == kbd_led_report) {
+    hogp_conn_t *conn = hogp_conn_find(conn_handle);
+    if (conn == NULL) {
+      return BLE_ATT_ERR_UNLIKELY;
     }
+    value = &conn->led_state;
+  }
+
+  if (report->info.type == HID_REPORT_TYPE_FEATURE) {
+    return hid_feature_access(report, ctxt);
+  }
 
-    rc = os_mbuf_append(ctxt->om, HID_BOOT_REPORT_MAP, HID_BOOT_REPORT_MAP_LEN);
+  if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+    rc = os_mbuf_append(ctxt->om, value, report->info.len);
     return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-  } else if (attr_handle == hogp_svr_handles[HID_CTRL_POINT_ATTR]) {
-    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
-      goto error;
+  }
+
+  if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR ||
+      report->info.type == HID_REPORT_TYPE_INPUT) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+
+  if (OS_MBUF_PKTLEN(ctxt->om) != report->info.len) {
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  }
+  rc = ble_hs_mbuf_to_flat(ctxt->om, value, report->info.len, NULL);
+  if (rc != 0) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+
+  KLOG_D(GATT, "Output report %d: 0x%02x", report->info.id, value[0]);
+  if (report == kbd_led_report) {
+    hogp_led_changed(hogp_conn_find(conn_handle));
+  }
+  return 0;
+}
+
+// Looks the handle up in hogp_attrs, the only access callback of the service
+static int hogp_access(uint16_t conn_handle, uint16_t attr_handle,
+                       struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  uint32_t start = hogp_cycles();
+  uint16_t idx = attr_handle - hogp_base_handle;
+  int rc = BLE_ATT_ERR_UNLIKELY;
+
+  KLOG_D(GATT, "access op=%d attr=%d", ctxt->op, attr_handle);
+
+  if (idx < HOGP_ATTR_MAX) {
+    const hogp_attr_t *attr = &hogp_attrs[idx];
+    if (attr->fn != NULL) {
+      rc = attr->fn(conn_handle, ctxt, attr->arg);
+    } else if (attr->value != NULL &&
+               (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR ||
+                ctxt->op == BLE_GATT_ACCESS_OP_READ_DSC)) {
+      rc = os_mbuf_append(ctxt->om, attr->value, attr->len);
+      rc = rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     }
+  }
 
-    ESP_LOGW(TAG, "HID Control point not yet implemented");
-    return 0;
-  } else if (attr_handle == hogp_svr_handles[REPORT_ATTR]) {
-    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-      rc = os_mbuf_append(ctxt->om, last_report, sizeof(last_report));
-      return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-    } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
-      ESP_LOGW(TAG, "HID Output features not supported! ");
-      return 0;
-    } else {
-      goto error;
+  if (rc == BLE_ATT_ERR_UNLIKELY) {
+    KLOG_E(GATT, "unexpected access op %d to handle %d", ctxt->op,
+           attr_handle);
+  }
+  hogp_cost(KEY_TRACE_COST_ACCESS, start);
+  return rc;
+}
+
+static hogp_report_t *hogp_report_find(uint8_t id, uint8_t type) {
+  for (size_t i = 0; i < HOGP_MAX_REPORTS; i++) {
+    if (hogp_reports[i].info.id == id && hogp_reports[i].info.type == type) {
+      return &hogp_reports[i];
+    }
+  }
+  return NULL;
+}
+
+static int hogp_tx_notify(uint16_t conn_handle, uint16_t val_handle,
+                          const uint8_t *data, uint8_t len, void *arg) {
+  // No mbuf holds the report back until mbufs come back from the controller
+  int rc = report_pool_notify(conn_handle, val_handle, data, len);
+  return rc == BLE_HS_ENOMEM ? HOGP_TX_BUSY : rc;
+}
+
+static const struct gap_link_info *hogp_tx_link(uint16_t conn_handle,
+                                                void *arg) {
+  return gap_link_info(conn_handle);
+}
+
+static void hogp_tx_sent(uint16_t conn_handle, void *arg) {
+  gap_report_sent(conn_handle);
+}
+
+// Sends what fits this connection event and retries the rest one connection
+// interval later
+static void hogp_tx_run(void) {
+  bool made_room;
+  uint32_t next =
+      hogp_tx_flush(&hogp_tx, (uint32_t)esp_timer_get_time(), &made_room);
+
+  if (made_room) {
+    // Room in the queue again, pick up any key events left in the ring
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &key_ring_ev);
+  }
+  if (next != UINT32_MAX) {
+    ble_npl_callout_reset(&hogp_tx_callout, ble_npl_time_ms_to_ticks32(next));
+  }
+}
+
+static void hogp_tx_callout_cb(struct ble_npl_event *ev) {
+  report_pool_path_enter();
+  hogp_tx_run();
+  report_pool_path_exit();
+}
+
+// Queues the current keyboard state for one host, in whichever layout its
+// protocol mode asks for
+static void hogp_queue_kbd_input(hogp_conn_t *conn) {
+  const kbd_input_path_t *path = &kbd_input_paths[conn->protocol_mode];
+  uint32_t start = hogp_cycles();
+  hogp_tx_queue(&hogp_tx, conn, *path->val_handle, path->notify_bit,
+                path->value, path->len, &hogp_trace_cur);
+  hogp_cost(KEY_TRACE_COST_ENQUEUE, start);
+}
+
+// Only ever called from the NimBLE host task, so the reports are never touched
+// by two tasks at once
+static void send_keyboard_input_notify(const key_event_t *event) {
+  uint32_t start = hogp_cycles();
+  bool changed =
+      report_builder_apply(&kbd_reports, event->usage, event->pressed);
+  hogp_cost(KEY_TRACE_COST_BUILD, start);
+  if (!changed) {
+    return;
+  }
+
+  if (KEY_TRACE_ENABLED) {
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    hogp_trace_cur.traced = 1;
+    hogp_trace_cur.seq = hogp_trace_seq++;
+    hogp_trace_cur.detected_us = event->timestamp_us;
+    hogp_trace_cur.built_us = now;
+    key_trace_record(KEY_TRACE_DETECTED, hogp_trace_cur.seq, 0,
+                     event->timestamp_us);
+    key_trace_record(KEY_TRACE_BUILT, hogp_trace_cur.seq, 0, now);
+    key_trace_span(KEY_TRACE_SPAN_BUILD, now - event->timestamp_us);
+  }
+
+  if (hogp_fanout == HOGP_FANOUT_ACTIVE) {
+    hogp_conn_t *conn = hogp_conn_find(hogp_active_conn);
+    if (conn != NULL) {
+      hogp_queue_kbd_input(conn);
     }
-  } else if (attr_handle == hogp_svr_handles[PRTCL_MODE_ATTR]) {
-    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-      const uint8_t REPORT_PRTCL_MODE = 0x01;
-      rc = os_mbuf_append(ctxt->om, &REPORT_PRTCL_MODE,
-                          sizeof(REPORT_PRTCL_MODE));
-      return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
-    } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
-      ESP_LOGW(TAG, "SWITCHING TO BOOT MODE NOT YET SUPPORTED");
+  } else {
+    hogp_conn_t *conn;
+    for (size_t i = 0; (conn = hogp_conn_next(&i)) != NULL; i++) {
+      hogp_queue_kbd_input(conn);
     }
-  } else if (attr_handle == hogp_svr_handles[BOOT_KBD_INP_REPORT_ATTR]) {
-    ESP_LOGW(TAG, "BOOT KBD NOT YET IMPLEMENTED");
-  } else if (attr_handle == hogp_svr_handles[BOOT_KBD_OUTP_REPORT_ATTR]) {
-    ESP_LOGW(TAG, "BOOT KBD NOT YET IMPLEMENTED");
-  }
-
-error:
-  ESP_LOGE(TAG,
-           "unexpected access operation to hogp characteristic, (could be not "
-           "supported)"
-           "opcode: %d",
-           ctxt->op);
-  return BLE_ATT_ERR_UNLIKELY;
+  }
+
+  // Reports queued from anywhere else carry no key event
+  hogp_trace_cur.traced = 0;
 }
 
-void send_keyboard_input_notify(uint8_t key) {
-  // TODO: Make the boot keyboard mode also work
+// Queues a value of one of the other input reports to the hosts in report
+// protocol mode
+static void hogp_queue_input(const hogp_report_t *report, const uint8_t *value,
+                             uint8_t len) {
+  hogp_conn_t *conn;
+  for (size_t i = 0; (conn = hogp_conn_next(&i)) != NULL; i++) {
+    if (conn->protocol_mode != HID_PROTOCOL_MODE_REPORT) {
+      continue;
+    }
+    if (hogp_fanout == HOGP_FANOUT_ACTIVE &&
+        conn->conn_handle != hogp_active_conn) {
+      continue;
+    }
+    hogp_tx_queue_always(&hogp_tx, conn, report->val_handle,
+                         report->notify_bit, value, len);
+  }
+}
 
-  ESP_LOGI(TAG, "Notifications on: %d, Conn_hadnle = %d",
-           hogp_subscription_states[REPORT_CONN_STATUS].notify,
-           hogp_conn_handle);
+// System and consumer keys. Only a change of a report's value is sent, so it
+// goes out without the per-host repeat check
+static void send_control_input_notify(const key_event_t *event) {
+  uint8_t id = control_report_apply(&ctrl_reports, event->page, event->usage,
+                                    event->pressed);
+  if (id == 0) {
+    return;
+  }
 
-  if (hogp_subscription_states[REPORT_CONN_STATUS].notify &&
-      hogp_conn_handle != BLE_HS_CONN_HANDLE_NONE) {
-    ESP_LOGI(TAG, "SENDING A KEY");
-    last_report[2] = key; // thats probably the a key
-    ble_gatts_notify(hogp_conn_handle, hogp_svr_handles[REPORT_ATTR]);
+  uint8_t len;
+  const uint8_t *value = control_report_value(&ctrl_reports, id, &len);
+  hogp_report_t *report = hogp_report_find(id, HID_REPORT_TYPE_INPUT);
+  if (report == NULL || len != report->info.len) {
+    return;
   }
+  // Reads get the latest value too
+  memcpy(report->value, value, len);
+  hogp_queue_input(report, value, len);
+}
+
+static void send_input_notify(const key_event_t *event) {
+  if (event->page == HID_PAGE_KEYBOARD) {
+    send_keyboard_input_notify(event);
+  } else {
+    send_control_input_notify(event);
+  }
+}
+
+// Runs on the NimBLE host task whenever the input side posts new events.
+// Every event gets its own report so quick taps inside one batch are not lost.
+// Keyboard and control keys share the ring, so their reports go out in the
+// order the keys changed
+static void key_ring_drain_cb(struct ble_npl_event *ev) {
+  key_event_t batch[KEY_EVENT_BATCH];
+  size_t count;
+  bool drained = false;
+
+  report_pool_path_enter();
+
+  uint32_t posted = atomic_exchange(&key_ring_posted_us, 0);
+  if (posted != 0) {
+    task_stats_jitter(TASK_JITTER_HOST,
+                      (uint32_t)esp_timer_get_time() - posted);
+  }
+
+  // Every event can produce one report per host, so only take as many as fit
+  // the tx queue. The rest stays in the ring until a flush makes room
+  for (;;) {
+    size_t room = hogp_tx_room(&hogp_tx) / HOGP_MAX_CONNS;
+    if (room == 0) {
+      break;
+    }
+    count = key_event_ring_pop_batch(&key_ring, batch,
+                                     room < KEY_EVENT_BATCH ? room
+                                                            : KEY_EVENT_BATCH);
+    if (count == 0) {
+      break;
+    }
+    drained = true;
+    for (size_t i = 0; i < count; i++) {
+      send_input_notify(&batch[i]);
+    }
+  }
+
+  if (drained) {
+    gap_conn_activity();
+  }
+  if (hogp_tx.count > 0) {
+    hogp_tx_run();
+  }
+  report_pool_path_exit();
+}
+
+// Called from the (single) input task. Queues the event and wakes up the host
+// task, the report itself is built and sent over there
+int hogp_gatt_svr_post_key(uint8_t key, bool pressed) {
+  return hogp_gatt_svr_post_key_at(key, pressed,
+                                   (uint32_t)esp_timer_get_time());
+}
+
+int hogp_gatt_svr_post_key_at(uint8_t key, bool pressed,
+                              uint32_t timestamp_us) {
+  return hogp_gatt_svr_post_control_at(HID_PAGE_KEYBOARD, key, pressed,
+                                       timestamp_us);
+}
+
+int hogp_gatt_svr_post_control(uint8_t page, uint16_t usage, bool pressed) {
+  return hogp_gatt_svr_post_control_at(page, usage, pressed,
+                                       (uint32_t)esp_timer_get_time());
+}
+
+int hogp_gatt_svr_post_control_at(uint8_t page, uint16_t usage, bool pressed,
+                                  uint32_t timestamp_us) {
+  key_event_t event = {
+      .timestamp_us = timestamp_us,
+      .usage = usage,
+      .page = page,
+      .pressed = pressed,
+  };
+
+  if (page != HID_PAGE_KEYBOARD && !control_report_page(page)) {
+    return BLE_HS_EINVAL;
+  }
+  // Refuses presses only, so a full ring never leaves a key stuck down
+  if (!key_event_ring_push_key(&key_ring, &event)) {
+    return BLE_HS_ENOMEM;
+  }
+
+  // Re-posting an event that is already queued is a no-op in NimBLE, so a
+  // burst of keys results in a single wakeup
+  uint32_t none = 0;
+  atomic_compare_exchange_strong(&key_ring_posted_us, &none,
+                                 (uint32_t)esp_timer_get_time() | 1);
+  ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &key_ring_ev);
+  return 0;
+}
+
+int hogp_gatt_svr_play_key(uint8_t key, bool pressed) {
+  // Room for this key's report to every host, as key_ring_drain_cb() keeps
+  if (hogp_tx_room(&hogp_tx) < HOGP_MAX_CONNS) {
+    return BLE_HS_ENOMEM;
+  }
+
+  key_event_t event = {
+      .timestamp_us = (uint32_t)esp_timer_get_time(),
+      .usage = key,
+      .page = HID_PAGE_KEYBOARD,
+      .pressed = pressed,
+  };
+  report_pool_path_enter();
+  send_keyboard_input_notify(&event);
+  gap_conn_activity();
+  hogp_tx_run();
+  report_pool_path_exit();
+  return 0;
+}
+
+int hogp_gatt_svr_send_input(uint8_t report_id, const uint8_t *value,
+                             uint8_t len) {
+  hogp_report_t *report = hogp_report_find(report_id, HID_REPORT_TYPE_INPUT);
+  // The keyboard and control reports are built from key events
+  if (report == NULL || report == kbd_input_report ||
+      report_id == SYSTEM_REPORT_ID || report_id == CONSUMER_REPORT_ID ||
+      len != report->info.len) {
+    return BLE_HS_EINVAL;
+  }
+  if (hogp_tx_room(&hogp_tx) < HOGP_MAX_CONNS) {
+    return BLE_HS_ENOMEM;
+  }
+
+  // Reads get the latest value too
+  memcpy(report->value, value, len);
+
+  report_pool_path_enter();
+  hogp_queue_input(report, value, len);
+  gap_conn_activity();
+  hogp_tx_run();
+  report_pool_path_exit();
+  return 0;
+}
+
+uint32_t hogp_gatt_svr_max_itvl_ms(void) {
+  uint16_t itvl = 0;
+  hogp_conn_t *conn;
+
+  for (size_t i = 0; (conn = hogp_conn_next(&i)) != NULL; i++) {
+    const struct gap_link_info *link = gap_link_info(conn->conn_handle);
+    if (link != NULL && link->conn_itvl > itvl) {
+      itvl = link->conn_itvl;
+    }
+  }
+  // 1.25 ms units, rounded up
+  return (itvl * 5 + 3) / 4;
+}
+
+// Puts one of our attributes into the dispatch table
+static void hogp_attr_set(uint16_t handle, const hogp_attr_t *attr) {
+  uint16_t idx = handle - hogp_base_handle;
+  assert(idx < HOGP_ATTR_MAX);
+  hogp_attrs[idx] = *attr;
 }
 
 // Handles GATT attribute register events: Service register event,
@@ -219,6 +787,9 @@ void hogp_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
   case BLE_GATT_REGISTER_OP_SVC:
     ESP_LOGD(TAG, "registered service %s with handle=%d",
              ble_uuid_to_str(ctxt->svc.svc_def->uuid, buf), ctxt->svc.handle);
+    if (ctxt->svc.svc_def == &hogp_svcs[0]) {
+      hogp_base_handle = ctxt->svc.handle;
+    }
     break;
 
   // Characteristic register event
@@ -228,12 +799,24 @@ void hogp_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
              "def_handle=%d val_handle=%d",
              ble_uuid_to_str(ctxt->chr.chr_def->uuid, buf),
              ctxt->chr.def_handle, ctxt->chr.val_handle);
+    if (ctxt->chr.chr_def->access_cb == hogp_access) {
+      hogp_attr_set(ctxt->chr.val_handle,
+                    &hogp_chr_attrs[ctxt->chr.chr_def - hogp_chrs]);
+    }
     break;
 
   // Descriptor register event
   case BLE_GATT_REGISTER_OP_DSC:
     ESP_LOGD(TAG, "registering descriptor %s with handle=%d",
              ble_uuid_to_str(ctxt->dsc.dsc_def->uuid, buf), ctxt->dsc.handle);
+    if (ctxt->dsc.dsc_def->access_cb == hogp_access) {
+      // Only the reports have descriptors, one each
+      const hogp_report_t *report =
+          &hogp_reports[(ctxt->dsc.dsc_def - hogp_report_dscs[0]) / 2];
+      hogp_attr_set(ctxt->dsc.handle,
+                    &(hogp_attr_t){.value = report->ref,
+                                   .len = sizeof(report->ref)});
+    }
     break;
 
   // Unknown event. Crash, should never happen
@@ -247,34 +830,221 @@ void hogp_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
 void hogp_gatt_svr_subscribe_cb(struct ble_gap_event *event) {
   // Check for connection
   if (event->subscribe.conn_handle != BLE_HS_CONN_HANDLE_NONE) {
-    ESP_LOGI(TAG, "subscribe event; conn_handle=%d attr_handle=%d",
-             event->subscribe.conn_handle, event->subscribe.attr_handle);
+    KLOG_I(GATT, "subscribe event; conn_handle=%d attr_handle=%d",
+           event->subscribe.conn_handle, event->subscribe.attr_handle);
   } else {
     // Usually to restore connection from previously bonded
-    ESP_LOGI(TAG, "subscribe by nimble stack; attr_handle=%d",
-             event->subscribe.attr_handle);
+    KLOG_I(GATT, "subscribe by nimble stack; attr_handle=%d",
+           event->subscribe.attr_handle);
+  }
+
+  // Only connections we know about. A subscribe that races with a
+  // disconnect, or one for a handle that is already reused, is dropped here
+  // instead of landing on another host's state
+  hogp_conn_t *conn = hogp_conn_find(event->subscribe.conn_handle);
+  if (conn == NULL) {
+    return;
   }
 
   // Check the ATT handle
-  if (event->subscribe.attr_handle == hogp_svr_handles[REPORT_ATTR]) {
-    hogp_conn_handle = event->subscribe.conn_handle;
-    hogp_subscription_states[REPORT_CONN_STATUS].notify =
-        event->subscribe.cur_notify;
-    hogp_subscription_states[REPORT_CONN_STATUS].indicate =
-        event->subscribe.cur_indicate;
-  } else if (event->subscribe.attr_handle ==
-             hogp_svr_handles[BOOT_KBD_INP_REPORT_ATTR]) {
-    hogp_conn_handle = event->subscribe.conn_handle;
-    hogp_subscription_states[BOOT_KBD_CONN_STATUS].notify =
-        event->subscribe.cur_notify;
-    hogp_subscription_states[BOOT_KBD_CONN_STATUS].indicate =
-        event->subscribe.cur_indicate;
+  uint16_t bit = 0;
+  if (event->subscribe.attr_handle ==
+      hogp_svr_handles[BOOT_KBD_INP_REPORT_ATTR]) {
+    bit = HOGP_NOTIFY_BOOT_KBD;
+  } else {
+    for (size_t i = 0; i < HOGP_MAX_REPORTS; i++) {
+      if (event->subscribe.attr_handle == hogp_reports[i].val_handle) {
+        bit = hogp_reports[i].notify_bit;
+        break;
+      }
+    }
+  }
+
+  if (event->subscribe.cur_notify) {
+    conn->notify_mask |= bit;
+  } else {
+    conn->notify_mask &= ~bit;
+  }
+  // Whatever was sent before may not have reached the host
+  conn->last_report_len = 0;
+}
+
+// Lays out one Report characteristic (plus its Report Reference descriptor)
+// for every (Report ID, type) pair in the report map
+static void hogp_build_report_chrs(void) {
+  const hid_report_info_t *infos = hogp_report_infos;
+
+  memcpy(hogp_chrs, hogp_fixed_chrs, sizeof(hogp_fixed_chrs));
+
+  for (size_t i = 0; i < HOGP_MAX_REPORTS; i++) {
+    hogp_report_t *report = &hogp_reports[i];
+    struct ble_gatt_chr_def *chr = &hogp_chrs[HOGP_FIXED_CHR_COUNT + i];
+
+    report->info = infos[i];
+    report->ref[0] = infos[i].id;
+    report->ref[1] = infos[i].type;
+    report->notify_bit = 1u << i;
+    report->value = NULL;
+    if (infos[i].type != HID_REPORT_TYPE_FEATURE) {
+      report->value = hogp_report_values[i];
+    }
+
+    hogp_report_dscs[i][0] = (struct ble_gatt_dsc_def){
+        .uuid = &report_ref_dsc_uuid.u,
+        .att_flags = BLE_ATT_F_READ,
+        .access_cb = hogp_access,
+    };
+
+    *chr = (struct ble_gatt_chr_def){
+        .uuid = &report_chr_uuid.u,
+        .access_cb = hogp_access,
+        .descriptors = hogp_report_dscs[i],
+        .val_handle = &report->val_handle,
+    };
+    switch (infos[i].type) {
+    case HID_REPORT_TYPE_INPUT:
+      chr->flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY;
+      break;
+    case HID_REPORT_TYPE_OUTPUT:
+      chr->flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+                   BLE_GATT_CHR_F_WRITE_NO_RSP;
+      break;
+    default:
+      chr->flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE;
+      break;
+    }
+  }
+
+  // The keyboard input report is sent straight out of the report builder
+  kbd_input_report =
+      hogp_report_find(KBD_NKRO_REPORT_ID, HID_REPORT_TYPE_INPUT);
+  kbd_input_report->value = kbd_reports.nkro;
+
+  _Static_assert(HID_COMPLEX_R4_OUT_LEN == HID_BOOT_R0_OUT_LEN,
+                 "boot and report protocol LED reports differ");
+  _Static_assert(HID_BOOT_R0_OUT_LEN == sizeof(((hogp_conn_t *)0)->led_state),
+                 "LED report does not fit hogp_conn_t.led_state");
+  kbd_led_report = hogp_report_find(KBD_NKRO_REPORT_ID, HID_REPORT_TYPE_OUTPUT);
+
+  kbd_input_paths[HID_PROTOCOL_MODE_BOOT] = (kbd_input_path_t){
+      .val_handle = &hogp_svr_handles[BOOT_KBD_INP_REPORT_ATTR],
+      .notify_bit = HOGP_NOTIFY_BOOT_KBD,
+      .value = kbd_reports.boot,
+      .len = sizeof(kbd_reports.boot),
+  };
+  kbd_input_paths[HID_PROTOCOL_MODE_REPORT] = (kbd_input_path_t){
+      .val_handle = &kbd_input_report->val_handle,
+      .notify_bit = kbd_input_report->notify_bit,
+      .value = kbd_reports.nkro,
+      .len = sizeof(kbd_reports.nkro),
+  };
+
+  // Input reports are only read, straight from their value. Everything else
+  // goes through the handler
+  for (size_t i = 0; i < HOGP_MAX_REPORTS; i++) {
+    hogp_report_t *report = &hogp_reports[i];
+    hogp_attr_t *attr = &hogp_chr_attrs[HOGP_FIXED_CHR_COUNT + i];
+    if (report->info.type == HID_REPORT_TYPE_INPUT) {
+      *attr = (hogp_attr_t){.value = report->value, .len = report->info.len};
+    } else {
+      *attr = (hogp_attr_t){.fn = hid_report_access, .arg = report};
+    }
+  }
+}
+
+// Every new host starts out in report protocol with nothing subscribed, and
+// becomes the active one
+int hogp_gatt_svr_connect_cb(uint16_t conn_handle) {
+  if (hogp_conn_add(conn_handle) == NULL) {
+    KLOG_W(GATT, "no room for connection %d", conn_handle);
+    return BLE_HS_ENOMEM;
+  }
+  hogp_active_conn = conn_handle;
+  return 0;
+}
+
+void hogp_gatt_svr_disconnect_cb(uint16_t conn_handle) {
+  hogp_conn_remove(conn_handle);
+
+  if (conn_handle == hogp_active_conn) {
+    // Hand input to any host that is still connected
+    size_t i = 0;
+    hogp_conn_t *conn = hogp_conn_next(&i);
+    hogp_active_conn =
+        conn != NULL ? conn->conn_handle : BLE_HS_CONN_HANDLE_NONE;
+  }
+}
+
+void hogp_gatt_svr_notify_tx_cb(struct ble_gap_event *event) {
+  hogp_conn_t *conn = hogp_conn_find(event->notify_tx.conn_handle);
+  if (conn == NULL || event->notify_tx.indication) {
+    return;
+  }
+  hogp_tx_done(conn, event->notify_tx.attr_handle, event->notify_tx.status,
+               (uint32_t)esp_timer_get_time());
+}
+
+void hogp_gatt_svr_set_fanout(hogp_fanout_t fanout) { hogp_fanout = fanout; }
+
+void hogp_gatt_svr_set_led_cb(hogp_led_cb_t cb) { hogp_led_cb = cb; }
+
+void hogp_gatt_svr_set_feature_ops(const hogp_feature_ops_t *ops) {
+  hogp_feature_ops = ops;
+}
+
+int hogp_gatt_svr_set_active_conn(uint16_t conn_handle) {
+  hogp_conn_t *conn = hogp_conn_find(conn_handle);
+  if (conn == NULL) {
+    return BLE_HS_ENOTCONN;
   }
+
+  hogp_conn_t *prev = hogp_conn_find(hogp_active_conn);
+  hogp_active_conn = conn_handle;
+  if (hogp_fanout != HOGP_FANOUT_ACTIVE || prev == conn) {
+    return 0;
+  }
+
+  // Release everything on the host being switched away from, and bring the
+  // new one up to date with the keys that are held right now
+  if (prev != NULL) {
+    static const uint8_t released[HOGP_REPORT_VALUE_MAX_LEN] = {0};
+    const kbd_input_path_t *path = &kbd_input_paths[prev->protocol_mode];
+    if (hogp_tx_room(&hogp_tx) > 0) {
+      hogp_tx_queue(&hogp_tx, prev, *path->val_handle, path->notify_bit,
+                    released, path->len, &hogp_trace_cur);
+    }
+  }
+  if (hogp_tx_room(&hogp_tx) > 0) {
+    hogp_queue_kbd_input(conn);
+  }
+  hogp_tx_run();
+  return 0;
+}
+
+void hogp_gatt_svr_get_tx_stats(struct hogp_tx_stats *stats) {
+  hogp_tx_get_stats(&hogp_tx, stats);
 }
 
 int hogp_gatt_svr_init() {
   int rc;
 
+  rc = report_pool_init();
+  if (rc != 0) {
+    return rc;
+  }
+
+  hogp_conn_init();
+  key_trace_init();
+  report_builder_init(&kbd_reports);
+  control_report_init(&ctrl_reports);
+  key_event_ring_init(&key_ring);
+  hogp_tx_init(&hogp_tx, &hogp_tx_ops);
+  ble_npl_event_init(&key_ring_ev, key_ring_drain_cb, NULL);
+  ble_npl_callout_init(&hogp_tx_callout, nimble_port_get_dflt_eventq(),
+                       hogp_tx_callout_cb, NULL);
+
+  hogp_build_report_chrs();
+
   // Initialize GATT services
   ble_svc_gatt_init();
 
@@ -6,9 +6,69 @@
 // GAP APIs for suscribe / indicate events
 #include "host/ble_gap.h"
 
-void send_keyboard_input_notify(uint8_t key);
+#include "hogp_tx.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Who keyboard input goes to when more than one central is connected
+typedef enum {
+  HOGP_FANOUT_ALL,    // Every subscribed central
+  HOGP_FANOUT_ACTIVE, // Only the active one (host switching)
+} hogp_fanout_t;
+
+// Called from the NimBLE host task with the keyboard LED bits a host wrote
+typedef void (*hogp_led_cb_t)(uint8_t leds);
+
+// Reads and writes of the feature reports, on the NimBLE host task. Both get
+// the whole report without its ID, reads start out zeroed. They return 0 or
+// an ATT error
+typedef struct {
+  int (*get)(uint8_t report_id, uint8_t *data, uint16_t len);
+  int (*set)(uint8_t report_id, const uint8_t *data, uint16_t len);
+} hogp_feature_ops_t;
+
+// Key events from the one input task, through the key ring. BLE_HS_ENOMEM if
+// the ring has no room for a press, key_event_ring_push_key() keeps a slot
+// for every held key's release, and the refused key's release is dropped too
+int hogp_gatt_svr_post_key(uint8_t key, bool pressed);
+// Same, for input that carries the time the key changed (esp_timer clock)
+int hogp_gatt_svr_post_key_at(uint8_t key, bool pressed,
+                              uint32_t timestamp_us);
+// Same, for a key on any page: keyboard, or the system (Generic Desktop) and
+// consumer keys of Report IDs 1 and 2 (control_report.h). Those go through
+// the key ring too, so they keep their order with keyboard keys, and are
+// only sent when a report's value changes. BLE_HS_EINVAL for other pages
+int hogp_gatt_svr_post_control(uint8_t page, uint16_t usage, bool pressed);
+int hogp_gatt_svr_post_control_at(uint8_t page, uint16_t usage, bool pressed,
+                                  uint32_t timestamp_us);
+// From the NimBLE host task only: applies a key change straight to the
+// reports, without the key ring. BLE_HS_ENOMEM while the tx queue has no room
+// for it
+int hogp_gatt_svr_play_key(uint8_t key, bool pressed);
+// From the NimBLE host task only: notifies a new value of one of the other
+// input reports of the report map that are not built from key events (value
+// without its Report ID) to the hosts in report protocol mode. Never skipped
+// as a repeat, see hogp_tx_queue_always(). BLE_HS_ENOMEM while the tx queue
+// has no room for it
+int hogp_gatt_svr_send_input(uint8_t report_id, const uint8_t *value,
+                             uint8_t len);
+// Longest connection interval of the connected hosts in ms, 0 if none is
+// known. Waiting this long between reports sends at most one per connection
+// event to every host
+uint32_t hogp_gatt_svr_max_itvl_ms(void);
+void hogp_gatt_svr_get_tx_stats(struct hogp_tx_stats *stats);
 void hogp_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 void hogp_gatt_svr_subscribe_cb(struct ble_gap_event *event);
+void hogp_gatt_svr_notify_tx_cb(struct ble_gap_event *event);
+int hogp_gatt_svr_connect_cb(uint16_t conn_handle);
+void hogp_gatt_svr_disconnect_cb(uint16_t conn_handle);
+void hogp_gatt_svr_set_fanout(hogp_fanout_t fanout);
+// The most recent connection is active until another one is picked
+int hogp_gatt_svr_set_active_conn(uint16_t conn_handle);
+// LED writes of the host(s) input goes to, see hogp_gatt_svr_set_fanout()
+void hogp_gatt_svr_set_led_cb(hogp_led_cb_t cb);
+void hogp_gatt_svr_set_feature_ops(const hogp_feature_ops_t *ops);
 int hogp_gatt_svr_init(void);
 
 #endif // pragma once
@@ -0,0 +1,209 @@
+#include "hogp_tx.h"
+#include "config.h"
+#include "key_trace.h"
+#include <string.h>
+
+// ATT notification header (opcode + handle)
+#define ATT_NOTIFY_HDR_LEN 3
+// Retry delay when no connection interval is known
+#define HOGP_TX_RETRY_MS 8
+
+void hogp_tx_init(hogp_tx_t *tx, const hogp_tx_ops_t *ops) {
+  memset(tx, 0, sizeof(*tx));
+  tx->ops = ops;
+}
+
+static bool tx_push(hogp_tx_t *tx, const hogp_conn_t *conn,
+                    uint16_t val_handle, const uint8_t *value, uint8_t len,
+                    const hogp_tx_trace_t *trace) {
+  if (tx->count == HOGP_TX_QUEUE_LEN || len > HOGP_CONN_LAST_REPORT_LEN) {
+    // Callers make room first, this should never happen
+    tx->stats.dropped++;
+    return false;
+  }
+
+  hogp_tx_entry_t *entry =
+      &tx->queue[(tx->head + tx->count) % HOGP_TX_QUEUE_LEN];
+  entry->conn_handle = conn->conn_handle;
+  entry->val_handle = val_handle;
+  entry->len = len;
+  memcpy(entry->data, value, len);
+  entry->trace = *trace;
+
+  tx->count++;
+  if (tx->count > tx->stats.max_queue_depth) {
+    tx->stats.max_queue_depth = tx->count;
+  }
+  return true;
+}
+
+void hogp_tx_queue(hogp_tx_t *tx, hogp_conn_t *conn, uint16_t val_handle,
+                   uint16_t notify_bit, const uint8_t *value, uint8_t len,
+                   const hogp_tx_trace_t *trace) {
+  if (!(conn->notify_mask & notify_bit)) {
+    return;
+  }
+  if (conn->last_report_len == len &&
+      memcmp(conn->last_report, value, len) == 0) {
+    return;
+  }
+  if (tx_push(tx, conn, val_handle, value, len, trace)) {
+    memcpy(conn->last_report, value, len);
+    conn->last_report_len = len;
+  }
+}
+
+void hogp_tx_queue_always(hogp_tx_t *tx, hogp_conn_t *conn,
+                          uint16_t val_handle, uint16_t notify_bit,
+                          const uint8_t *value, uint8_t len) {
+  static const hogp_tx_trace_t untraced = {0};
+
+  if (conn->notify_mask & notify_bit) {
+    tx_push(tx, conn, val_handle, value, len, &untraced);
+  }
+}
+
+// Remembers a notification about to be handed to the stack, so the matching
+// NOTIFY_TX can be tied back to its key event. The oldest one is forgotten if
+// the stack never reported on it. Returns the slot it went to
+static uint8_t trace_push(hogp_conn_t *conn, const hogp_tx_entry_t *entry,
+                          uint32_t now_us) {
+  if (conn->trace_count == HOGP_CONN_TRACE_DEPTH) {
+    conn->trace_head = (conn->trace_head + 1) % HOGP_CONN_TRACE_DEPTH;
+    conn->trace_count--;
+  }
+  uint8_t slot = (conn->trace_head + conn->trace_count) % HOGP_CONN_TRACE_DEPTH;
+  conn->trace[slot] = (hogp_conn_trace_t){
+      .detected_us = entry->trace.detected_us,
+      .queued_us = now_us,
+      .seq = entry->trace.seq,
+      .val_handle = entry->val_handle,
+      .traced = entry->trace.traced,
+  };
+  conn->trace_count++;
+  return slot;
+}
+
+// Takes back the record trace_push() put in slot, if the stack never saw the
+// notification
+static void trace_unpush(hogp_conn_t *conn, uint8_t slot) {
+  if (conn->trace_count > 0 &&
+      (conn->trace_head + conn->trace_count - 1) % HOGP_CONN_TRACE_DEPTH ==
+          slot) {
+    conn->trace_count--;
+  }
+}
+
+// A report for conn did not make it to the host. The last report it got is
+// no longer known, so the next one must not be skipped as a repeat
+static void tx_forget(hogp_conn_t *conn) { conn->last_report_len = 0; }
+
+static void tx_pop(hogp_tx_t *tx) {
+  tx->head = (tx->head + 1) % HOGP_TX_QUEUE_LEN;
+  tx->count--;
+}
+
+uint32_t hogp_tx_flush(hogp_tx_t *tx, uint32_t now_us, bool *made_room) {
+  const hogp_tx_ops_t *ops = tx->ops;
+  const struct gap_link_info *link = NULL;
+  uint8_t sent = 0;
+  uint8_t count = tx->count;
+
+  while (tx->count > 0 && sent < HOGP_TX_BURST_MAX) {
+    hogp_tx_entry_t *entry = &tx->queue[tx->head];
+
+    link = ops->link(entry->conn_handle, ops->arg);
+    hogp_conn_t *conn = hogp_conn_find(entry->conn_handle);
+    if (link == NULL || conn == NULL) {
+      // Host disconnected since the report was queued
+      tx->stats.dropped++;
+      tx_pop(tx);
+      continue;
+    }
+    if (entry->len > link->mtu - ATT_NOTIFY_HDR_LEN) {
+      // Would be truncated by the host, there is no point sending it
+      tx->stats.dropped++;
+      tx_forget(conn);
+      tx_pop(tx);
+      continue;
+    }
+
+    uint8_t slot = 0;
+    if (KEY_TRACE_ENABLED) {
+      slot = trace_push(conn, entry, now_us);
+    }
+    int rc = ops->notify(entry->conn_handle, entry->val_handle, entry->data,
+                         entry->len, ops->arg);
+    if (rc == HOGP_TX_BUSY) {
+      tx->stats.busy++;
+      if (KEY_TRACE_ENABLED) {
+        trace_unpush(conn, slot);
+      }
+      break;
+    }
+    if (KEY_TRACE_ENABLED && entry->trace.traced) {
+      key_trace_record(KEY_TRACE_QUEUED, entry->trace.seq, entry->conn_handle,
+                       now_us);
+      key_trace_span(KEY_TRACE_SPAN_QUEUE, now_us - entry->trace.built_us);
+    }
+    if (rc != 0) {
+      tx->stats.dropped++;
+      tx_forget(conn);
+    } else {
+      sent++;
+      ops->sent(entry->conn_handle, ops->arg);
+    }
+    tx_pop(tx);
+  }
+
+  if (sent > 0) {
+    tx->stats.flushes++;
+    tx->stats.reports_sent += sent;
+    if (sent > tx->stats.max_reports_per_flush) {
+      tx->stats.max_reports_per_flush = sent;
+    }
+  }
+  *made_room = tx->count < count;
+
+  if (tx->count == 0) {
+    return UINT32_MAX;
+  }
+  if (link == NULL) {
+    return HOGP_TX_RETRY_MS;
+  }
+  // Connection interval of the host that is being waited on, in 1.25 ms
+  // units
+  return (link->conn_itvl * 5 + 3) / 4;
+}
+
+// Notifications complete in the order they were handed to the stack, so the
+// oldest one remembered for the connection is the one this is about
+void hogp_tx_done(hogp_conn_t *conn, uint16_t val_handle, int status,
+                  uint32_t now_us) {
+  if (status != 0) {
+    tx_forget(conn);
+  }
+
+  // Skip anything the stack never reported on
+  while (conn->trace_count > 0) {
+    hogp_conn_trace_t *done = &conn->trace[conn->trace_head];
+    conn->trace_head = (conn->trace_head + 1) % HOGP_CONN_TRACE_DEPTH;
+    conn->trace_count--;
+    if (done->val_handle != val_handle) {
+      continue;
+    }
+
+    if (done->traced && status == 0) {
+      key_trace_record(KEY_TRACE_TX_DONE, done->seq, conn->conn_handle,
+                       now_us);
+      key_trace_span(KEY_TRACE_SPAN_TX, now_us - done->queued_us);
+      key_trace_span(KEY_TRACE_SPAN_TOTAL, now_us - done->detected_us);
+    }
+    break;
+  }
+}
+
+void hogp_tx_get_stats(const hogp_tx_t *tx, struct hogp_tx_stats *stats) {
+  *stats = tx->stats;
+  stats->queue_depth = tx->count;
+}
@@ -0,0 +1,110 @@
+#ifndef HOGP_TX_H
+#define HOGP_TX_H
+
+#include "gap.h"
+#include "hogp_conn.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Queue of report notifications waiting for the stack. A report is copied in
+// when it is built, so later key events can not change it before it goes
+// out, and handed to the stack up to HOGP_TX_BURST_MAX at a time so a burst
+// lands in one connection event.
+//
+// It does not call NimBLE directly, notifications go through hogp_tx_ops_t
+// and time is passed in, so it can run against a fake stack.
+
+// Reports waiting to be notified. When full, key events are left in the key
+// ring until there is room again
+#define HOGP_TX_QUEUE_LEN 32
+// Notifications handed to the stack back-to-back per connection event. Kept
+// at or below the controller's ACL buffer count so a burst is not split up
+#define HOGP_TX_BURST_MAX 4
+
+// hogp_tx_ops_t.notify result: no buffer right now, try again later
+#define HOGP_TX_BUSY 1
+
+// Report delivery counters. A flush is one back-to-back burst of
+// notifications, i.e. one connection event worth of reports
+struct hogp_tx_stats {
+  uint32_t flushes;
+  uint32_t reports_sent;
+  uint32_t dropped;
+  uint32_t busy; // Bursts cut short because the stack had no buffer
+  uint8_t max_reports_per_flush;
+  uint8_t queue_depth;
+  uint8_t max_queue_depth;
+};
+
+typedef struct {
+  // Hands one notification to the stack. 0 if it was taken, HOGP_TX_BUSY if
+  // it never reached the stack (no buffer) and stays queued, anything else
+  // drops it
+  int (*notify)(uint16_t conn_handle, uint16_t val_handle,
+                const uint8_t *data, uint8_t len, void *arg);
+  // NULL if conn_handle is no longer connected
+  const struct gap_link_info *(*link)(uint16_t conn_handle, void *arg);
+  // A notification was taken by the stack
+  void (*sent)(uint16_t conn_handle, void *arg);
+  void *arg;
+} hogp_tx_ops_t;
+
+// Key event a report carries, see key_trace.h. traced is 0 for reports that
+// were not caused by a key event
+typedef struct {
+  uint8_t traced;
+  uint16_t seq;
+  uint32_t detected_us;
+  uint32_t built_us;
+} hogp_tx_trace_t;
+
+typedef struct {
+  uint16_t conn_handle;
+  uint16_t val_handle;
+  uint8_t len;
+  uint8_t data[HOGP_CONN_LAST_REPORT_LEN];
+  hogp_tx_trace_t trace;
+} hogp_tx_entry_t;
+
+typedef struct {
+  const hogp_tx_ops_t *ops;
+  hogp_tx_entry_t queue[HOGP_TX_QUEUE_LEN];
+  uint8_t head;
+  uint8_t count;
+  struct hogp_tx_stats stats;
+} hogp_tx_t;
+
+void hogp_tx_init(hogp_tx_t *tx, const hogp_tx_ops_t *ops);
+
+static inline uint8_t hogp_tx_room(const hogp_tx_t *tx) {
+  return HOGP_TX_QUEUE_LEN - tx->count;
+}
+
+// Queues a report for one connection if it subscribed to notify_bit. Reports
+// equal to the last one queued for the host are skipped, until a report to
+// it is dropped or fails to send. Callers make room first
+void hogp_tx_queue(hogp_tx_t *tx, hogp_conn_t *conn, uint16_t val_handle,
+                   uint16_t notify_bit, const uint8_t *value, uint8_t len,
+                   const hogp_tx_trace_t *trace);
+
+// Same, for reports that are never skipped: relative ones (pointer motion),
+// where two equal reports in a row both count, and ones whose producer
+// already sends changes only. They do not become the last report
+void hogp_tx_queue_always(hogp_tx_t *tx, hogp_conn_t *conn,
+                          uint16_t val_handle, uint16_t notify_bit,
+                          const uint8_t *value, uint8_t len);
+
+// Hands up to HOGP_TX_BURST_MAX queued reports to the stack. Returns how many
+// ms until the rest should be retried (one connection interval of the host
+// being waited on), or UINT32_MAX if the queue is empty. *made_room is set if
+// anything left the queue for good
+uint32_t hogp_tx_flush(hogp_tx_t *tx, uint32_t now_us, bool *made_room);
+
+// BLE_GAP_EVENT_NOTIFY_TX for a notification on conn, closes its key trace.
+// A failed one makes the next report to conn go out even if it repeats
+void hogp_tx_done(hogp_conn_t *conn, uint16_t val_handle, int status,
+                  uint32_t now_us);
+
+void hogp_tx_get_stats(const hogp_tx_t *tx, struct hogp_tx_stats *stats);
+
+#endif
@@ -0,0 +1,92 @@
+#include "key_event_ring.h"
+
+#define KEY_EVENT_RING_MASK (KEY_EVENT_RING_SIZE - 1)
+
+_Static_assert((KEY_EVENT_RING_SIZE & KEY_EVENT_RING_MASK) == 0,
+               "KEY_EVENT_RING_SIZE must be a power of two");
+_Static_assert(KEY_EVENT_RING_HELD_MAX < KEY_EVENT_RING_SIZE,
+               "every held key needs a slot for its release");
+
+void key_event_ring_init(key_event_ring_t *ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->held_count = 0;
+}
+
+bool key_event_ring_push(key_event_ring_t *ring, const key_event_t *event) {
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  // Acquire so the consumer is done reading the slot before we overwrite it
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (head - tail >= KEY_EVENT_RING_SIZE) {
+    return false;
+  }
+
+  ring->events[head & KEY_EVENT_RING_MASK] = *event;
+
+  // Release publishes the slot contents together with the new head
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+static int key_event_ring_held(const key_event_ring_t *ring,
+                               const key_event_t *event) {
+  for (int i = 0; i < ring->held_count; i++) {
+    if (ring->held[i].usage == event->usage &&
+        ring->held[i].page == event->page) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool key_event_ring_push_key(key_event_ring_t *ring, const key_event_t *event) {
+  int held = key_event_ring_held(ring, event);
+
+  if (!event->pressed) {
+    if (held < 0) {
+      // Its press never went in
+      return true;
+    }
+    // Free slots never drop below the keys held, so this fits
+    key_event_ring_push(ring, event);
+    ring->held[held] = ring->held[--ring->held_count];
+    return true;
+  }
+
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  uint32_t free = KEY_EVENT_RING_SIZE - (head - tail);
+  // This press, plus a release for every key held after it
+  uint32_t need = 1 + ring->held_count + (held < 0 ? 1 : 0);
+  if (free < need ||
+      (held < 0 && ring->held_count == KEY_EVENT_RING_HELD_MAX)) {
+    return false;
+  }
+  key_event_ring_push(ring, event);
+  if (held < 0) {
+    ring->held[ring->held_count].usage = event->usage;
+    ring->held[ring->held_count].page = event->page;
+    ring->held_count++;
+  }
+  return true;
+}
+
+size_t key_event_ring_pop_batch(key_event_ring_t *ring, key_event_t *out,
+                                size_t max) {
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  size_t count = head - tail;
+  if (count > max) {
+    count = max;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    out[i] = ring->events[(tail + i) & KEY_EVENT_RING_MASK];
+  }
+
+  // Hand the slots back to the producer
+  atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+  return count;
+}
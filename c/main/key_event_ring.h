@@ -0,0 +1,55 @@
+#ifndef KEY_EVENT_RING_H
+#define KEY_EVENT_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of slots in the ring, must be a power of two so the free running
+// indices can be wrapped with a mask
+#define KEY_EVENT_RING_SIZE 64
+// Keys key_event_ring_push_key() tracks as held at once
+#define KEY_EVENT_RING_HELD_MAX 32
+
+typedef struct {
+  uint32_t timestamp_us; // When the key changed state (esp_timer clock)
+  uint16_t usage;        // HID usage code on page
+  uint8_t page;          // HID usage page, see control_report.h
+  uint8_t pressed;       // 1 for key down, 0 for key up
+} key_event_t;
+
+// Single-producer / single-consumer lock-free ring. `head` is only ever
+// written by the producer and `tail` only by the consumer, so no locks are
+// needed as long as there is exactly one task on each side.
+typedef struct {
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  key_event_t events[KEY_EVENT_RING_SIZE];
+  // Producer side only: keys pushed down by key_event_ring_push_key() and
+  // not up yet
+  struct {
+    uint16_t usage;
+    uint8_t page;
+  } held[KEY_EVENT_RING_HELD_MAX];
+  uint8_t held_count;
+} key_event_ring_t;
+
+void key_event_ring_init(key_event_ring_t *ring);
+
+// Producer side. Returns false (and drops nothing) if the ring is full
+bool key_event_ring_push(key_event_ring_t *ring, const key_event_t *event);
+
+// Producer side, for key presses and releases. A full ring must not lose a
+// release, or the key stays down on the host. So a press only goes in while
+// the ring keeps a slot for the release of every key held, its own included,
+// and a release always fits. Returns false if a press was refused; the
+// release of a refused key is then dropped too and returns true
+bool key_event_ring_push_key(key_event_ring_t *ring, const key_event_t *event);
+
+// Consumer side. Copies up to `max` events in FIFO order into `out` and
+// returns how many were copied
+size_t key_event_ring_pop_batch(key_event_ring_t *ring, key_event_t *out,
+                                size_t max);
+
+#endif
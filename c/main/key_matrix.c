@@ -0,0 +1,66 @@
+#include "key_matrix.h"
+#include <string.h>
+
+// The vertical counters below count 3, 2, 1, 0 and toggle on the next sample
+_Static_assert(KEY_MATRIX_DEBOUNCE_SAMPLES == 4,
+               "the 2-bit integrators debounce over 4 samples");
+_Static_assert(KEY_MATRIX_MAX_COLS <= 32, "a row is read as one word");
+
+static inline uint8_t key_matrix_words(const key_matrix_t *km) {
+  return (km->rows * km->cols + 31) / 32;
+}
+
+void key_matrix_init(key_matrix_t *km, uint8_t rows, uint8_t cols,
+                     const key_matrix_ops_t *ops) {
+  *km = (key_matrix_t){
+      .ops = ops,
+      .rows = rows,
+      .cols = cols,
+  };
+  // Integrators rest at 3
+  memset(km->ct0, 0xFF, sizeof(km->ct0));
+  memset(km->ct1, 0xFF, sizeof(km->ct1));
+}
+
+bool key_matrix_scan(key_matrix_t *km, uint32_t now_us) {
+  uint32_t raw[KEY_MATRIX_WORDS] = {0};
+
+  for (uint8_t row = 0; row < km->rows; row++) {
+    uint32_t cols = km->ops->read_row(row, km->ops->arg);
+    if (km->cols < 32) {
+      cols &= (1u << km->cols) - 1;
+    }
+    // A row can straddle two words
+    uint32_t bit = row * km->cols;
+    raw[bit >> 5] |= cols << (bit & 31);
+    if ((bit & 31) + km->cols > 32) {
+      raw[(bit >> 5) + 1] |= cols >> (32 - (bit & 31));
+    }
+  }
+  return key_matrix_sample(km, raw, now_us);
+}
+
+bool key_matrix_sample(key_matrix_t *km, const uint32_t *raw, uint32_t now_us) {
+  uint8_t words = key_matrix_words(km);
+  uint32_t busy = 0;
+
+  for (uint8_t w = 0; w < words; w++) {
+    // Keys that disagree with their debounced state count down, all others
+    // are reset to 3. The ones that were at 0 roll over and toggle
+    uint32_t delta = raw[w] ^ km->state[w];
+    km->ct0[w] = ~(km->ct0[w] & delta);
+    km->ct1[w] = km->ct0[w] ^ (km->ct1[w] & delta);
+    uint32_t toggle = delta & km->ct0[w] & km->ct1[w];
+    km->state[w] ^= toggle;
+
+    busy |= km->state[w] | (delta & ~toggle);
+
+    while (toggle) {
+      uint8_t bit = __builtin_ctz(toggle);
+      toggle &= toggle - 1;
+      km->ops->emit((w << 5) | bit, (km->state[w] >> bit) & 1, now_us,
+                    km->ops->arg);
+    }
+  }
+  return busy != 0;
+}
@@ -0,0 +1,53 @@
+#ifndef KEY_MATRIX_H
+#define KEY_MATRIX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Key matrix scan and debounce core. Every key has a 2-bit integrator; a key
+// only changes state after KEY_MATRIX_DEBOUNCE_SAMPLES scans in a row saw it
+// in the other state, any sample agreeing with the current state resets it.
+// The integrators are vertical counters: bit 0 and bit 1 of every key's
+// counter live in two packed bitsets, so one word of bit operations
+// debounces 32 keys at once.
+//
+// It does not touch GPIO or timers, rows are read through key_matrix_ops_t
+// and time is passed in, so it can run against synthetic bounce traces.
+
+#define KEY_MATRIX_MAX_ROWS 8
+#define KEY_MATRIX_MAX_COLS 16
+#define KEY_MATRIX_MAX_KEYS (KEY_MATRIX_MAX_ROWS * KEY_MATRIX_MAX_COLS)
+#define KEY_MATRIX_WORDS ((KEY_MATRIX_MAX_KEYS + 31) / 32)
+
+// Scans a change has to be seen for before it is reported
+#define KEY_MATRIX_DEBOUNCE_SAMPLES 4
+
+typedef struct {
+  // Selects one row and returns its columns, bit set = switch closed
+  uint32_t (*read_row)(uint8_t row, void *arg);
+  // A key changed state after debouncing. key is row * cols + col
+  void (*emit)(uint16_t key, bool pressed, uint32_t timestamp_us, void *arg);
+  void *arg;
+} key_matrix_ops_t;
+
+typedef struct {
+  const key_matrix_ops_t *ops;
+  uint8_t rows;
+  uint8_t cols;
+  uint32_t state[KEY_MATRIX_WORDS]; // Debounced, bit set = key down
+  uint32_t ct0[KEY_MATRIX_WORDS];   // Integrator bit 0
+  uint32_t ct1[KEY_MATRIX_WORDS];   // Integrator bit 1
+} key_matrix_t;
+
+void key_matrix_init(key_matrix_t *km, uint8_t rows, uint8_t cols,
+                     const key_matrix_ops_t *ops);
+
+// Reads every row and debounces the result. Returns true while any key is
+// down or still settling, i.e. while scanning has to go on
+bool key_matrix_scan(key_matrix_t *km, uint32_t now_us);
+
+// Debounces one raw sample (bit row * cols + col set = switch closed), the
+// second half of key_matrix_scan()
+bool key_matrix_sample(key_matrix_t *km, const uint32_t *raw, uint32_t now_us);
+
+#endif
@@ -0,0 +1,109 @@
+#include "key_trace.h"
+#include <string.h>
+
+#define KEY_TRACE_RING_MASK (KEY_TRACE_RING_SIZE - 1)
+
+_Static_assert((KEY_TRACE_RING_SIZE & KEY_TRACE_RING_MASK) == 0,
+               "KEY_TRACE_RING_SIZE must be a power of two");
+_Static_assert(sizeof(key_trace_rec_t) == 8, "trace records are dumped raw");
+
+typedef struct {
+  uint32_t count;
+  uint32_t max_us;
+  uint32_t buckets[KEY_TRACE_HIST_BUCKETS + 1]; // Last one is the overflow
+} key_trace_hist_t;
+
+static key_trace_rec_t trace_ring[KEY_TRACE_RING_SIZE];
+static uint32_t trace_head;
+static key_trace_hist_t trace_hists[KEY_TRACE_SPAN_COUNT];
+static key_trace_cost_stats_t trace_costs[KEY_TRACE_COST_COUNT];
+
+void key_trace_init(void) {
+  trace_head = 0;
+  memset(trace_hists, 0, sizeof(trace_hists));
+  memset(trace_costs, 0, sizeof(trace_costs));
+}
+
+void key_trace_record(key_trace_stage_t stage, uint16_t seq, uint8_t arg,
+                      uint32_t timestamp_us) {
+  trace_ring[trace_head & KEY_TRACE_RING_MASK] = (key_trace_rec_t){
+      .timestamp_us = timestamp_us,
+      .seq = seq,
+      .stage = stage,
+      .arg = arg,
+  };
+  trace_head++;
+}
+
+void key_trace_span(key_trace_span_t span, uint32_t us) {
+  key_trace_hist_t *hist = &trace_hists[span];
+  uint32_t bucket = us / KEY_TRACE_HIST_BUCKET_US;
+
+  if (bucket > KEY_TRACE_HIST_BUCKETS) {
+    bucket = KEY_TRACE_HIST_BUCKETS;
+  }
+  hist->buckets[bucket]++;
+  hist->count++;
+  if (us > hist->max_us) {
+    hist->max_us = us;
+  }
+}
+
+// Smallest bucket edge at or below which pct percent of the samples are
+static uint32_t hist_percentile(const key_trace_hist_t *hist, uint32_t pct) {
+  uint32_t want = (hist->count * pct + 99) / 100;
+  uint32_t seen = 0;
+
+  for (uint32_t i = 0; i < KEY_TRACE_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= want) {
+      uint32_t edge = (i + 1) * KEY_TRACE_HIST_BUCKET_US;
+      return edge < hist->max_us ? edge : hist->max_us;
+    }
+  }
+  return hist->max_us;
+}
+
+void key_trace_summary(key_trace_span_t span, key_trace_summary_t *summary) {
+  const key_trace_hist_t *hist = &trace_hists[span];
+
+  *summary = (key_trace_summary_t){
+      .count = hist->count,
+      .max_us = hist->max_us,
+  };
+  if (hist->count > 0) {
+    summary->p50_us = hist_percentile(hist, 50);
+    summary->p99_us = hist_percentile(hist, 99);
+  }
+}
+
+void key_trace_cost(key_trace_cost_t cost, uint32_t cycles) {
+  key_trace_cost_stats_t *stats = &trace_costs[cost];
+
+  stats->count++;
+  stats->total_cycles += cycles;
+  if (cycles > stats->max_cycles) {
+    stats->max_cycles = cycles;
+  }
+}
+
+void key_trace_cost_stats(key_trace_cost_t cost,
+                          key_trace_cost_stats_t *stats) {
+  *stats = trace_costs[cost];
+}
+
+size_t key_trace_dump(key_trace_rec_t *out, size_t max) {
+  uint32_t n = trace_head < KEY_TRACE_RING_SIZE ? trace_head
+                                                : KEY_TRACE_RING_SIZE;
+  if (n > max) {
+    n = max;
+  }
+
+  uint32_t first = trace_head - n;
+  for (uint32_t i = 0; i < n; i++) {
+    out[i] = trace_ring[(first + i) & KEY_TRACE_RING_MASK];
+  }
+  return n;
+}
+
+uint32_t key_trace_total(void) { return trace_head; }
@@ -0,0 +1,90 @@
+#ifndef KEY_TRACE_H
+#define KEY_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Key latency tracing. Every key event gets a sequence number, and each
+// stage it passes through writes a timestamped record into a RAM ring. The
+// time between stages also goes into fixed bucket histograms, so p50/p99/max
+// are available without keeping every sample.
+//
+// A record is a handful of stores, nothing is formatted or printed. Only the
+// NimBLE host task writes and reads it, so there is no locking. Timestamps
+// and cycle counts are passed in, the core has no platform code.
+
+// Records kept, must be a power of two
+#define KEY_TRACE_RING_SIZE 256
+// Histogram resolution and range, slower samples land in an overflow bucket
+#define KEY_TRACE_HIST_BUCKET_US 100
+#define KEY_TRACE_HIST_BUCKETS 128
+
+// Records keep no usage, so a trace read over the air is not a key log
+typedef enum {
+  KEY_TRACE_DETECTED, // Input saw the key change (its event timestamp)
+  KEY_TRACE_BUILT,    // Report builder applied it
+  KEY_TRACE_QUEUED,   // Notification handed to the stack, arg = connection
+  KEY_TRACE_TX_DONE,  // BLE_GAP_EVENT_NOTIFY_TX, arg = connection
+  KEY_TRACE_STAGE_COUNT
+} key_trace_stage_t;
+
+// Latencies that are histogrammed
+typedef enum {
+  KEY_TRACE_SPAN_BUILD, // Detected -> built
+  KEY_TRACE_SPAN_QUEUE, // Built -> queued, includes waiting for a burst
+  KEY_TRACE_SPAN_TX,    // Queued -> tx done
+  KEY_TRACE_SPAN_TOTAL, // Detected -> tx done
+  KEY_TRACE_SPAN_COUNT
+} key_trace_span_t;
+
+// CPU cost of the hot path steps, in cycles. Cycles and not time, the CPU
+// clock changes with power management
+typedef enum {
+  KEY_TRACE_COST_BUILD,   // Report builder applying one key event
+  KEY_TRACE_COST_ACCESS,  // One HOGP GATT access callback
+  KEY_TRACE_COST_ENQUEUE, // Copying one report into the tx queue
+  KEY_TRACE_COST_COUNT
+} key_trace_cost_t;
+
+// 8 bytes, dumped as is (little endian) by the trace service
+typedef struct {
+  uint32_t timestamp_us;
+  uint16_t seq;
+  uint8_t stage; // key_trace_stage_t
+  uint8_t arg;
+} key_trace_rec_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t p50_us; // Upper edge of the bucket, so rounded up
+  uint32_t p99_us;
+  uint32_t max_us;
+} key_trace_summary_t;
+
+typedef struct {
+  uint32_t count;
+  uint64_t total_cycles;
+  uint32_t max_cycles;
+} key_trace_cost_stats_t;
+
+void key_trace_init(void);
+
+void key_trace_record(key_trace_stage_t stage, uint16_t seq, uint8_t arg,
+                      uint32_t timestamp_us);
+
+void key_trace_span(key_trace_span_t span, uint32_t us);
+
+void key_trace_summary(key_trace_span_t span, key_trace_summary_t *summary);
+
+void key_trace_cost(key_trace_cost_t cost, uint32_t cycles);
+
+void key_trace_cost_stats(key_trace_cost_t cost,
+                          key_trace_cost_stats_t *stats);
+
+// Copies the most recent records, oldest first, and returns how many
+size_t key_trace_dump(key_trace_rec_t *out, size_t max);
+
+// Records written since init, including the ones overwritten since
+uint32_t key_trace_total(void);
+
+#endif
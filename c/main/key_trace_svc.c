@@ -0,0 +1,196 @@
+#include "key_trace_svc.h"
+#include "config.h"
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "key_trace.h"
+#include "os/endian.h"
+#include "power_mgr.h"
+#include <assert.h>
+#include <stdbool.h>
+
+// What fits one attribute value (512 bytes) after the record counter
+#define KEY_TRACE_SVC_RECORDS 62
+
+_Static_assert(4 + KEY_TRACE_SVC_RECORDS * sizeof(key_trace_rec_t) <=
+                   BLE_ATT_ATTR_MAX_LEN,
+               "trace records do not fit one attribute value");
+
+static int key_trace_svc_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+// 377a77cf-5433-4af6-8f1b-854c6920xxxx
+#define KEY_TRACE_UUID(id)                                                     \
+  BLE_UUID128_INIT(id, 0x00, 0x20, 0x69, 0x4c, 0x85, 0x1b, 0x8f, 0xf6, 0x4a,   \
+                   0x33, 0x54, 0xcf, 0x77, 0x7a, 0x37)
+
+static const ble_uuid128_t key_trace_svc_uuid = KEY_TRACE_UUID(0x01);
+static const ble_uuid128_t key_trace_summary_uuid = KEY_TRACE_UUID(0x02);
+static const ble_uuid128_t key_trace_records_uuid = KEY_TRACE_UUID(0x03);
+static const ble_uuid128_t key_trace_costs_uuid = KEY_TRACE_UUID(0x04);
+
+static const struct ble_gatt_chr_def key_trace_chrs[] = {
+    {.uuid = &key_trace_summary_uuid.u,
+     .access_cb = key_trace_svc_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC},
+    {.uuid = &key_trace_records_uuid.u,
+     .access_cb = key_trace_svc_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |
+              BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC},
+    {.uuid = &key_trace_costs_uuid.u,
+     .access_cb = key_trace_svc_access,
+     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC},
+    {0} /* No more characteristics */
+};
+#define KEY_TRACE_CHR_COUNT                                                    \
+  (sizeof(key_trace_chrs) / sizeof(key_trace_chrs[0]) - 1)
+
+static const struct ble_gatt_svc_def key_trace_svcs[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &key_trace_svc_uuid.u,
+        .characteristics = key_trace_chrs,
+    },
+    {0} /* No more services */
+};
+
+static int key_trace_summary_read(struct os_mbuf *om) {
+  uint8_t buf[KEY_TRACE_SPAN_COUNT * 4 * sizeof(uint32_t)];
+  uint8_t *p = buf;
+
+  for (int span = 0; span < KEY_TRACE_SPAN_COUNT; span++) {
+    key_trace_summary_t summary;
+    key_trace_summary(span, &summary);
+    put_le32(p, summary.count);
+    put_le32(p + 4, summary.p50_us);
+    put_le32(p + 8, summary.p99_us);
+    put_le32(p + 12, summary.max_us);
+    p += 16;
+  }
+  return os_mbuf_append(om, buf, sizeof(buf));
+}
+
+// The records a write took. NimBLE calls the access callback again for
+// every blob of a long read, so reads serve this rather than the live ring
+static struct {
+  bool taken;
+  uint8_t total[4];
+  size_t count;
+  key_trace_rec_t recs[KEY_TRACE_SVC_RECORDS];
+} key_trace_records_snap;
+
+static void key_trace_records_take(void) {
+  put_le32(key_trace_records_snap.total, key_trace_total());
+  key_trace_records_snap.count =
+      key_trace_dump(key_trace_records_snap.recs, KEY_TRACE_SVC_RECORDS);
+  key_trace_records_snap.taken = true;
+}
+
+// Records are little endian structs already (key_trace_rec_t), they go out
+// as they are in memory
+static int key_trace_records_read(struct os_mbuf *om) {
+  if (!key_trace_records_snap.taken) {
+    key_trace_records_take();
+  }
+  if (os_mbuf_append(om, key_trace_records_snap.total,
+                     sizeof(key_trace_records_snap.total)) != 0) {
+    return BLE_HS_ENOMEM;
+  }
+  return os_mbuf_append(om, key_trace_records_snap.recs,
+                        key_trace_records_snap.count *
+                            sizeof(key_trace_records_snap.recs[0]));
+}
+
+static int key_trace_costs_read(struct os_mbuf *om) {
+  uint8_t buf[4 + KEY_TRACE_COST_COUNT * 3 * sizeof(uint32_t)];
+  uint8_t *p = buf + 4;
+
+  put_le32(buf, POWER_MAX_FREQ_MHZ);
+  for (int cost = 0; cost < KEY_TRACE_COST_COUNT; cost++) {
+    key_trace_cost_stats_t stats;
+    key_trace_cost_stats(cost, &stats);
+    put_le32(p, stats.count);
+    put_le32(p + 4, stats.count > 0 ? stats.total_cycles / stats.count : 0);
+    put_le32(p + 8, stats.max_cycles);
+    p += 12;
+  }
+  return os_mbuf_append(om, buf, sizeof(buf));
+}
+
+typedef struct {
+  int (*read)(struct os_mbuf *om);
+  // Takes the snapshot reads return, NULL if reads are live
+  void (*take)(void);
+} key_trace_chr_t;
+
+// Handlers of each characteristic, in key_trace_chrs order
+static const key_trace_chr_t key_trace_chr_ops[KEY_TRACE_CHR_COUNT] = {
+    {.read = key_trace_summary_read},
+    {.read = key_trace_records_read, .take = key_trace_records_take},
+    {.read = key_trace_costs_read},
+};
+
+// Service declaration, then a declaration and a value per characteristic
+#define KEY_TRACE_ATTR_MAX (1 + KEY_TRACE_CHR_COUNT * 2)
+
+// Dispatch table, indexed by attribute handle - key_trace_base_handle.
+// Filled in as NimBLE registers the service (key_trace_svc_register_cb)
+static const key_trace_chr_t *key_trace_attrs[KEY_TRACE_ATTR_MAX];
+static uint16_t key_trace_base_handle;
+
+static int key_trace_svc_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  uint16_t idx = attr_handle - key_trace_base_handle;
+  const key_trace_chr_t *chr =
+      idx < KEY_TRACE_ATTR_MAX ? key_trace_attrs[idx] : NULL;
+
+  if (chr == NULL) {
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+  if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+    return chr->read(ctxt->om) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+  } else if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR && chr->take != NULL) {
+    // Whatever was written, it only asks for a fresh snapshot
+    chr->take();
+    return 0;
+  }
+  return BLE_ATT_ERR_UNLIKELY;
+}
+
+void key_trace_svc_register_cb(struct ble_gatt_register_ctxt *ctxt,
+                               void *arg) {
+  switch (ctxt->op) {
+  case BLE_GATT_REGISTER_OP_SVC:
+    if (ctxt->svc.svc_def == &key_trace_svcs[0]) {
+      key_trace_base_handle = ctxt->svc.handle;
+    }
+    break;
+
+  case BLE_GATT_REGISTER_OP_CHR:
+    if (ctxt->chr.chr_def->access_cb == key_trace_svc_access) {
+      uint16_t idx = ctxt->chr.val_handle - key_trace_base_handle;
+      assert(idx < KEY_TRACE_ATTR_MAX);
+      key_trace_attrs[idx] =
+          &key_trace_chr_ops[ctxt->chr.chr_def - key_trace_chrs];
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+int key_trace_svc_init(void) {
+  int rc;
+
+  rc = ble_gatts_count_cfg(key_trace_svcs);
+  if (rc != 0) {
+    return rc;
+  }
+
+  rc = ble_gatts_add_svcs(key_trace_svcs);
+  if (rc != 0) {
+    return rc;
+  }
+
+  return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef KEY_TRACE_SVC_H
+#define KEY_TRACE_SVC_H
+
+#include "host/ble_gatt.h"
+
+// Vendor GATT service to read the key latency trace (key_trace.h). Every
+// characteristic needs an encrypted link, so only a bonded host can read it:
+//
+//  - Summary: for every key_trace_span_t in order, count, p50, p99 and max in
+//    us, each a little endian uint32
+//  - Records: records written so far (uint32), then the most recent records
+//    as dumped by key_trace_dump(), oldest first. Writing it (any value)
+//    takes a snapshot, and reads return that snapshot until the next write,
+//    so the blobs of a long read agree. The first read takes one itself
+//  - Costs: the CPU clock the hot path runs at in MHz (POWER_MAX_FREQ_MHZ),
+//    then for every key_trace_cost_t in order, count, average and max in
+//    CPU cycles, each a little endian uint32
+//
+// tools/decode_key_trace.py turns them into tables or JSON. The firmware's
+// other counters are on the diagnostics service (diag_svc.h).
+
+void key_trace_svc_register_cb(struct ble_gatt_register_ctxt *ctxt,
+                               void *arg);
+
+int key_trace_svc_init(void);
+
+#endif
@@ -0,0 +1,376 @@
+#include "keymap.h"
+#include <string.h>
+
+#define HID_KEY_LEFT_CTRL 0xE0
+#define HID_PAGE_GENERIC_DESKTOP 0x01
+#define HID_PAGE_CONSUMER 0x0C
+
+typedef enum {
+  DECIDE_WAIT,
+  DECIDE_TAP,
+  DECIDE_HOLD,
+} decision_t;
+
+void keymap_init(keymap_t *km, const keymap_def_t *def,
+                 const keymap_cfg_t *cfg, const keymap_ops_t *ops) {
+  memset(km, 0, sizeof(*km));
+  km->def = def;
+  km->cfg = cfg;
+  km->ops = ops;
+  km->layers = 1;
+
+  for (uint8_t i = 0; i < def->combo_count; i++) {
+    for (uint8_t k = 0; k < def->combos[i].count; k++) {
+      uint8_t pos = def->combos[i].keys[k];
+      km->combo_keys[pos / 32] |= 1u << (pos % 32);
+    }
+  }
+}
+
+// Top-most active layer that does not pass the key through
+static uint16_t keymap_lookup(const keymap_t *km, uint16_t pos) {
+  for (int l = km->def->layers - 1; l >= 0; l--) {
+    if (!(km->layers & (1u << l))) {
+      continue;
+    }
+    uint16_t action = km->def->actions[l * km->def->keys + pos];
+    if (KEYMAP_KIND(action) != KEYMAP_TRANS) {
+      return action;
+    }
+  }
+  return KEYMAP_NONE;
+}
+
+// Usages are counted, so two keys resolving to the same one (a modifier held
+// through mt() and osm() say) only release it once both are up
+static void emit_key(keymap_t *km, uint8_t usage, bool pressed,
+                     uint32_t timestamp_us) {
+  if (usage == 0) {
+    return;
+  }
+  if (pressed ? km->usage_count[usage]++ == 0
+              : km->usage_count[usage] > 0 && --km->usage_count[usage] == 0) {
+    km->ops->key(usage, pressed, timestamp_us, km->ops->arg);
+  }
+}
+
+static void emit_control(keymap_t *km, uint16_t action, bool pressed,
+                         uint32_t timestamp_us) {
+  uint8_t page = KEYMAP_KIND(action) == KEYMAP_CONSUMER
+                     ? HID_PAGE_CONSUMER
+                     : HID_PAGE_GENERIC_DESKTOP;
+  if (KEYMAP_ARG(action) != 0) {
+    km->ops->control(page, KEYMAP_ARG(action), pressed, timestamp_us,
+                     km->ops->arg);
+  }
+}
+
+static void emit_mods(keymap_t *km, uint8_t mods, bool pressed,
+                      uint32_t timestamp_us) {
+  for (uint8_t i = 0; i < 8; i++) {
+    if (mods & (1u << i)) {
+      emit_key(km, HID_KEY_LEFT_CTRL + i, pressed, timestamp_us);
+    }
+  }
+}
+
+// A key other than a modifier went down: held one-shot modifiers act as
+// plain ones from now on, armed ones have done their job
+static void osm_key_pressed(keymap_t *km, uint32_t timestamp_us) {
+  km->osm_used = 1;
+  if (km->osm_armed != 0) {
+    emit_mods(km, km->osm_armed & ~km->osm_held, false, timestamp_us);
+    km->osm_armed = 0;
+  }
+}
+
+static void osm_press(keymap_t *km, uint16_t pos, uint8_t mods,
+                      uint32_t timestamp_us) {
+  if ((km->osm_armed & mods) == mods) {
+    // Tapped again while armed, cancels them
+    emit_mods(km, mods & ~km->osm_held, false, timestamp_us);
+    km->osm_armed &= ~mods;
+    km->active[pos] = KEYMAP_NONE;
+    return;
+  }
+  emit_mods(km, mods & ~(km->osm_held | km->osm_armed), true, timestamp_us);
+  km->osm_held |= mods;
+  km->osm_used = 0;
+}
+
+static void osm_release(keymap_t *km, uint8_t mods, uint32_t timestamp_us) {
+  km->osm_held &= ~mods;
+  if (km->osm_used) {
+    emit_mods(km, mods & ~(km->osm_held | km->osm_armed), false,
+              timestamp_us);
+  } else {
+    km->osm_armed |= mods;
+  }
+}
+
+static void action_press(keymap_t *km, uint16_t pos, uint16_t action,
+                         uint32_t timestamp_us) {
+  uint16_t arg = KEYMAP_ARG(action);
+
+  km->active[pos] = action;
+  switch (KEYMAP_KIND(action)) {
+  case KEYMAP_KEY:
+    emit_key(km, arg, true, timestamp_us);
+    if (arg != 0 && arg < HID_KEY_LEFT_CTRL) {
+      osm_key_pressed(km, timestamp_us);
+    }
+    break;
+  case KEYMAP_MO:
+    km->layers |= 1u << arg;
+    break;
+  case KEYMAP_TG:
+    km->layers = (km->layers ^ (1u << arg)) | 1;
+    break;
+  case KEYMAP_OSM:
+    osm_press(km, pos, arg, timestamp_us);
+    break;
+  case KEYMAP_MACRO:
+    km->ops->macro(arg, km->ops->arg);
+    osm_key_pressed(km, timestamp_us);
+    break;
+  case KEYMAP_CONSUMER:
+  case KEYMAP_SYSTEM:
+    emit_control(km, action, true, timestamp_us);
+    break;
+  default:
+    break;
+  }
+}
+
+static void action_release(keymap_t *km, uint16_t pos,
+                           uint32_t timestamp_us) {
+  uint16_t action = km->active[pos];
+  uint16_t arg = KEYMAP_ARG(action);
+
+  km->active[pos] = KEYMAP_NONE;
+  switch (KEYMAP_KIND(action)) {
+  case KEYMAP_KEY:
+    emit_key(km, arg, false, timestamp_us);
+    break;
+  case KEYMAP_MO:
+    km->layers = (km->layers & ~(1u << arg)) | 1;
+    break;
+  case KEYMAP_OSM:
+    osm_release(km, arg, timestamp_us);
+    break;
+  case KEYMAP_CONSUMER:
+  case KEYMAP_SYSTEM:
+    emit_control(km, action, false, timestamp_us);
+    break;
+  default:
+    break;
+  }
+}
+
+static bool in_combo(const keymap_t *km, uint16_t pos) {
+  return km->combo_keys[pos / 32] & (1u << (pos % 32));
+}
+
+static bool combo_has(const keymap_combo_t *combo, uint16_t pos) {
+  for (uint8_t k = 0; k < combo->count; k++) {
+    if (combo->keys[k] == pos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool set_has(const uint16_t *set, uint8_t len, uint16_t pos) {
+  for (uint8_t i = 0; i < len; i++) {
+    if (set[i] == pos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Looks at the presses queued behind the head for a combo it completes.
+// Returns it, NULL if there is none or it is too early to tell (*wait)
+static const keymap_combo_t *decide_combo(keymap_t *km, uint32_t now_us,
+                                          bool *wait) {
+  const keymap_event_t *head = &km->queue[0];
+  const keymap_def_t *def = km->def;
+  uint16_t down[KEYMAP_QUEUE_LEN] = {head->pos};
+  uint8_t down_len = 1;
+
+  *wait = false;
+  for (uint8_t i = 1; i < km->queue_len; i++) {
+    const keymap_event_t *ev = &km->queue[i];
+    if (!ev->pressed) {
+      return NULL;
+    }
+    down[down_len++] = ev->pos;
+
+    bool shared = false;
+    for (uint8_t c = 0; c < def->combo_count; c++) {
+      const keymap_combo_t *combo = &def->combos[c];
+      if (!combo_has(combo, head->pos) || !combo_has(combo, ev->pos)) {
+        continue;
+      }
+      shared = true;
+      uint8_t k = 0;
+      while (k < combo->count && set_has(down, down_len, combo->keys[k])) {
+        k++;
+      }
+      if (k == combo->count) {
+        return combo;
+      }
+    }
+    if (!shared) {
+      return NULL;
+    }
+  }
+
+  if (km->queue_len == KEYMAP_QUEUE_LEN) {
+    km->stats.forced++;
+    return NULL;
+  }
+  km->deadline_us = head->timestamp_us + km->cfg->combo_term_us;
+  if ((int32_t)(now_us - km->deadline_us) >= 0) {
+    return NULL;
+  }
+  *wait = true;
+  return NULL;
+}
+
+static decision_t decide_tap_hold(keymap_t *km, uint32_t now_us) {
+  const keymap_event_t *head = &km->queue[0];
+
+  for (uint8_t i = 1; i < km->queue_len; i++) {
+    const keymap_event_t *ev = &km->queue[i];
+    if (ev->pressed) {
+      continue;
+    }
+    if (ev->pos == head->pos) {
+      return DECIDE_TAP;
+    }
+    // Another key went down and up inside the tap-hold key
+    for (uint8_t j = 1; j < i; j++) {
+      if (km->queue[j].pressed && km->queue[j].pos == ev->pos) {
+        return DECIDE_HOLD;
+      }
+    }
+  }
+
+  if (km->queue_len == KEYMAP_QUEUE_LEN) {
+    km->stats.forced++;
+    return DECIDE_HOLD;
+  }
+  km->deadline_us = head->timestamp_us + km->cfg->tapping_term_us;
+  if ((int32_t)(now_us - km->deadline_us) >= 0) {
+    return DECIDE_HOLD;
+  }
+  return DECIDE_WAIT;
+}
+
+static void queue_remove(keymap_t *km, uint8_t i) {
+  km->queue_len--;
+  memmove(&km->queue[i], &km->queue[i + 1],
+          (km->queue_len - i) * sizeof(km->queue[0]));
+}
+
+// Takes the combo's other presses out of the queue, their releases then do
+// nothing. The combo action is held as long as the head key is
+static void apply_combo(keymap_t *km, const keymap_combo_t *combo) {
+  const keymap_event_t *head = &km->queue[0];
+
+  for (uint8_t k = 0; k < combo->count; k++) {
+    if (combo->keys[k] == head->pos) {
+      continue;
+    }
+    // The first press of the key, a release queued after it stays
+    for (uint8_t i = 1; i < km->queue_len; i++) {
+      if (km->queue[i].pos == combo->keys[k] && km->queue[i].pressed) {
+        km->active[combo->keys[k]] = KEYMAP_NONE;
+        queue_remove(km, i);
+        break;
+      }
+    }
+  }
+  action_press(km, head->pos, combo->action, head->timestamp_us);
+  km->stats.combos++;
+}
+
+// Resolves queued key changes in order until one has to wait
+static void keymap_run(keymap_t *km, uint32_t now_us) {
+  while (km->queue_len > 0) {
+    keymap_event_t *head = &km->queue[0];
+    uint32_t waited = now_us - head->timestamp_us;
+
+    if (!head->pressed) {
+      action_release(km, head->pos, head->timestamp_us);
+    } else if (!head->combo_done && in_combo(km, head->pos)) {
+      bool wait;
+      const keymap_combo_t *combo = decide_combo(km, now_us, &wait);
+      if (wait) {
+        return;
+      }
+      if (combo == NULL) {
+        // Resolve it as a single key on the next pass
+        head->combo_done = 1;
+        continue;
+      }
+      apply_combo(km, combo);
+    } else {
+      uint16_t action = keymap_lookup(km, head->pos);
+      uint8_t kind = KEYMAP_KIND(action);
+      uint16_t arg = KEYMAP_ARG(action);
+
+      if (kind == KEYMAP_LT || kind == KEYMAP_MT) {
+        decision_t decision = decide_tap_hold(km, now_us);
+        if (decision == DECIDE_WAIT) {
+          return;
+        }
+        if (decision == DECIDE_TAP) {
+          action = KEYMAP_ACTION(KEYMAP_KEY, arg & 0xFF);
+          km->stats.taps++;
+        } else if (kind == KEYMAP_LT) {
+          action = KEYMAP_ACTION(KEYMAP_MO, arg >> 8);
+          km->stats.holds++;
+        } else {
+          action =
+              KEYMAP_ACTION(KEYMAP_KEY, HID_KEY_LEFT_CTRL + ((arg >> 8) & 7));
+          km->stats.holds++;
+        }
+      }
+      action_press(km, head->pos, action, head->timestamp_us);
+    }
+
+    if (waited > km->stats.max_wait_us) {
+      km->stats.max_wait_us = waited;
+    }
+    queue_remove(km, 0);
+  }
+}
+
+void keymap_event(keymap_t *km, uint16_t key, bool pressed,
+                  uint32_t timestamp_us) {
+  if (key >= km->def->keys) {
+    return;
+  }
+  // keymap_run() never leaves the queue full
+  km->queue[km->queue_len++] = (keymap_event_t){
+      .pos = key,
+      .pressed = pressed,
+      .timestamp_us = timestamp_us,
+  };
+  keymap_run(km, timestamp_us);
+}
+
+uint32_t keymap_tick(keymap_t *km, uint32_t now_us) {
+  keymap_run(km, now_us);
+  if (km->queue_len == 0) {
+    return UINT32_MAX;
+  }
+  int32_t left = (int32_t)(km->deadline_us - now_us);
+  return left > 0 ? (uint32_t)left : 0;
+}
+
+void keymap_get_stats(const keymap_t *km, keymap_stats_t *stats) {
+  *stats = km->stats;
+}
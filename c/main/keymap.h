@@ -0,0 +1,125 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keymap resolver: turns matrix key changes into HID usages through up to
+// KEYMAP_MAX_LAYERS layers, with tap-hold keys, one-shot modifiers and
+// combos. The table is generated from keymap.def (tools/gen_keymap.py).
+//
+// A key change goes straight through unless a decision is pending:
+// - A tap-hold key becomes its tap key if it is released first, its hold
+//   action if another key is pressed and released inside it or once it was
+//   held for tapping_term_us.
+// - A key that is part of a combo waits up to combo_term_us for the rest of
+//   the combo. Any release or other key gives up on it.
+// While a decision is pending later key changes queue behind it, so every
+// key change waits at most the longer of the two terms, plus one tick. A
+// full queue forces the decision early.
+//
+// The action a key was resolved to is kept until it is released, so a layer
+// change never leaves a key stuck. Like key_matrix.h it does not touch any
+// hardware and time is passed in, so it can run against timed traces.
+
+#define KEYMAP_MAX_LAYERS 8
+#define KEYMAP_MAX_KEYS 128
+#define KEYMAP_COMBO_KEYS 4
+#define KEYMAP_QUEUE_LEN 8
+
+// Actions are 16 bits: kind in the top 4, argument below
+#define KEYMAP_KIND(a) ((a) >> 12)
+#define KEYMAP_ARG(a) ((a) & 0xFFF)
+#define KEYMAP_ACTION(kind, arg) ((uint16_t)((kind) << 12 | (arg)))
+
+typedef enum {
+  KEYMAP_KEY,      // HID usage, 0 does nothing
+  KEYMAP_TRANS,    // Whatever the next active layer down has
+  KEYMAP_MO,       // Layer on while held
+  KEYMAP_TG,       // Layer toggled on press
+  KEYMAP_OSM,      // One-shot modifiers (bit n = usage 0xE0 + n)
+  KEYMAP_MACRO,    // Macro index, see macro_mgr.h
+  KEYMAP_LT,       // Layer (bits 8-11) on hold, usage (bits 0-7) on tap
+  KEYMAP_MT,       // Modifier 0xE0 + bits 8-10 on hold, usage on tap
+  KEYMAP_CONSUMER, // Consumer page usage (media, volume)
+  KEYMAP_SYSTEM,   // Generic Desktop system usage (power, sleep, wake)
+} keymap_kind_t;
+
+#define KEYMAP_NONE KEYMAP_ACTION(KEYMAP_KEY, 0)
+
+typedef struct {
+  uint8_t keys[KEYMAP_COMBO_KEYS]; // Matrix positions
+  uint8_t count;
+  uint16_t action; // Not a tap-hold
+} keymap_combo_t;
+
+typedef struct {
+  uint8_t layers;
+  uint8_t keys;            // Matrix positions per layer
+  const uint16_t *actions; // layers * keys, layer 0 first
+  const keymap_combo_t *combos;
+  uint8_t combo_count;
+} keymap_def_t;
+
+typedef struct {
+  uint32_t tapping_term_us;
+  uint32_t combo_term_us;
+} keymap_cfg_t;
+
+typedef struct {
+  // A usage changed state. timestamp_us is when the key that caused it
+  // changed, not when it was resolved
+  void (*key)(uint8_t usage, bool pressed, uint32_t timestamp_us, void *arg);
+  // Same for a consumer or system usage, page is its HID usage page
+  void (*control)(uint8_t page, uint16_t usage, bool pressed,
+                  uint32_t timestamp_us, void *arg);
+  void (*macro)(uint8_t index, void *arg);
+  void *arg;
+} keymap_ops_t;
+
+typedef struct {
+  uint32_t taps;
+  uint32_t holds;
+  uint32_t combos;
+  uint32_t forced; // Decisions forced by a full queue
+  uint32_t max_wait_us; // Longest a key change waited to be resolved
+} keymap_stats_t;
+
+typedef struct {
+  uint16_t pos;
+  uint8_t pressed;
+  uint8_t combo_done; // Combos were already ruled out for this press
+  uint32_t timestamp_us;
+} keymap_event_t;
+
+typedef struct {
+  const keymap_def_t *def;
+  const keymap_cfg_t *cfg;
+  const keymap_ops_t *ops;
+  uint8_t layers;     // Bit n set = layer n on, layer 0 always is
+  uint8_t osm_held;   // One-shot modifiers whose key is down
+  uint8_t osm_armed;  // Released one-shot modifiers, up after the next key
+  uint8_t osm_used;   // A key was pressed while osm_held
+  uint32_t combo_keys[KEYMAP_MAX_KEYS / 32]; // Positions in any combo
+  uint16_t active[KEYMAP_MAX_KEYS]; // What each down key was resolved to
+  uint8_t usage_count[256];         // Keys holding each usage down
+  keymap_event_t queue[KEYMAP_QUEUE_LEN];
+  uint8_t queue_len;
+  uint32_t deadline_us; // Of the pending decision, if queue_len > 0
+  keymap_stats_t stats;
+} keymap_t;
+
+void keymap_init(keymap_t *km, const keymap_def_t *def,
+                 const keymap_cfg_t *cfg, const keymap_ops_t *ops);
+
+// A key changed state, key is row * cols + col as key_matrix.h reports it
+void keymap_event(keymap_t *km, uint16_t key, bool pressed,
+                  uint32_t timestamp_us);
+
+// Runs decisions whose time is up. Returns us until the next one, or
+// UINT32_MAX if none is pending
+uint32_t keymap_tick(keymap_t *km, uint32_t now_us);
+
+void keymap_get_stats(const keymap_t *km, keymap_stats_t *stats);
+
+#endif
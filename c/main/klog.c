@@ -0,0 +1,141 @@
+#include "klog.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define KLOG_RING_MASK (KLOG_RING_SIZE - 1)
+#define KLOG_LINE_MAX 160
+
+_Static_assert((KLOG_RING_SIZE & KLOG_RING_MASK) == 0,
+               "KLOG_RING_SIZE must be a power of two");
+
+typedef struct {
+  const klog_fmt_t *fmt;
+  uint32_t timestamp_us;
+  uint32_t nargs;
+  uint32_t args[KLOG_MAX_ARGS];
+} klog_rec_t;
+
+// Lock free, many writers and the formatting task as the one reader. A
+// writer reserves a slot by moving klog_head on, fills it in and then marks
+// it ready in klog_seq. The reader stops at the first slot not ready yet.
+// head and tail are free running.
+//
+// klog_seq[i] holds the first position of the lap the slot is free for, or
+// that plus one once the record of that lap is ready. It starts at 0, free
+// for the first lap
+static klog_rec_t klog_ring[KLOG_RING_SIZE];
+static _Atomic uint32_t klog_seq[KLOG_RING_SIZE];
+static _Atomic uint32_t klog_head;
+static _Atomic uint32_t klog_tail;
+static _Atomic uint32_t klog_written;
+static _Atomic uint32_t klog_dropped;
+static TaskHandle_t klog_task;
+
+static const esp_log_level_t klog_esp_levels[] = {
+    [KLOG_ERROR] = ESP_LOG_ERROR,
+    [KLOG_WARN] = ESP_LOG_WARN,
+    [KLOG_INFO] = ESP_LOG_INFO,
+    [KLOG_DEBUG] = ESP_LOG_DEBUG,
+};
+static const char klog_letters[] = {
+    [KLOG_ERROR] = 'E',
+    [KLOG_WARN] = 'W',
+    [KLOG_INFO] = 'I',
+    [KLOG_DEBUG] = 'D',
+};
+
+void klog_write(const klog_fmt_t *fmt, uint32_t nargs, ...) {
+  klog_rec_t rec = {
+      .fmt = fmt,
+      .timestamp_us = (uint32_t)esp_timer_get_time(),
+      .nargs = nargs,
+  };
+  va_list ap;
+
+  va_start(ap, nargs);
+  for (uint32_t i = 0; i < nargs && i < KLOG_MAX_ARGS; i++) {
+    rec.args[i] = va_arg(ap, uint32_t);
+  }
+  va_end(ap);
+
+  // Claims the next position unless its slot still holds a record from the
+  // lap before, which means the ring is full
+  uint32_t pos = atomic_load(&klog_head);
+  for (;;) {
+    uint32_t seq = atomic_load(&klog_seq[pos & KLOG_RING_MASK]);
+    int32_t diff = (int32_t)(seq - (pos & ~KLOG_RING_MASK));
+    if (diff < 0) {
+      atomic_fetch_add(&klog_dropped, 1);
+      return;
+    }
+    if (diff == 0 &&
+        atomic_compare_exchange_weak(&klog_head, &pos, pos + 1)) {
+      break;
+    }
+    if (diff > 0) {
+      // Another writer took it first
+      pos = atomic_load(&klog_head);
+    }
+  }
+  klog_ring[pos & KLOG_RING_MASK] = rec;
+  atomic_store(&klog_seq[pos & KLOG_RING_MASK], (pos & ~KLOG_RING_MASK) + 1);
+  atomic_fetch_add(&klog_written, 1);
+
+  // Only the record the task stopped at needs to wake it
+  if (atomic_load(&klog_tail) == pos && klog_task != NULL) {
+    xTaskNotifyGive(klog_task);
+  }
+}
+
+static void klog_print(const klog_rec_t *rec) {
+  char line[KLOG_LINE_MAX];
+  const uint32_t *a = rec->args;
+
+  // Unused arguments are zero and ignored by the format
+  snprintf(line, sizeof(line), rec->fmt->fmt, a[0], a[1], a[2], a[3]);
+  esp_log_write(klog_esp_levels[rec->fmt->level], TAG, "%c (%lu) %s: %s\n",
+                klog_letters[rec->fmt->level],
+                (unsigned long)(rec->timestamp_us / 1000), rec->fmt->subsys,
+                line);
+}
+
+static void klog_task_fn(void *param) {
+  for (;;) {
+    // Starts with whatever was logged before the task existed
+    for (;;) {
+      uint32_t tail = atomic_load(&klog_tail);
+      uint32_t slot = tail & KLOG_RING_MASK;
+
+      if (atomic_load(&klog_seq[slot]) != (tail & ~KLOG_RING_MASK) + 1) {
+        break;
+      }
+      klog_rec_t rec = klog_ring[slot];
+      // Free for the next lap
+      atomic_store(&klog_seq[slot], (tail & ~KLOG_RING_MASK) + KLOG_RING_SIZE);
+      atomic_store(&klog_tail, tail + 1);
+      klog_print(&rec);
+    }
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+int klog_init(void) {
+  // Lowest priority, away from the core the NimBLE host runs on
+  if (xTaskCreatePinnedToCore(klog_task_fn, "klog", KLOG_TASK_STACK, NULL,
+                              KLOG_TASK_PRIO, &klog_task,
+                              CORE_INPUT) != pdPASS) {
+    return ESP_ERR_NO_MEM;
+  }
+  return 0;
+}
+
+void klog_get_stats(struct klog_stats *stats) {
+  stats->written = atomic_load(&klog_written);
+  stats->dropped = atomic_load(&klog_dropped);
+}
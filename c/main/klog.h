@@ -0,0 +1,82 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include "config.h"
+#include <stdint.h>
+
+// Deferred binary logging for code on the report path. A log call stores a
+// pointer to its (static) format record, a timestamp and up to
+// KLOG_MAX_ARGS raw 32-bit arguments in a RAM ring. A low priority task on
+// the other core formats and prints them later, so the caller never waits on
+// the UART.
+//
+// Every subsystem has a compile-time level (KLOG_LEVEL_<SUBSYS> in
+// config.h), calls above it compile to nothing. Arguments are converted to
+// uint32_t, so only integer conversions work: no %s, no floats. Anything
+// wider than 32 bits fails to compile.
+//
+//   KLOG_I(GATT, "access op=%d attr=%d", ctxt->op, attr_handle);
+
+#define KLOG_NONE 0
+#define KLOG_ERROR 1
+#define KLOG_WARN 2
+#define KLOG_INFO 3
+#define KLOG_DEBUG 4
+
+#define KLOG_MAX_ARGS 4
+// Records buffered before new ones are dropped, must be a power of two
+#define KLOG_RING_SIZE 128
+
+typedef struct {
+  const char *fmt;
+  const char *subsys;
+  uint8_t level;
+} klog_fmt_t;
+
+struct klog_stats {
+  uint32_t written;
+  uint32_t dropped; // Ring was full
+};
+
+// Starts the formatting task
+int klog_init(void);
+
+// Use the KLOG_* macros instead
+void klog_write(const klog_fmt_t *fmt, uint32_t nargs, ...);
+
+void klog_get_stats(struct klog_stats *stats);
+
+// Number of arguments, 0 to KLOG_MAX_ARGS
+#define KLOG_NARGS(...) KLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+
+// Each argument as a uint32_t, rejecting the wider ones. The + 0 promotes
+// bit-fields, which sizeof does not take
+#define KLOG_ARG(x)                                                            \
+  ((void)sizeof(char[sizeof((x) + 0) <= sizeof(uint32_t) ? 1 : -1]),        \
+   (uint32_t)(x))
+#define KLOG_ARGS(n, ...) KLOG_ARGS_(n, ##__VA_ARGS__)
+#define KLOG_ARGS_(n, ...) KLOG_ARGS_##n(__VA_ARGS__)
+#define KLOG_ARGS_0()
+#define KLOG_ARGS_1(a) , KLOG_ARG(a)
+#define KLOG_ARGS_2(a, b) , KLOG_ARG(a), KLOG_ARG(b)
+#define KLOG_ARGS_3(a, b, c) , KLOG_ARG(a), KLOG_ARG(b), KLOG_ARG(c)
+#define KLOG_ARGS_4(a, b, c, d)                                                \
+  , KLOG_ARG(a), KLOG_ARG(b), KLOG_ARG(c), KLOG_ARG(d)
+
+#define KLOG(sub, lvl, format, ...)                                            \
+  do {                                                                         \
+    if ((lvl) <= KLOG_LEVEL_##sub) {                                           \
+      static const klog_fmt_t klog_fmt_ = {                                    \
+          .fmt = (format), .subsys = #sub, .level = (lvl)};                    \
+      klog_write(&klog_fmt_, KLOG_NARGS(__VA_ARGS__)                          \
+                 KLOG_ARGS(KLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__));           \
+    }                                                                          \
+  } while (0)
+
+#define KLOG_E(sub, format, ...) KLOG(sub, KLOG_ERROR, format, ##__VA_ARGS__)
+#define KLOG_W(sub, format, ...) KLOG(sub, KLOG_WARN, format, ##__VA_ARGS__)
+#define KLOG_I(sub, format, ...) KLOG(sub, KLOG_INFO, format, ##__VA_ARGS__)
+#define KLOG_D(sub, format, ...) KLOG(sub, KLOG_DEBUG, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,252 @@
+#include "macro.h"
+#include <string.h>
+
+#define HID_KEY_LEFT_SHIFT 0xE1
+
+// Set in ascii_usages for characters typed with shift held
+#define SHIFT 0x80
+
+// US layout. Letters and digits are filled in by ascii_usage(), 0 means the
+// character can not be typed
+static const uint8_t ascii_usages[128] = {
+    ['\t'] = 0x2B,         ['\n'] = 0x28,         [' '] = 0x2C,
+    ['!'] = SHIFT | 0x1E,  ['"'] = SHIFT | 0x34,  ['#'] = SHIFT | 0x20,
+    ['$'] = SHIFT | 0x21,  ['%'] = SHIFT | 0x22,  ['&'] = SHIFT | 0x24,
+    ['\''] = 0x34,         ['('] = SHIFT | 0x26,  [')'] = SHIFT | 0x27,
+    ['*'] = SHIFT | 0x25,  ['+'] = SHIFT | 0x2E,  [','] = 0x36,
+    ['-'] = 0x2D,          ['.'] = 0x37,          ['/'] = 0x38,
+    [':'] = SHIFT | 0x33,  [';'] = 0x33,          ['<'] = SHIFT | 0x36,
+    ['='] = 0x2E,          ['>'] = SHIFT | 0x37,  ['?'] = SHIFT | 0x38,
+    ['@'] = SHIFT | 0x1F,  ['['] = 0x2F,          ['\\'] = 0x31,
+    [']'] = 0x30,          ['^'] = SHIFT | 0x23,  ['_'] = SHIFT | 0x2D,
+    ['`'] = 0x35,          ['{'] = SHIFT | 0x2F,  ['|'] = SHIFT | 0x31,
+    ['}'] = SHIFT | 0x30,  ['~'] = SHIFT | 0x35,
+};
+
+static uint8_t ascii_usage(uint8_t c) {
+  if (c >= 'a' && c <= 'z') {
+    return 0x04 + (c - 'a');
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return SHIFT | (0x04 + (c - 'A'));
+  }
+  if (c >= '1' && c <= '9') {
+    return 0x1E + (c - '1');
+  }
+  if (c == '0') {
+    return 0x27;
+  }
+  return c < sizeof(ascii_usages) ? ascii_usages[c] : 0;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// CRC-32 as zlib computes it. Only run when a store is checked, so no table
+static uint32_t crc32(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+// Size of the op at pc, 0 if it is unknown or does not fit before end
+static size_t op_size(const uint8_t *pc, const uint8_t *end) {
+  size_t left = end - pc;
+  size_t size;
+
+  switch (pc[0]) {
+  case MACRO_OP_END:
+    size = 1;
+    break;
+  case MACRO_OP_PRESS:
+  case MACRO_OP_RELEASE:
+  case MACRO_OP_TAP:
+    size = 2;
+    break;
+  case MACRO_OP_DELAY:
+    size = 3;
+    break;
+  case MACRO_OP_TEXT:
+    size = left >= 2 ? 2 + pc[1] : 2;
+    break;
+  default:
+    return 0;
+  }
+  return size <= left ? size : 0;
+}
+
+static bool ops_check(const uint8_t *pc, const uint8_t *end) {
+  while (pc < end) {
+    size_t size = op_size(pc, end);
+    if (size == 0) {
+      return false;
+    }
+    if (pc[0] == MACRO_OP_END) {
+      return true;
+    }
+    if (pc[0] == MACRO_OP_TEXT) {
+      for (size_t i = 2; i < size; i++) {
+        if (ascii_usage(pc[i]) == 0) {
+          return false;
+        }
+      }
+    }
+    pc += size;
+  }
+  return false;
+}
+
+macro_err_t macro_store_check(const uint8_t *store, size_t size,
+                              uint8_t *count) {
+  *count = 0;
+  if (size < MACRO_STORE_HDR_LEN || get_u32(store) != MACRO_STORE_MAGIC ||
+      store[4] != MACRO_STORE_VERSION) {
+    return MACRO_ERR_HEADER;
+  }
+
+  uint8_t n = store[5];
+  uint32_t len = get_u32(store + 8);
+  uint32_t ops_start = MACRO_STORE_HDR_LEN + 4 * n;
+  if (len > size || len < ops_start) {
+    return MACRO_ERR_HEADER;
+  }
+  // The first macro starts right after the offsets. The count is outside
+  // the CRC, this catches one that lost macros
+  uint32_t first = n > 0 ? get_u32(store + MACRO_STORE_HDR_LEN) : len;
+  if (first != ops_start) {
+    return MACRO_ERR_HEADER;
+  }
+  if (crc32(store + MACRO_STORE_HDR_LEN, len - MACRO_STORE_HDR_LEN) !=
+      get_u32(store + 12)) {
+    return MACRO_ERR_CRC;
+  }
+
+  for (uint8_t i = 0; i < n; i++) {
+    uint32_t off = get_u32(store + MACRO_STORE_HDR_LEN + 4 * i);
+    if (off < ops_start || off >= len ||
+        !ops_check(store + off, store + len)) {
+      return MACRO_ERR_OPS;
+    }
+  }
+  *count = n;
+  return MACRO_OK;
+}
+
+macro_err_t macro_player_start(macro_player_t *p, const uint8_t *store,
+                               uint8_t index) {
+  if (index >= store[5]) {
+    return MACRO_ERR_INDEX;
+  }
+  memset(p, 0, sizeof(*p));
+  p->pc = store + get_u32(store + MACRO_STORE_HDR_LEN + 4 * index);
+  p->end = store + get_u32(store + 8);
+  return MACRO_OK;
+}
+
+static void seq_add(macro_player_t *p, uint8_t usage, bool pressed) {
+  p->seq_usage[p->seq_len] = usage;
+  if (pressed) {
+    p->seq_pressed |= 1u << p->seq_len;
+  }
+  p->seq_len++;
+}
+
+// Press and release of one key, wrapped in left shift if asked for
+static void seq_tap(macro_player_t *p, uint8_t usage, bool shift) {
+  p->seq_len = 0;
+  p->seq_pos = 0;
+  p->seq_pressed = 0;
+  if (shift) {
+    seq_add(p, HID_KEY_LEFT_SHIFT, true);
+  }
+  seq_add(p, usage, true);
+  seq_add(p, usage, false);
+  if (shift) {
+    seq_add(p, HID_KEY_LEFT_SHIFT, false);
+  }
+}
+
+static bool key_step(macro_player_t *p, macro_step_t *step, uint8_t usage,
+                     bool pressed) {
+  uint32_t bit = 1u << (usage % 32);
+
+  if (pressed) {
+    p->held[usage / 32] |= bit;
+  } else {
+    p->held[usage / 32] &= ~bit;
+  }
+  *step = (macro_step_t){
+      .type = MACRO_STEP_KEY,
+      .usage = usage,
+      .pressed = pressed,
+  };
+  return true;
+}
+
+bool macro_player_next(macro_player_t *p, macro_step_t *step) {
+  for (;;) {
+    if (p->seq_pos < p->seq_len) {
+      uint8_t i = p->seq_pos++;
+      return key_step(p, step, p->seq_usage[i], (p->seq_pressed >> i) & 1);
+    }
+    if (p->text_left > 0) {
+      uint8_t usage = ascii_usage(*p->text++);
+      p->text_left--;
+      seq_tap(p, usage & ~SHIFT, usage & SHIFT);
+      continue;
+    }
+    if (p->pc == NULL || p->pc >= p->end) {
+      break;
+    }
+
+    const uint8_t *op = p->pc;
+    switch (op[0]) {
+    case MACRO_OP_PRESS:
+      p->pc += 2;
+      return key_step(p, step, op[1], true);
+    case MACRO_OP_RELEASE:
+      p->pc += 2;
+      return key_step(p, step, op[1], false);
+    case MACRO_OP_TAP:
+      p->pc += 2;
+      seq_tap(p, op[1], false);
+      break;
+    case MACRO_OP_DELAY:
+      p->pc += 3;
+      *step = (macro_step_t){
+          .type = MACRO_STEP_DELAY,
+          .delay_ms = op[1] | op[2] << 8,
+      };
+      return true;
+    case MACRO_OP_TEXT:
+      p->pc += 2 + op[1];
+      p->text = op + 2;
+      p->text_left = op[1];
+      break;
+    default:
+      p->pc = NULL;
+      break;
+    }
+  }
+
+  // Nothing left to play, release whatever the macro left down
+  for (int w = 0; w < 8; w++) {
+    if (p->held[w] != 0) {
+      return key_step(p, step, w * 32 + __builtin_ctz(p->held[w]), false);
+    }
+  }
+  return false;
+}
+
+void macro_player_stop(macro_player_t *p) {
+  p->pc = NULL;
+  p->seq_len = 0;
+  p->seq_pos = 0;
+  p->text_left = 0;
+}
@@ -0,0 +1,88 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Macro store format and player. A store is one blob, compiled on the host
+// (tools/macro_compile.py) and read in place from flash, so a macro is never
+// copied to RAM. All fields are little endian:
+//
+//   u32 magic (MACRO_STORE_MAGIC), u8 version, u8 macro count, u16 reserved
+//   u32 store length in bytes, header included
+//   u32 CRC-32 (zlib) of everything after the header
+//   u32 offset of each macro from the start of the store, the first one
+//   right after these
+//   the macros, each a run of ops ended by MACRO_OP_END
+//
+// It does not touch flash or the HID service, the player only turns a macro
+// into key changes and delays, so it can run against a plain buffer.
+
+#define MACRO_STORE_MAGIC 0x43414D4B // "KMAC"
+#define MACRO_STORE_VERSION 1
+#define MACRO_STORE_HDR_LEN 16
+
+// Ops, one byte followed by its operands
+#define MACRO_OP_END 0x00
+#define MACRO_OP_PRESS 0x01   // u8 usage
+#define MACRO_OP_RELEASE 0x02 // u8 usage
+#define MACRO_OP_TAP 0x03     // u8 usage, press then release
+#define MACRO_OP_DELAY 0x04   // u16 ms
+#define MACRO_OP_TEXT 0x05    // u8 length, then that many ASCII characters
+
+// Why a store or an upload was refused
+typedef enum {
+  MACRO_OK,
+  MACRO_ERR_HEADER, // Bad magic, version or length
+  MACRO_ERR_CRC,
+  MACRO_ERR_OPS,   // An op is unknown or runs past the store
+  MACRO_ERR_STATE, // Not allowed right now (upload or playback running)
+  MACRO_ERR_RANGE, // Write outside the announced upload
+  MACRO_ERR_FLASH,
+  MACRO_ERR_INDEX, // No such macro
+} macro_err_t;
+
+typedef enum {
+  MACRO_STEP_KEY,
+  MACRO_STEP_DELAY,
+} macro_step_type_t;
+
+typedef struct {
+  uint8_t type; // macro_step_type_t
+  uint8_t usage;
+  uint8_t pressed;
+  uint16_t delay_ms;
+} macro_step_t;
+
+typedef struct {
+  const uint8_t *pc;  // Next op, NULL once the ops are done
+  const uint8_t *end; // End of the store
+  // Key changes of the op or character being played
+  uint8_t seq_usage[4];
+  uint8_t seq_pressed; // Bit n set = seq_usage[n] goes down
+  uint8_t seq_len;
+  uint8_t seq_pos;
+  const uint8_t *text; // Rest of a MACRO_OP_TEXT
+  uint8_t text_left;
+  uint32_t held[8]; // Usages the macro has down, released when it ends
+} macro_player_t;
+
+// Checks a whole store: header, CRC and every op of every macro. The player
+// trusts a store that passed. *count is set to its number of macros
+macro_err_t macro_store_check(const uint8_t *store, size_t size,
+                              uint8_t *count);
+
+// Starts macro index of a checked store
+macro_err_t macro_player_start(macro_player_t *p, const uint8_t *store,
+                               uint8_t index);
+
+// Next key change or delay. Keys the macro left down are released at the
+// end. Returns false once there is nothing left
+bool macro_player_next(macro_player_t *p, macro_step_t *step);
+
+// Skips the rest of the macro. macro_player_next() then only releases what
+// is still down
+void macro_player_stop(macro_player_t *p);
+
+#endif
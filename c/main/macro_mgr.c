@@ -0,0 +1,457 @@
+#include "macro_mgr.h"
+#include "config.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "hid_layout.h"
+#include "hogp_conn.h"
+#include "hogp_gatt_svr.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include <stdatomic.h>
+#include <string.h>
+
+// Pace used while no connection interval is known
+#define MACRO_TICK_MS 8
+#define MACRO_NONE 0xFF
+#define MACRO_STATUS_LEN 24
+
+_Static_assert(HID_COMPLEX_R5_FEAT_LEN == 5, "control report layout changed");
+_Static_assert(HID_COMPLEX_R6_FEAT_LEN > MACRO_DATA_HDR_LEN,
+               "data report has no room for data");
+_Static_assert(HID_COMPLEX_R8_FEAT_LEN >= MACRO_STATUS_LEN,
+               "status does not fit the status report");
+
+static int macro_feature_get(uint8_t id, uint8_t *data, uint16_t len);
+static int macro_feature_set(uint8_t id, const uint8_t *data, uint16_t len);
+
+static const hogp_feature_ops_t macro_feature_ops = {
+    .get = macro_feature_get,
+    .set = macro_feature_set,
+};
+
+static const esp_partition_t *macro_part;
+
+// Everything below is only touched by the NimBLE host task
+
+// The mapped store, NULL while there is no valid one
+static const uint8_t *macro_store;
+static esp_partition_mmap_handle_t macro_map;
+static bool macro_mapped;
+static uint8_t macro_count;
+static macro_err_t macro_result;
+
+static bool macro_uploading;
+// The upload is the bulk channel's, written from its task
+static bool upload_bulk;
+static uint32_t upload_len;
+static uint32_t upload_written;
+static uint32_t upload_erased;
+
+static macro_player_t macro_player;
+// Step taken from the player that did not fit the tx queue yet
+static macro_step_t macro_step;
+static bool macro_step_pending;
+static uint8_t macro_playing = MACRO_NONE;
+static uint32_t macros_played;
+static uint32_t macro_keys_sent;
+
+static struct ble_npl_callout macro_callout;
+static struct ble_npl_event macro_play_ev;
+// Index + 1 of the macro macro_mgr_play() asked for, 0 for none
+static _Atomic uint16_t macro_req;
+
+// Length of the mapped store, for macro_mgr_read() on other tasks
+static _Atomic uint32_t macro_store_len;
+
+// A macro_mgr_upload_*() call waiting for the host task. Only one task
+// uploads at a time
+static struct ble_npl_event macro_call_ev;
+static SemaphoreHandle_t macro_call_done;
+static StaticSemaphore_t macro_call_sem;
+static uint8_t macro_call_cmd;
+static uint32_t macro_call_arg;
+static macro_err_t macro_call_result;
+
+static uint32_t get_u32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void macro_unmap(void) {
+  if (macro_mapped) {
+    esp_partition_munmap(macro_map);
+    macro_mapped = false;
+  }
+  macro_store = NULL;
+  macro_count = 0;
+  atomic_store(&macro_store_len, 0);
+}
+
+// Maps the partition and checks the store in it
+static macro_err_t macro_map_store(void) {
+  const void *ptr;
+  uint8_t count;
+
+  macro_unmap();
+  esp_err_t rc = esp_partition_mmap(macro_part, 0, macro_part->size,
+                                    ESP_PARTITION_MMAP_DATA, &ptr, &macro_map);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to map macro partition, error code: %d", rc);
+    return MACRO_ERR_FLASH;
+  }
+  macro_mapped = true;
+
+  macro_err_t err = macro_store_check(ptr, macro_part->size, &count);
+  if (err != MACRO_OK) {
+    macro_unmap();
+    return err;
+  }
+  macro_store = ptr;
+  macro_count = count;
+  atomic_store(&macro_store_len, get_u32(macro_store + 8));
+  return MACRO_OK;
+}
+
+// Longest connection interval of the connected hosts, in ms
+static uint32_t macro_itvl_ms(void) {
+  uint32_t itvl = hogp_gatt_svr_max_itvl_ms();
+  return itvl == 0 ? MACRO_TICK_MS : itvl;
+}
+
+// Plays one connection event worth of key changes
+static void macro_tick(void) {
+  uint32_t wait_ms = 0;
+
+  for (uint8_t sent = 0; sent < HOGP_TX_BURST_MAX;) {
+    if (!macro_step_pending) {
+      if (!macro_player_next(&macro_player, &macro_step)) {
+        macro_playing = MACRO_NONE;
+        return;
+      }
+      macro_step_pending = true;
+    }
+    if (macro_step.type == MACRO_STEP_DELAY) {
+      macro_step_pending = false;
+      wait_ms = macro_step.delay_ms;
+      break;
+    }
+    if (hogp_gatt_svr_play_key(macro_step.usage, macro_step.pressed) != 0) {
+      // The tx queue is full, try the same step again next time
+      break;
+    }
+    macro_step_pending = false;
+    macro_keys_sent++;
+    sent++;
+  }
+
+  uint32_t itvl = macro_itvl_ms();
+  ble_npl_callout_reset(
+      &macro_callout,
+      ble_npl_time_ms_to_ticks32(wait_ms > itvl ? wait_ms : itvl));
+}
+
+static void macro_callout_cb(struct ble_npl_event *ev) { macro_tick(); }
+
+static macro_err_t macro_start(uint8_t index) {
+  size_t i = 0;
+
+  if (macro_uploading || macro_playing != MACRO_NONE ||
+      hogp_conn_next(&i) == NULL) {
+    return MACRO_ERR_STATE;
+  }
+  if (macro_store == NULL) {
+    return MACRO_ERR_INDEX;
+  }
+  macro_err_t err = macro_player_start(&macro_player, macro_store, index);
+  if (err != MACRO_OK) {
+    return err;
+  }
+
+  macro_playing = index;
+  macro_step_pending = false;
+  macros_played++;
+  macro_tick();
+  return MACRO_OK;
+}
+
+// Keys the macro holds are still released, over the next ticks
+static void macro_stop(void) {
+  if (macro_playing == MACRO_NONE) {
+    return;
+  }
+  macro_player_stop(&macro_player);
+  if (macro_step_pending && macro_step.type == MACRO_STEP_KEY &&
+      macro_step.pressed) {
+    // Never sent, it is released below with the rest
+    macro_step_pending = false;
+  }
+}
+
+static void macro_play_cb(struct ble_npl_event *ev) {
+  uint16_t req = atomic_exchange(&macro_req, 0);
+  if (req != 0) {
+    macro_result = macro_start(req - 1);
+  }
+}
+
+static macro_err_t macro_begin(uint32_t len) {
+  if (len < MACRO_STORE_HDR_LEN || len > macro_part->size) {
+    return MACRO_ERR_RANGE;
+  }
+  // Releasing keys does not read the store, so it can go right away
+  macro_stop();
+  macro_unmap();
+  macro_uploading = true;
+  upload_bulk = false;
+  upload_len = len;
+  upload_written = 0;
+  upload_erased = 0;
+  return MACRO_OK;
+}
+
+static macro_err_t macro_write_at(uint32_t offset, const uint8_t *data,
+                                  uint16_t n) {
+  esp_err_t rc;
+
+  if (offset != upload_written || n > upload_len - offset) {
+    return MACRO_ERR_RANGE;
+  }
+
+  // Sectors are erased as the upload reaches them, so no single write holds
+  // up the host task for a whole partition erase
+  while (upload_erased < offset + n) {
+    rc = esp_partition_erase_range(macro_part, upload_erased,
+                                   macro_part->erase_size);
+    if (rc != ESP_OK) {
+      ESP_LOGE(TAG, "failed to erase macro partition, error code: %d", rc);
+      return MACRO_ERR_FLASH;
+    }
+    upload_erased += macro_part->erase_size;
+  }
+
+  rc = esp_partition_write(macro_part, offset, data, n);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to write macro partition, error code: %d", rc);
+    return MACRO_ERR_FLASH;
+  }
+  upload_written += n;
+  return MACRO_OK;
+}
+
+static macro_err_t macro_write(const uint8_t *data, uint16_t len) {
+  uint16_t n = data[4] | data[5] << 8;
+
+  if (!macro_uploading || upload_bulk) {
+    return MACRO_ERR_STATE;
+  }
+  if (n > len - MACRO_DATA_HDR_LEN) {
+    return MACRO_ERR_RANGE;
+  }
+  return macro_write_at(get_u32(data), data + MACRO_DATA_HDR_LEN, n);
+}
+
+static macro_err_t macro_commit(void) {
+  if (!macro_uploading) {
+    return MACRO_ERR_STATE;
+  }
+  if (upload_written != upload_len) {
+    return MACRO_ERR_RANGE;
+  }
+  macro_uploading = false;
+  upload_bulk = false;
+
+  macro_err_t err = macro_map_store();
+  ESP_LOGI(TAG, "macro upload of %lu bytes, %d macros, result %d",
+           (unsigned long)upload_len, macro_count, err);
+  return err;
+}
+
+// Sectors the upload did not reach yet still hold the old store, it comes
+// back if the upload never erased any
+static macro_err_t macro_abort(void) {
+  if (!macro_uploading) {
+    return MACRO_ERR_STATE;
+  }
+  macro_uploading = false;
+  upload_bulk = false;
+  macro_map_store();
+  return MACRO_OK;
+}
+
+static macro_err_t macro_command(uint8_t cmd, uint32_t arg) {
+  // The bulk channel's upload can only be ended by the bulk channel
+  if (upload_bulk && (cmd == MACRO_CMD_BEGIN || cmd == MACRO_CMD_COMMIT ||
+                      cmd == MACRO_CMD_ABORT)) {
+    return MACRO_ERR_STATE;
+  }
+
+  switch (cmd) {
+  case MACRO_CMD_BEGIN:
+    return macro_begin(arg);
+  case MACRO_CMD_COMMIT:
+    return macro_commit();
+  case MACRO_CMD_PLAY:
+    return arg <= UINT8_MAX ? macro_start(arg) : MACRO_ERR_INDEX;
+  case MACRO_CMD_STOP:
+    macro_stop();
+    return MACRO_OK;
+  case MACRO_CMD_ABORT:
+    return macro_abort();
+  default:
+    return MACRO_ERR_STATE;
+  }
+}
+
+static int macro_feature_get(uint8_t id, uint8_t *data, uint16_t len) {
+  if (id != MACRO_STATUS_REPORT_ID) {
+    return 0;
+  }
+
+  macro_state_t state = MACRO_STATE_IDLE;
+  if (macro_uploading) {
+    state = MACRO_STATE_UPLOADING;
+  } else if (macro_playing != MACRO_NONE) {
+    state = MACRO_STATE_PLAYING;
+  }
+  data[0] = state;
+  data[1] = macro_result;
+  data[2] = macro_count;
+  data[3] = macro_playing;
+  put_u32(data + 4, macro_store != NULL ? get_u32(macro_store + 8) : 0);
+  put_u32(data + 8, upload_written);
+  put_u32(data + 12, macro_part->size);
+  put_u32(data + 16, macros_played);
+  put_u32(data + 20, macro_keys_sent);
+  return 0;
+}
+
+static int macro_feature_set(uint8_t id, const uint8_t *data, uint16_t len) {
+  macro_err_t err;
+
+  switch (id) {
+  case MACRO_CTRL_REPORT_ID:
+    err = macro_command(data[0], get_u32(data + 1));
+    break;
+  case MACRO_DATA_REPORT_ID:
+    err = macro_write(data, len);
+    break;
+  default:
+    return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+  }
+
+  macro_result = err;
+  return err == MACRO_OK ? 0 : MACRO_ATT_ERR(err);
+}
+
+static void macro_call_cb(struct ble_npl_event *ev) {
+  switch (macro_call_cmd) {
+  case MACRO_CMD_BEGIN:
+    if (upload_bulk) {
+      macro_call_result = MACRO_ERR_STATE;
+      break;
+    }
+    macro_call_result = macro_begin(macro_call_arg);
+    upload_bulk = macro_call_result == MACRO_OK;
+    break;
+  case MACRO_CMD_COMMIT:
+    macro_call_result = upload_bulk ? macro_commit() : MACRO_ERR_STATE;
+    break;
+  case MACRO_CMD_ABORT:
+    macro_call_result = upload_bulk ? macro_abort() : MACRO_ERR_STATE;
+    break;
+  default:
+    macro_call_result = MACRO_ERR_STATE;
+    break;
+  }
+  macro_result = macro_call_result;
+  xSemaphoreGive(macro_call_done);
+}
+
+// Runs cmd on the host task and waits for its result
+static macro_err_t macro_call(uint8_t cmd, uint32_t arg) {
+  if (macro_part == NULL) {
+    return MACRO_ERR_FLASH;
+  }
+  macro_call_cmd = cmd;
+  macro_call_arg = arg;
+  ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &macro_call_ev);
+  xSemaphoreTake(macro_call_done, portMAX_DELAY);
+  return macro_call_result;
+}
+
+int macro_mgr_init(void) {
+  macro_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY,
+                                        MACRO_PARTITION);
+  if (macro_part == NULL) {
+    ESP_LOGE(TAG, "failed to find partition %s", MACRO_PARTITION);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  macro_call_done = xSemaphoreCreateBinaryStatic(&macro_call_sem);
+  ble_npl_event_init(&macro_call_ev, macro_call_cb, NULL);
+  ble_npl_event_init(&macro_play_ev, macro_play_cb, NULL);
+  ble_npl_callout_init(&macro_callout, nimble_port_get_dflt_eventq(),
+                       macro_callout_cb, NULL);
+
+  macro_err_t err = macro_map_store();
+  if (err == MACRO_OK) {
+    ESP_LOGI(TAG, "%d macros loaded", macro_count);
+  } else {
+    ESP_LOGW(TAG, "no macros loaded, store error %d", err);
+  }
+
+  hogp_gatt_svr_set_feature_ops(&macro_feature_ops);
+  return 0;
+}
+
+void macro_mgr_play(uint8_t index) {
+  if (macro_part == NULL) {
+    return;
+  }
+  atomic_store(&macro_req, index + 1);
+  ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &macro_play_ev);
+}
+
+macro_err_t macro_mgr_upload_begin(uint32_t len) {
+  return macro_call(MACRO_CMD_BEGIN, len);
+}
+
+// upload_written and upload_erased are this task's until commit or abort,
+// the host task only reads them for the status report
+macro_err_t macro_mgr_upload_write(uint32_t offset, const uint8_t *data,
+                                   uint16_t len) {
+  if (!upload_bulk) {
+    return MACRO_ERR_STATE;
+  }
+  return macro_write_at(offset, data, len);
+}
+
+macro_err_t macro_mgr_upload_commit(void) {
+  return macro_call(MACRO_CMD_COMMIT, 0);
+}
+
+void macro_mgr_upload_abort(void) { macro_call(MACRO_CMD_ABORT, 0); }
+
+uint32_t macro_mgr_read(uint32_t offset, uint8_t *data, uint32_t len) {
+  uint32_t store_len = atomic_load(&macro_store_len);
+
+  if (macro_part == NULL || offset >= store_len) {
+    return 0;
+  }
+  if (len > store_len - offset) {
+    len = store_len - offset;
+  }
+  if (esp_partition_read(macro_part, offset, data, len) != ESP_OK) {
+    return 0;
+  }
+  return len;
+}
@@ -0,0 +1,69 @@
+#ifndef MACRO_MGR_H
+#define MACRO_MGR_H
+
+#include "macro.h"
+#include <stdint.h>
+
+// ESP-IDF side of macro.h. The store lives in the MACRO_PARTITION flash
+// partition and is played straight out of the memory mapped flash window.
+// Playback runs on the NimBLE host task, at most HOGP_TX_BURST_MAX key
+// changes per connection interval so every one gets its own report and none
+// is dropped while the tx queue is full.
+//
+// A store is uploaded through the vendor feature reports of
+// HID_COMPLEX_REPORT_MAP (tools/macro_compile.py --reports):
+//
+//   Report 5, control (write): u8 command, u32 argument
+//   Report 6, data (write): u32 offset, u16 length, u8 reserved, data. The
+//     upload has to be written in order
+//   Report 8, status (read): u8 state, u8 result of the last command
+//     (macro_err_t), u8 macro count, u8 macro playing (0xFF for none),
+//     u32 store length, u32 bytes uploaded, u32 partition size,
+//     u32 macros played, u32 key changes sent
+//
+// A refused write also fails with ATT error MACRO_ATT_ERR(result).
+//
+// The bulk channel (bulk_mgr.h) uploads through macro_mgr_upload_*() instead.
+// While it does, the feature report upload is refused.
+
+#define MACRO_CTRL_REPORT_ID 5
+#define MACRO_DATA_REPORT_ID 6
+#define MACRO_STATUS_REPORT_ID 8
+
+#define MACRO_CMD_BEGIN 1  // Argument: store length. Stops playback
+#define MACRO_CMD_COMMIT 2 // Checks the uploaded store and starts using it
+#define MACRO_CMD_PLAY 3   // Argument: macro index
+#define MACRO_CMD_STOP 4
+#define MACRO_CMD_ABORT 5  // Drops an upload
+
+#define MACRO_DATA_HDR_LEN 7
+
+#define MACRO_ATT_ERR(err) (0x80 + (err))
+
+typedef enum {
+  MACRO_STATE_IDLE,
+  MACRO_STATE_UPLOADING,
+  MACRO_STATE_PLAYING,
+} macro_state_t;
+
+// Call after hogp_gatt_svr_init()
+int macro_mgr_init(void);
+
+// Safe from any task. Ignored while a macro is playing
+void macro_mgr_play(uint8_t index);
+
+// Upload from a task other than the NimBLE host task. Begin, commit and abort
+// run on the host task and wait for it. Writes erase and program flash on the
+// calling task, so the host task does not run them, but it still stalls with
+// every other task running from flash while they do, see bulk_mgr.h
+macro_err_t macro_mgr_upload_begin(uint32_t len);
+macro_err_t macro_mgr_upload_write(uint32_t offset, const uint8_t *data,
+                                   uint16_t len);
+macro_err_t macro_mgr_upload_commit(void);
+void macro_mgr_upload_abort(void);
+
+// Copies up to len bytes of the store in use from offset, from any task.
+// Returns how many, 0 past its end or while there is none
+uint32_t macro_mgr_read(uint32_t offset, uint8_t *data, uint32_t len);
+
+#endif
@@ -1,9 +1,19 @@
+#include "bench_mgr.h"
+#include "bulk_mgr.h"
 #include "config.h"
+#include "diag_svc.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "freertos/idf_additions.h"
 #include "gap.h"
 #include "hogp_gatt_svr.h"
+#include "key_trace_svc.h"
+#include "klog.h"
+#include "macro_mgr.h"
+#include "matrix_scanner.h"
+#include "pointer_mgr.h"
+#include "power_mgr.h"
+#include "usb_bridge.h"
 #include "host/ble_hs.h"
 #include "host/ble_store.h"
 #include "nimble/nimble_port.h"
@@ -24,10 +34,20 @@ static void on_stack_sync() {
   adv_init();
 }
 
+// Each service fills in its own handle dispatch table
+static void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt,
+                                 void *arg) {
+  hogp_gatt_svr_register_cb(ctxt, arg);
+  diag_svc_register_cb(ctxt, arg);
+#if KEY_TRACE_ENABLED
+  key_trace_svc_register_cb(ctxt, arg);
+#endif
+}
+
 static void nimble_host_config_init() {
   ble_hs_cfg.reset_cb = on_stack_reset;
   ble_hs_cfg.sync_cb = on_stack_sync;
-  ble_hs_cfg.gatts_register_cb = hogp_gatt_svr_register_cb;
+  ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
   ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
 
   ble_hs_cfg.sm_io_cap = BLE_SM_IO_CAP_NO_IO;
@@ -49,16 +69,24 @@ static void nimble_host_task(void *param) {
   vTaskDelete(NULL);
 }
 
-// Dummy task for heart rate
-static void keyboard_task(void *param) {
-  ESP_LOGI(TAG, "heart rate task started!");
-  while (1) {
-    ESP_LOGI(TAG, "SEND KEYBOARD");
-    send_keyboard_input_notify(0x04);
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-    send_keyboard_input_notify(0x00);
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+// Brings up the input side on CORE_INPUT. Interrupts are allocated on the
+// core that installs them, so the scan timer, column and USB interrupts land
+// there too and not next to the BT controller's
+static void input_init_task(void *param) {
+  int rc;
+
+#if INPUT_USB_BRIDGE
+  rc = usb_bridge_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize USB bridge, error code %d", rc);
   }
+#else
+  rc = matrix_scanner_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize key matrix, error code %d", rc);
+  }
+#endif
+
   vTaskDelete(NULL);
 }
 
@@ -78,6 +106,21 @@ void app_main(void) {
   }
   ESP_ERROR_CHECK(ret);
 
+  // Hot path logging goes through klog, start its printer before anything
+  // can log
+  rc = klog_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to start the log task, error code %d", rc);
+    return;
+  }
+
+  // Before the BT controller starts, so it comes up with modem sleep. The
+  // keyboard works without it, just never sleeps
+  rc = power_mgr_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize power management, error code %d", rc);
+  }
+
   // Configure NimBLE
   nimble_host_config_init();
 
@@ -94,12 +137,61 @@ void app_main(void) {
     ESP_LOGE(TAG, "Failed to initialize GAP, error code: %d", rc);
   }
 
+#if BENCH_REPORT_PATH
+  // Uses the connection table, so before the HID service owns it
+  rc = bench_mgr_run();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to run the report path bench, error code %d", rc);
+  }
+#endif
+
   rc = hogp_gatt_svr_init();
   if (rc != 0) {
     ESP_LOGE(TAG, "Failed to initialize GATT, error code %d", rc);
   }
-  // Run it as a task
-  xTaskCreate(nimble_host_task, "NimBLE Host", 4 * 1024, NULL, 5, NULL);
-  xTaskCreate(keyboard_task, "Heart Rate", 4 * 1024, NULL, 5, NULL);
+
+  rc = macro_mgr_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize macros, error code %d", rc);
+  }
+
+  rc = pointer_mgr_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize pointer, error code %d", rc);
+  }
+
+  rc = bulk_mgr_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize bulk channel, error code %d", rc);
+  }
+
+  rc = diag_svc_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize diagnostics service, error code %d",
+             rc);
+  }
+
+#if KEY_TRACE_ENABLED
+  rc = key_trace_svc_init();
+  if (rc != 0) {
+    ESP_LOGE(TAG, "Failed to initialize trace service, error code %d", rc);
+  }
+#endif
+
+  // Run it as a task, on the core the BT controller is pinned to
+  if (xTaskCreatePinnedToCore(nimble_host_task, "NimBLE Host",
+                              NIMBLE_HOST_TASK_STACK, NULL,
+                              NIMBLE_HOST_TASK_PRIO, NULL,
+                              CORE_BLE) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start the NimBLE host task");
+    return;
+  }
+
+  if (xTaskCreatePinnedToCore(input_init_task, "Input init",
+                              INPUT_INIT_TASK_STACK, NULL,
+                              MATRIX_SCAN_TASK_PRIO, NULL,
+                              CORE_INPUT) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start the input init task");
+  }
   return;
 }
@@ -0,0 +1,289 @@
+#include "matrix_scanner.h"
+#include "config.h"
+#include "driver/gpio.h"
+#include "driver/gptimer.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "hogp_gatt_svr.h"
+#include "key_matrix.h"
+#include "keymap.h"
+#include "keymap_table.h"
+#include "macro_mgr.h"
+#include "power_mgr.h"
+#include "task_stats.h"
+
+_Static_assert(MATRIX_ROWS <= KEY_MATRIX_MAX_ROWS &&
+                   MATRIX_COLS <= KEY_MATRIX_MAX_COLS,
+               "matrix does not fit key_matrix_t");
+_Static_assert(KEYMAP_ROWS == MATRIX_ROWS && KEYMAP_COLS == MATRIX_COLS,
+               "keymap.def does not match the matrix");
+_Static_assert(KEYMAP_LAYER_COUNT <= KEYMAP_MAX_LAYERS &&
+                   MATRIX_ROWS * MATRIX_COLS <= KEYMAP_MAX_KEYS,
+               "keymap does not fit keymap_t");
+
+static const gpio_num_t row_pins[MATRIX_ROWS] = MATRIX_ROW_PINS;
+static const gpio_num_t col_pins[MATRIX_COLS] = MATRIX_COL_PINS;
+
+static const uint16_t keymap_actions[] = KEYMAP_ACTIONS_INIT;
+static const keymap_combo_t keymap_combos[] = KEYMAP_COMBOS_INIT;
+
+static const keymap_def_t keymap_def = {
+    .layers = KEYMAP_LAYER_COUNT,
+    .keys = MATRIX_ROWS * MATRIX_COLS,
+    .actions = keymap_actions,
+    .combos = keymap_combos,
+    .combo_count = KEYMAP_COMBO_COUNT,
+};
+
+static const keymap_cfg_t keymap_cfg = {
+    .tapping_term_us = KEYMAP_TAPPING_TERM_MS * 1000,
+    .combo_term_us = KEYMAP_COMBO_TERM_MS * 1000,
+};
+
+static uint32_t matrix_read_row(uint8_t row, void *arg);
+static void matrix_emit(uint16_t key, bool pressed, uint32_t timestamp_us,
+                        void *arg);
+static void matrix_key(uint8_t usage, bool pressed, uint32_t timestamp_us,
+                       void *arg);
+static void matrix_control(uint8_t page, uint16_t usage, bool pressed,
+                           uint32_t timestamp_us, void *arg);
+static void matrix_macro(uint8_t index, void *arg);
+
+static const key_matrix_ops_t matrix_ops = {
+    .read_row = matrix_read_row,
+    .emit = matrix_emit,
+};
+
+static const keymap_ops_t keymap_ops = {
+    .key = matrix_key,
+    .control = matrix_control,
+    .macro = matrix_macro,
+};
+
+// Only touched by the scan task
+static key_matrix_t matrix;
+static keymap_t keymap;
+static struct matrix_scanner_stats matrix_stats;
+
+static gptimer_handle_t scan_timer;
+static TaskHandle_t scan_task;
+// When an interrupt last woke the scan task, for its wake jitter
+static volatile uint32_t scan_wake_us;
+
+// Rows are open drain, so two keys on one column can never short a driven
+// row against another
+static void rows_set(uint32_t level) {
+  for (size_t i = 0; i < MATRIX_ROWS; i++) {
+    gpio_set_level(row_pins[i], level);
+  }
+}
+
+static uint32_t matrix_read_row(uint8_t row, void *arg) {
+  uint32_t cols = 0;
+
+  gpio_set_level(row_pins[row], 0);
+  esp_rom_delay_us(MATRIX_SETTLE_US);
+  for (size_t i = 0; i < MATRIX_COLS; i++) {
+    // Pulled up, a closed switch pulls the column to the selected row
+    if (gpio_get_level(col_pins[i]) == 0) {
+      cols |= 1u << i;
+    }
+  }
+  gpio_set_level(row_pins[row], 1);
+  return cols;
+}
+
+static void matrix_emit(uint16_t key, bool pressed, uint32_t timestamp_us,
+                        void *arg) {
+  keymap_event(&keymap, key, pressed, timestamp_us);
+}
+
+static void matrix_key(uint8_t usage, bool pressed, uint32_t timestamp_us,
+                       void *arg) {
+  if (hogp_gatt_svr_post_key_at(usage, pressed, timestamp_us) != 0) {
+    matrix_stats.dropped++;
+  }
+}
+
+static void matrix_control(uint8_t page, uint16_t usage, bool pressed,
+                           uint32_t timestamp_us, void *arg) {
+  if (hogp_gatt_svr_post_control_at(page, usage, pressed, timestamp_us) != 0) {
+    matrix_stats.dropped++;
+  }
+}
+
+static void matrix_macro(uint8_t index, void *arg) { macro_mgr_play(index); }
+
+static void cols_intr_set(bool enable) {
+  for (size_t i = 0; i < MATRIX_COLS; i++) {
+    if (enable) {
+      gpio_intr_enable(col_pins[i]);
+    } else {
+      gpio_intr_disable(col_pins[i]);
+    }
+  }
+}
+
+// A column went low: some key is down. Scanning takes over until the matrix
+// is idle again
+static void matrix_col_isr(void *arg) {
+  BaseType_t woken = pdFALSE;
+
+  cols_intr_set(false);
+  scan_wake_us = (uint32_t)esp_timer_get_time();
+  vTaskNotifyGiveFromISR(scan_task, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+static bool matrix_timer_cb(gptimer_handle_t timer,
+                            const gptimer_alarm_event_data_t *edata,
+                            void *arg) {
+  BaseType_t woken = pdFALSE;
+  scan_wake_us = (uint32_t)esp_timer_get_time();
+  vTaskNotifyGiveFromISR(scan_task, &woken);
+  return woken == pdTRUE;
+}
+
+static void matrix_scan_task(void *param) {
+  bool scanning = false;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    task_stats_jitter(TASK_JITTER_SCAN, now - scan_wake_us);
+
+    if (!scanning) {
+      // Woken by a column, release the rows so they can be read one by one.
+      // No light sleep while the scan timer runs
+      scanning = true;
+      matrix_stats.wakeups++;
+      power_mgr_hold(POWER_HOLD_SCAN, true);
+      rows_set(1);
+      gptimer_enable(scan_timer);
+      gptimer_set_raw_count(scan_timer, 0);
+      gptimer_start(scan_timer);
+    }
+
+    matrix_stats.scans++;
+    bool busy = key_matrix_scan(&matrix, now);
+    // Pending tap-hold and combo decisions are timed by the scans
+    if (keymap_tick(&keymap, now) != UINT32_MAX) {
+      busy = true;
+    }
+    if (busy) {
+      continue;
+    }
+
+    // All keys up and settled, go back to waiting on the columns
+    gptimer_stop(scan_timer);
+    gptimer_disable(scan_timer);
+    scanning = false;
+    // A tick that fired while stopping must not count as a column wakeup
+    ulTaskNotifyTake(pdTRUE, 0);
+    rows_set(0);
+    cols_intr_set(true);
+    power_mgr_hold(POWER_HOLD_SCAN, false);
+  }
+}
+
+int matrix_scanner_init(void) {
+  esp_err_t rc;
+
+  key_matrix_init(&matrix, MATRIX_ROWS, MATRIX_COLS, &matrix_ops);
+  keymap_init(&keymap, &keymap_def, &keymap_cfg, &keymap_ops);
+
+  gpio_config_t row_cfg = {
+      .mode = GPIO_MODE_OUTPUT_OD,
+      .intr_type = GPIO_INTR_DISABLE,
+  };
+  for (size_t i = 0; i < MATRIX_ROWS; i++) {
+    row_cfg.pin_bit_mask |= 1ull << row_pins[i];
+  }
+  rc = gpio_config(&row_cfg);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to configure matrix rows, error code: %d", rc);
+    return rc;
+  }
+  // Every row selected, so a press on any key pulls its column low
+  rows_set(0);
+
+  // Level triggered: a key that is already down when the interrupt is
+  // enabled again still wakes the scanner. The same level wakes the chip
+  // from light sleep
+  gpio_config_t col_cfg = {
+      .mode = GPIO_MODE_INPUT,
+      .pull_up_en = GPIO_PULLUP_ENABLE,
+      .intr_type = GPIO_INTR_LOW_LEVEL,
+  };
+  for (size_t i = 0; i < MATRIX_COLS; i++) {
+    col_cfg.pin_bit_mask |= 1ull << col_pins[i];
+  }
+  rc = gpio_config(&col_cfg);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to configure matrix columns, error code: %d", rc);
+    return rc;
+  }
+  cols_intr_set(false);
+  for (size_t i = 0; i < MATRIX_COLS; i++) {
+    gpio_wakeup_enable(col_pins[i], GPIO_INTR_LOW_LEVEL);
+  }
+  rc = esp_sleep_enable_gpio_wakeup();
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to enable GPIO wakeup, error code: %d", rc);
+    return rc;
+  }
+
+  gptimer_config_t timer_cfg = {
+      .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+      .direction = GPTIMER_COUNT_UP,
+      .resolution_hz = 1000000, // 1 us per tick
+  };
+  rc = gptimer_new_timer(&timer_cfg, &scan_timer);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create scan timer, error code: %d", rc);
+    return rc;
+  }
+  gptimer_event_callbacks_t timer_cbs = {.on_alarm = matrix_timer_cb};
+  gptimer_register_event_callbacks(scan_timer, &timer_cbs, NULL);
+  gptimer_alarm_config_t alarm_cfg = {
+      .alarm_count = MATRIX_SCAN_PERIOD_US,
+      .reload_count = 0,
+      .flags.auto_reload_on_alarm = true,
+  };
+  gptimer_set_alarm_action(scan_timer, &alarm_cfg);
+  // Enabled only while scanning, an enabled timer holds its own PM lock and
+  // would keep the chip out of light sleep
+
+  // Above the NimBLE host task and on the other core, a scan is never held up
+  // by the BLE stack
+  if (xTaskCreatePinnedToCore(matrix_scan_task, "Matrix scan",
+                              MATRIX_SCAN_TASK_STACK, NULL,
+                              MATRIX_SCAN_TASK_PRIO, &scan_task,
+                              CORE_INPUT) != pdPASS) {
+    ESP_LOGE(TAG, "failed to create matrix scan task");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // The GPIO ISR service may already be installed by another driver
+  rc = gpio_install_isr_service(0);
+  if (rc != ESP_OK && rc != ESP_ERR_INVALID_STATE) {
+    ESP_LOGE(TAG, "failed to install GPIO ISR service, error code: %d", rc);
+    return rc;
+  }
+  for (size_t i = 0; i < MATRIX_COLS; i++) {
+    gpio_isr_handler_add(col_pins[i], matrix_col_isr, NULL);
+  }
+  cols_intr_set(true);
+
+  ESP_LOGI(TAG, "key matrix %dx%d ready", MATRIX_ROWS, MATRIX_COLS);
+  return 0;
+}
+
+void matrix_scanner_get_stats(struct matrix_scanner_stats *stats) {
+  *stats = matrix_stats;
+  keymap_get_stats(&keymap, &stats->keymap);
+}
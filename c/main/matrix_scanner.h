@@ -0,0 +1,27 @@
+#ifndef MATRIX_SCANNER_H
+#define MATRIX_SCANNER_H
+
+#include "keymap.h"
+#include <stdint.h>
+
+// GPIO key matrix driver for key_matrix.h. While no key is down every row is
+// driven low and the columns wait on a GPIO interrupt, nothing runs. A press
+// starts a hardware timer that scans every MATRIX_SCAN_PERIOD_US until all
+// keys are released and settled again. The chip may light sleep while
+// waiting, a column going low wakes it. Key changes go through the keymap
+// resolver (keymap.h, keymap.def) on the scan task.
+
+struct matrix_scanner_stats {
+  uint32_t wakeups; // Column interrupts that started a scan run
+  uint32_t scans;
+  uint32_t dropped; // Key presses the key ring had no room for
+  keymap_stats_t keymap;
+};
+
+int matrix_scanner_init(void);
+
+// Copied without a lock while the scan task runs: every counter is whole,
+// they may just not all be from the same scan
+void matrix_scanner_get_stats(struct matrix_scanner_stats *stats);
+
+#endif
@@ -0,0 +1,135 @@
+#include "pointer.h"
+#include <string.h>
+
+#define MOUSE_BUTTONS_BYTE (HID_COMPLEX_R7_IN_F0_OFFSET / 8)
+#define MOUSE_X_BYTE (HID_COMPLEX_R7_IN_F2_OFFSET / 8)
+#define MOUSE_Y_BYTE (MOUSE_X_BYTE + 2)
+#define MOUSE_WHEEL_BYTE (HID_COMPLEX_R7_IN_F3_OFFSET / 8)
+#define MOUSE_PAN_BYTE (HID_COMPLEX_R7_IN_F4_OFFSET / 8)
+
+#define MOUSE_XY_MAX HID_COMPLEX_R7_IN_F2_LOGICAL_MAX
+#define MOUSE_XY_MIN HID_COMPLEX_R7_IN_F2_LOGICAL_MIN
+#define MOUSE_WHEEL_MAX HID_COMPLEX_R7_IN_F3_LOGICAL_MAX
+#define MOUSE_WHEEL_MIN HID_COMPLEX_R7_IN_F3_LOGICAL_MIN
+#define MOUSE_PAN_MAX HID_COMPLEX_R7_IN_F4_LOGICAL_MAX
+#define MOUSE_PAN_MIN HID_COMPLEX_R7_IN_F4_LOGICAL_MIN
+
+// The packing below follows the report map, fail the build if it changes
+_Static_assert(HID_COMPLEX_R7_IN_F0_OFFSET % 8 == 0 &&
+                   HID_COMPLEX_R7_IN_F0_SIZE == 1 &&
+                   HID_COMPLEX_R7_IN_F0_COUNT <= 8,
+               "mouse buttons are not one bit each in one byte");
+_Static_assert(HID_COMPLEX_R7_IN_F2_OFFSET % 8 == 0 &&
+                   HID_COMPLEX_R7_IN_F2_SIZE == 16 &&
+                   HID_COMPLEX_R7_IN_F2_COUNT == 2,
+               "mouse X/Y are not two 16-bit fields");
+_Static_assert(HID_COMPLEX_R7_IN_F3_OFFSET % 8 == 0 &&
+                   HID_COMPLEX_R7_IN_F3_SIZE == 8 &&
+                   HID_COMPLEX_R7_IN_F4_OFFSET % 8 == 0 &&
+                   HID_COMPLEX_R7_IN_F4_SIZE == 8,
+               "mouse wheel/pan are not 8-bit fields");
+
+void pointer_init(pointer_t *p) {
+  memset(p, 0, sizeof(*p));
+  p->count = 1;
+}
+
+// Adds without wrapping, a sensor would need hours of motion in one
+// direction to get here
+static int32_t add_sat(int32_t acc, int32_t d) {
+  int64_t sum = (int64_t)acc + d;
+  if (sum > INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (sum < INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (int32_t)sum;
+}
+
+// Takes what fits [min, max] out of *acc
+static int32_t take(int32_t *acc, int32_t min, int32_t max) {
+  int32_t v = *acc < min ? min : *acc > max ? max : *acc;
+  *acc -= v;
+  return v;
+}
+
+static bool seg_moved(const pointer_seg_t *seg) {
+  return seg->x != 0 || seg->y != 0 || seg->wheel != 0 || seg->pan != 0;
+}
+
+void pointer_move(pointer_t *p, int32_t dx, int32_t dy) {
+  pointer_seg_t *seg = &p->seg[p->count - 1];
+  seg->x = add_sat(seg->x, dx);
+  seg->y = add_sat(seg->y, dy);
+}
+
+void pointer_scroll(pointer_t *p, int32_t wheel, int32_t pan) {
+  pointer_seg_t *seg = &p->seg[p->count - 1];
+  seg->wheel = add_sat(seg->wheel, wheel);
+  seg->pan = add_sat(seg->pan, pan);
+}
+
+void pointer_buttons(pointer_t *p, uint8_t buttons) {
+  pointer_seg_t *last = &p->seg[p->count - 1];
+
+  buttons &= (1u << MOUSE_BUTTON_COUNT) - 1;
+  if (buttons == last->buttons) {
+    return;
+  }
+  if (p->count == POINTER_SEGMENTS) {
+    // The last state gets the new buttons, its own are never reported
+    last->buttons = buttons;
+    p->stats.merged++;
+    return;
+  }
+  p->seg[p->count++] = (pointer_seg_t){.buttons = buttons};
+}
+
+// Drops states at the front that have nothing left to report
+static void pointer_trim(pointer_t *p) {
+  while (p->count > 1 && !seg_moved(&p->seg[0]) &&
+         p->seg[0].buttons == p->sent_buttons) {
+    memmove(&p->seg[0], &p->seg[1], (p->count - 1) * sizeof(p->seg[0]));
+    p->count--;
+  }
+}
+
+bool pointer_pending(const pointer_t *p) {
+  const pointer_seg_t *seg = &p->seg[0];
+  return p->count > 1 || seg_moved(seg) || seg->buttons != p->sent_buttons;
+}
+
+bool pointer_take(pointer_t *p, uint8_t *report) {
+  pointer_trim(p);
+  if (!pointer_pending(p)) {
+    return false;
+  }
+
+  pointer_seg_t *seg = &p->seg[0];
+  int32_t x = take(&seg->x, MOUSE_XY_MIN, MOUSE_XY_MAX);
+  int32_t y = take(&seg->y, MOUSE_XY_MIN, MOUSE_XY_MAX);
+  int32_t wheel = take(&seg->wheel, MOUSE_WHEEL_MIN, MOUSE_WHEEL_MAX);
+  int32_t pan = take(&seg->pan, MOUSE_PAN_MIN, MOUSE_PAN_MAX);
+
+  memset(report, 0, MOUSE_REPORT_LEN);
+  report[MOUSE_BUTTONS_BYTE] = seg->buttons;
+  report[MOUSE_X_BYTE] = (uint16_t)x;
+  report[MOUSE_X_BYTE + 1] = (uint16_t)x >> 8;
+  report[MOUSE_Y_BYTE] = (uint16_t)y;
+  report[MOUSE_Y_BYTE + 1] = (uint16_t)y >> 8;
+  report[MOUSE_WHEEL_BYTE] = (uint8_t)wheel;
+  report[MOUSE_PAN_BYTE] = (uint8_t)pan;
+
+  p->sent_buttons = seg->buttons;
+  p->stats.reports++;
+  if (seg_moved(seg)) {
+    p->stats.saturated++;
+  }
+  pointer_trim(p);
+  return true;
+}
+
+void pointer_get_stats(const pointer_t *p, pointer_stats_t *stats) {
+  *stats = p->stats;
+}
@@ -0,0 +1,65 @@
+#ifndef POINTER_H
+#define POINTER_H
+
+#include "hid_layout.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pointer motion accumulator for the mouse report (Report ID 7 of
+// HID_COMPLEX_REPORT_MAP). Motion and scroll deltas are added up at whatever
+// rate the sensor produces them, and taken out one report at a time when the
+// link can send one. Each field is saturated to what the report can carry and
+// the rest stays for the next report, so no motion is ever lost.
+//
+// Motion is kept per button state: whatever moved while a button was down
+// goes out with the button down, so a quick click or drag between two
+// reports keeps its shape. Like key_matrix.h it does not touch any hardware,
+// so it can run against simulated sensors.
+
+#define MOUSE_REPORT_ID 7
+#define MOUSE_REPORT_LEN HID_COMPLEX_R7_IN_LEN
+#define MOUSE_BUTTON_COUNT HID_COMPLEX_R7_IN_F0_COUNT
+// Button changes kept between two reports, later ones replace the last
+#define POINTER_SEGMENTS 4
+
+typedef struct {
+  int32_t x;
+  int32_t y;
+  int32_t wheel;
+  int32_t pan;
+  uint8_t buttons; // Held while this motion happened
+} pointer_seg_t;
+
+typedef struct {
+  uint32_t reports;
+  uint32_t saturated; // Reports that left motion for the next one
+  uint32_t merged;    // Button changes lost to a full segment list
+} pointer_stats_t;
+
+typedef struct {
+  pointer_seg_t seg[POINTER_SEGMENTS]; // Oldest first, the last one is live
+  uint8_t count;
+  uint8_t sent_buttons;
+  pointer_stats_t stats;
+} pointer_t;
+
+void pointer_init(pointer_t *p);
+
+void pointer_move(pointer_t *p, int32_t dx, int32_t dy);
+
+void pointer_scroll(pointer_t *p, int32_t wheel, int32_t pan);
+
+// Bit n = button n + 1 down
+void pointer_buttons(pointer_t *p, uint8_t buttons);
+
+// True if there is anything a report would carry
+bool pointer_pending(const pointer_t *p);
+
+// Fills in the next report (MOUSE_REPORT_LEN bytes, without the Report ID)
+// and takes what it carries out of the accumulator. Returns false, leaving
+// report alone, if nothing is pending
+bool pointer_take(pointer_t *p, uint8_t *report);
+
+void pointer_get_stats(const pointer_t *p, pointer_stats_t *stats);
+
+#endif
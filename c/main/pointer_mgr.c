@@ -0,0 +1,97 @@
+#include "pointer_mgr.h"
+#include "freertos/FreeRTOS.h"
+#include "hogp_gatt_svr.h"
+#include "nimble/nimble_port.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+static pointer_t pointer;
+static portMUX_TYPE pointer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct ble_npl_event pointer_ev;
+static struct ble_npl_callout pointer_callout;
+// Set while the host task has the pointer scheduled: an event is queued or
+// the callout is running. Input only posts the event when it is not
+static _Atomic bool pointer_scheduled;
+
+// Report taken from the accumulator that did not fit the tx queue yet. Only
+// touched by the NimBLE host task
+static uint8_t pointer_report[MOUSE_REPORT_LEN];
+static bool pointer_report_pending;
+
+static void pointer_kick(void) {
+  if (!atomic_exchange(&pointer_scheduled, true)) {
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &pointer_ev);
+  }
+}
+
+// Sends at most one report, then waits a connection interval before the
+// next. With nothing left to send the pointer goes idle, and the next motion
+// is sent right away
+static void pointer_tick(struct ble_npl_event *ev) {
+  if (!pointer_report_pending) {
+    portENTER_CRITICAL(&pointer_lock);
+    pointer_report_pending = pointer_take(&pointer, pointer_report);
+    portEXIT_CRITICAL(&pointer_lock);
+  }
+
+  if (!pointer_report_pending) {
+    atomic_store(&pointer_scheduled, false);
+    // Motion that came in after the take above found the flag still set
+    portENTER_CRITICAL(&pointer_lock);
+    bool pending = pointer_pending(&pointer);
+    portEXIT_CRITICAL(&pointer_lock);
+    if (!pending || atomic_exchange(&pointer_scheduled, true)) {
+      return;
+    }
+    // Nothing went out this interval, so it can go right away
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &pointer_ev);
+    return;
+  }
+
+  // Stays pending while the tx queue is full, it is retried next interval
+  if (hogp_gatt_svr_send_input(MOUSE_REPORT_ID, pointer_report,
+                               MOUSE_REPORT_LEN) == 0) {
+    pointer_report_pending = false;
+  }
+
+  uint32_t itvl = hogp_gatt_svr_max_itvl_ms();
+  ble_npl_callout_reset(&pointer_callout,
+                        ble_npl_time_ms_to_ticks32(itvl == 0 ? POINTER_TICK_MS
+                                                             : itvl));
+}
+
+int pointer_mgr_init(void) {
+  pointer_init(&pointer);
+  ble_npl_event_init(&pointer_ev, pointer_tick, NULL);
+  ble_npl_callout_init(&pointer_callout, nimble_port_get_dflt_eventq(),
+                       pointer_tick, NULL);
+  return 0;
+}
+
+void pointer_mgr_move(int32_t dx, int32_t dy) {
+  portENTER_CRITICAL(&pointer_lock);
+  pointer_move(&pointer, dx, dy);
+  portEXIT_CRITICAL(&pointer_lock);
+  pointer_kick();
+}
+
+void pointer_mgr_scroll(int32_t wheel, int32_t pan) {
+  portENTER_CRITICAL(&pointer_lock);
+  pointer_scroll(&pointer, wheel, pan);
+  portEXIT_CRITICAL(&pointer_lock);
+  pointer_kick();
+}
+
+void pointer_mgr_buttons(uint8_t buttons) {
+  portENTER_CRITICAL(&pointer_lock);
+  pointer_buttons(&pointer, buttons);
+  portEXIT_CRITICAL(&pointer_lock);
+  pointer_kick();
+}
+
+void pointer_mgr_get_stats(pointer_stats_t *stats) {
+  portENTER_CRITICAL(&pointer_lock);
+  pointer_get_stats(&pointer, stats);
+  portEXIT_CRITICAL(&pointer_lock);
+}
@@ -0,0 +1,29 @@
+#ifndef POINTER_MGR_H
+#define POINTER_MGR_H
+
+#include "pointer.h"
+#include <stdint.h>
+
+// ESP-IDF side of pointer.h. Input (a sensor driver, the USB bridge) adds
+// motion from its own task at any rate. The NimBLE host task takes one
+// mouse report out per connection interval of the slowest host (see
+// hogp_gatt_svr_max_itvl_ms()), so the sensor rate and the radio rate are
+// independent and whatever did not fit one report goes out with the next.
+//
+// The accumulator is shared under a spinlock that is held for a few dozen
+// instructions and never across a call into the stack.
+
+// Report interval while no host interval is known
+#define POINTER_TICK_MS 8
+
+// Call after hogp_gatt_svr_init()
+int pointer_mgr_init(void);
+
+// Safe from any task
+void pointer_mgr_move(int32_t dx, int32_t dy);
+void pointer_mgr_scroll(int32_t wheel, int32_t pan);
+void pointer_mgr_buttons(uint8_t buttons);
+
+void pointer_mgr_get_stats(pointer_stats_t *stats);
+
+#endif
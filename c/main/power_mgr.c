@@ -0,0 +1,265 @@
+#include "power_mgr.h"
+#include "config.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+
+static void power_set_sleep(bool allowed, void *arg);
+
+static const power_policy_cfg_t power_cfg = {
+    .awake_ua = POWER_AWAKE_UA,
+    .sleep_ua = POWER_SLEEP_UA,
+    .radio_event_nc = POWER_RADIO_EVENT_NC,
+    .link_hold_ms = POWER_LINK_HOLD_MS,
+};
+
+static const power_policy_ops_t power_ops = {
+    .set_sleep = power_set_sleep,
+};
+
+// The policy is only touched with power_mutex held, by the esp_timer task
+// and by stats readers
+static power_policy_t power;
+static SemaphoreHandle_t power_mutex;
+static esp_pm_lock_handle_t sleep_lock;
+// Taken together with sleep_lock. Without it the CPU would stay at
+// POWER_MIN_FREQ_MHZ while it works through key events
+static esp_pm_lock_handle_t freq_lock;
+static esp_timer_handle_t power_timer;
+// Fired at once by power_mgr_hold() and power_mgr_radio() so the policy
+// catches up with the requests below
+static esp_timer_handle_t power_kick;
+
+// What callers asked for, applied to the policy by the esp_timer task. A
+// hold never waits for the task that reads the stats
+static _Atomic uint32_t hold_req;   // power_hold_t bits
+static _Atomic uint32_t link_takes; // POWER_HOLD_LINK taken, restarts it
+static _Atomic uint32_t radio_req;
+// Last requests the policy saw, power_mutex
+static uint32_t hold_applied;
+static uint32_t link_takes_applied;
+static uint32_t radio_applied;
+
+// Light sleeps that ended since the policy last saw them. The exit callback
+// runs in the idle task with the scheduler stopped, so it only counts here
+// and the policy picks them up on its next call
+static portMUX_TYPE wake_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t wake_count[POWER_WAKE_COUNT];
+static uint64_t wake_slept_us[POWER_WAKE_COUNT];
+
+static inline uint32_t now_ms(void) {
+  return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void power_set_sleep(bool allowed, void *arg) {
+  if (allowed) {
+    esp_pm_lock_release(freq_lock);
+    esp_pm_lock_release(sleep_lock);
+  } else {
+    esp_pm_lock_acquire(sleep_lock);
+    esp_pm_lock_acquire(freq_lock);
+  }
+}
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+static IRAM_ATTR esp_err_t power_sleep_exit_cb(int64_t sleep_time_us,
+                                               void *arg) {
+  power_wake_t reason;
+
+  switch (esp_sleep_get_wakeup_cause()) {
+  case ESP_SLEEP_WAKEUP_GPIO:
+    reason = POWER_WAKE_KEY;
+    break;
+  case ESP_SLEEP_WAKEUP_TIMER:
+    reason = POWER_WAKE_TIMER;
+    break;
+  default:
+    reason = POWER_WAKE_OTHER;
+    break;
+  }
+
+  portENTER_CRITICAL_SAFE(&wake_lock);
+  wake_count[reason]++;
+  wake_slept_us[reason] += sleep_time_us;
+  portEXIT_CRITICAL_SAFE(&wake_lock);
+  return ESP_OK;
+}
+#endif
+
+// Call with power_mutex held
+static void power_sync_wakes(void) {
+  uint32_t count[POWER_WAKE_COUNT];
+  uint64_t slept_us[POWER_WAKE_COUNT];
+
+  portENTER_CRITICAL(&wake_lock);
+  for (int i = 0; i < POWER_WAKE_COUNT; i++) {
+    count[i] = wake_count[i];
+    slept_us[i] = wake_slept_us[i];
+    wake_count[i] = 0;
+    wake_slept_us[i] = 0;
+  }
+  portEXIT_CRITICAL(&wake_lock);
+
+  for (int i = 0; i < POWER_WAKE_COUNT; i++) {
+    if (count[i] != 0) {
+      power_policy_wake(&power, i, count[i], slept_us[i]);
+    }
+  }
+}
+
+// Call with power_mutex held, hands the policy the requests that changed
+// since the last call
+static void power_apply(void) {
+  uint32_t now = now_ms();
+  uint32_t holds = atomic_load(&hold_req);
+  uint32_t takes = atomic_load(&link_takes);
+  uint32_t radio = atomic_load(&radio_req);
+
+  for (uint32_t hold = 1; hold <= POWER_HOLD_LINK; hold <<= 1) {
+    bool retake = hold == POWER_HOLD_LINK && takes != link_takes_applied;
+    if (((holds ^ hold_applied) & hold) || (retake && (holds & hold))) {
+      power_policy_hold(&power, hold, holds & hold, now);
+    }
+  }
+  hold_applied = holds;
+  link_takes_applied = takes;
+  if (radio != radio_applied) {
+    power_policy_radio(&power, radio, now);
+    radio_applied = radio;
+  }
+}
+
+// Call with power_mutex held, runs the policy timeouts and re-arms the timer
+static void power_run(void) {
+  uint32_t next = power_policy_tick(&power, now_ms());
+
+  esp_timer_stop(power_timer);
+  if (next != UINT32_MAX) {
+    esp_timer_start_once(power_timer, (uint64_t)next * 1000);
+  }
+}
+
+// Both timers, on the esp_timer task
+static void power_timer_cb(void *arg) {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  power_apply();
+  power_run();
+  xSemaphoreGive(power_mutex);
+}
+
+static void power_kick_now(void) {
+  if (power_kick != NULL) {
+    // Fails if a kick is already pending, which then sees this request too
+    esp_timer_start_once(power_kick, 0);
+  }
+}
+
+int power_mgr_init(void) {
+  esp_err_t rc;
+
+  rc = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "power", &sleep_lock);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create PM lock, error code: %d", rc);
+    return rc;
+  }
+  rc = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power", &freq_lock);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create PM lock, error code: %d", rc);
+    return rc;
+  }
+
+  esp_timer_create_args_t timer_args = {
+      .callback = power_timer_cb,
+      .name = "power",
+  };
+  rc = esp_timer_create(&timer_args, &power_timer);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create power timer, error code: %d", rc);
+    return rc;
+  }
+  esp_timer_handle_t kick;
+  timer_args.name = "power kick";
+  rc = esp_timer_create(&timer_args, &kick);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to create power timer, error code: %d", rc);
+    return rc;
+  }
+
+  power_mutex = xSemaphoreCreateMutex();
+  if (power_mutex == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+  esp_pm_sleep_cbs_register_config_t cbs = {
+      .exit_cb = power_sleep_exit_cb,
+  };
+  rc = esp_pm_light_sleep_register_cbs(&cbs);
+  if (rc != ESP_OK) {
+    ESP_LOGW(TAG, "failed to register sleep callbacks, error code: %d", rc);
+  }
+#endif
+
+  // The policy starts by releasing them
+  esp_pm_lock_acquire(sleep_lock);
+  esp_pm_lock_acquire(freq_lock);
+  power_policy_init(&power, &power_cfg, &power_ops, now_ms());
+  // Holds taken before init. Nothing else runs the policy until the kick
+  // timer is published, then one kick for any taken in between
+  power_apply();
+  power_run();
+  power_kick = kick;
+  power_kick_now();
+
+  // Only sleep once the holds are in place
+  esp_pm_config_t pm_cfg = {
+      .max_freq_mhz = POWER_MAX_FREQ_MHZ,
+      .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+      .light_sleep_enable = POWER_LIGHT_SLEEP,
+  };
+  rc = esp_pm_configure(&pm_cfg);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to configure power management, error code: %d",
+             rc);
+    return rc;
+  }
+
+  ESP_LOGI(TAG, "power management ready, light sleep %s",
+           POWER_LIGHT_SLEEP ? "on" : "off");
+  return 0;
+}
+
+void power_mgr_hold(power_hold_t hold, bool held) {
+  if (held) {
+    if (hold == POWER_HOLD_LINK) {
+      atomic_fetch_add(&link_takes, 1);
+    }
+    atomic_fetch_or(&hold_req, hold);
+  } else {
+    atomic_fetch_and(&hold_req, ~(uint32_t)hold);
+  }
+  power_kick_now();
+}
+
+void power_mgr_radio(uint32_t radio_mhz) {
+  atomic_store(&radio_req, radio_mhz);
+  power_kick_now();
+}
+
+void power_mgr_get_stats(power_stats_t *stats) {
+  if (power_mutex == NULL) {
+    *stats = (power_stats_t){0};
+    return;
+  }
+
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  power_sync_wakes();
+  power_policy_stats(&power, now_ms(), stats);
+  xSemaphoreGive(power_mutex);
+}
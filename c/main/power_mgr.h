@@ -0,0 +1,28 @@
+#ifndef POWER_MGR_H
+#define POWER_MGR_H
+
+#include "power_policy.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// ESP-IDF side of power_policy.h. Configures dynamic frequency scaling and
+// automatic light sleep (tickless idle). While the policy holds the chip
+// awake, PM locks keep it out of light sleep and at the full CPU clock. The
+// BT controller keeps its connection events through light sleep (modem
+// sleep, see sdkconfig.defaults), a key press wakes the chip through the
+// matrix columns.
+
+int power_mgr_init(void);
+
+// Safe from any task, not from ISRs. Holds and the radio rate are atomics
+// that a one-shot esp_timer hands to the policy, so the scan task never
+// waits on a lock the NimBLE host task holds. The policy's mutex is only
+// shared between that timer and power_mgr_get_stats()
+void power_mgr_hold(power_hold_t hold, bool held);
+
+// Sum of the radio event rates, see power_policy_radio
+void power_mgr_radio(uint32_t radio_mhz);
+
+void power_mgr_get_stats(power_stats_t *stats);
+
+#endif
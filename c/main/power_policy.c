@@ -0,0 +1,95 @@
+#include "power_policy.h"
+
+// True if time a is at or after time b, wrap-around safe
+static inline bool time_reached(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) >= 0;
+}
+
+// Books the time since the last call at the radio rate that applied to it
+static void account(power_policy_t *p, uint32_t now_ms) {
+  uint32_t delta_ms = now_ms - p->last_ms;
+
+  p->last_ms = now_ms;
+  p->elapsed_us += (uint64_t)delta_ms * 1000;
+  // mHz * ms = 1e-6 events, times nC * 1000 for pC
+  p->radio_pc += (uint64_t)p->radio_mhz * delta_ms * p->cfg->radio_event_nc /
+                 1000;
+}
+
+static void update_sleep(power_policy_t *p) {
+  bool allowed = p->holds == 0;
+  if (allowed != p->sleep_allowed) {
+    p->sleep_allowed = allowed;
+    p->ops->set_sleep(allowed, p->ops->arg);
+  }
+}
+
+void power_policy_init(power_policy_t *p, const power_policy_cfg_t *cfg,
+                       const power_policy_ops_t *ops, uint32_t now_ms) {
+  *p = (power_policy_t){
+      .cfg = cfg,
+      .ops = ops,
+      .last_ms = now_ms,
+  };
+  update_sleep(p);
+}
+
+void power_policy_hold(power_policy_t *p, power_hold_t hold, bool held,
+                       uint32_t now_ms) {
+  account(p, now_ms);
+  if (held) {
+    p->holds |= hold;
+    if (hold == POWER_HOLD_LINK) {
+      p->link_hold_at = now_ms + p->cfg->link_hold_ms;
+    }
+  } else {
+    p->holds &= ~(uint32_t)hold;
+  }
+  update_sleep(p);
+}
+
+void power_policy_radio(power_policy_t *p, uint32_t radio_mhz,
+                        uint32_t now_ms) {
+  account(p, now_ms);
+  p->radio_mhz = radio_mhz;
+}
+
+void power_policy_wake(power_policy_t *p, power_wake_t reason, uint32_t count,
+                       uint64_t slept_us) {
+  p->wakes[reason] += count;
+  p->asleep_us += slept_us;
+}
+
+uint32_t power_policy_tick(power_policy_t *p, uint32_t now_ms) {
+  if (!(p->holds & POWER_HOLD_LINK)) {
+    return UINT32_MAX;
+  }
+  if (time_reached(now_ms, p->link_hold_at)) {
+    // The central never settled the parameters, do not stay up for it
+    power_policy_hold(p, POWER_HOLD_LINK, false, now_ms);
+    return UINT32_MAX;
+  }
+  return p->link_hold_at - now_ms;
+}
+
+void power_policy_stats(power_policy_t *p, uint32_t now_ms,
+                        power_stats_t *stats) {
+  account(p, now_ms);
+
+  *stats = (power_stats_t){.radio_mhz = p->radio_mhz};
+  for (int i = 0; i < POWER_WAKE_COUNT; i++) {
+    stats->wakes[i] = p->wakes[i];
+  }
+  if (p->elapsed_us == 0) {
+    return;
+  }
+
+  // Sleep is measured in us and time in ms, they can disagree a little
+  uint64_t asleep = p->asleep_us < p->elapsed_us ? p->asleep_us
+                                                 : p->elapsed_us;
+  uint64_t awake = p->elapsed_us - asleep;
+  uint64_t charge_pc = awake * p->cfg->awake_ua + asleep * p->cfg->sleep_ua +
+                       p->radio_pc;
+  stats->avg_ua = (uint32_t)(charge_pc / p->elapsed_us);
+  stats->sleep_permille = (uint32_t)(asleep * 1000 / p->elapsed_us);
+}
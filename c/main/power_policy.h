@@ -0,0 +1,94 @@
+#ifndef POWER_POLICY_H
+#define POWER_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Light sleep policy and current estimate. The chip may light sleep between
+// radio events as long as nothing holds it awake: the key scanner while a
+// key is down, the USB host, and a new connection until its parameters have
+// settled. The estimate adds up time awake, time in light sleep and the
+// charge of every radio event at the rate the links and advertising run at.
+//
+// Like conn_params.h it does not touch the hardware, sleep is switched
+// through power_policy_ops_t and time is passed in, so it can run against a
+// simulated timeline.
+
+typedef enum {
+  POWER_HOLD_SCAN = 1 << 0, // Matrix scan timer running
+  POWER_HOLD_USB = 1 << 1,  // USB host, does not survive light sleep
+  POWER_HOLD_LINK = 1 << 2, // New connection, until its parameters settle
+} power_hold_t;
+
+typedef enum {
+  POWER_WAKE_KEY,   // Matrix column
+  POWER_WAKE_TIMER, // Radio event or a task timeout
+  POWER_WAKE_OTHER,
+  POWER_WAKE_COUNT
+} power_wake_t;
+
+typedef struct {
+  // Allows or forbids light sleep, only called when that changes
+  void (*set_sleep)(bool allowed, void *arg);
+  void *arg;
+} power_policy_ops_t;
+
+// Currents only feed the estimate, they do not change any decision
+typedef struct {
+  uint32_t awake_ua;       // CPU running, radio off
+  uint32_t sleep_ua;       // Light sleep
+  uint32_t radio_event_nc; // One connection or advertising event
+  uint32_t link_hold_ms;   // Longest a new connection keeps us awake
+} power_policy_cfg_t;
+
+typedef struct {
+  uint32_t avg_ua;         // Since power_policy_init
+  uint32_t sleep_permille; // Share of that time spent in light sleep
+  uint32_t radio_mhz;      // Current radio event rate, in mHz
+  uint32_t wakes[POWER_WAKE_COUNT];
+} power_stats_t;
+
+typedef struct {
+  const power_policy_cfg_t *cfg;
+  const power_policy_ops_t *ops;
+  uint32_t holds;        // power_hold_t bits
+  bool sleep_allowed;    // Last state passed to ops->set_sleep
+  uint32_t link_hold_at; // When POWER_HOLD_LINK lapses, if held
+  uint32_t last_ms;      // Up to where the totals below are accounted
+  uint64_t elapsed_us;
+  uint64_t asleep_us;
+  uint64_t radio_pc; // Radio charge, pC (uA * us)
+  uint32_t radio_mhz;
+  uint32_t wakes[POWER_WAKE_COUNT];
+} power_policy_t;
+
+// Event rate of something that happens every period_us, in mHz
+static inline uint32_t power_rate_mhz(uint32_t period_us) {
+  return period_us != 0 ? 1000000000u / period_us : 0;
+}
+
+// Starts with nothing held, so light sleep is allowed right away
+void power_policy_init(power_policy_t *p, const power_policy_cfg_t *cfg,
+                       const power_policy_ops_t *ops, uint32_t now_ms);
+
+// Takes or drops one hold reason. POWER_HOLD_LINK lapses by itself after
+// link_hold_ms, taking it again restarts that
+void power_policy_hold(power_policy_t *p, power_hold_t hold, bool held,
+                       uint32_t now_ms);
+
+// Sum of the radio event rates of every link and advertising, in mHz
+void power_policy_radio(power_policy_t *p, uint32_t radio_mhz,
+                        uint32_t now_ms);
+
+// count light sleeps that ended for reason, slept_us long together
+void power_policy_wake(power_policy_t *p, power_wake_t reason, uint32_t count,
+                       uint64_t slept_us);
+
+// Runs the link hold timeout. Returns how many ms until it needs to run
+// again, or UINT32_MAX if nothing is scheduled
+uint32_t power_policy_tick(power_policy_t *p, uint32_t now_ms);
+
+void power_policy_stats(power_policy_t *p, uint32_t now_ms,
+                        power_stats_t *stats);
+
+#endif
@@ -0,0 +1,123 @@
+#include "report_builder.h"
+#include <string.h>
+
+#define BOOT_MODIFIER_BYTE (HID_BOOT_R0_IN_F0_OFFSET / 8)
+#define BOOT_FIRST_KEY_BYTE (HID_BOOT_R0_IN_F2_OFFSET / 8)
+#define NKRO_MODIFIER_BYTE (HID_COMPLEX_R4_IN_F0_OFFSET / 8)
+#define NKRO_FIRST_KEY_BIT HID_COMPLEX_R4_IN_F1_OFFSET
+
+// The byte-wise packing below relies on these layouts
+_Static_assert(HID_BOOT_R0_IN_F0_OFFSET % 8 == 0 &&
+                   HID_BOOT_R0_IN_F0_COUNT == 8 &&
+                   HID_BOOT_R0_IN_F2_OFFSET % 8 == 0 &&
+                   HID_BOOT_R0_IN_F2_SIZE == 8,
+               "unexpected boot keyboard report layout");
+_Static_assert(HID_COMPLEX_R4_IN_F0_OFFSET % 8 == 0 &&
+                   HID_COMPLEX_R4_IN_F0_COUNT == 8 &&
+                   HID_COMPLEX_R4_IN_F1_SIZE == 1 &&
+                   KBD_NKRO_USAGE_MIN + KBD_NKRO_USAGE_COUNT <= 0x100,
+               "unexpected NKRO keyboard report layout");
+
+static inline bool is_modifier(uint8_t usage) {
+  return usage >= HID_KEY_LEFT_CTRL && usage <= HID_KEY_RIGHT_GUI;
+}
+
+static inline bool bitmap_test(const uint32_t *bitmap, uint8_t usage) {
+  return (bitmap[usage >> 5] >> (usage & 31)) & 1;
+}
+
+// Updates the NKRO bitmap bit for usage, if the report has one for it
+static inline void nkro_set(report_builder_t *rb, uint8_t usage, bool pressed) {
+  if (usage < KBD_NKRO_USAGE_MIN ||
+      usage >= KBD_NKRO_USAGE_MIN + KBD_NKRO_USAGE_COUNT) {
+    return;
+  }
+
+  uint32_t bit = NKRO_FIRST_KEY_BIT + usage - KBD_NKRO_USAGE_MIN;
+  uint8_t mask = 1 << (bit & 7);
+  uint8_t *byte = &rb->nkro[bit >> 3];
+  *byte = pressed ? (*byte | mask) : (*byte & ~mask);
+}
+
+// Refills the boot key slots from the bitmap. Only done when leaving the
+// rollover state, and bounded by the 8 bitmap words
+static void boot_rebuild_slots(report_builder_t *rb) {
+  uint8_t *slots = &rb->boot[BOOT_FIRST_KEY_BYTE];
+  uint8_t n = 0;
+
+  memset(slots, HID_KEY_NONE, KBD_BOOT_REPORT_KEYS);
+  for (uint8_t word = 0; word < 8 && n < KBD_BOOT_REPORT_KEYS; word++) {
+    uint32_t bits = rb->pressed[word];
+    // Modifiers live in their own byte
+    if (word == (HID_KEY_LEFT_CTRL >> 5)) {
+      bits &= ~(0xFFu << (HID_KEY_LEFT_CTRL & 31));
+    }
+    while (bits && n < KBD_BOOT_REPORT_KEYS) {
+      slots[n++] = (word << 5) | __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+  }
+}
+
+void report_builder_init(report_builder_t *rb) { memset(rb, 0, sizeof(*rb)); }
+
+bool report_builder_rollover(const report_builder_t *rb) {
+  return rb->key_count > KBD_BOOT_REPORT_KEYS;
+}
+
+bool report_builder_apply(report_builder_t *rb, uint8_t usage, bool pressed) {
+  if (usage == HID_KEY_NONE || bitmap_test(rb->pressed, usage) == pressed) {
+    return false;
+  }
+
+  uint32_t word_mask = 1u << (usage & 31);
+  if (pressed) {
+    rb->pressed[usage >> 5] |= word_mask;
+  } else {
+    rb->pressed[usage >> 5] &= ~word_mask;
+  }
+
+  if (is_modifier(usage)) {
+    uint8_t mask = 1 << (usage - HID_KEY_LEFT_CTRL);
+    uint8_t mods = pressed ? (rb->boot[BOOT_MODIFIER_BYTE] | mask)
+                           : (rb->boot[BOOT_MODIFIER_BYTE] & ~mask);
+    rb->boot[BOOT_MODIFIER_BYTE] = mods;
+    rb->nkro[NKRO_MODIFIER_BYTE] = mods;
+    return true;
+  }
+
+  nkro_set(rb, usage, pressed);
+
+  uint8_t *slots = &rb->boot[BOOT_FIRST_KEY_BYTE];
+  if (pressed) {
+    rb->key_count++;
+    if (rb->key_count > KBD_BOOT_REPORT_KEYS) {
+      // Too many keys for the boot report, signal phantom state
+      memset(slots, HID_KEY_ERR_ROLLOVER, KBD_BOOT_REPORT_KEYS);
+      return true;
+    }
+    for (uint8_t i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+      if (slots[i] == HID_KEY_NONE) {
+        slots[i] = usage;
+        break;
+      }
+    }
+    return true;
+  }
+
+  rb->key_count--;
+  if (rb->key_count == KBD_BOOT_REPORT_KEYS) {
+    // Just left rollover, slots no longer describe the held keys
+    boot_rebuild_slots(rb);
+  } else if (rb->key_count < KBD_BOOT_REPORT_KEYS) {
+    // Remove the key and keep the remaining slots packed in press order
+    for (uint8_t i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+      if (slots[i] == usage) {
+        memmove(&slots[i], &slots[i + 1], KBD_BOOT_REPORT_KEYS - 1 - i);
+        slots[KBD_BOOT_REPORT_KEYS - 1] = HID_KEY_NONE;
+        break;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef REPORT_BUILDER_H
+#define REPORT_BUILDER_H
+
+#include "hid_layout.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HID_KEY_NONE 0x00
+#define HID_KEY_ERR_ROLLOVER 0x01
+#define HID_KEY_LEFT_CTRL 0xE0
+#define HID_KEY_RIGHT_GUI 0xE7
+
+// Boot / 6KRO keyboard report: modifiers, reserved, 6 key slots
+#define KBD_BOOT_REPORT_LEN HID_BOOT_R0_IN_LEN
+#define KBD_BOOT_REPORT_KEYS HID_BOOT_R0_IN_F2_COUNT
+
+// NKRO keyboard report (Report ID 4 of HID_COMPLEX_REPORT_MAP): modifiers
+// followed by one bit per usage starting at KBD_NKRO_USAGE_MIN
+#define KBD_NKRO_REPORT_ID 4
+#define KBD_NKRO_USAGE_MIN HID_COMPLEX_R4_IN_F1_USAGE_MIN
+#define KBD_NKRO_USAGE_COUNT HID_COMPLEX_R4_IN_F1_COUNT
+#define KBD_NKRO_REPORT_LEN HID_COMPLEX_R4_IN_LEN
+
+// Keeps the pressed state of every usage and incrementally maintains both
+// keyboard report layouts, so every event costs the same bounded amount of
+// work no matter how many keys are held
+typedef struct {
+  uint32_t pressed[8]; // 256-bit bitmap, one bit per usage
+  uint8_t key_count;   // Non-modifier keys currently held
+  uint8_t boot[KBD_BOOT_REPORT_LEN];
+  uint8_t nkro[KBD_NKRO_REPORT_LEN];
+} report_builder_t;
+
+void report_builder_init(report_builder_t *rb);
+
+// Applies a key down/up. Returns true if the key state changed, i.e. a new
+// report should be sent
+bool report_builder_apply(report_builder_t *rb, uint8_t usage, bool pressed);
+
+// True if more keys are held than the boot report can carry, in which case
+// its key slots all hold HID_KEY_ERR_ROLLOVER
+bool report_builder_rollover(const report_builder_t *rb);
+
+#endif
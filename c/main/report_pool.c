@@ -0,0 +1,91 @@
+#include "report_pool.h"
+#include "config.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host/ble_gatt.h"
+#include "host/ble_hs.h"
+#include "os/os_mempool.h"
+#include "sdkconfig.h"
+#include <stddef.h>
+
+#define REPORT_POOL_BLOCK_SIZE                                                 \
+  OS_ALIGN(sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) +            \
+               REPORT_POOL_DATA_LEN,                                           \
+           OS_ALIGNMENT)
+
+static os_membuf_t
+    report_pool_mem[OS_MEMPOOL_SIZE(REPORT_POOL_COUNT, REPORT_POOL_BLOCK_SIZE)];
+static struct os_mempool report_mempool;
+static struct os_mbuf_pool report_mbuf_pool;
+
+static struct report_pool_stats pool_stats;
+
+// The NimBLE host task while it is on the report path, NULL otherwise
+static TaskHandle_t report_path_task;
+static volatile uint32_t report_path_allocs;
+
+#if CONFIG_HEAP_USE_HOOKS
+// Called by the heap for every allocation, from any task
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size,
+                                         uint32_t caps) {
+  if (report_path_task != NULL &&
+      xTaskGetCurrentTaskHandle() == report_path_task) {
+    report_path_allocs++;
+  }
+}
+#endif
+
+int report_pool_init(void) {
+  int rc;
+
+  rc = os_mempool_init(&report_mempool, REPORT_POOL_COUNT,
+                       REPORT_POOL_BLOCK_SIZE, report_pool_mem, "report_pool");
+  if (rc != 0) {
+    ESP_LOGE(TAG, "failed to init report mempool, error code: %d", rc);
+    return rc;
+  }
+  rc = os_mbuf_pool_init(&report_mbuf_pool, &report_mempool,
+                         REPORT_POOL_BLOCK_SIZE, REPORT_POOL_COUNT);
+  if (rc != 0) {
+    ESP_LOGE(TAG, "failed to init report mbuf pool, error code: %d", rc);
+    return rc;
+  }
+  return 0;
+}
+
+int report_pool_notify(uint16_t conn_handle, uint16_t val_handle,
+                       const uint8_t *data, uint8_t len) {
+  if (len > REPORT_POOL_DATA_LEN) {
+    return BLE_HS_EINVAL;
+  }
+  struct os_mbuf *om = os_mbuf_get_pkthdr(&report_mbuf_pool, 0);
+  if (om == NULL) {
+    pool_stats.empty++;
+    return BLE_HS_ENOMEM;
+  }
+  pool_stats.taken++;
+
+  // Fits the block, so this is a plain copy and can not fail
+  os_mbuf_append(om, data, len);
+  // Consumes om, also on failure. ENOMEM here is the ATT header's msys mbuf
+  int rc = ble_gatts_notify_custom(conn_handle, val_handle, om);
+  if (rc == BLE_HS_ENOMEM) {
+    pool_stats.msys_empty++;
+  }
+  return rc;
+}
+
+void report_pool_path_enter(void) {
+  report_path_task = xTaskGetCurrentTaskHandle();
+}
+
+void report_pool_path_exit(void) { report_path_task = NULL; }
+
+void report_pool_get_stats(struct report_pool_stats *stats) {
+  *stats = pool_stats;
+  stats->free = report_mempool.mp_num_free;
+  stats->min_free = report_mempool.mp_min_free;
+  stats->heap_allocs = report_path_allocs;
+}
@@ -0,0 +1,52 @@
+#ifndef REPORT_POOL_H
+#define REPORT_POOL_H
+
+#include "hogp_conn.h"
+#include "hogp_tx.h"
+#include "os/os_mbuf.h"
+#include <stdint.h>
+
+// Dedicated mbuf pool for report notifications. Its memory is static and set
+// up once at init, so sending a report never touches the heap. The report is
+// copied into a block from this pool and nothing is chained to it.
+//
+// It does not take the stack off msys: ble_att_clt_tx_notify() takes a fresh
+// msys mbuf for the 3 byte ATT header and chains the report behind it, so
+// every notification still needs one msys block, a small one, and competes
+// with ACL traffic for it. The blocks here have no leading space for that
+// reason.
+//
+// An empty pool, or an empty msys, is backpressure, not a drop: the report
+// stays in the tx queue (HOGP_TX_BUSY) and key events stay in the key ring
+// until mbufs come back from the controller. Both are counted.
+
+// A burst to every host can be in flight at once
+#define REPORT_POOL_COUNT (HOGP_TX_BURST_MAX * HOGP_MAX_CONNS)
+#define REPORT_POOL_DATA_LEN HOGP_CONN_LAST_REPORT_LEN
+
+struct report_pool_stats {
+  uint32_t taken;
+  uint32_t empty;       // Times a report had to wait for a free mbuf
+  uint32_t msys_empty;  // Same, for the ATT header's msys mbuf
+  uint16_t free;
+  uint16_t min_free;
+  uint32_t heap_allocs; // Heap allocations on the report path, see below
+};
+
+int report_pool_init(void);
+
+// Notifies data from a pool mbuf. BLE_HS_ENOMEM if this pool or msys is
+// empty, otherwise what ble_gatts_notify_custom() returned. Only called from
+// the NimBLE host task
+int report_pool_notify(uint16_t conn_handle, uint16_t val_handle,
+                       const uint8_t *data, uint8_t len);
+
+// Brackets the report path on the NimBLE host task. With CONFIG_HEAP_USE_HOOKS
+// any heap allocation the task makes in between is counted in heap_allocs,
+// which should stay 0 once the first report went out
+void report_pool_path_enter(void);
+void report_pool_path_exit(void);
+
+void report_pool_get_stats(struct report_pool_stats *stats);
+
+#endif
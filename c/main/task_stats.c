@@ -0,0 +1,77 @@
+#include "task_stats.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+_Static_assert(sizeof(task_stats_task_t) == 20,
+               "task_stats_task_t is sent as is");
+
+static task_jitter_stats_t jitter[TASK_JITTER_COUNT];
+
+// Run time counters of the previous sample, to turn them into deltas
+static TaskStatus_t task_status[TASK_STATS_MAX_TASKS];
+static struct {
+  TaskHandle_t handle;
+  configRUN_TIME_COUNTER_TYPE run;
+} task_prev[TASK_STATS_MAX_TASKS];
+static size_t task_prev_count;
+static configRUN_TIME_COUNTER_TYPE total_prev;
+
+void task_stats_jitter(task_jitter_t src, uint32_t us) {
+  task_jitter_stats_t *stats = &jitter[src];
+  uint32_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+
+  if (bucket >= TASK_STATS_JITTER_BUCKETS) {
+    bucket = TASK_STATS_JITTER_BUCKETS - 1;
+  }
+  stats->buckets[bucket]++;
+  if (us > stats->max_us) {
+    stats->max_us = us;
+  }
+  stats->count++;
+}
+
+void task_stats_jitter_get(task_jitter_t src, task_jitter_stats_t *stats) {
+  *stats = jitter[src];
+}
+
+static configRUN_TIME_COUNTER_TYPE prev_run(TaskHandle_t handle) {
+  for (size_t i = 0; i < task_prev_count; i++) {
+    if (task_prev[i].handle == handle) {
+      return task_prev[i].run;
+    }
+  }
+  // Started since the previous sample
+  return 0;
+}
+
+size_t task_stats_sample(task_stats_task_t *out, size_t max,
+                         uint32_t *elapsed_us) {
+  configRUN_TIME_COUNTER_TYPE total;
+  size_t count =
+      uxTaskGetSystemState(task_status, TASK_STATS_MAX_TASKS, &total);
+  size_t n = count < max ? count : max;
+
+  *elapsed_us = total - total_prev;
+  total_prev = total;
+
+  for (size_t i = 0; i < n; i++) {
+    const TaskStatus_t *status = &task_status[i];
+    task_stats_task_t *task = &out[i];
+
+    memset(task->name, 0, sizeof(task->name));
+    strncpy(task->name, status->pcTaskName, sizeof(task->name));
+    task->core = status->xCoreID == tskNO_AFFINITY ? 0xFF : status->xCoreID;
+    task->priority = status->uxCurrentPriority;
+    task->stack_free = status->usStackHighWaterMark;
+    task->run_us = status->ulRunTimeCounter - prev_run(status->xHandle);
+  }
+
+  // Deleted tasks drop out here
+  task_prev_count = count;
+  for (size_t i = 0; i < count; i++) {
+    task_prev[i].handle = task_status[i].xHandle;
+    task_prev[i].run = task_status[i].ulRunTimeCounter;
+  }
+  return n;
+}
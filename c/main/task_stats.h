@@ -0,0 +1,53 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the CPU time goes, per task, and how late the input side gets to run
+// after it was woken. Meant to check the task layout in config.h: the input
+// core should show no BLE task and wake jitter that does not move with radio
+// traffic.
+//
+// Every jitter source has a single writer and the counters are plain 32-bit
+// stores, so recording takes no lock. A reader on another core may see one
+// sample half counted, which does not matter for statistics.
+
+// Tasks reported, must cover every task in the system
+#define TASK_STATS_MAX_TASKS 24
+// Bucket n counts wakeups of under 2^n us, the last one everything slower
+#define TASK_STATS_JITTER_BUCKETS 16
+
+typedef enum {
+  TASK_JITTER_SCAN, // Scan timer or column interrupt -> scan task running
+  TASK_JITTER_HOST, // Key event posted -> NimBLE host task draining the ring
+  TASK_JITTER_COUNT
+} task_jitter_t;
+
+typedef struct {
+  uint32_t count;
+  uint32_t max_us;
+  uint32_t buckets[TASK_STATS_JITTER_BUCKETS];
+} task_jitter_stats_t;
+
+// 20 bytes, dumped as is (little endian) by the diagnostics service
+typedef struct {
+  char name[12];       // Cut short and NUL padded
+  uint8_t core;        // 0xFF if not pinned
+  uint8_t priority;
+  uint16_t stack_free; // Least free stack seen, in bytes
+  uint32_t run_us;     // CPU time since the previous sample
+} task_stats_task_t;
+
+void task_stats_jitter(task_jitter_t src, uint32_t us);
+
+void task_stats_jitter_get(task_jitter_t src, task_jitter_stats_t *stats);
+
+// Fills in every task's CPU time since the previous call and returns how
+// many there are, 0 if there are more than TASK_STATS_MAX_TASKS tasks.
+// *elapsed_us is the wall time since the previous call. Not reentrant, call
+// it from one task only
+size_t task_stats_sample(task_stats_task_t *out, size_t max,
+                         uint32_t *elapsed_us);
+
+#endif
@@ -0,0 +1,321 @@
+#include "usb_bridge.h"
+#include "config.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "hogp_gatt_svr.h"
+#include "klog.h"
+#include "pointer_mgr.h"
+#include "power_mgr.h"
+#include "usb/hid_host.h"
+#include "usb/usb_host.h"
+#include "usb_kbd_translate.h"
+
+#define USB_BRIDGE_QUEUE_LEN 8
+// Largest input report read from the keyboard
+#define USB_REPORT_MAX_LEN 64
+// Boot mouse report: buttons, X, Y, then optionally a wheel byte
+#define USB_MOUSE_REPORT_MIN_LEN 3
+
+// Everything that opens, closes or talks to the device over the control pipe
+// goes through the bridge task, so none of it blocks the HID driver task or
+// the NimBLE host task
+typedef enum {
+  USB_BRIDGE_EV_DEVICE, // A HID interface appeared
+  USB_BRIDGE_EV_CLOSE,  // The keyboard or mouse is gone
+  USB_BRIDGE_EV_LEDS,   // A BLE host wrote the LED report
+} usb_bridge_ev_type_t;
+
+typedef struct {
+  usb_bridge_ev_type_t type;
+  hid_host_device_handle_t handle;
+  uint8_t leds;
+} usb_bridge_ev_t;
+
+static QueueHandle_t bridge_queue;
+// Only touched by the bridge task
+static hid_host_device_handle_t kbd_handle;
+static hid_host_device_handle_t mouse_handle;
+
+// Only touched by the HID driver task, which is the only producer of the key
+// ring while bridging
+static usb_kbd_translator_t translator;
+static uint32_t report_timestamp_us;
+static struct usb_bridge_stats bridge_stats;
+
+static void usb_bridge_post(const usb_bridge_ev_t *ev) {
+  if (xQueueSend(bridge_queue, ev, 0) != pdTRUE) {
+    KLOG_W(USB, "usb bridge queue full, event %d lost", ev->type);
+  }
+}
+
+static void usb_kbd_key(uint8_t usage, bool pressed, void *arg) {
+  if (hogp_gatt_svr_post_key_at(usage, pressed, report_timestamp_us) != 0) {
+    bridge_stats.dropped++;
+  }
+}
+
+static void usb_kbd_interface_cb(hid_host_device_handle_t handle,
+                                 const hid_host_interface_event_t event,
+                                 void *arg) {
+  uint8_t report[USB_REPORT_MAX_LEN];
+  size_t len = 0;
+
+  switch (event) {
+  case HID_HOST_INTERFACE_EVENT_INPUT_REPORT:
+    report_timestamp_us = (uint32_t)esp_timer_get_time();
+    if (hid_host_device_get_raw_input_report_data(handle, report,
+                                                  sizeof(report),
+                                                  &len) != ESP_OK) {
+      return;
+    }
+    bridge_stats.reports++;
+    bridge_stats.key_events +=
+        usb_kbd_translate(&translator, report, len, usb_kbd_key, NULL);
+
+    uint32_t elapsed = (uint32_t)esp_timer_get_time() - report_timestamp_us;
+    if (elapsed > bridge_stats.max_translate_us) {
+      bridge_stats.max_translate_us = elapsed;
+    }
+    break;
+
+  case HID_HOST_INTERFACE_EVENT_DISCONNECTED:
+    // Nothing stays stuck down on the BLE side
+    report_timestamp_us = (uint32_t)esp_timer_get_time();
+    bridge_stats.key_events +=
+        usb_kbd_release_all(&translator, usb_kbd_key, NULL);
+    usb_bridge_post(&(usb_bridge_ev_t){
+        .type = USB_BRIDGE_EV_CLOSE,
+        .handle = handle,
+    });
+    break;
+
+  case HID_HOST_INTERFACE_EVENT_TRANSFER_ERROR:
+    KLOG_W(USB, "usb keyboard transfer error");
+    break;
+
+  default:
+    break;
+  }
+}
+
+// Mouse reports go into the pointer accumulator as they come, at the
+// mouse's polling rate. It is sent on at the BLE host's pace
+static void usb_mouse_interface_cb(hid_host_device_handle_t handle,
+                                   const hid_host_interface_event_t event,
+                                   void *arg) {
+  uint8_t report[USB_REPORT_MAX_LEN];
+  size_t len = 0;
+
+  switch (event) {
+  case HID_HOST_INTERFACE_EVENT_INPUT_REPORT:
+    if (hid_host_device_get_raw_input_report_data(handle, report,
+                                                  sizeof(report),
+                                                  &len) != ESP_OK ||
+        len < USB_MOUSE_REPORT_MIN_LEN) {
+      return;
+    }
+    bridge_stats.mouse_reports++;
+    pointer_mgr_buttons(report[0]);
+    pointer_mgr_move((int8_t)report[1], (int8_t)report[2]);
+    if (len > USB_MOUSE_REPORT_MIN_LEN) {
+      pointer_mgr_scroll((int8_t)report[3], 0);
+    }
+    break;
+
+  case HID_HOST_INTERFACE_EVENT_DISCONNECTED:
+    pointer_mgr_buttons(0);
+    usb_bridge_post(&(usb_bridge_ev_t){
+        .type = USB_BRIDGE_EV_CLOSE,
+        .handle = handle,
+    });
+    break;
+
+  case HID_HOST_INTERFACE_EVENT_TRANSFER_ERROR:
+    KLOG_W(USB, "usb mouse transfer error");
+    break;
+
+  default:
+    break;
+  }
+}
+
+// Called from the HID driver task
+static void usb_hid_device_cb(hid_host_device_handle_t handle,
+                              const hid_host_driver_event_t event, void *arg) {
+  if (event == HID_HOST_DRIVER_EVENT_CONNECTED) {
+    usb_bridge_post(&(usb_bridge_ev_t){
+        .type = USB_BRIDGE_EV_DEVICE,
+        .handle = handle,
+    });
+  }
+}
+
+// Called from the NimBLE host task
+static void usb_bridge_leds(uint8_t leds) {
+  usb_bridge_post(&(usb_bridge_ev_t){
+      .type = USB_BRIDGE_EV_LEDS,
+      .leds = leds,
+  });
+}
+
+// Boot protocol mice report buttons and 8-bit X/Y (and often a wheel), no
+// matter what their own report descriptor says
+static void usb_bridge_open_mouse(hid_host_device_handle_t handle) {
+  hid_class_request_set_protocol(handle, HID_REPORT_PROTOCOL_BOOT);
+
+  esp_err_t rc = hid_host_device_start(handle);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to start usb mouse, error code: %d", rc);
+    hid_host_device_close(handle);
+    return;
+  }
+  mouse_handle = handle;
+  ESP_LOGI(TAG, "usb mouse connected");
+}
+
+// Takes the first boot keyboard and the first boot mouse interface.
+// Anything else (report-only devices, a second keyboard) is never opened
+static void usb_bridge_open(hid_host_device_handle_t handle) {
+  hid_host_dev_params_t params;
+
+  esp_err_t rc = hid_host_device_get_params(handle, &params);
+  if (rc != ESP_OK || params.sub_class != HID_SUBCLASS_BOOT_INTERFACE) {
+    return;
+  }
+  bool mouse = params.proto == HID_PROTOCOL_MOUSE;
+  if (mouse ? mouse_handle != NULL
+            : kbd_handle != NULL || params.proto != HID_PROTOCOL_KEYBOARD) {
+    return;
+  }
+
+  hid_host_device_config_t dev_cfg = {
+      .callback = mouse ? usb_mouse_interface_cb : usb_kbd_interface_cb,
+  };
+  rc = hid_host_device_open(handle, &dev_cfg);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to open usb hid device, error code: %d", rc);
+    return;
+  }
+  if (mouse) {
+    usb_bridge_open_mouse(handle);
+    return;
+  }
+
+  // Boot protocol reports have our boot report's layout, and without idle
+  // reports the keyboard only sends when something changed
+  hid_class_request_set_protocol(handle, HID_REPORT_PROTOCOL_BOOT);
+  hid_class_request_set_idle(handle, 0, 0);
+
+  usb_kbd_translator_init(&translator);
+  rc = hid_host_device_start(handle);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to start usb keyboard, error code: %d", rc);
+    hid_host_device_close(handle);
+    return;
+  }
+  kbd_handle = handle;
+  ESP_LOGI(TAG, "usb keyboard connected");
+}
+
+static void usb_bridge_task(void *param) {
+  usb_bridge_ev_t ev;
+
+  for (;;) {
+    if (xQueueReceive(bridge_queue, &ev, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+
+    switch (ev.type) {
+    case USB_BRIDGE_EV_DEVICE:
+      usb_bridge_open(ev.handle);
+      break;
+
+    case USB_BRIDGE_EV_CLOSE:
+      hid_host_device_close(ev.handle);
+      if (ev.handle == kbd_handle) {
+        kbd_handle = NULL;
+        ESP_LOGI(TAG, "usb keyboard disconnected");
+      } else if (ev.handle == mouse_handle) {
+        mouse_handle = NULL;
+        ESP_LOGI(TAG, "usb mouse disconnected");
+      }
+      break;
+
+    case USB_BRIDGE_EV_LEDS:
+      if (kbd_handle != NULL &&
+          hid_class_request_set_report(kbd_handle, HID_REPORT_TYPE_OUTPUT, 0,
+                                       &ev.leds, sizeof(ev.leds)) == ESP_OK) {
+        bridge_stats.led_writes++;
+      }
+      break;
+    }
+  }
+}
+
+// Runs the USB host library, device enumeration happens in here
+static void usb_lib_task(void *param) {
+  for (;;) {
+    uint32_t flags;
+    usb_host_lib_handle_events(portMAX_DELAY, &flags);
+    if (flags & USB_HOST_LIB_EVENT_FLAGS_NO_CLIENTS) {
+      usb_host_device_free_all();
+    }
+  }
+}
+
+int usb_bridge_init(void) {
+  esp_err_t rc;
+
+  bridge_queue = xQueueCreate(USB_BRIDGE_QUEUE_LEN, sizeof(usb_bridge_ev_t));
+  if (bridge_queue == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  // The USB host does not survive light sleep
+  power_mgr_hold(POWER_HOLD_USB, true);
+
+  usb_host_config_t host_cfg = {
+      .skip_phy_setup = false,
+      .intr_flags = ESP_INTR_FLAG_LEVEL1,
+  };
+  rc = usb_host_install(&host_cfg);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to install usb host, error code: %d", rc);
+    return rc;
+  }
+  if (xTaskCreatePinnedToCore(usb_lib_task, "USB host", USB_BRIDGE_TASK_STACK,
+                              NULL, USB_BRIDGE_TASK_PRIO, NULL,
+                              CORE_INPUT) != pdPASS) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  hid_host_driver_config_t hid_cfg = {
+      .create_background_task = true,
+      .task_priority = USB_HID_TASK_PRIO,
+      .stack_size = USB_HID_TASK_STACK,
+      .core_id = CORE_INPUT,
+      .callback = usb_hid_device_cb,
+  };
+  rc = hid_host_install(&hid_cfg);
+  if (rc != ESP_OK) {
+    ESP_LOGE(TAG, "failed to install usb hid host, error code: %d", rc);
+    return rc;
+  }
+
+  if (xTaskCreatePinnedToCore(usb_bridge_task, "USB bridge",
+                              USB_BRIDGE_TASK_STACK, NULL, USB_BRIDGE_TASK_PRIO,
+                              NULL, CORE_INPUT) != pdPASS) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  hogp_gatt_svr_set_led_cb(usb_bridge_leds);
+  ESP_LOGI(TAG, "usb bridge waiting for a keyboard");
+  return 0;
+}
+
+void usb_bridge_get_stats(struct usb_bridge_stats *stats) {
+  *stats = bridge_stats;
+}
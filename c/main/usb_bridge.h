@@ -0,0 +1,26 @@
+#ifndef USB_BRIDGE_H
+#define USB_BRIDGE_H
+
+#include <stdint.h>
+
+// USB keyboard to BLE bridge. A keyboard on the OTG port is put in boot
+// protocol, its input reports are turned into key events for the HOGP server
+// (see usb_kbd_translate.h) and LED writes from the BLE host are sent back to
+// it as output reports. A boot protocol mouse is bridged too, its reports go
+// into the pointer accumulator (pointer_mgr.h).
+
+struct usb_bridge_stats {
+  uint32_t reports;          // Input reports from the keyboard
+  uint32_t key_events;       // Key events they turned into
+  uint32_t dropped;          // Key presses the key ring had no room for
+  uint32_t max_translate_us; // Report received to its key events posted,
+                             // see KEY_TRACE_SPAN_BUILD for the whole hop
+  uint32_t led_writes;       // Output reports sent to the keyboard
+  uint32_t mouse_reports;    // Input reports from the mouse
+};
+
+int usb_bridge_init(void);
+
+void usb_bridge_get_stats(struct usb_bridge_stats *stats);
+
+#endif
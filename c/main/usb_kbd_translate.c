@@ -0,0 +1,71 @@
+#include "usb_kbd_translate.h"
+#include <string.h>
+
+#define USB_KBD_MODIFIER_BYTE (HID_BOOT_R0_IN_F0_OFFSET / 8)
+#define USB_KBD_FIRST_KEY_BYTE (HID_BOOT_R0_IN_F2_OFFSET / 8)
+
+static bool slots_contain(const uint8_t *slots, uint8_t usage) {
+  for (size_t i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+    if (slots[i] == usage) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void usb_kbd_translator_init(usb_kbd_translator_t *t) {
+  memset(t->prev, 0, sizeof(t->prev));
+}
+
+size_t usb_kbd_translate(usb_kbd_translator_t *t, const uint8_t *report,
+                         size_t len, usb_kbd_key_fn key, void *arg) {
+  if (len < USB_KBD_REPORT_LEN) {
+    return 0;
+  }
+
+  const uint8_t *keys = &report[USB_KBD_FIRST_KEY_BYTE];
+  const uint8_t *prev_keys = &t->prev[USB_KBD_FIRST_KEY_BYTE];
+  if (keys[0] == HID_KEY_ERR_ROLLOVER) {
+    // Too many keys down, the keyboard can not tell which. Hold on to the
+    // last known state until it can
+    return 0;
+  }
+
+  size_t events = 0;
+  uint8_t mods = report[USB_KBD_MODIFIER_BYTE];
+  uint8_t prev_mods = t->prev[USB_KBD_MODIFIER_BYTE];
+
+  // Releases first
+  for (size_t i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+    if (prev_keys[i] != HID_KEY_NONE && !slots_contain(keys, prev_keys[i])) {
+      key(prev_keys[i], false, arg);
+      events++;
+    }
+  }
+  uint8_t released = prev_mods & ~mods;
+  for (; released; released &= released - 1) {
+    key(HID_KEY_LEFT_CTRL + __builtin_ctz(released), false, arg);
+    events++;
+  }
+
+  uint8_t pressed = mods & ~prev_mods;
+  for (; pressed; pressed &= pressed - 1) {
+    key(HID_KEY_LEFT_CTRL + __builtin_ctz(pressed), true, arg);
+    events++;
+  }
+  for (size_t i = 0; i < KBD_BOOT_REPORT_KEYS; i++) {
+    if (keys[i] != HID_KEY_NONE && !slots_contain(prev_keys, keys[i])) {
+      key(keys[i], true, arg);
+      events++;
+    }
+  }
+
+  memcpy(t->prev, report, USB_KBD_REPORT_LEN);
+  return events;
+}
+
+size_t usb_kbd_release_all(usb_kbd_translator_t *t, usb_kbd_key_fn key,
+                           void *arg) {
+  static const uint8_t released[USB_KBD_REPORT_LEN] = {0};
+  return usb_kbd_translate(t, released, sizeof(released), key, arg);
+}
@@ -0,0 +1,45 @@
+#ifndef USB_KBD_TRANSLATE_H
+#define USB_KBD_TRANSLATE_H
+
+#include "report_builder.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Turns boot protocol keyboard reports from a USB keyboard into key events.
+// The USB report has our own boot report's layout, so its fields are read at
+// the same generated offsets, and only the keys that changed since the
+// previous report are passed on. Releases come before presses, so the report
+// builder never holds more keys than the USB keyboard did.
+//
+// Reports are not forwarded byte for byte, not even to a host in boot
+// protocol. The key events go through the key ring and the HOGP server
+// builds every host's report from them, so one key state serves hosts in
+// either protocol mode and a host can switch modes with keys held. That
+// costs one ring hop to the NimBLE host task: key_trace.h measures it as
+// KEY_TRACE_SPAN_BUILD, USB report received to report built.
+//
+// No USB code in here, reports are passed in, so captured report streams can
+// be replayed through it.
+
+#define USB_KBD_REPORT_LEN KBD_BOOT_REPORT_LEN
+
+typedef void (*usb_kbd_key_fn)(uint8_t usage, bool pressed, void *arg);
+
+typedef struct {
+  uint8_t prev[USB_KBD_REPORT_LEN]; // Last report that was applied
+} usb_kbd_translator_t;
+
+void usb_kbd_translator_init(usb_kbd_translator_t *t);
+
+// Diffs report against the previous one and calls key for every change.
+// Returns the number of key events, 0 for short reports and for rollover
+// (phantom) reports, which leave the state as it was
+size_t usb_kbd_translate(usb_kbd_translator_t *t, const uint8_t *report,
+                         size_t len, usb_kbd_key_fn key, void *arg);
+
+// Releases everything still held, e.g. when the keyboard is unplugged
+size_t usb_kbd_release_all(usb_kbd_translator_t *t, usb_kbd_key_fn key,
+                           void *arg);
+
+#endif
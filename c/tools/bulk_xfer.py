@@ -0,0 +1,452 @@
+#!/usr/bin/env python3
+"""Moves data over the bulk channel (main/bulk.h, main/bulk_mgr.h).
+
+Connects to the keyboard's L2CAP connection-oriented channel through BlueZ.
+The keyboard has to be paired already (bluetoothctl), the channel only opens
+on an encrypted link. With --stand-in it talks to the device side running in
+this process instead, over a local SEQPACKET socket pair, to test the
+protocol and this tool on Linux without a keyboard. The stand-in is
+main/bulk.c and main/macro.c themselves, loaded through ctypes from a shared
+library built for the host (--lib, host_test/CMakeLists.txt builds it as
+bulk_sim), with flash and the rest of macro_mgr.c and bulk_mgr.c modelled
+here. It starts out empty on every run. Its bench rates are those of the
+local socket and say nothing about the radio.
+
+Commands:
+
+  upload <store.bin>      uploads a macro store built by macro_compile.py
+  verify <store.bin>      uploads it and reads it back to compare
+  dump macros <file>      reads back the macro store in use
+  dump trace <file>       reads the whole key trace ring, the file decodes
+                          with decode_key_trace.py like a Records read
+  bench [<bytes>]         uploads to the sink and dumps the test pattern,
+                          default 256 KiB each way, and prints the throughput
+
+Usage: bulk_xfer.py (--stand-in --lib <libbulk_sim.so> | --addr <address> [--random]) [--psm <psm>] <command> [<args>]
+"""
+
+import ctypes
+import errno
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+
+# main/bulk.h
+OP_BEGIN, OP_DATA, OP_COMMIT, OP_DUMP, OP_ABORT = 1, 2, 3, 4, 5
+OP_STATUS = 0x80
+STATUS = struct.Struct("<BBBII")
+SDU_MAX = 2048
+TARGET_MACROS, TARGET_SINK = 0, 1
+SOURCE_MACROS, SOURCE_KEY_TRACE, SOURCE_PATTERN = 0, 1, 2
+ERRORS = ["ok", "bad op", "wrong state", "no such target", "out of range",
+          "flash error", "rejected by target", "link error"]
+OK, ERR_OP, ERR_STATE, ERR_TARGET, ERR_RANGE, ERR_FLASH, ERR_REJECTED = \
+    range(7)
+
+# main/config.h
+PSM = 0x00A1
+
+# main/macro.h, partitions.csv
+STORE_HDR_LEN = 16
+(MACRO_OK, MACRO_ERR_HEADER, MACRO_ERR_CRC, MACRO_ERR_OPS, MACRO_ERR_STATE,
+ MACRO_ERR_RANGE, MACRO_ERR_FLASH) = range(7)
+PARTITION_SIZE = 0x10000
+
+# Linux <bluetooth/bluetooth.h>, <bluetooth/l2cap.h>
+AF_BLUETOOTH = 31
+BTPROTO_L2CAP = 0
+SOL_BLUETOOTH = 274
+BT_SECURITY = 4
+BT_SECURITY_MEDIUM = 2
+BT_SNDMTU = 12
+BT_RCVMTU = 13
+BDADDR_LE_PUBLIC = 1
+BDADDR_LE_RANDOM = 2
+
+
+class BulkError(Exception):
+    pass
+
+
+class SockaddrL2(ctypes.Structure):
+    _fields_ = [("family", ctypes.c_ushort), ("psm", ctypes.c_ushort),
+                ("bdaddr", ctypes.c_ubyte * 6), ("cid", ctypes.c_ushort),
+                ("bdaddr_type", ctypes.c_ubyte)]
+
+
+def l2cap_connect(addr, addr_type, psm):
+    """An LE CoC socket to addr, returns (socket, send MTU)."""
+    libc = ctypes.CDLL(None, use_errno=True)
+
+    def check(rc, what):
+        if rc < 0:
+            err = ctypes.get_errno()
+            raise OSError(err, f"{what}: {errno.errorcode.get(err)}")
+        return rc
+
+    fd = check(libc.socket(AF_BLUETOOTH, socket.SOCK_SEQPACKET,
+                           BTPROTO_L2CAP), "socket")
+    sock = socket.socket(fileno=fd)
+    local = SockaddrL2(AF_BLUETOOTH, 0, (ctypes.c_ubyte * 6)(), 0,
+                       BDADDR_LE_PUBLIC)
+    check(libc.bind(fd, ctypes.byref(local), ctypes.sizeof(local)), "bind")
+    sock.setsockopt(SOL_BLUETOOTH, BT_SECURITY,
+                    struct.pack("BB", BT_SECURITY_MEDIUM, 0))
+    sock.setsockopt(SOL_BLUETOOTH, BT_RCVMTU, struct.pack("H", SDU_MAX))
+
+    octets = bytes(int(b, 16) for b in addr.split(":"))
+    if len(octets) != 6:
+        raise BulkError(f"bad address {addr!r}")
+    remote = SockaddrL2(AF_BLUETOOTH, psm,
+                        (ctypes.c_ubyte * 6)(*reversed(octets)), 0, addr_type)
+    check(libc.connect(fd, ctypes.byref(remote), ctypes.sizeof(remote)),
+          "connect")
+    (mtu,) = struct.unpack("H", sock.getsockopt(SOL_BLUETOOTH, BT_SNDMTU, 2))
+    return sock, min(mtu, SDU_MAX)
+
+
+class BulkOps(ctypes.Structure):
+    """bulk_ops_t"""
+
+    BEGIN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_uint8, ctypes.c_uint32,
+                             ctypes.c_void_p)
+    WRITE = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_uint8, ctypes.c_uint32,
+                             ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint16,
+                             ctypes.c_void_p)
+    COMMIT = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_uint8, ctypes.c_void_p)
+    ABORT = ctypes.CFUNCTYPE(None, ctypes.c_uint8, ctypes.c_void_p)
+    READ = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_uint8, ctypes.c_uint32,
+                            ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint16,
+                            ctypes.c_void_p)
+    SEND = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.POINTER(ctypes.c_uint8),
+                            ctypes.c_uint16, ctypes.c_void_p)
+
+    _fields_ = [("begin", BEGIN), ("write", WRITE), ("commit", COMMIT),
+                ("abort", ABORT), ("read", READ), ("send", SEND),
+                ("arg", ctypes.c_void_p)]
+
+
+class BulkT(ctypes.Structure):
+    """bulk_t"""
+
+    _fields_ = [("ops", ctypes.POINTER(BulkOps)), ("mtu", ctypes.c_uint16),
+                ("state", ctypes.c_uint8), ("target", ctypes.c_uint8),
+                ("err", ctypes.c_uint8), ("len", ctypes.c_uint32),
+                ("offset", ctypes.c_uint32), ("begin_us", ctypes.c_uint32),
+                ("stats", ctypes.c_uint32 * 5),
+                ("buf", ctypes.c_uint8 * SDU_MAX)]
+
+
+def load(path):
+    lib = ctypes.CDLL(path)
+    bulk = ctypes.POINTER(BulkT)
+    for name, args in (
+            ("bulk_init", [bulk, ctypes.POINTER(BulkOps)]),
+            ("bulk_open", [bulk, ctypes.c_uint16]),
+            ("bulk_close", [bulk]),
+            ("bulk_rx", [bulk, ctypes.c_char_p, ctypes.c_uint16,
+                         ctypes.c_uint32])):
+        fn = getattr(lib, name)
+        fn.argtypes = args
+        fn.restype = None
+    lib.macro_store_check.argtypes = [ctypes.c_char_p, ctypes.c_size_t,
+                                      ctypes.POINTER(ctypes.c_uint8)]
+    lib.macro_store_check.restype = ctypes.c_int
+    return lib
+
+
+class StandIn(threading.Thread):
+    """The device side on one end of a socket pair: bulk.c with the ops of
+    main/bulk_mgr.c, and the upload and read of main/macro_mgr.c on a
+    bytearray for flash, erased a sector at a time as the upload reaches it.
+    Stores are checked by macro.c's macro_store_check()."""
+
+    SECTOR = 4096
+
+    def __init__(self, sock, lib):
+        super().__init__(daemon=True)
+        self.sock = sock
+        self.lib = lib
+        self.flash = bytearray(b"\xff" * PARTITION_SIZE)
+        self.store_len = 0
+        self.uploading = False
+        self.upload_len = self.written = self.erased = 0
+        # Kept here, C holds pointers to them
+        self.ops = BulkOps(BulkOps.BEGIN(self.begin),
+                           BulkOps.WRITE(self.write),
+                           BulkOps.COMMIT(self.commit),
+                           BulkOps.ABORT(self.abort),
+                           BulkOps.READ(self.read),
+                           BulkOps.SEND(self.send), None)
+        self.bulk = BulkT()
+        lib.bulk_init(self.bulk, self.ops)
+
+    def run(self):
+        start = time.monotonic()
+        self.lib.bulk_open(self.bulk, SDU_MAX)
+        while True:
+            try:
+                sdu = self.sock.recv(SDU_MAX)
+            except OSError:
+                break
+            if not sdu:
+                break
+            now_us = int((time.monotonic() - start) * 1e6) & 0xFFFFFFFF
+            self.lib.bulk_rx(self.bulk, sdu, len(sdu), now_us)
+        self.lib.bulk_close(self.bulk)
+
+    @staticmethod
+    def bulk_err(err):
+        """bulk_mgr.c's bulk_macro_err()"""
+        return {MACRO_OK: OK, MACRO_ERR_STATE: ERR_STATE,
+                MACRO_ERR_RANGE: ERR_RANGE,
+                MACRO_ERR_FLASH: ERR_FLASH}.get(err, ERR_REJECTED)
+
+    def map_store(self):
+        count = ctypes.c_uint8()
+        err = self.lib.macro_store_check(bytes(self.flash), len(self.flash),
+                                         ctypes.byref(count))
+        self.store_len = (struct.unpack_from("<I", self.flash, 8)[0]
+                          if err == MACRO_OK else 0)
+        return err
+
+    def begin(self, target, length, arg):
+        if target == TARGET_SINK:
+            return OK
+        if target != TARGET_MACROS:
+            return ERR_TARGET
+        if not STORE_HDR_LEN <= length <= PARTITION_SIZE:
+            return ERR_RANGE
+        self.store_len = 0
+        self.uploading = True
+        self.upload_len = length
+        self.written = self.erased = 0
+        return OK
+
+    def write(self, target, offset, data, length, arg):
+        if target != TARGET_MACROS:
+            return OK
+        if not self.uploading:
+            return ERR_STATE
+        if offset != self.written or length > self.upload_len - offset:
+            return ERR_RANGE
+        end = offset + length
+        while self.erased < end:
+            self.flash[self.erased:self.erased + self.SECTOR] = \
+                b"\xff" * self.SECTOR
+            self.erased += self.SECTOR
+        self.flash[offset:end] = ctypes.string_at(data, length)
+        self.written = end
+        return OK
+
+    def commit(self, target, arg):
+        if target != TARGET_MACROS:
+            return OK
+        if not self.uploading:
+            return ERR_STATE
+        if self.written != self.upload_len:
+            return ERR_RANGE
+        self.uploading = False
+        return self.bulk_err(self.map_store())
+
+    def abort(self, target, arg):
+        if target == TARGET_MACROS and self.uploading:
+            self.uploading = False
+            self.map_store()
+
+    def read(self, source, offset, data, room, arg):
+        if source == SOURCE_MACROS:
+            chunk = bytes(self.flash[offset:max(offset, min(offset + room,
+                                                            self.store_len))])
+        elif source == SOURCE_KEY_TRACE:
+            # No keys are pressed here, an empty ring
+            chunk = struct.pack("<I", 0)[offset:offset + room]
+        elif source == SOURCE_PATTERN:
+            chunk = bytes((offset + i) & 0xFF for i in range(room))
+        else:
+            return -1
+        ctypes.memmove(data, chunk, len(chunk))
+        return len(chunk)
+
+    def send(self, data, length, arg):
+        try:
+            self.sock.send(ctypes.string_at(data, length))
+        except OSError:
+            return -1
+        return 0
+
+
+class Channel:
+    """The peer side of main/bulk.h on a connected SEQPACKET socket."""
+
+    def __init__(self, sock, mtu, local=False):
+        self.sock = sock
+        self.mtu = mtu
+        self.local = local  # The stand-in, over a local socket
+
+    def recv_status(self, op):
+        while True:
+            sdu = self.sock.recv(SDU_MAX)
+            if not sdu:
+                raise BulkError("channel closed")
+            if sdu[0] != OP_STATUS:
+                continue
+            _, answered, err, count, elapsed_us = STATUS.unpack(sdu)
+            if answered == OP_DATA:
+                raise BulkError(f"upload failed at byte {count}: "
+                                f"{ERRORS[err]}")
+            if answered == op:
+                return err, count, elapsed_us
+
+    def data_failed(self):
+        """Raises if the device already refused some of the data."""
+        while select.select([self.sock], [], [], 0)[0]:
+            sdu = self.sock.recv(SDU_MAX)
+            if not sdu:
+                raise BulkError("channel closed")
+            if sdu[0] == OP_STATUS:
+                _, _, err, count, _ = STATUS.unpack(sdu)
+                raise BulkError(f"upload failed at byte {count}: "
+                                f"{ERRORS[err]}")
+
+    def upload(self, target, data):
+        """Returns (bytes, device us from begin to commit, seconds)."""
+        start = time.monotonic()
+        self.sock.send(struct.pack("<BBI", OP_BEGIN, target, len(data)))
+        err, _, _ = self.recv_status(OP_BEGIN)
+        if err != OK:
+            raise BulkError(f"begin refused: {ERRORS[err]}")
+        chunk = self.mtu - 1
+        for off in range(0, len(data), chunk):
+            self.sock.send(bytes([OP_DATA]) + data[off:off + chunk])
+            self.data_failed()
+        self.sock.send(bytes([OP_COMMIT]))
+        err, count, elapsed_us = self.recv_status(OP_COMMIT)
+        if err != OK:
+            raise BulkError(f"commit refused: {ERRORS[err]}")
+        return count, elapsed_us, time.monotonic() - start
+
+    def dump(self, source, limit=0):
+        """Returns (data, seconds)."""
+        start = time.monotonic()
+        self.sock.send(struct.pack("<BBI", OP_DUMP, source, limit))
+        out = bytearray()
+        while True:
+            sdu = self.sock.recv(SDU_MAX)
+            if not sdu:
+                raise BulkError("channel closed")
+            if sdu[0] == OP_DATA:
+                out += sdu[1:]
+                continue
+            if sdu[0] != OP_STATUS:
+                continue
+            _, answered, err, count, _ = STATUS.unpack(sdu)
+            if answered != OP_DUMP:
+                continue
+            if err != OK or count != len(out):
+                raise BulkError(f"dump failed after {len(out)} bytes: "
+                                f"{ERRORS[err]}")
+            return bytes(out), time.monotonic() - start
+
+
+def rate(count, seconds):
+    return f"{count / 1024 / seconds:8.1f} KiB/s" if seconds > 0 else "-"
+
+
+def bench(chan, size):
+    payload = bytes((i * 7) & 0xFF for i in range(size))
+    count, elapsed_us, seconds = chan.upload(TARGET_SINK, payload)
+    print(f"upload {count:9} bytes in {seconds:7.3f} s {rate(count, seconds)}"
+          f"  (device {elapsed_us / 1e6:.3f} s)")
+    data, seconds = chan.dump(SOURCE_PATTERN, size)
+    if data != bytes(i & 0xFF for i in range(size)):
+        raise BulkError("dump pattern does not match")
+    print(f"dump   {len(data):9} bytes in {seconds:7.3f} s "
+          f"{rate(len(data), seconds)}")
+    if chan.local:
+        print(f"{chan.mtu} byte SDUs, stand-in over a local socket: "
+              f"these rates are not the radio's")
+    else:
+        print(f"{chan.mtu} byte SDUs")
+
+
+def run(chan, args):
+    if args[0] in ("upload", "verify") and len(args) == 2:
+        with open(args[1], "rb") as f:
+            store = f.read()
+        count, elapsed_us, seconds = chan.upload(TARGET_MACROS, store)
+        print(f"uploaded {count} bytes in {seconds:.3f} s "
+              f"{rate(count, seconds)}")
+        if args[0] == "verify":
+            data, _ = chan.dump(SOURCE_MACROS)
+            if data != store:
+                raise BulkError(f"read back {len(data)} bytes, they differ")
+            print("read back, same")
+    elif args[0] == "dump" and len(args) == 3 and args[1] in ("macros",
+                                                              "trace"):
+        source = SOURCE_MACROS if args[1] == "macros" else SOURCE_KEY_TRACE
+        data, seconds = chan.dump(source)
+        with open(args[2], "wb") as f:
+            f.write(data)
+        print(f"{len(data)} bytes in {seconds:.3f} s")
+    elif args[0] == "bench" and len(args) <= 2:
+        bench(chan, int(args[1], 0) if len(args) == 2 else 256 * 1024)
+    else:
+        raise IndexError
+
+
+def main(argv):
+    args = argv[1:]
+    stand_in = False
+    lib = None
+    addr = None
+    addr_type = BDADDR_LE_PUBLIC
+    psm = PSM
+    try:
+        while args and args[0].startswith("--"):
+            if args[0] == "--stand-in":
+                stand_in = True
+                args = args[1:]
+            elif args[0] == "--lib":
+                lib = args[1]
+                args = args[2:]
+            elif args[0] == "--random":
+                addr_type = BDADDR_LE_RANDOM
+                args = args[1:]
+            elif args[0] == "--addr":
+                addr = args[1]
+                args = args[2:]
+            elif args[0] == "--psm":
+                psm = int(args[1], 0)
+                args = args[2:]
+            else:
+                raise IndexError
+        if stand_in == (addr is not None) or stand_in != (lib is not None) \
+                or not args:
+            raise IndexError
+
+        if stand_in:
+            sock, device = socket.socketpair(socket.AF_UNIX,
+                                             socket.SOCK_SEQPACKET)
+            StandIn(device, load(lib)).start()
+            chan = Channel(sock, SDU_MAX, local=True)
+        else:
+            chan = Channel(*l2cap_connect(addr, addr_type, psm))
+        try:
+            run(chan, args)
+        finally:
+            chan.sock.close()
+    except (IndexError, ValueError):
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+    except (BulkError, OSError) as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,377 @@
+#!/usr/bin/env python3
+"""Decodes key latency trace dumps read from the trace service.
+
+Each input file holds one read of the Records characteristic (see
+main/key_trace_svc.h), either as raw bytes or as hex text as most BLE tools
+show it. Reads return the snapshot the last write to the characteristic
+took, so write it (any value) before each read. Records from several reads
+are merged, so doing that every few seconds while typing collects more than
+one attribute's worth. Every key event is followed through its stages and
+the time between them is printed as a per-stage breakdown:
+
+  build  detected -> report built
+  queue  built -> handed to the stack (per connection)
+  tx     handed to the stack -> NOTIFY_TX
+  total  detected -> NOTIFY_TX
+
+With --summary the files are reads of the Summary characteristic instead,
+the device's own histogram percentiles, which are printed as they are.
+With --costs they are reads of the Costs characteristic, the CPU cycles the
+report build, GATT access and tx enqueue steps took.
+
+The diagnostics service (main/diag_svc.h) decodes the same way. With
+--tasks the files are reads of its Tasks characteristic, the CPU time of
+every task per core between the last two writes to it, and with --jitter
+reads of the Jitter characteristic, how late the scan and NimBLE host
+tasks ran after being woken. With --stats they are reads of the Stats
+characteristic: the report delivery counters, how long bonded hosts took
+to get their first report after reconnecting, the key matrix scanner and
+keymap counters, the deferred log records written and dropped, the
+current estimate and light sleep share, and the report mbuf pool.
+
+--json prints the same results as one JSON object, to compare runs.
+
+Usage: decode_key_trace.py [--summary|--costs|--tasks|--jitter|--stats] [--json] <dump>...
+"""
+
+import json
+import re
+import struct
+import sys
+
+STAGES = ["detected", "built", "queued", "tx_done"]
+DETECTED, BUILT, QUEUED, TX_DONE = range(4)
+SPANS = ["build", "queue", "tx", "total"]
+COSTS = ["build", "access", "enqueue"]
+JITTERS = ["scan", "host"]
+JITTER_BUCKETS = 16
+# Stats records by type: little endian uint32 counters in this order
+STATS = {
+    1: ("tx", ["flushes", "reports_sent", "dropped", "max_reports_per_flush",
+               "queue_depth", "max_queue_depth", "busy"]),
+    2: ("reconnect", ["count", "directed", "last_ms", "max_ms"]),
+    3: ("scanner", ["wakeups", "scans", "dropped", "taps", "holds", "combos",
+                    "forced", "max_wait_us"]),
+    4: ("klog", ["written", "dropped"]),
+    5: ("power", ["avg_ua", "sleep_permille", "radio_mhz", "wakes_key",
+                  "wakes_timer", "wakes_other"]),
+    6: ("pool", ["taken", "empty", "msys_empty", "free", "min_free",
+                 "heap_allocs"]),
+}
+
+RECORD = struct.Struct("<IHBB")
+SUMMARY = struct.Struct("<IIII")
+COST = struct.Struct("<III")
+TASK = struct.Struct("<12sBBHI")
+HEX_RE = re.compile(r"[0-9a-fA-F]{2}")
+
+
+class DumpError(Exception):
+    pass
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    try:
+        text = data.decode("ascii")
+    except UnicodeDecodeError:
+        return data
+    # Hex text, with or without separators and 0x prefixes
+    text = re.sub(r"0[xX]", "", text)
+    if text.strip() and not re.fullmatch(r"[0-9a-fA-F\s:,\-]*", text):
+        return data
+    return bytes(int(b, 16) for b in HEX_RE.findall(text))
+
+
+def parse_records(data, path):
+    if len(data) < 4 or (len(data) - 4) % RECORD.size != 0:
+        raise DumpError(f"{path}: {len(data)} bytes is not a records dump")
+    (total,) = struct.unpack_from("<I", data)
+    records = [RECORD.unpack_from(data, off)
+               for off in range(4, len(data), RECORD.size)]
+    for ts, seq, stage, arg in records:
+        if stage >= len(STAGES):
+            raise DumpError(f"{path}: unknown stage {stage}")
+    return total, records
+
+
+def percentile(values, pct):
+    values = sorted(values)
+    idx = max(0, -(-len(values) * pct // 100) - 1)
+    return values[idx]
+
+
+def elapsed(later, earlier):
+    # Timestamps are the low 32 bits of the us clock
+    return (later - earlier) & 0xFFFFFFFF
+
+
+def breakdown(records):
+    # seq wraps at 16 bits, so a key is the run of records since its
+    # DETECTED, not every record that ever had the same seq
+    keys = {}
+    spans = {name: [] for name in SPANS}
+    for ts, seq, stage, arg in sorted(set(records)):
+        if stage == DETECTED:
+            keys[seq] = {"detected": ts, "queued": {}}
+            continue
+        key = keys.get(seq)
+        if key is None:
+            continue
+        if stage == BUILT:
+            key["built"] = ts
+            spans["build"].append(elapsed(ts, key["detected"]))
+        elif stage == QUEUED and "built" in key:
+            key["queued"][arg] = ts
+            spans["queue"].append(elapsed(ts, key["built"]))
+        elif stage == TX_DONE and arg in key["queued"]:
+            spans["tx"].append(elapsed(ts, key["queued"].pop(arg)))
+            spans["total"].append(elapsed(ts, key["detected"]))
+    return spans
+
+
+def reports_per_second(records):
+    # Notifications the stack confirmed, over the time they span
+    done = sorted(ts for ts, seq, stage, arg in set(records)
+                  if stage == TX_DONE)
+    if len(done) < 2 or done[-1] == done[0]:
+        return None
+    return (len(done) - 1) * 1000000 / elapsed(done[-1], done[0])
+
+
+def print_table(rows):
+    print(f"{'stage':<8}{'count':>8}{'p50 us':>10}{'p99 us':>10}{'max us':>10}")
+    for name, count, p50, p99, top in rows:
+        print(f"{name:<8}{count:>8}{p50:>10}{p99:>10}{top:>10}")
+
+
+def rows_json(rows):
+    return {name: {"count": count, "p50_us": p50, "p99_us": p99,
+                   "max_us": top}
+            for name, count, p50, p99, top in rows}
+
+
+def decode_records(paths, as_json):
+    records = []
+    total = 0
+    for path in paths:
+        dump_total, dump_records = parse_records(read_dump(path), path)
+        total = max(total, dump_total)
+        records.extend(dump_records)
+
+    spans = breakdown(records)
+    rate = reports_per_second(records)
+    rows = []
+    for name in SPANS:
+        values = spans[name]
+        if values:
+            rows.append((name, len(values), percentile(values, 50),
+                         percentile(values, 99), max(values)))
+        else:
+            rows.append((name, 0, None, None, None))
+
+    if as_json:
+        print(json.dumps({"records": len(set(records)), "written": total,
+                          "reports_per_s": rate, "spans": rows_json(rows)},
+                         indent=2))
+        return
+    print(f"{len(set(records))} records decoded, {total} written on device")
+    if rate is not None:
+        print(f"{rate:.1f} reports/s while notifying")
+    print_table([tuple("-" if v is None else v for v in row) for row in rows])
+
+
+def decode_summary(paths, as_json):
+    results = {}
+    for path in paths:
+        data = read_dump(path)
+        if len(data) != SUMMARY.size * len(SPANS):
+            raise DumpError(f"{path}: {len(data)} bytes is not a summary")
+        results[path] = [(name,) + SUMMARY.unpack_from(data, i * SUMMARY.size)
+                         for i, name in enumerate(SPANS)]
+
+    if as_json:
+        print(json.dumps({path: rows_json(rows)
+                          for path, rows in results.items()}, indent=2))
+        return
+    for path, rows in results.items():
+        print(path)
+        print_table(rows)
+
+
+def decode_costs(paths, as_json):
+    results = {}
+    for path in paths:
+        data = read_dump(path)
+        if len(data) != 4 + COST.size * len(COSTS):
+            raise DumpError(f"{path}: {len(data)} bytes is not a costs read")
+        (mhz,) = struct.unpack_from("<I", data)
+        costs = {}
+        for i, name in enumerate(COSTS):
+            count, avg, top = COST.unpack_from(data, 4 + i * COST.size)
+            costs[name] = {"count": count, "avg_cycles": avg,
+                           "max_cycles": top,
+                           "avg_ns": avg * 1000 // mhz if mhz else None}
+        results[path] = {"cpu_mhz": mhz, "costs": costs}
+
+    if as_json:
+        print(json.dumps(results, indent=2))
+        return
+    for path, result in results.items():
+        print(f"{path} ({result['cpu_mhz']} MHz)")
+        print(f"{'step':<8}{'count':>8}{'avg cyc':>10}{'max cyc':>10}"
+              f"{'avg ns':>10}")
+        for name, cost in result["costs"].items():
+            print(f"{name:<8}{cost['count']:>8}{cost['avg_cycles']:>10}"
+                  f"{cost['max_cycles']:>10}{cost['avg_ns']:>10}")
+
+
+def decode_tasks(paths, as_json):
+    results = {}
+    for path in paths:
+        data = read_dump(path)
+        if len(data) < 4 or (len(data) - 4) % TASK.size != 0:
+            raise DumpError(f"{path}: {len(data)} bytes is not a tasks read")
+        (elapsed_us,) = struct.unpack_from("<I", data)
+        tasks = []
+        for off in range(4, len(data), TASK.size):
+            name, core, prio, stack_free, run_us = TASK.unpack_from(data, off)
+            tasks.append({
+                "name": name.rstrip(b"\0").decode("ascii", "replace"),
+                "core": None if core == 0xFF else core,
+                "priority": prio,
+                "stack_free": stack_free,
+                "run_us": run_us,
+                "cpu_pct": (round(run_us * 100 / elapsed_us, 1)
+                            if elapsed_us else None),
+            })
+        # Pinned tasks by core, then the ones that may run anywhere
+        tasks.sort(key=lambda t: (t["core"] is None, t["core"] or 0,
+                                  -t["run_us"]))
+        results[path] = {"elapsed_us": elapsed_us, "tasks": tasks}
+
+    if as_json:
+        print(json.dumps(results, indent=2))
+        return
+    for path, result in results.items():
+        print(f"{path} ({result['elapsed_us']} us)")
+        print(f"{'task':<14}{'core':>6}{'prio':>6}{'cpu %':>8}"
+              f"{'stack free':>12}")
+        for t in result["tasks"]:
+            core = "any" if t["core"] is None else t["core"]
+            pct = "-" if t["cpu_pct"] is None else t["cpu_pct"]
+            print(f"{t['name']:<14}{core:>6}{t['priority']:>6}{pct:>8}"
+                  f"{t['stack_free']:>12}")
+
+
+def bucket_percentile(buckets, count, pct):
+    # Upper edge of the bucket, so rounded up
+    want = -(-count * pct // 100)
+    seen = 0
+    for i, n in enumerate(buckets):
+        seen += n
+        if seen >= want:
+            return 1 << i
+    return None
+
+
+def decode_jitter(paths, as_json):
+    size = len(JITTERS) * (2 + JITTER_BUCKETS) * 4
+    results = {}
+    for path in paths:
+        data = read_dump(path)
+        if len(data) != size:
+            raise DumpError(f"{path}: {len(data)} bytes is not a jitter read")
+        rows = []
+        for i, name in enumerate(JITTERS):
+            values = struct.unpack_from(f"<{2 + JITTER_BUCKETS}I", data,
+                                        i * (2 + JITTER_BUCKETS) * 4)
+            count, top, buckets = values[0], values[1], values[2:]
+            if count:
+                rows.append((name, count, bucket_percentile(buckets, count, 50),
+                             bucket_percentile(buckets, count, 99), top))
+            else:
+                rows.append((name, 0, None, None, None))
+        results[path] = rows
+
+    if as_json:
+        print(json.dumps({path: rows_json(rows)
+                          for path, rows in results.items()}, indent=2))
+        return
+    for path, rows in results.items():
+        print(path)
+        print_table([tuple("-" if v is None else v for v in row)
+                     for row in rows])
+
+
+def parse_stats(data, path):
+    """Returns {source: {counter: value}}. Unknown types are skipped, and
+    counters past the known ones are named by their index."""
+    stats = {}
+    off = 0
+    while off < len(data):
+        if off + 2 > len(data) or off + 2 + data[off + 1] > len(data):
+            raise DumpError(f"{path}: stats record at byte {off} is cut short")
+        rtype, length = data[off], data[off + 1]
+        if length % 4:
+            raise DumpError(f"{path}: stats record of {length} bytes")
+        values = struct.unpack_from(f"<{length // 4}I", data, off + 2)
+        off += 2 + length
+        if rtype not in STATS:
+            continue
+        name, names = STATS[rtype]
+        names = names + [str(i) for i in range(len(names), len(values))]
+        stats[name] = dict(zip(names, values))
+    return stats
+
+
+def decode_stats(paths, as_json):
+    results = {path: parse_stats(read_dump(path), path) for path in paths}
+
+    if as_json:
+        print(json.dumps(results, indent=2))
+        return
+    for path, stats in results.items():
+        print(path)
+        for name, counters in stats.items():
+            print(f"  {name}")
+            for key, value in counters.items():
+                print(f"    {key:<22}{value:>10}")
+
+
+def main(argv):
+    args = argv[1:]
+    decode = decode_records
+    as_json = False
+    while args and args[0].startswith("--"):
+        if args[0] == "--summary":
+            decode = decode_summary
+        elif args[0] == "--costs":
+            decode = decode_costs
+        elif args[0] == "--tasks":
+            decode = decode_tasks
+        elif args[0] == "--jitter":
+            decode = decode_jitter
+        elif args[0] == "--stats":
+            decode = decode_stats
+        elif args[0] == "--json":
+            as_json = True
+        else:
+            args = []
+            break
+        args = args[1:]
+    if not args:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+
+    try:
+        decode(args, as_json)
+    except (DumpError, OSError) as err:
+        print(f"decode_key_trace: {err}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
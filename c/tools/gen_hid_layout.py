@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+"""Generates hid_layout.h from the report maps in main/hid_vars.c.
+
+Every `const uint8_t HID_<NAME>_REPORT_MAP[]` array is parsed as a HID report
+descriptor and turned into plain C macros: the payload length of every
+(Report ID, type) pair, and the bit offset, size, count and usage range of
+every field in it. Firmware code packs reports with those constants instead
+of parsing the descriptor at runtime, and static asserts tie its buffers to
+them.
+
+A malformed descriptor fails the build.
+
+Usage: gen_hid_layout.py <hid_vars.c> <hid_layout.h>
+"""
+
+import re
+import sys
+
+MAP_RE = re.compile(r"const\s+uint8_t\s+(HID_(\w+?)_REPORT_MAP)\[\]\s*=\s*\{(.*?)\};",
+                    re.S)
+COMMENT_RE = re.compile(r"//[^\n]*|/\*.*?\*/", re.S)
+NUMBER_RE = re.compile(r"0[xX][0-9a-fA-F]+|\d+")
+
+# Item types
+MAIN, GLOBAL, LOCAL = 0, 1, 2
+
+# Main item tags -> Report Reference type (Input, Output, Feature)
+MAIN_REPORTS = {0x8: 1, 0x9: 2, 0xB: 3}
+TYPE_SUFFIX = {1: "IN", 2: "OUT", 3: "FEAT"}
+MAIN_COLLECTION = 0xA
+MAIN_END_COLLECTION = 0xC
+
+# Global item tags
+G_USAGE_PAGE = 0x0
+G_LOGICAL_MIN = 0x1
+G_LOGICAL_MAX = 0x2
+G_REPORT_SIZE = 0x7
+G_REPORT_ID = 0x8
+G_REPORT_COUNT = 0x9
+G_PUSH = 0xA
+G_POP = 0xB
+
+# Local item tags
+L_USAGE = 0x0
+L_USAGE_MIN = 0x1
+L_USAGE_MAX = 0x2
+
+MAX_FIELD_BITS = 32
+
+
+class DescriptorError(Exception):
+    pass
+
+
+def signed(value, size):
+    bits = 8 * size
+    if size and value & (1 << (bits - 1)):
+        return value - (1 << bits)
+    return value
+
+
+def parse(desc):
+    """Returns {(report_id, type): {"bits": n, "fields": [...]}} in order."""
+    reports = {}
+    glob = {"page": 0, "lmin": 0, "lmax": 0, "size": 0, "count": 0, "id": 0}
+    stack = []
+    local = {"usages": [], "min": None, "max": None}
+    depth = 0
+    uses_ids = None
+    pos = 0
+
+    while pos < len(desc):
+        prefix = desc[pos]
+        pos += 1
+
+        if prefix == 0xFE:  # Long item, skip it
+            if pos + 1 >= len(desc):
+                raise DescriptorError("truncated long item")
+            pos += 2 + desc[pos]
+            continue
+
+        size = (0, 1, 2, 4)[prefix & 0x3]
+        kind = (prefix >> 2) & 0x3
+        tag = prefix >> 4
+        if pos + size > len(desc):
+            raise DescriptorError(f"truncated item at byte {pos - 1}")
+        value = int.from_bytes(desc[pos:pos + size], "little")
+        pos += size
+
+        if kind == GLOBAL:
+            if tag == G_USAGE_PAGE:
+                glob["page"] = value
+            elif tag == G_LOGICAL_MIN:
+                glob["lmin"] = signed(value, size)
+            elif tag == G_LOGICAL_MAX:
+                glob["lmax"] = signed(value, size)
+            elif tag == G_REPORT_SIZE:
+                glob["size"] = value
+            elif tag == G_REPORT_COUNT:
+                glob["count"] = value
+            elif tag == G_REPORT_ID:
+                if not 0 < value <= 0xFF:
+                    raise DescriptorError(f"invalid Report ID {value}")
+                glob["id"] = value
+            elif tag == G_PUSH:
+                stack.append(dict(glob))
+            elif tag == G_POP:
+                if not stack:
+                    raise DescriptorError("Pop without Push")
+                glob = stack.pop()
+            continue
+
+        if kind == LOCAL:
+            # 4-byte usages carry their own usage page in the high half
+            if size == 4:
+                value &= 0xFFFF
+            if tag == L_USAGE:
+                local["usages"].append(value)
+            elif tag == L_USAGE_MIN:
+                local["min"] = value
+            elif tag == L_USAGE_MAX:
+                local["max"] = value
+            continue
+
+        if kind != MAIN:
+            raise DescriptorError(f"reserved item type at byte {pos - 1}")
+
+        if tag == MAIN_COLLECTION:
+            depth += 1
+        elif tag == MAIN_END_COLLECTION:
+            if depth == 0:
+                raise DescriptorError("End Collection without Collection")
+            depth -= 1
+        elif tag in MAIN_REPORTS:
+            if uses_ids is None:
+                uses_ids = glob["id"] != 0
+            elif uses_ids != (glob["id"] != 0):
+                raise DescriptorError("report without a Report ID in a map "
+                                      "that uses Report IDs")
+            constant = value & 0x1
+            if not constant and glob["size"] > MAX_FIELD_BITS:
+                raise DescriptorError(f"field of {glob['size']} bits in "
+                                      f"report {glob['id']}")
+
+            rtype = MAIN_REPORTS[tag]
+            report = reports.setdefault((glob["id"], rtype),
+                                        {"bits": 0, "fields": []})
+            usage_min = local["min"]
+            if usage_min is None:
+                usage_min = local["usages"][0] if local["usages"] else 0
+            usage_max = local["max"]
+            if usage_max is None:
+                usage_max = (local["usages"][-1] if local["usages"]
+                             else usage_min)
+            if usage_max < usage_min:
+                raise DescriptorError(f"Usage Maximum below Usage Minimum in "
+                                      f"report {glob['id']}")
+            report["fields"].append({
+                "offset": report["bits"],
+                "size": glob["size"],
+                "count": glob["count"],
+                "flags": value,
+                "page": glob["page"],
+                "usage_min": usage_min,
+                "usage_max": usage_max,
+                "lmin": glob["lmin"],
+                "lmax": glob["lmax"],
+            })
+            report["bits"] += glob["size"] * glob["count"]
+        else:
+            raise DescriptorError(f"unknown main item 0x{prefix:02X}")
+
+        # Local items only apply to the next main item
+        local = {"usages": [], "min": None, "max": None}
+
+    if depth != 0:
+        raise DescriptorError("unterminated Collection")
+    if stack:
+        raise DescriptorError("Push without Pop")
+    for (report_id, _), report in reports.items():
+        if report["bits"] % 8:
+            raise DescriptorError(f"report {report_id} is {report['bits']} "
+                                  "bits, not a whole number of bytes")
+    return reports
+
+
+def extract_maps(source):
+    text = COMMENT_RE.sub("", source)
+    maps = []
+    for match in MAP_RE.finditer(text):
+        values = [int(n, 0) for n in NUMBER_RE.findall(match.group(3))]
+        if any(v > 0xFF for v in values):
+            raise DescriptorError(f"{match.group(1)}: value out of byte range")
+        maps.append((match.group(1), match.group(2), bytes(values)))
+    return maps
+
+
+def emit(maps):
+    out = [
+        "// Generated by tools/gen_hid_layout.py from hid_vars.c, do not edit",
+        "#ifndef HID_LAYOUT_H",
+        "#define HID_LAYOUT_H",
+        "",
+    ]
+    for array, name, desc in maps:
+        try:
+            reports = parse(desc)
+        except DescriptorError as err:
+            raise DescriptorError(f"{array}: {err}") from None
+
+        prefix = f"HID_{name}"
+        out.append(f"// {array}")
+        out.append(f"#define {prefix}_REPORT_MAP_SIZE {len(desc)}")
+        out.append(f"#define {prefix}_REPORT_COUNT {len(reports)}")
+        init = ", ".join(f"{{{rid}, {rtype}, {r['bits'] // 8}}}"
+                         for (rid, rtype), r in reports.items())
+        out.append(f"#define {prefix}_REPORTS_INIT {{{init}}}")
+        out.append("")
+
+        for (rid, rtype), report in reports.items():
+            rname = f"{prefix}_R{rid}_{TYPE_SUFFIX[rtype]}"
+            out.append(f"#define {rname}_LEN {report['bits'] // 8}")
+            for i, field in enumerate(report["fields"]):
+                fname = f"{rname}_F{i}"
+                out.append(f"#define {fname}_OFFSET {field['offset']}")
+                out.append(f"#define {fname}_SIZE {field['size']}")
+                out.append(f"#define {fname}_COUNT {field['count']}")
+                out.append(f"#define {fname}_FLAGS 0x{field['flags']:02X}")
+                out.append(f"#define {fname}_USAGE_PAGE 0x{field['page']:02X}")
+                out.append(f"#define {fname}_USAGE_MIN 0x{field['usage_min']:02X}")
+                out.append(f"#define {fname}_USAGE_MAX 0x{field['usage_max']:02X}")
+                out.append(f"#define {fname}_LOGICAL_MIN ({field['lmin']})")
+                out.append(f"#define {fname}_LOGICAL_MAX ({field['lmax']})")
+            out.append("")
+
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def main(argv):
+    if len(argv) != 3:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+
+    with open(argv[1]) as f:
+        source = f.read()
+
+    try:
+        maps = extract_maps(source)
+        if not maps:
+            raise DescriptorError(f"no report maps found in {argv[1]}")
+        header = emit(maps)
+    except DescriptorError as err:
+        print(f"gen_hid_layout: {err}", file=sys.stderr)
+        return 1
+
+    with open(argv[2], "w") as f:
+        f.write(header)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
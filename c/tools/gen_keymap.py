@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+"""Generates keymap_table.h from main/keymap.def.
+
+The keymap is a list of layers, each one line of actions per matrix row,
+and combos of matrix positions. It is turned into one flat table of 16-bit
+actions (main/keymap.h), layer after layer, which the resolver indexes with
+layer * keys + position. Key names are the ones tools/macro_compile.py
+takes, cc() and sys() take the names in CONSUMER and SYSTEM below.
+
+A malformed keymap fails the build.
+
+Usage: gen_keymap.py <keymap.def> <keymap_table.h>
+"""
+
+import os
+import re
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from macro_compile import KEYS  # noqa: E402
+
+# main/keymap.h
+KEY, TRANS, MO, TG, OSM, MACRO, LT, MT, CONSUMER_KEY, SYSTEM_KEY = range(10)
+MAX_LAYERS = 8
+MAX_KEYS = 128
+COMBO_KEYS = 4
+
+# Consumer page usages, and the system ones of main/control_report.h
+CONSUMER = {
+    "play": 0xCD, "stop": 0xB7, "next": 0xB5, "prev": 0xB6, "mute": 0xE2,
+    "volup": 0xE9, "voldown": 0xEA, "brightup": 0x6F, "brightdown": 0x70,
+    "calc": 0x192, "mail": 0x18A, "browser": 0x196, "search": 0x221,
+    "home": 0x223, "back": 0x224, "forward": 0x225, "refresh": 0x227,
+}
+SYSTEM = {"power": 0x81, "sleep": 0x82, "wake": 0x83}
+
+MODS = ["lctrl", "lshift", "lalt", "lgui", "rctrl", "rshift", "ralt", "rgui"]
+
+CALL_RE = re.compile(r"(\w+)\((.*)\)")
+POS_RE = re.compile(r"r(\d+)c(\d+)")
+# Actions never contain spaces except after commas inside parentheses
+TOKEN_RE = re.compile(r"\w+\([^)]*\)|\S+")
+
+
+class KeymapError(Exception):
+    pass
+
+
+def action(kind, arg):
+    return kind << 12 | arg
+
+
+def parse_key(name, where):
+    name = name.strip().lower()
+    if name in KEYS:
+        return KEYS[name]
+    if re.fullmatch(r"0x[0-9a-f]{1,2}", name):
+        return int(name, 16)
+    raise KeymapError(f"{where}: unknown key {name!r}")
+
+
+def parse_control(name, names, where):
+    name = name.strip().lower()
+    if name in names:
+        return names[name]
+    if re.fullmatch(r"0x[0-9a-f]{1,3}", name) and int(name, 16) != 0:
+        return int(name, 16)
+    raise KeymapError(f"{where}: unknown control {name!r}")
+
+
+def parse_mod(name, where):
+    name = name.strip().lower()
+    if name not in MODS:
+        raise KeymapError(f"{where}: {name!r} is not a modifier")
+    return MODS.index(name)
+
+
+def parse_action(token, layers, where):
+    if token == "___":
+        return action(TRANS, 0)
+    if token == "xxx":
+        return action(KEY, 0)
+    m = CALL_RE.fullmatch(token)
+    if m is None:
+        return action(KEY, parse_key(token, where))
+
+    name, args = m.group(1).lower(), [a.strip() for a in m.group(2).split(",")]
+
+    def layer(arg):
+        if arg in layers:
+            return layers.index(arg)
+        if arg.isdigit() and int(arg) < MAX_LAYERS:
+            return int(arg)
+        raise KeymapError(f"{where}: unknown layer {arg!r}")
+
+    def want(n):
+        if len(args) != n:
+            raise KeymapError(f"{where}: {name}() takes {n} argument(s)")
+
+    if name in ("mo", "tg"):
+        want(1)
+        return action(MO if name == "mo" else TG, layer(args[0]))
+    if name == "lt":
+        want(2)
+        return action(LT, layer(args[0]) << 8 | parse_key(args[1], where))
+    if name == "mt":
+        want(2)
+        return action(MT, parse_mod(args[0], where) << 8 |
+                      parse_key(args[1], where))
+    if name == "osm":
+        want(1)
+        mods = 0
+        for mod in args[0].split("+"):
+            mods |= 1 << parse_mod(mod, where)
+        return action(OSM, mods)
+    if name == "cc":
+        want(1)
+        return action(CONSUMER_KEY, parse_control(args[0], CONSUMER, where))
+    if name == "sys":
+        want(1)
+        usage = parse_control(args[0], SYSTEM, where)
+        if usage not in SYSTEM.values():
+            raise KeymapError(f"{where}: sys() takes {', '.join(SYSTEM)}")
+        return action(SYSTEM_KEY, usage)
+    if name == "macro":
+        want(1)
+        if not args[0].isdigit() or int(args[0]) > 255:
+            raise KeymapError(f"{where}: bad macro index {args[0]!r}")
+        return action(MACRO, int(args[0]))
+    raise KeymapError(f"{where}: unknown action {name!r}")
+
+
+def parse(source, path):
+    # First pass for the layer names, so any layer can refer to any other
+    layer_names = []
+    for line in source.splitlines():
+        words = line.split("#")[0].split()
+        if words[:1] == ["layer"] and len(words) == 2:
+            layer_names.append(words[1])
+    if not layer_names:
+        raise KeymapError(f"{path}: no layers")
+    if len(layer_names) > MAX_LAYERS:
+        raise KeymapError(f"{path}: more than {MAX_LAYERS} layers")
+    if len(set(layer_names)) != len(layer_names):
+        raise KeymapError(f"{path}: layer names are not unique")
+
+    layers = []
+    combos = []
+    for lineno, line in enumerate(source.splitlines(), 1):
+        where = f"{path}:{lineno}"
+        line = line.split("#")[0].strip()
+        if not line:
+            continue
+        words = line.split()
+        if words[0] == "layer":
+            if len(words) != 2:
+                raise KeymapError(f"{where}: expected 'layer <name>'")
+            layers.append([])
+        elif words[0] == "combo":
+            keys, _, act = line[len("combo"):].partition("=")
+            combos.append((keys.split(), act.strip(), where))
+        elif not layers:
+            raise KeymapError(f"{where}: actions before the first layer")
+        else:
+            layers[-1].append([parse_action(t, layer_names, where)
+                               for t in TOKEN_RE.findall(line)])
+
+    rows = len(layers[0])
+    cols = len(layers[0][0]) if rows else 0
+    for name, layer in zip(layer_names, layers):
+        if len(layer) != rows or any(len(r) != cols for r in layer):
+            raise KeymapError(f"{path}: layer {name} is not {rows}x{cols}")
+    if rows == 0 or rows * cols > MAX_KEYS:
+        raise KeymapError(f"{path}: matrix of {rows}x{cols} keys")
+
+    combo_defs = []
+    for keys, act, where in combos:
+        positions = []
+        for key in keys:
+            m = POS_RE.fullmatch(key)
+            if m is None or int(m.group(1)) >= rows or int(m.group(2)) >= cols:
+                raise KeymapError(f"{where}: bad position {key!r}")
+            positions.append(int(m.group(1)) * cols + int(m.group(2)))
+        if not 2 <= len(set(positions)) == len(positions) <= COMBO_KEYS:
+            raise KeymapError(f"{where}: a combo takes 2 to {COMBO_KEYS} "
+                              "different keys")
+        value = parse_action(act, layer_names, where)
+        if value >> 12 in (TRANS, LT, MT):
+            raise KeymapError(f"{where}: combos can not be tap-hold or ___")
+        combo_defs.append((positions, value))
+    if len(combo_defs) > 255:
+        raise KeymapError(f"{path}: more than 255 combos")
+
+    return layer_names, layers, rows, cols, combo_defs
+
+
+def emit(layer_names, layers, rows, cols, combos):
+    out = [
+        "// Generated by tools/gen_keymap.py from keymap.def, do not edit",
+        "#ifndef KEYMAP_TABLE_H",
+        "#define KEYMAP_TABLE_H",
+        "",
+        f"#define KEYMAP_ROWS {rows}",
+        f"#define KEYMAP_COLS {cols}",
+        f"#define KEYMAP_LAYER_COUNT {len(layers)}",
+        f"#define KEYMAP_COMBO_COUNT {len(combos)}",
+        "",
+        f"// Layers: {', '.join(layer_names)}",
+        "#define KEYMAP_ACTIONS_INIT \\",
+        "  { \\",
+    ]
+    for layer in layers:
+        for row in layer:
+            out.append("    " + " ".join(f"0x{a:04X}," for a in row) + " \\")
+    out.append("  }")
+
+    init = ", ".join(
+        f"{{{{{', '.join(str(p) for p in keys)}}}, {len(keys)}, 0x{a:04X}}}"
+        for keys, a in combos) or "{{0}}"
+    out.append(f"#define KEYMAP_COMBOS_INIT {{{init}}}")
+    out.append("")
+    out.append("#endif")
+    return "\n".join(out) + "\n"
+
+
+def main(argv):
+    if len(argv) != 3:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+
+    with open(argv[1]) as f:
+        source = f.read()
+
+    try:
+        header = emit(*parse(source, argv[1]))
+    except KeymapError as err:
+        print(f"gen_keymap: {err}", file=sys.stderr)
+        return 1
+
+    with open(argv[2], "w") as f:
+        f.write(header)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
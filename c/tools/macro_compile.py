@@ -0,0 +1,343 @@
+#!/usr/bin/env python3
+"""Compiles keyboard macros into the store format of main/macro.h.
+
+A source file holds any number of macros, numbered in the order they appear.
+Lines starting with # are comments:
+
+  macro login
+    text "admin\\t"          # Typed on a US layout, \\n \\t \\" \\\\ escapes
+    delay 50                 # ms
+    tap enter                # Press and release, any number of keys
+    press lctrl
+    tap c
+    release lctrl
+  end
+
+Keys are a-z, 0-9, f1-f24, the names in KEYS below or a usage as 0xNN.
+
+The store is written to <store.bin>. --reports also writes the feature
+reports that upload it (main/macro_mgr.h), one per line as hex with the
+Report ID first, for any tool that can send HID feature reports.
+
+--simulate N plays macro N the way the firmware does: key changes go out at
+most HOGP_TX_BURST_MAX per connection interval (--itvl-ms, default 7.5) and
+delays wait at least one interval. It prints the timeline and the text the
+host ends up with.
+
+Usage: macro_compile.py [--reports <file>] [--simulate <n> [--itvl-ms <ms>]] <source> [<store.bin>]
+"""
+
+import re
+import struct
+import sys
+import zlib
+
+STORE_MAGIC = 0x43414D4B
+STORE_VERSION = 1
+STORE_HDR = struct.Struct("<IBBHII")
+
+OP_END, OP_PRESS, OP_RELEASE, OP_TAP, OP_DELAY, OP_TEXT = range(6)
+
+# main/hogp_tx.h
+TX_BURST_MAX = 4
+
+# main/macro_mgr.h
+CTRL_REPORT_ID = 5
+DATA_REPORT_ID = 6
+DATA_REPORT_LEN = 1031
+DATA_HDR = struct.Struct("<IHB")
+CMD_BEGIN, CMD_COMMIT = 1, 2
+
+LEFT_SHIFT = 0xE1
+SHIFT = 0x80
+
+KEYS = {
+    "enter": 0x28, "esc": 0x29, "backspace": 0x2A, "tab": 0x2B,
+    "space": 0x2C, "minus": 0x2D, "equal": 0x2E, "lbracket": 0x2F,
+    "rbracket": 0x30, "backslash": 0x31, "semicolon": 0x33, "quote": 0x34,
+    "grave": 0x35, "comma": 0x36, "dot": 0x37, "slash": 0x38,
+    "capslock": 0x39, "printscreen": 0x46, "scrolllock": 0x47, "pause": 0x48,
+    "insert": 0x49, "home": 0x4A, "pageup": 0x4B, "delete": 0x4C,
+    "end": 0x4D, "pagedown": 0x4E, "right": 0x4F, "left": 0x50,
+    "down": 0x51, "up": 0x52, "menu": 0x65, "numlock": 0x53,
+    "kp_slash": 0x54, "kp_asterisk": 0x55, "kp_minus": 0x56, "kp_plus": 0x57,
+    "kp_enter": 0x58, "kp_dot": 0x63,
+    "lctrl": 0xE0, "lshift": 0xE1, "lalt": 0xE2, "lgui": 0xE3,
+    "rctrl": 0xE4, "rshift": 0xE5, "ralt": 0xE6, "rgui": 0xE7,
+}
+for i, c in enumerate("abcdefghijklmnopqrstuvwxyz"):
+    KEYS[c] = 0x04 + i
+for i, c in enumerate("1234567890"):
+    KEYS[c] = 0x1E + i
+for i, c in enumerate("1234567890"):
+    KEYS[f"kp{c}"] = 0x59 + i
+for i in range(12):
+    KEYS[f"f{i + 1}"] = 0x3A + i
+for i in range(12):
+    KEYS[f"f{i + 13}"] = 0x68 + i
+
+# Same table as main/macro.c
+ASCII = {"\t": 0x2B, "\n": 0x28, " ": 0x2C}
+ASCII.update({c: 0x04 + i for i, c in enumerate("abcdefghijklmnopqrstuvwxyz")})
+ASCII.update({c: SHIFT | (0x04 + i)
+              for i, c in enumerate("ABCDEFGHIJKLMNOPQRSTUVWXYZ")})
+ASCII.update({c: 0x1E + i for i, c in enumerate("1234567890")})
+ASCII.update({c: SHIFT | (0x1E + i) for i, c in enumerate("!@#$%^&*()")})
+for plain, shifted, usage in [("-", "_", 0x2D), ("=", "+", 0x2E),
+                              ("[", "{", 0x2F), ("]", "}", 0x30),
+                              ("\\", "|", 0x31), (";", ":", 0x33),
+                              ("'", '"', 0x34), ("`", "~", 0x35),
+                              (",", "<", 0x36), (".", ">", 0x37),
+                              ("/", "?", 0x38)]:
+    ASCII[plain] = usage
+    ASCII[shifted] = SHIFT | usage
+USAGE_CHARS = {usage: c for c, usage in ASCII.items()}
+
+STRING_RE = re.compile(r'"((?:[^"\\]|\\.)*)"')
+ESCAPES = {"n": "\n", "t": "\t", '"': '"', "\\": "\\"}
+
+
+class MacroError(Exception):
+    pass
+
+
+def parse_key(name, where):
+    name = name.lower()
+    if name in KEYS:
+        return KEYS[name]
+    if re.fullmatch(r"0x[0-9a-f]{1,2}", name):
+        return int(name, 16)
+    raise MacroError(f"{where}: unknown key {name!r}")
+
+
+def parse_text(rest, where):
+    m = STRING_RE.match(rest)
+    if m is None or rest[m.end():].strip()[:1] not in ("", "#"):
+        raise MacroError(f"{where}: text needs one quoted string")
+    text = re.sub(r"\\(.)", lambda e: ESCAPES.get(e.group(1), "\0"),
+                  m.group(1))
+    for c in text:
+        if c not in ASCII:
+            raise MacroError(f"{where}: can not type {c!r}")
+    return text
+
+
+def parse(source, path):
+    macros = []
+    ops = None
+    for lineno, line in enumerate(source.splitlines(), 1):
+        where = f"{path}:{lineno}"
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        word, _, rest = line.partition(" ")
+        rest = rest.strip()
+        args = rest.split("#")[0].split()
+
+        if word == "macro":
+            if ops is not None or len(args) != 1:
+                raise MacroError(f"{where}: expected 'macro <name>'")
+            ops = bytearray()
+            macros.append((args[0], ops))
+            continue
+        if ops is None:
+            raise MacroError(f"{where}: {word!r} outside of a macro")
+
+        if word == "end":
+            ops.append(OP_END)
+            ops = None
+        elif word in ("press", "release", "tap"):
+            if not args:
+                raise MacroError(f"{where}: {word} needs a key")
+            op = {"press": OP_PRESS, "release": OP_RELEASE, "tap": OP_TAP}
+            for key in args:
+                ops += bytes([op[word], parse_key(key, where)])
+        elif word == "delay":
+            if len(args) != 1 or not args[0].isdigit():
+                raise MacroError(f"{where}: expected 'delay <ms>'")
+            ms = int(args[0])
+            while True:
+                ops += struct.pack("<BH", OP_DELAY, min(ms, 0xFFFF))
+                ms -= min(ms, 0xFFFF)
+                if ms == 0:
+                    break
+        elif word == "text":
+            text = parse_text(rest, where)
+            data = text.encode("ascii")
+            for off in range(0, len(data), 255):
+                chunk = data[off:off + 255]
+                ops += bytes([OP_TEXT, len(chunk)]) + chunk
+        else:
+            raise MacroError(f"{where}: unknown statement {word!r}")
+    if ops is not None:
+        raise MacroError(f"{path}: macro {macros[-1][0]} has no 'end'")
+    if not macros:
+        raise MacroError(f"{path}: no macros")
+    if len(macros) > 255:
+        raise MacroError(f"{path}: more than 255 macros")
+    return macros
+
+
+def build_store(macros):
+    offsets = []
+    body = bytearray()
+    ops_start = STORE_HDR.size + 4 * len(macros)
+    for _, ops in macros:
+        offsets.append(ops_start + len(body))
+        body += ops
+    payload = struct.pack(f"<{len(offsets)}I", *offsets) + body
+    length = STORE_HDR.size + len(payload)
+    header = STORE_HDR.pack(STORE_MAGIC, STORE_VERSION, len(macros), 0,
+                            length, zlib.crc32(payload))
+    return header + payload
+
+
+def upload_reports(store):
+    chunk_max = DATA_REPORT_LEN - DATA_HDR.size
+    reports = [bytes([CTRL_REPORT_ID]) + struct.pack("<BI", CMD_BEGIN,
+                                                     len(store))]
+    for off in range(0, len(store), chunk_max):
+        chunk = store[off:off + chunk_max]
+        data = DATA_HDR.pack(off, len(chunk), 0) + chunk
+        reports.append(bytes([DATA_REPORT_ID]) +
+                       data.ljust(DATA_REPORT_LEN, b"\0"))
+    reports.append(bytes([CTRL_REPORT_ID]) + struct.pack("<BI", CMD_COMMIT,
+                                                         0))
+    return reports
+
+
+def play(store, index):
+    """Key changes and delays of one macro, as main/macro.c plays them."""
+    count = store[5]
+    if index >= count:
+        raise MacroError(f"no macro {index}, the store has {count}")
+    (pc,) = struct.unpack_from("<I", store, STORE_HDR.size + 4 * index)
+    held = set()
+
+    def key(usage, pressed):
+        (held.add if pressed else held.discard)(usage)
+        return ("key", usage, pressed)
+
+    def tap(usage, shift):
+        if shift:
+            yield key(LEFT_SHIFT, True)
+        yield key(usage, True)
+        yield key(usage, False)
+        if shift:
+            yield key(LEFT_SHIFT, False)
+
+    while store[pc] != OP_END:
+        op = store[pc]
+        if op in (OP_PRESS, OP_RELEASE):
+            yield key(store[pc + 1], op == OP_PRESS)
+            pc += 2
+        elif op == OP_TAP:
+            yield from tap(store[pc + 1], False)
+            pc += 2
+        elif op == OP_DELAY:
+            yield ("delay", struct.unpack_from("<H", store, pc + 1)[0])
+            pc += 3
+        elif op == OP_TEXT:
+            for c in store[pc + 2:pc + 2 + store[pc + 1]]:
+                usage = ASCII[chr(c)]
+                yield from tap(usage & ~SHIFT, bool(usage & SHIFT))
+            pc += 2 + store[pc + 1]
+        else:
+            raise MacroError(f"unknown op 0x{op:02x} at {pc}")
+    for usage in sorted(held):
+        yield key(usage, False)
+
+
+def simulate(store, index, itvl_ms):
+    """Paces a macro like main/macro_mgr.c, returns (time_ms, step) pairs."""
+    timeline = []
+    now = 0.0
+    sent = 0
+    for step in play(store, index):
+        if step[0] == "delay":
+            now += max(step[1], itvl_ms)
+            sent = 0
+            continue
+        if sent == TX_BURST_MAX:
+            now += itvl_ms
+            sent = 0
+        timeline.append((now, step))
+        sent += 1
+    return timeline
+
+
+def typed_text(timeline):
+    """What a US layout host types from the key changes."""
+    down = set()
+    out = []
+    for _, (_, usage, pressed) in timeline:
+        if not pressed:
+            down.discard(usage)
+            continue
+        down.add(usage)
+        shift = SHIFT if {0xE1, 0xE5} & down else 0
+        c = USAGE_CHARS.get(usage | shift)
+        if c is not None and not ({0xE0, 0xE2, 0xE3, 0xE4, 0xE6, 0xE7} &
+                                  down):
+            out.append(c)
+    return "".join(out)
+
+
+def print_simulation(store, index, itvl_ms):
+    names = {v: k for k, v in KEYS.items()}
+    timeline = simulate(store, index, itvl_ms)
+    for t, (_, usage, pressed) in timeline:
+        name = names.get(usage, f"0x{usage:02x}")
+        print(f"{t:9.2f} ms  {'down' if pressed else 'up':<4}  {name}")
+    duration = timeline[-1][0] if timeline else 0
+    print(f"{len(timeline)} key changes in {duration:.2f} ms at "
+          f"{itvl_ms} ms connection interval")
+    print(f"typed: {typed_text(timeline)!r}")
+
+
+def main(argv):
+    args = argv[1:]
+    reports_path = None
+    sim_index = None
+    itvl_ms = 7.5
+    try:
+        while args and args[0].startswith("--"):
+            if args[0] == "--reports":
+                reports_path = args[1]
+            elif args[0] == "--simulate":
+                sim_index = int(args[1])
+            elif args[0] == "--itvl-ms":
+                itvl_ms = float(args[1])
+            else:
+                raise IndexError
+            args = args[2:]
+    except (IndexError, ValueError):
+        args = []
+    if len(args) not in (1, 2) or itvl_ms <= 0:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+
+    try:
+        with open(args[0]) as f:
+            macros = parse(f.read(), args[0])
+        store = build_store(macros)
+        if len(args) == 2:
+            with open(args[1], "wb") as f:
+                f.write(store)
+        if reports_path is not None:
+            with open(reports_path, "w") as f:
+                for report in upload_reports(store):
+                    f.write(report.hex() + "\n")
+        for i, (name, ops) in enumerate(macros):
+            print(f"{i:3} {name} ({len(ops)} bytes)")
+        print(f"store: {len(store)} bytes")
+        if sim_index is not None:
+            print_simulation(store, sim_index, itvl_ms)
+    except (MacroError, OSError) as err:
+        print(f"macro_compile: {err}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
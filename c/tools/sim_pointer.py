@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Simulates the pointer coalescing of main/pointer.c and main/pointer_mgr.c.
+
+pointer.c itself runs here, loaded through ctypes from a shared library built
+for the host (host_test/CMakeLists.txt builds it as pointer_sim, ctest runs
+this script against it). A mouse reports random motion, wheel and button
+changes at a fixed rate, the host task sends at most one Report 7 per
+connection interval and goes idle when there is nothing left, as
+pointer_mgr.c does. For every input rate and connection interval it checks
+that the reports add up to exactly the motion that came in, that no two
+reports go out less than an interval apart and that every button state
+reaches the host in order (unless the segments ran out, which is counted).
+
+Usage: sim_pointer.py --lib <libpointer_sim.so> [--seconds <s>] [--seed <n>]
+"""
+
+import ctypes
+import random
+import struct
+import sys
+
+# main/pointer.h
+SEGMENTS = 4
+BUTTON_COUNT = 5
+MOUSE_REPORT_LEN = 7
+
+RATES_HZ = (1000, 2000, 4000, 8000)
+ITVLS_MS = (7.5, 11.25, 15, 30)
+
+
+class PointerSeg(ctypes.Structure):
+    _fields_ = [("x", ctypes.c_int32), ("y", ctypes.c_int32),
+                ("wheel", ctypes.c_int32), ("pan", ctypes.c_int32),
+                ("buttons", ctypes.c_uint8)]
+
+
+class PointerStats(ctypes.Structure):
+    _fields_ = [("reports", ctypes.c_uint32), ("saturated", ctypes.c_uint32),
+                ("merged", ctypes.c_uint32)]
+
+
+class PointerT(ctypes.Structure):
+    _fields_ = [("seg", PointerSeg * SEGMENTS), ("count", ctypes.c_uint8),
+                ("sent_buttons", ctypes.c_uint8), ("stats", PointerStats)]
+
+
+LIB = None
+
+
+def load(path):
+    lib = ctypes.CDLL(path)
+    ptr = ctypes.POINTER(PointerT)
+    for name, args, res in (
+            ("pointer_init", [ptr], None),
+            ("pointer_move", [ptr, ctypes.c_int32, ctypes.c_int32], None),
+            ("pointer_scroll", [ptr, ctypes.c_int32, ctypes.c_int32], None),
+            ("pointer_buttons", [ptr, ctypes.c_uint8], None),
+            ("pointer_pending", [ptr], ctypes.c_bool),
+            ("pointer_take", [ptr, ctypes.c_char_p], ctypes.c_bool)):
+        fn = getattr(lib, name)
+        fn.argtypes = args
+        fn.restype = res
+    return lib
+
+
+class Pointer:
+    """A pointer_t, driven through pointer.h."""
+
+    def __init__(self):
+        self.p = PointerT()
+        self.report = ctypes.create_string_buffer(MOUSE_REPORT_LEN)
+        LIB.pointer_init(self.p)
+
+    def move(self, dx, dy):
+        LIB.pointer_move(self.p, dx, dy)
+
+    def scroll(self, wheel, pan):
+        LIB.pointer_scroll(self.p, wheel, pan)
+
+    def buttons(self, buttons):
+        LIB.pointer_buttons(self.p, buttons)
+
+    def take(self):
+        """(buttons, x, y, wheel, pan) of the next report, None if idle."""
+        if not LIB.pointer_take(self.p, self.report):
+            return None
+        return struct.unpack("<Bhhbb", self.report.raw)
+
+    @property
+    def saturated(self):
+        return self.p.stats.saturated
+
+    @property
+    def merged(self):
+        return self.p.stats.merged
+
+
+def run(rate_hz, itvl_ms, seconds, rng):
+    """Returns (inputs, reports, pointer) for one rate and interval."""
+    p = Pointer()
+    period_ms = 1000 / rate_hz
+    n = int(seconds * rate_hz)
+    total = [0, 0, 0, 0]
+    states = []
+    reports = []
+    next_tick = None  # None while idle, like pointer_scheduled == false
+    buttons = 0
+
+    def tick(now):
+        report = p.take()
+        if report is None:
+            return None
+        reports.append((now, report))
+        return now + itvl_ms
+
+    for i in range(n):
+        now = i * period_ms
+        while next_tick is not None and next_tick <= now:
+            next_tick = tick(next_tick)
+
+        dx, dy = rng.randint(-127, 127), rng.randint(-127, 127)
+        if rng.random() < 0.001:
+            # A flick, more than one report can carry
+            dx, dy = rng.randint(-200000, 200000), rng.randint(-200000, 200000)
+        wheel = rng.choice((0, 0, 0, 1, -1))
+        pan = rng.choice((0, 0, 0, 0, 1, -1))
+        p.move(dx, dy)
+        p.scroll(wheel, pan)
+        total = [a + b for a, b in zip(total, (dx, dy, wheel, pan))]
+        if rng.random() < 0.002:
+            buttons ^= 1 << rng.randrange(BUTTON_COUNT)
+            p.buttons(buttons)
+            states.append(buttons)
+
+        if next_tick is None:
+            next_tick = tick(now)
+
+    now = n * period_ms
+    while next_tick is not None:
+        next_tick = tick(max(next_tick, now))
+    return total, states, reports, p
+
+
+def check(rate_hz, itvl_ms, seconds, rng):
+    total, states, reports, p = run(rate_hz, itvl_ms, seconds, rng)
+    sent = [sum(r[1][k] for r in reports) for k in range(1, 5)]
+    error = sum(abs(a - b) for a, b in zip(total, sent))
+
+    gaps = [b[0] - a[0] for a, b in zip(reports, reports[1:])]
+    min_gap = min(gaps) if gaps else itvl_ms
+
+    seen = [0]
+    for _, r in reports:
+        if r[0] != seen[-1]:
+            seen.append(r[0])
+    ok_buttons = p.merged > 0 or seen[1:] == [s for i, s in enumerate(states)
+                                              if i == 0 or s != states[i - 1]]
+
+    ok = error == 0 and min_gap >= itvl_ms - 1e-9 and ok_buttons
+    print(f"{rate_hz:5} Hz {itvl_ms:6.2f} ms  {len(reports):6} reports  "
+          f"{p.saturated:3} saturated  {p.merged:2} merged  "
+          f"error {error}  min gap {min_gap:.2f} ms  "
+          f"{'ok' if ok else 'FAIL'}")
+    return ok
+
+
+def main(argv):
+    args = argv[1:]
+    lib = None
+    seconds = 10.0
+    seed = 1
+    try:
+        while args:
+            if args[0] == "--lib":
+                lib = args[1]
+            elif args[0] == "--seconds":
+                seconds = float(args[1])
+            elif args[0] == "--seed":
+                seed = int(args[1])
+            else:
+                raise IndexError
+            args = args[2:]
+        if lib is None:
+            raise IndexError
+    except (IndexError, ValueError):
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 2
+
+    global LIB
+    LIB = load(lib)
+
+    rng = random.Random(seed)
+    ok = True
+    for rate_hz in RATES_HZ:
+        for itvl_ms in ITVLS_MS:
+            ok &= check(rate_hz, itvl_ms, seconds, rng)
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))